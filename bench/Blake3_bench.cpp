@@ -0,0 +1,38 @@
+#include "Blake3.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Args: input size, threads
+static void BM_Blake3Hash(benchmark::State& state) {
+  std::vector<uint8_t> input(state.range(0), 0xa5);
+  Blake3Hash hash;
+
+  for (auto _ : state) {
+    Blake3::hash(input.data(), input.size(), &hash, (unsigned)state.range(1));
+    benchmark::DoNotOptimize(hash);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_Blake3Hash)->ArgsProduct({{4096, 1 << 20, 16 << 20}, {1, 4}})->UseRealTime();
+
+static void BM_Blake3Streaming(benchmark::State& state) {
+  std::vector<uint8_t> input(state.range(0), 0xa5);
+  Blake3Hash hash;
+
+  for (auto _ : state) {
+    Blake3 hasher;
+    for (size_t offset = 0; offset < input.size(); offset += 65536) hasher.update(input.data() + offset, std::min((size_t)65536, input.size() - offset));
+    hasher.finalize(&hash);
+    benchmark::DoNotOptimize(hash);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_Blake3Streaming)->Arg(1 << 20);
+
+}  // namespace KapuaBench
@@ -0,0 +1,48 @@
+#include "BlockCache.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Repeat reads of a working set that fits in the cache. Args: block size
+static void BM_BlockCacheHit(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  BlockCache cache(&logger, 256 << 20);
+  std::vector<uint8_t> block(state.range(0), 0xa5), data;
+  for (uint64_t id = 0; id < 1024; id++) cache.put(id, block.data(), block.size());
+
+  uint64_t id = 0;
+  for (auto _ : state) {
+    cache.get(id++ & 1023, &data);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() * block.size());
+}
+BENCHMARK(BM_BlockCacheHit)->Arg(4096)->Arg(64 << 10)->ThreadRange(1, 4)->UseRealTime();
+
+// Zipfian-ish reads over a key space 10x the cache, reporting the hit ratio
+static void BM_BlockCacheSkewed(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  BlockCache cache(&logger, 1024 * 4096);
+  std::vector<uint8_t> block(4096, 0xa5), data;
+  auto loader = [&](uint64_t, std::vector<uint8_t>* out) {
+    *out = block;
+    return true;
+  };
+
+  std::mt19937_64 rng(1);
+  std::exponential_distribution<double> skew(1.0 / 1000);
+  for (auto _ : state) {
+    cache.get((uint64_t)skew(rng) % 10240, &data, loader);
+  }
+  state.counters["hit_ratio"] = (double)cache.get_hits() / (cache.get_hits() + cache.get_misses());
+}
+BENCHMARK(BM_BlockCacheSkewed);
+
+}  // namespace KapuaBench
@@ -0,0 +1,58 @@
+#include "BlockCipher.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Args: block size, threads
+static void BM_BlockCipherEncrypt(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  BlockCipher cipher(&logger, (unsigned)state.range(1));
+  BlockKey key = {};
+  std::vector<uint8_t> input(state.range(0), 0xa5), output;
+
+  for (auto _ : state) {
+    cipher.encrypt(key, 1, input.data(), input.size(), &output);
+    benchmark::DoNotOptimize(output.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_BlockCipherEncrypt)->ArgsProduct({{64 << 10, 4 << 20, 64 << 20}, {1, 4}})->UseRealTime();
+
+static void BM_BlockCipherDecrypt(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  BlockCipher cipher(&logger, (unsigned)state.range(1));
+  BlockKey key = {};
+  std::vector<uint8_t> input(state.range(0), 0xa5), encrypted, output;
+  cipher.encrypt(key, 1, input.data(), input.size(), &encrypted);
+
+  for (auto _ : state) {
+    cipher.decrypt(key, 1, encrypted.data(), encrypted.size(), &output);
+    benchmark::DoNotOptimize(output.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_BlockCipherDecrypt)->ArgsProduct({{4 << 20, 64 << 20}, {1, 4}})->UseRealTime();
+
+static void BM_BlockCipherStreaming(benchmark::State& state) {
+  BlockKey key = {};
+  std::vector<uint8_t> input(state.range(0), 0xa5), output;
+
+  for (auto _ : state) {
+    output.clear();
+    BlockCipher::Encryptor encryptor(key, 1, input.size());
+    for (size_t offset = 0; offset < input.size(); offset += 65536)
+      encryptor.update(input.data() + offset, std::min((size_t)65536, input.size() - offset), &output);
+    encryptor.finish(&output);
+    benchmark::DoNotOptimize(output.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_BlockCipherStreaming)->Arg(4 << 20);
+
+}  // namespace KapuaBench
@@ -0,0 +1,58 @@
+#include "Core.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <memory>
+
+#include "SockaddrHashable.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+static sockaddr_in node_addr(uint64_t i) { return SockaddrHashable(4000 + (i & 0xfff), 0x0a000000 + (uint32_t)(i >> 12)); }
+
+// The threads of a run share the fixture, as the network and core threads share the node tables. Arg: nodes
+class CoreNodes : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State& state) override {
+    if (state.thread_index() != 0) return;
+    core.reset(new Core(&logger, nullptr, nullptr));
+    count = state.range(0);
+    for (uint64_t i = 0; i < count; i++) core->add_node(0x1000 + i, node_addr(i));
+  }
+
+  void TearDown(const benchmark::State& state) override {
+    if (state.thread_index() == 0) core.reset();
+  }
+
+  IOStreamLogger logger{&std::cerr, LOG_LEVEL_ERROR};
+  std::unique_ptr<Core> core;
+  uint64_t count;
+};
+
+BENCHMARK_DEFINE_F(CoreNodes, FindById)(benchmark::State& state) {
+  uint64_t i = state.thread_index();
+  for (auto _ : state) benchmark::DoNotOptimize(core->find_node(0x1000 + (i++ % count)));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(CoreNodes, FindById)->Arg(16)->Arg(4096)->ThreadRange(1, 4)->UseRealTime();
+
+// Every received packet looks its sender up by address
+BENCHMARK_DEFINE_F(CoreNodes, FindByAddr)(benchmark::State& state) {
+  uint64_t i = state.thread_index();
+  for (auto _ : state) benchmark::DoNotOptimize(core->find_node(node_addr(i++ % count)));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(CoreNodes, FindByAddr)->Arg(16)->Arg(4096)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_SockaddrHash(benchmark::State& state) {
+  SockaddrHashableHasher hasher;
+  uint64_t i = 0;
+  for (auto _ : state) benchmark::DoNotOptimize(hasher(SockaddrHashable(node_addr(i++))));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SockaddrHash);
+
+}  // namespace KapuaBench
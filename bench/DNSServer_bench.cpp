@@ -0,0 +1,106 @@
+#include "DNSServer.hpp"
+
+#include <benchmark/benchmark.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// A local query generator keeping a batch of queries in flight against a server on loopback, over 1000 names held by a
+// three node in-process cluster. Args: cache size, 0 to send every query to the store
+static void BM_DNSServerQueries(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1ULL << 40);
+  char path[] = "/tmp/kapua_dns_bench_XXXXXX";
+  if (!mkdtemp(path)) abort();
+  std::string dir = path;
+  LoopbackKVTransport transport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  for (uint64_t id = 1; id <= 3; id++) {
+    if (id > 1) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1ULL << 40);
+    logs.emplace_back(new KVLog(&logger));
+    logs.back()->open(dir + "/" + std::to_string(id) + ".log");
+    transport.add_node(id, logs.back().get());
+  }
+
+  {
+    KVStore kv(&logger, &dbs, &transport);
+    Config config(&logger);
+    inet_pton(AF_INET, "127.0.0.1", &config.dns_ip4_sockaddr.sin_addr);
+    config.dns_ip4_sockaddr.sin_port = 0;
+    config.dns_cache_size = state.range(0);
+    DNSServer server(&logger, &config, &kv);
+    server.start();
+
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < 1000; i++) {
+      std::string name = "host" + std::to_string(i) + ".kapua";
+      server.set_records(name, {{DNSServer::TYPE_A, 3600, {10, 0, (uint8_t)(i >> 8), (uint8_t)i}}});
+      std::vector<uint8_t> query = {(uint8_t)(i >> 8), (uint8_t)i, 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+      std::vector<uint8_t> wire;
+      DNSServer::encode_name(name, &wire);
+      query.insert(query.end(), wire.begin(), wire.end());
+      query.insert(query.end(), {0, 1, 0, 1});
+      queries.push_back(query);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr = config.dns_ip4_sockaddr;
+    addr.sin_port = htons(server.get_port());
+
+    mmsghdr sends[KAPUA_DNS_BATCH], receives[KAPUA_DNS_BATCH];
+    iovec sendVecs[KAPUA_DNS_BATCH], receiveVecs[KAPUA_DNS_BATCH];
+    std::vector<uint8_t> responses(KAPUA_DNS_BATCH * KAPUA_DNS_MAX_UDP_LENGTH);
+    std::memset(sends, 0, sizeof(sends));
+    std::memset(receives, 0, sizeof(receives));
+    for (int i = 0; i < KAPUA_DNS_BATCH; i++) {
+      sends[i].msg_hdr.msg_name = &addr;
+      sends[i].msg_hdr.msg_namelen = sizeof(addr);
+      sends[i].msg_hdr.msg_iov = &sendVecs[i];
+      sends[i].msg_hdr.msg_iovlen = 1;
+      receiveVecs[i] = {&responses[i * KAPUA_DNS_MAX_UDP_LENGTH], KAPUA_DNS_MAX_UDP_LENGTH};
+      receives[i].msg_hdr.msg_iov = &receiveVecs[i];
+      receives[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    size_t next = 0, answered = 0;
+    for (auto _ : state) {
+      for (int i = 0; i < KAPUA_DNS_BATCH; i++) {
+        std::vector<uint8_t>& query = queries[next++ % queries.size()];
+        sendVecs[i] = {query.data(), query.size()};
+      }
+      sendmmsg(fd, sends, KAPUA_DNS_BATCH, 0);
+      for (int received = 0; received < KAPUA_DNS_BATCH;) {
+        int n = recvmmsg(fd, receives, KAPUA_DNS_BATCH - received, MSG_WAITFORONE, nullptr);
+        if (n <= 0) break;
+        received += n;
+        answered += n;
+      }
+    }
+    state.SetItemsProcessed(answered);
+    state.counters["qps"] = benchmark::Counter(answered, benchmark::Counter::kIsRate);
+    state.counters["cache_hits"] = server.get_cache_hits();
+
+    close(fd);
+    server.stop();
+  }
+
+  logs.clear();
+  system(("rm -rf " + dir).c_str());
+}
+BENCHMARK(BM_DNSServerQueries)->Arg(0)->Arg(16 << 20)->UseRealTime();
+
+}  // namespace KapuaBench
@@ -0,0 +1,35 @@
+#include "DistributedBlockStore.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Placing a block's replicas on a ring of 64 virtual nodes per node. Arg: nodes
+static void BM_DBSPlacement(benchmark::State& state) {
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1ULL << 40);
+  for (uint64_t id = 2; id <= (uint64_t)state.range(0); id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1ULL << 40);
+
+  uint64_t block = 0;
+  for (auto _ : state) benchmark::DoNotOptimize(dbs.get_dbs_nodes_for_block(block++ * 0x9e3779b97f4a7c15ULL));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DBSPlacement)->Arg(8)->Arg(64)->Arg(1024);
+
+// Adding a node, which rebuilds the ring. Arg: nodes already on the ring
+static void BM_DBSAddNode(benchmark::State& state) {
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1ULL << 40);
+  for (uint64_t id = 2; id <= (uint64_t)state.range(0); id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1ULL << 40);
+  std::vector<uint64_t> virtualIds = DistributedBlockStore::get_dbs_virtual_ids(0xffff, 64);
+
+  for (auto _ : state) {
+    dbs.add_dbs_node(0xffff, virtualIds, 1ULL << 40);
+    state.PauseTiming();
+    dbs.remove_dbs_node(0xffff);
+    state.ResumeTiming();
+  }
+}
+BENCHMARK(BM_DBSAddNode)->Arg(64)->Arg(1024);
+
+}  // namespace KapuaBench
@@ -0,0 +1,38 @@
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "EventLog.hpp"
+#include "Protocol.hpp"
+#include "Util.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// A per-packet trace as a binary event, against the same line through the text logger
+static void BM_EventLogRecord(benchmark::State& state) {
+  static IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  static EventLog events(&logger, "/dev/null");
+  if (state.thread_index() == 0) events.start();
+  uint64_t length = 0;
+  for (auto _ : state) events.record(EVENT_PACKET_RECEIVED, 0x0123456789abcdefULL, length++ & 1023, Packet::Ping);
+  if (state.thread_index() == 0) events.stop();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EventLogRecord)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_EventLogTextEquivalent(benchmark::State& state) {
+  std::ofstream out("/dev/null");
+  AsyncLogger logger(&out, LOG_LEVEL_DEBUG);
+  uint64_t length = 0;
+  for (auto _ : state) {
+    logger.debug("Packet From " + Util::to_hex64_str(0x0123456789abcdefULL) + ", " + std::to_string(length++ & 1023) + " bytes (" +
+                 Packet::packet_type_to_string(Packet::Ping) + ")");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EventLogTextEquivalent);
+
+}  // namespace KapuaBench
@@ -0,0 +1,103 @@
+#include "FileSystem.hpp"
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Nodes with a link of fixed bandwidth each, which serves one transfer at a time
+class LinkBlockTransport : public BlockTransport {
+ public:
+  LinkBlockTransport(size_t nodes, uint64_t bytesPerSecond) : _bytes_per_second(bytesPerSecond) {
+    for (uint64_t id = 1; id <= nodes; id++) _nodes[id].reset(new Node());
+  }
+
+  bool put_block(uint64_t nodeId, uint64_t blockId, const uint8_t* data, size_t len) override {
+    Node* node = _nodes.at(nodeId).get();
+    std::lock_guard<std::mutex> lock(node->mutex);
+    node->blocks[blockId].assign(data, data + len);
+    return true;
+  }
+
+  bool get_block(uint64_t nodeId, uint64_t blockId, std::vector<uint8_t>* data) override {
+    Node* node = _nodes.at(nodeId).get();
+    std::lock_guard<std::mutex> lock(node->mutex);
+    auto it = node->blocks.find(blockId);
+    if (it == node->blocks.end()) return false;
+    *data = it->second;
+    std::this_thread::sleep_for(std::chrono::microseconds(data->size() * 1000000 / _bytes_per_second));
+    return true;
+  }
+
+  bool remove_block(uint64_t nodeId, uint64_t blockId) override {
+    Node* node = _nodes.at(nodeId).get();
+    std::lock_guard<std::mutex> lock(node->mutex);
+    return node->blocks.erase(blockId) > 0;
+  }
+
+ protected:
+  struct Node {
+    std::mutex mutex;
+    std::map<uint64_t, std::vector<uint8_t>> blocks;
+  };
+
+  uint64_t _bytes_per_second;
+  std::map<uint64_t, std::unique_ptr<Node>> _nodes;
+};
+
+// A 16MiB file in 1MiB chunks on eight nodes with 200MB/s links. Args: readahead
+static void BM_FileSystemSequentialRead(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1ULL << 40);
+  for (uint64_t id = 2; id <= 8; id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1ULL << 40);
+
+  char path[] = "/tmp/kapua_fs_bench_XXXXXX";
+  if (!mkdtemp(path)) abort();
+  std::string dir = path;
+  LoopbackKVTransport kvTransport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  for (uint64_t id = 1; id <= 8; id++) {
+    logs.emplace_back(new KVLog(&logger));
+    logs.back()->open(dir + "/" + std::to_string(id) + ".log");
+    kvTransport.add_node(id, logs.back().get());
+  }
+
+  {
+    KVStore kv(&logger, &dbs, &kvTransport);
+    LinkBlockTransport transport(8, 200 * 1000 * 1000);
+    ReplicationPipeline pipeline(&logger, &dbs, &transport);
+    FileSystemOptions options;
+    options.chunk_size = 1 << 20;
+    options.readahead = state.range(0);
+    FileSystem fs(&logger, &kv, &dbs, &transport, &pipeline, options);
+
+    std::vector<uint8_t> data(16 << 20, 0xa5);
+    std::unique_ptr<FileWriter> writer = fs.create("/file");
+    writer->write(data.data(), data.size());
+    writer->close();
+
+    std::vector<uint8_t> buffer(256 * 1024);
+    for (auto _ : state) {
+      std::unique_ptr<FileReader> reader = fs.open("/file");
+      while (reader->read(buffer.data(), buffer.size()) > 0) {
+      }
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+  }
+
+  logs.clear();
+  system(("rm -rf " + dir).c_str());
+}
+BENCHMARK(BM_FileSystemSequentialRead)->Arg(1)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+}  // namespace KapuaBench
@@ -0,0 +1,139 @@
+#include "KVStore.hpp"
+
+#include <arpa/inet.h>
+#include <benchmark/benchmark.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "MemcachedServer.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// An in-process cluster of KVLogs on one ring, connected by the loopback transport
+class LoopbackCluster {
+ public:
+  LoopbackCluster(size_t nodes) : logger(&std::cerr, LOG_LEVEL_ERROR), dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1ULL << 40) {
+    char path[] = "/tmp/kapua_kv_bench_XXXXXX";
+    dir = mkdtemp(path);
+    for (uint64_t id = 1; id <= nodes; id++) {
+      if (id > 1) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1ULL << 40);
+      logs.emplace_back(new KVLog(&logger));
+      logs.back()->open(dir + "/" + std::to_string(id) + ".log");
+      transport.add_node(id, logs.back().get());
+    }
+    kv.reset(new KVStore(&logger, &dbs, &transport));
+  }
+
+  ~LoopbackCluster() {
+    kv.reset();
+    logs.clear();
+    system(("rm -rf " + dir).c_str());
+  }
+
+  IOStreamLogger logger;
+  DistributedBlockStore dbs;
+  LoopbackKVTransport transport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  std::unique_ptr<KVStore> kv;
+  std::string dir;
+};
+
+static void report_latency(benchmark::State& state, std::vector<double>& latencies) {
+  if (latencies.empty()) return;
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["p50_us"] = latencies[latencies.size() / 2];
+  state.counters["p99_us"] = latencies[latencies.size() * 99 / 100];
+}
+
+// N = 3, R = W = 2 on a five node cluster. Args: value size
+static void BM_KVStoreSet(benchmark::State& state) {
+  LoopbackCluster cluster(5);
+  std::vector<uint8_t> value(state.range(0), 0xa5);
+  std::vector<double> latencies;
+  uint64_t i = 0;
+
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    cluster.kv->set("key" + std::to_string(i++ % 10000), value.data(), value.size());
+    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_latency(state, latencies);
+}
+BENCHMARK(BM_KVStoreSet)->Arg(100)->Arg(4096);
+
+static void BM_KVStoreGet(benchmark::State& state) {
+  LoopbackCluster cluster(5);
+  std::vector<uint8_t> value(state.range(0), 0xa5), read;
+  for (int i = 0; i < 10000; i++) cluster.kv->set("key" + std::to_string(i), value.data(), value.size());
+  std::vector<double> latencies;
+  uint64_t i = 0;
+
+  for (auto _ : state) {
+    auto start = std::chrono::steady_clock::now();
+    cluster.kv->get("key" + std::to_string(i++ % 10000), &read);
+    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_latency(state, latencies);
+}
+BENCHMARK(BM_KVStoreGet)->Arg(100)->Arg(4096);
+
+// End to end through the memcached front end over loopback TCP, one request in flight
+static void BM_MemcachedGetSet(benchmark::State& state) {
+  LoopbackCluster cluster(5);
+  Config config(&cluster.logger);
+  inet_pton(AF_INET, "127.0.0.1", &config.memcached_ip4_sockaddr.sin_addr);
+  config.memcached_ip4_sockaddr.sin_port = 0;
+  MemcachedServer server(&cluster.logger, &config, cluster.kv.get());
+  server.start();
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  sockaddr_in addr = config.memcached_ip4_sockaddr;
+  addr.sin_port = htons(server.get_port());
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    state.SkipWithError("connect failed");
+    return;
+  }
+
+  std::string value(100, 'x'), response;
+  std::vector<double> latencies;
+  char buffer[4096];
+  uint64_t i = 0;
+
+  for (auto _ : state) {
+    std::string key = "key" + std::to_string(i % 1000);
+    std::string request = (i++ & 1) ? "get " + key + "\r\n" : "set " + key + " 0 0 100\r\n" + value + "\r\n";
+    const char* terminator = request[0] == 'g' ? "END\r\n" : "\r\n";
+
+    auto start = std::chrono::steady_clock::now();
+    send(fd, request.data(), request.size(), 0);
+    response.clear();
+    while (response.size() < strlen(terminator) || response.compare(response.size() - strlen(terminator), std::string::npos, terminator) != 0) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) break;
+      response.append(buffer, n);
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_latency(state, latencies);
+
+  close(fd);
+  server.stop();
+}
+BENCHMARK(BM_MemcachedGetSet)->UseRealTime();
+
+}  // namespace KapuaBench
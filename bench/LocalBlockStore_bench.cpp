@@ -0,0 +1,61 @@
+#include "LocalBlockStore.hpp"
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+class LocalBlockStoreFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State& state) override {
+    char path[] = "/tmp/kapua_lbs_bench_XXXXXX";
+    if (!mkdtemp(path)) abort();
+    dir = path;
+    store.reset(new LocalBlockStore(&logger, 256 << 20));
+    store->open(dir);
+    std::vector<uint8_t> block(state.range(0), 0xa5);
+    for (uint64_t id = 0; id < 64; id++) store->put(id, block.data(), block.size());
+  }
+
+  void TearDown(const benchmark::State&) override {
+    store.reset();
+    system(("rm -rf " + dir).c_str());
+  }
+
+  IOStreamLogger logger{&std::cerr, LOG_LEVEL_ERROR};
+  std::unique_ptr<LocalBlockStore> store;
+  std::string dir;
+};
+
+// Copying reads, for comparison. Args: block size
+BENCHMARK_DEFINE_F(LocalBlockStoreFixture, Copy)(benchmark::State& state) {
+  std::vector<uint8_t> data;
+  uint64_t id = 0;
+  for (auto _ : state) {
+    store->get(id++ & 63, &data);
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_REGISTER_F(LocalBlockStoreFixture, Copy)->Arg(4096)->Arg(1 << 20);
+
+// Pinned views of the page cache. Args: block size
+BENCHMARK_DEFINE_F(LocalBlockStoreFixture, View)(benchmark::State& state) {
+  BlockView view;
+  uint64_t id = 0;
+  for (auto _ : state) {
+    store->get_view(id++ & 63, &view);
+    benchmark::DoNotOptimize(view.data());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_REGISTER_F(LocalBlockStoreFixture, View)->Arg(4096)->Arg(1 << 20);
+
+}  // namespace KapuaBench
@@ -0,0 +1,49 @@
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "Logger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// A stream that discards everything, so only the logger's own cost is measured
+class NullBuf : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// A scoped info line, as the network logs on the packet path
+template <class L>
+static void BM_LoggerInfo(benchmark::State& state) {
+  // Shared by the benchmark's threads
+  static NullBuf buf;
+  static std::ostream out(&buf);
+  static L logger(&out, LOG_LEVEL_INFO);
+  ScopedLogger scoped("UDPNetwork", &logger);
+  for (auto _ : state) scoped.info("Packet From 0123456789abcdef, 1200 bytes (Ping)");
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_LoggerInfo, IOStreamLogger)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LoggerInfo, AsyncLogger)->ThreadRange(1, 4)->UseRealTime();
+
+// A debug line guarded by is_enabled with debug switched off, which should cost next to nothing
+template <class L>
+static void BM_LoggerDisabled(benchmark::State& state) {
+  NullBuf buf;
+  std::ostream out(&buf);
+  L logger(&out, LOG_LEVEL_INFO);
+  ScopedLogger scoped("UDPNetwork", &logger);
+  uint64_t id = 0;
+  for (auto _ : state) {
+    if (scoped.is_enabled(LOG_LEVEL_DEBUG)) scoped.debug("Packet From " + std::to_string(id++));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_LoggerDisabled, IOStreamLogger);
+BENCHMARK_TEMPLATE(BM_LoggerDisabled, AsyncLogger);
+
+}  // namespace KapuaBench
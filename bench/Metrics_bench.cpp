@@ -0,0 +1,43 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+
+#include "Metrics.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Every thread counting the same thing, as the network threads count packets
+static void BM_MetricCounterAdd(benchmark::State& state) {
+  static MetricCounter counter;
+  for (auto _ : state) counter.add();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MetricCounterAdd)->ThreadRange(1, 4)->UseRealTime();
+
+// The same with one shared atomic, for comparison
+static void BM_MetricSharedAtomicAdd(benchmark::State& state) {
+  static std::atomic<uint64_t> counter(0);
+  for (auto _ : state) counter.fetch_add(1, std::memory_order_relaxed);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MetricSharedAtomicAdd)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_MetricHistogramRecord(benchmark::State& state) {
+  static MetricHistogram histogram;
+  uint64_t value = 12345;
+  for (auto _ : state) histogram.record(value++ & 0xfffff);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MetricHistogramRecord)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_MetricsPrometheus(benchmark::State& state) {
+  MetricsRegistry metrics;
+  for (int i = 0; i < 32; i++) metrics.counter("kapua_bench_total", "Bench", "n=\"" + std::to_string(i) + "\"")->add(i);
+  for (int i = 0; i < 4; i++) metrics.histogram("kapua_bench_ns", "Bench", "n=\"" + std::to_string(i) + "\"")->record(1000000);
+  for (auto _ : state) benchmark::DoNotOptimize(metrics.to_prometheus());
+}
+BENCHMARK(BM_MetricsPrometheus);
+
+}  // namespace KapuaBench
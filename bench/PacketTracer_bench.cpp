@@ -0,0 +1,31 @@
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+
+#include "PacketTracer.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// The tracing around one packet with four stages, as UDPNetwork does it. Args: trace one packet in this many, 0 for off
+static void BM_PacketTracerPacket(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  MetricsRegistry metrics;
+  PacketTracer tracer(&logger, &metrics, state.range(0));
+  for (auto _ : state) {
+    tracer.begin();
+    { PacketTracer::Span span(&tracer, PacketTracer::STAGE_RECEIVE); }
+    { PacketTracer::Span span(&tracer, PacketTracer::STAGE_LOOKUP); }
+    { PacketTracer::Span span(&tracer, PacketTracer::STAGE_DECRYPT); }
+    {
+      PacketTracer::Span span(&tracer, PacketTracer::STAGE_PROCESS);
+      PacketTracer::Span send(&tracer, PacketTracer::STAGE_SEND);
+    }
+    tracer.end(true, 0);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PacketTracerPacket)->Arg(0)->Arg(64)->Arg(1);
+
+}  // namespace KapuaBench
@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <memory>
+
+#include "Protocol.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Building a Ping with a load report, as every node does each ping interval
+static void BM_PacketEncode(benchmark::State& state) {
+  NodeLoadReport report = {1ULL << 40, 1ULL << 30, 1000, 8, 4, 1};
+  for (auto _ : state) {
+    std::shared_ptr<Packet> pkt = std::make_shared<Packet>(Packet::Ping, 0x1234, KAPUA_ID_BROADCAST);
+    pkt->write_load_report(&report);
+    benchmark::DoNotOptimize(pkt.get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PacketEncode);
+
+// The checks a received packet goes through before it is handled, then reading the load report back
+static void BM_PacketDecode(benchmark::State& state) {
+  Packet sent(Packet::Ping, 0x1234, KAPUA_ID_BROADCAST);
+  NodeLoadReport report = {1ULL << 40, 1ULL << 30, 1000, 8, 4, 1};
+  sent.write_load_report(&report);
+  size_t size = KAPUA_HEADER_SIZE + sent.length;
+
+  uint8_t buffer[KAPUA_MAX_PACKET_SIZE];
+  Packet* pkt = (Packet*)buffer;
+  for (auto _ : state) {
+    std::memcpy(buffer, &sent, size);
+    NodeLoadReport received;
+    bool valid = pkt->check_magic_valid() && pkt->check_version_valid() && pkt->read_load_report(&received, sent.length);
+    benchmark::DoNotOptimize(valid);
+    benchmark::DoNotOptimize(received);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PacketDecode);
+
+}  // namespace KapuaBench
@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "QueueLog.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+class QueueLogFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State& state) override {
+    if (state.thread_index() != 0) return;
+    char path[] = "/tmp/kapua_queue_bench_XXXXXX";
+    if (!mkdtemp(path)) abort();
+    dir = path;
+    log.reset(new QueueLog(&logger, 64 << 20));
+    log->open(dir);
+  }
+
+  void TearDown(const benchmark::State& state) override {
+    if (state.thread_index() != 0) return;
+    log.reset();
+    system(("rm -rf " + dir).c_str());
+  }
+
+  IOStreamLogger logger{&std::cerr, LOG_LEVEL_ERROR};
+  std::unique_ptr<QueueLog> log;
+  std::string dir;
+};
+
+// Synced appends of 1KB messages. Args: messages per batch
+BENCHMARK_DEFINE_F(QueueLogFixture, Produce)(benchmark::State& state) {
+  std::vector<uint8_t> message(1024, 0xa5);
+  std::vector<const uint8_t*> data(state.range(0), message.data());
+  std::vector<size_t> lens(state.range(0), message.size());
+  uint64_t offset;
+  for (auto _ : state) log->append(data.data(), lens.data(), data.size(), &offset);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * state.range(0) * message.size());
+}
+BENCHMARK_REGISTER_F(QueueLogFixture, Produce)->Arg(1)->Arg(64)->UseRealTime();
+
+// Single synced 1KB messages from many producers, group committed
+BENCHMARK_DEFINE_F(QueueLogFixture, GroupCommit)(benchmark::State& state) {
+  std::vector<uint8_t> message(1024, 0xa5);
+  uint64_t offset;
+  for (auto _ : state) log->append(message.data(), message.size(), &offset);
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) state.counters["commits"] = log->get_commits();
+}
+BENCHMARK_REGISTER_F(QueueLogFixture, GroupCommit)->Threads(1)->Threads(16)->UseRealTime();
+
+// Reading 1KB messages back in place, 1MB at a time
+BENCHMARK_DEFINE_F(QueueLogFixture, Consume)(benchmark::State& state) {
+  std::vector<uint8_t> message(1024, 0xa5);
+  std::vector<const uint8_t*> data(1024, message.data());
+  std::vector<size_t> lens(1024, message.size());
+  uint64_t offset;
+  for (int i = 0; i < 32; i++) log->append(data.data(), lens.data(), data.size(), &offset);
+
+  QueueSlice slice;
+  QueueMessage msg;
+  offset = 0;
+  size_t messages = 0;
+  for (auto _ : state) {
+    if (offset == log->get_end_offset()) offset = 0;
+    log->fetch(offset, 1 << 20, &slice);
+    while (slice.next(&msg)) {
+      benchmark::DoNotOptimize(msg.data);
+      messages++;
+    }
+    offset = slice.get_next_offset();
+  }
+  state.SetItemsProcessed(messages);
+  state.SetBytesProcessed(messages * message.size());
+}
+BENCHMARK_REGISTER_F(QueueLogFixture, Consume);
+
+}  // namespace KapuaBench
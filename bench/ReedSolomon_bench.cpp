@@ -0,0 +1,94 @@
+#include "ReedSolomon.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+static void set_fragments(std::vector<std::vector<uint8_t>>* fragments, std::vector<uint8_t*>* ptrs, size_t count, size_t len) {
+  std::mt19937 rng(42);
+  fragments->assign(count, std::vector<uint8_t>(len));
+  ptrs->resize(count);
+  for (size_t i = 0; i < count; i++) {
+    for (auto& b : (*fragments)[i]) b = (uint8_t)rng();
+    (*ptrs)[i] = (*fragments)[i].data();
+  }
+}
+
+// Args: kernel, fragment size
+static void BM_GFMulAddRegion(benchmark::State& state) {
+  ReedSolomon::Kernel kernel = (ReedSolomon::Kernel)state.range(0);
+  if (!ReedSolomon::is_kernel_supported(kernel)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  size_t len = state.range(1);
+  std::vector<uint8_t> src(len, 0x5a), dst(len, 0);
+
+  for (auto _ : state) {
+    ReedSolomon::gf_mul_add_region(kernel, 0x8e, src.data(), dst.data(), len);
+    benchmark::DoNotOptimize(dst.data());
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+  state.SetLabel(ReedSolomon::kernel_to_string(kernel));
+}
+BENCHMARK(BM_GFMulAddRegion)->ArgsProduct({{0, 1, 2}, {4096, 1 << 20}});
+
+// Args: kernel, k, m, block size. Throughput is counted over the data, not the parity.
+static void BM_RSEncode(benchmark::State& state) {
+  ReedSolomon::Kernel kernel = (ReedSolomon::Kernel)state.range(0);
+  if (!ReedSolomon::is_kernel_supported(kernel)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  size_t k = state.range(1), m = state.range(2), len = state.range(3) / k;
+  ReedSolomon rs(k, m);
+  rs.set_kernel(kernel);
+
+  std::vector<std::vector<uint8_t>> fragments;
+  std::vector<uint8_t*> ptrs;
+  set_fragments(&fragments, &ptrs, k + m, len);
+
+  for (auto _ : state) {
+    rs.encode(ptrs.data(), ptrs.data() + k, len);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * len * k);
+  state.SetLabel(ReedSolomon::kernel_to_string(kernel));
+}
+BENCHMARK(BM_RSEncode)->ArgsProduct({{0, 1, 2}, {4, 10}, {2, 4}, {1 << 20}});
+
+// Args: kernel, k, m, block size. Worst case decode, with m data fragments lost.
+static void BM_RSDecode(benchmark::State& state) {
+  ReedSolomon::Kernel kernel = (ReedSolomon::Kernel)state.range(0);
+  if (!ReedSolomon::is_kernel_supported(kernel)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  size_t k = state.range(1), m = state.range(2), len = state.range(3) / k;
+  ReedSolomon rs(k, m);
+  rs.set_kernel(kernel);
+
+  std::vector<std::vector<uint8_t>> fragments;
+  std::vector<uint8_t*> ptrs;
+  set_fragments(&fragments, &ptrs, k + m, len);
+  rs.encode(ptrs.data(), ptrs.data() + k, len);
+
+  std::unique_ptr<bool[]> present(new bool[k + m]);
+  for (size_t i = 0; i < k + m; i++) present[i] = i >= m;
+
+  for (auto _ : state) {
+    rs.reconstruct(ptrs.data(), present.get(), len);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * len * k);
+  state.SetLabel(ReedSolomon::kernel_to_string(kernel));
+}
+BENCHMARK(BM_RSDecode)->ArgsProduct({{0, 1, 2}, {4, 10}, {2, 4}, {1 << 20}});
+
+}  // namespace KapuaBench
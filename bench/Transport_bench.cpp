@@ -0,0 +1,119 @@
+#include <benchmark/benchmark.h>
+#include <sys/socket.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "IOUringTransport.hpp"
+#include "SocketTransport.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+#define BENCH_PORT 47891
+
+// A transport open on loopback, and a plain socket to talk to it. Arg 0 is a SocketTransport, 1 an IOUringTransport.
+class TransportLoopback : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State& state) override {
+    logger.reset(new IOStreamLogger(&std::cerr, LOG_LEVEL_ERROR));
+    if (state.range(0)) {
+      transport.reset(new IOUringTransport(logger.get()));
+    } else {
+      transport.reset(new SocketTransport(logger.get()));
+    }
+    transport->open(BENCH_PORT);
+
+    peer = socket(AF_INET, SOCK_DGRAM, 0);
+    std::memset(&peer_addr, 0, sizeof(peer_addr));
+    peer_addr.sin_family = AF_INET;
+    peer_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(peer, (sockaddr*)&peer_addr, sizeof(peer_addr));
+    socklen_t len = sizeof(peer_addr);
+    getsockname(peer, (sockaddr*)&peer_addr, &len);
+
+    std::memset(&transport_addr, 0, sizeof(transport_addr));
+    transport_addr.sin_family = AF_INET;
+    transport_addr.sin_port = htons(BENCH_PORT);
+    transport_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::memset(payload, 0xa5, sizeof(payload));
+    for (int i = 0; i < KAPUA_RECEIVE_BATCH; i++) {
+      iovs[i].iov_base = payload;
+      iovs[i].iov_len = sizeof(payload);
+      std::memset(&msgs[i], 0, sizeof(mmsghdr));
+      msgs[i].msg_hdr.msg_name = &transport_addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(transport_addr);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+  }
+
+  void TearDown(const benchmark::State&) override {
+    ::close(peer);
+    transport.reset();
+    logger.reset();
+  }
+
+  std::unique_ptr<Logger> logger;
+  std::unique_ptr<Transport> transport;
+  int peer;
+  sockaddr_in peer_addr;
+  sockaddr_in transport_addr;
+  uint8_t payload[KAPUA_HEADER_SIZE];
+  iovec iovs[KAPUA_RECEIVE_BATCH];
+  mmsghdr msgs[KAPUA_RECEIVE_BATCH];
+};
+
+// A batch sent to the transport in one sendmmsg, then waited for and received
+BENCHMARK_DEFINE_F(TransportLoopback, Receive)(benchmark::State& state) {
+  Transport::Datagram datagrams[KAPUA_RECEIVE_BATCH];
+  for (auto _ : state) {
+    sendmmsg(peer, msgs, KAPUA_RECEIVE_BATCH, 0);
+    for (int received = 0; received < KAPUA_RECEIVE_BATCH;) {
+      if (!transport->wait(100000)) {
+        state.SkipWithError("datagrams lost");
+        break;
+      }
+      received += transport->receive(datagrams, KAPUA_RECEIVE_BATCH);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * KAPUA_RECEIVE_BATCH);
+}
+BENCHMARK_REGISTER_F(TransportLoopback, Receive)->Arg(0)->Arg(1);
+
+// A batch sent by the transport and flushed, then drained from the peer
+BENCHMARK_DEFINE_F(TransportLoopback, Send)(benchmark::State& state) {
+  Transport::Datagram datagrams[KAPUA_RECEIVE_BATCH];
+  for (int i = 0; i < KAPUA_RECEIVE_BATCH; i++) datagrams[i] = {payload, sizeof(payload), peer_addr};
+  mmsghdr drain[KAPUA_RECEIVE_BATCH];
+  iovec drainIovs[KAPUA_RECEIVE_BATCH];
+  uint8_t buffers[KAPUA_RECEIVE_BATCH][KAPUA_HEADER_SIZE];
+  for (int i = 0; i < KAPUA_RECEIVE_BATCH; i++) {
+    drainIovs[i] = {buffers[i], sizeof(buffers[i])};
+    std::memset(&drain[i], 0, sizeof(mmsghdr));
+    drain[i].msg_hdr.msg_iov = &drainIovs[i];
+    drain[i].msg_hdr.msg_iovlen = 1;
+  }
+  timeval tv = {0, 100000};
+  setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  for (auto _ : state) {
+    transport->send(datagrams, KAPUA_RECEIVE_BATCH);
+    transport->flush();
+    for (int received = 0; received < KAPUA_RECEIVE_BATCH;) {
+      int got = recvmmsg(peer, drain, KAPUA_RECEIVE_BATCH - received, MSG_WAITFORONE, nullptr);
+      if (got <= 0) {
+        state.SkipWithError("datagrams lost");
+        break;
+      }
+      received += got;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * KAPUA_RECEIVE_BATCH);
+}
+BENCHMARK_REGISTER_F(TransportLoopback, Send)->Arg(0)->Arg(1);
+
+}  // namespace KapuaBench
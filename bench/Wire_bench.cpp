@@ -0,0 +1,57 @@
+#include "Wire.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+// Arg: bits in each value, so how many bytes each varint takes
+static void BM_WireVarintEncode(benchmark::State& state) {
+  uint64_t value = state.range(0) == 64 ? UINT64_MAX : (1ULL << state.range(0)) - 1;
+  uint8_t buffer[64 * KAPUA_WIRE_MAX_VARINT];
+  for (auto _ : state) {
+    WireWriter writer(buffer, sizeof(buffer));
+    for (int i = 0; i < 64; i++) writer.put_varint(value);
+    benchmark::DoNotOptimize(writer.size());
+  }
+  state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_WireVarintEncode)->Arg(7)->Arg(28)->Arg(64);
+
+static void BM_WireVarintDecode(benchmark::State& state) {
+  uint64_t value = state.range(0) == 64 ? UINT64_MAX : (1ULL << state.range(0)) - 1;
+  uint8_t buffer[64 * KAPUA_WIRE_MAX_VARINT];
+  WireWriter writer(buffer, sizeof(buffer));
+  for (int i = 0; i < 64; i++) writer.put_varint(value);
+  for (auto _ : state) {
+    WireReader reader(buffer, writer.size());
+    uint64_t sum = 0;
+    for (int i = 0; i < 64; i++) sum += reader.get_varint();
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_WireVarintDecode)->Arg(7)->Arg(28)->Arg(64);
+
+// Arg: IDs in the array, read in place
+static void BM_WireIdsDecode(benchmark::State& state) {
+  std::vector<uint64_t> ids(state.range(0));
+  for (size_t i = 0; i < ids.size(); i++) ids[i] = 0x0123456789abcdef * (i + 1);
+  std::vector<uint8_t> buffer(KAPUA_WIRE_MAX_VARINT + ids.size() * sizeof(uint64_t));
+  WireWriter writer(buffer.data(), buffer.size());
+  writer.put_ids(ids.data(), ids.size());
+  for (auto _ : state) {
+    WireReader reader(buffer.data(), writer.size());
+    WireIds view = reader.get_ids();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < view.size(); i++) sum += view[i];
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * ids.size());
+}
+BENCHMARK(BM_WireIdsDecode)->Arg(16)->Arg(128);
+
+}  // namespace KapuaBench
@@ -0,0 +1,49 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <iostream>
+
+#include "WorkStealingPool.hpp"
+
+using namespace Kapua;
+
+namespace KapuaBench {
+
+std::atomic<uint64_t> bench_leaves;
+
+void bench_split(WorkStealingPool* pool, int depth) {
+  if (depth == 0) {
+    bench_leaves++;
+    return;
+  }
+  pool->submit([pool, depth] { bench_split(pool, depth - 1); });
+  pool->submit([pool, depth] { bench_split(pool, depth - 1); });
+}
+
+// Tiny tasks all submitted from outside the pool, so every one goes through the shared queue. Args: threads
+static void BM_WorkStealingPoolShared(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  WorkStealingPool pool(&logger, state.range(0));
+  std::atomic<uint64_t> ran(0);
+  for (auto _ : state) {
+    for (int i = 0; i < 4096; i++) pool.submit([&ran] { ran++; });
+    pool.wait();
+  }
+  state.SetItemsProcessed(state.iterations() * 4096);
+}
+BENCHMARK(BM_WorkStealingPoolShared)->Arg(1)->Arg(4)->UseRealTime();
+
+// The same number of tiny tasks spawned from inside the pool, so they go on the workers' own deques. Args: threads
+static void BM_WorkStealingPoolNested(benchmark::State& state) {
+  IOStreamLogger logger(&std::cerr, LOG_LEVEL_ERROR);
+  WorkStealingPool pool(&logger, state.range(0));
+  for (auto _ : state) {
+    pool.submit([&pool] { bench_split(&pool, 11); });
+    pool.wait();
+  }
+  state.SetItemsProcessed(state.iterations() * 4096);
+  state.counters["steals"] = pool.get_steals();
+}
+BENCHMARK(BM_WorkStealingPoolNested)->Arg(1)->Arg(4)->UseRealTime();
+
+}  // namespace KapuaBench
@@ -0,0 +1,35 @@
+//
+// Kapua event log decoder
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+// Prints the events in a file written by a node's EventLog (logging.events_file) as text, one per line.
+//
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "EventLog.hpp"
+#include "Logger.hpp"
+
+using namespace std;
+
+int main(int ac, char** av) {
+  Kapua::IOStreamLogger stdlog(&cerr, Kapua::LOG_LEVEL_WARN);
+
+  if (ac < 2) {
+    cerr << "Usage: " << av[0] << " <events file> [event name]" << endl;
+    return EXIT_FAILURE;
+  }
+  const char* only = ac > 2 ? av[2] : nullptr;
+
+  bool ok = Kapua::EventLog::read_file(&stdlog, av[1], [only](const Kapua::EventLog::Record& record) {
+    if (only) {
+      const Kapua::EventLog::Format* format = Kapua::EventLog::get_format(record.id);
+      if (!format || strcmp(format->name, only) != 0) return;
+    }
+    cout << Kapua::EventLog::format(record) << "\n";
+  });
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+//
+// Kapua cluster simulator
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+// Runs a cluster of nodes in one process over a simulated network, and reports how long discovery, the handshake and
+// ring placement take to converge, and what they cost in datagrams.
+//
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iostream>
+
+#include "Config.hpp"
+#include "Logger.hpp"
+#include "Simulator.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+static string format_ms(int64_t ms) { return ms < 0 ? "-" : to_string(ms / 1000) + "." + to_string(ms / 100 % 10) + "s"; }
+
+static Kapua::LogLevel_t parse_log_level(const string& level) {
+  if (level == "error") return Kapua::LOG_LEVEL_ERROR;
+  if (level == "info") return Kapua::LOG_LEVEL_INFO;
+  if (level == "debug") return Kapua::LOG_LEVEL_DEBUG;
+  return Kapua::LOG_LEVEL_WARN;
+}
+
+static void report(Kapua::Simulator& sim) {
+  Kapua::Simulator::Stats stats = sim.get_stats();
+  cout << format_ms(stats.time_ms) << ": " << stats.nodes_started << " started, " << stats.nodes_discovered << " discovered, " << stats.nodes_connected
+       << " connected, " << stats.nodes_placed << " placed, " << stats.datagrams_sent << " datagrams sent, " << stats.datagrams_lost << " lost, "
+       << stats.datagrams_unreachable << " unreachable" << endl;
+}
+
+int main(int ac, char** av) {
+  Kapua::Simulator::Options options;
+  uint64_t duration, reportEvery;
+  int32_t discoveryInterval, pingInterval, antiEntropyInterval;
+  string logLevel;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "Show this help")
+      ("nodes", po::value<size_t>(&options.nodes)->default_value(options.nodes), "Nodes to simulate")
+      ("segment-size", po::value<size_t>(&options.segment_size)->default_value(options.segment_size), "Nodes in each broadcast domain, at most 254")
+      ("seeds", po::value<size_t>(&options.seeds)->default_value(options.seeds), "Nodes in other segments each node is told about")
+      ("latency-us", po::value<uint32_t>(&options.latency_us)->default_value(options.latency_us), "One way latency within a segment")
+      ("segment-latency-us", po::value<uint32_t>(&options.segment_latency_us)->default_value(options.segment_latency_us), "One way latency between segments")
+      ("jitter-us", po::value<uint32_t>(&options.jitter_us)->default_value(options.jitter_us), "Most jitter added to the latency")
+      ("reorder", po::bool_switch(&options.reorder), "Let jitter reorder datagrams between two nodes")
+      ("loss", po::value<double>(&options.loss)->default_value(options.loss), "Fraction of datagrams lost")
+      ("bandwidth", po::value<uint64_t>(&options.bandwidth)->default_value(options.bandwidth), "Bytes per second each node can send, 0 for no limit")
+      ("start-spread-ms", po::value<uint32_t>(&options.start_spread_ms)->default_value(options.start_spread_ms), "Nodes start at random over this time")
+      ("tick-ms", po::value<uint32_t>(&options.tick_ms)->default_value(options.tick_ms), "How often node timers run")
+      ("key-bits", po::value<int>(&options.key_bits)->default_value(options.key_bits), "RSA key size")
+      ("keys", po::value<size_t>(&options.keys)->default_value(options.keys), "RSA key pairs to share between the nodes")
+      ("seed", po::value<uint64_t>(&options.seed)->default_value(options.seed), "Random seed")
+      ("discovery-interval-ms", po::value<int32_t>(&discoveryInterval)->default_value(5000), "Local discovery broadcast interval")
+      ("ping-interval-ms", po::value<int32_t>(&pingInterval)->default_value(16000), "Ping interval")
+      ("anti-entropy-interval-ms", po::value<int32_t>(&antiEntropyInterval)->default_value(0), "Anti-entropy round interval, 0 for none")
+      ("duration-ms", po::value<uint64_t>(&duration)->default_value(120000), "Give up after this much virtual time")
+      ("report-ms", po::value<uint64_t>(&reportEvery)->default_value(10000), "Report progress this often, in virtual time")
+      ("log-level", po::value<string>(&logLevel)->default_value("warn"), "Log level for the nodes");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(ac, av, desc), vm);
+    po::notify(vm);
+  } catch (const po::error& e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return EXIT_SUCCESS;
+  }
+
+  Kapua::IOStreamLogger stdlog(&cerr, parse_log_level(logLevel));
+  Kapua::Config config(&stdlog);
+  config.local_discovery_enable = true;
+  config.local_discovery_interval_ms = discoveryInterval;
+  config.server_ping_interval_ms = pingInterval;
+  // Anti-entropy rounds time out in real time, so leaving them off keeps runs repeatable
+  config.storage_anti_entropy_interval_ms = antiEntropyInterval > 0 ? antiEntropyInterval : INT32_MAX;
+
+  Kapua::Simulator sim(&stdlog, &config, options);
+  if (!sim.start()) return EXIT_FAILURE;
+
+  bool converged = false;
+  while (!converged && sim.get_time_ms() < duration) {
+    converged = sim.run_until_converged(std::min(duration, sim.get_time_ms() + reportEvery));
+    report(sim);
+  }
+
+  Kapua::Simulator::Stats stats = sim.get_stats();
+  cout << "Discovery converged: " << format_ms(stats.discovered_ms) << endl;
+  cout << "Handshakes converged: " << format_ms(stats.connected_ms) << endl;
+  cout << "Ring converged: " << format_ms(stats.placed_ms) << endl;
+  cout << "Datagrams per node: " << (options.nodes ? stats.datagrams_sent / options.nodes : 0) << ", bytes per node: " << (options.nodes ? stats.bytes_sent / options.nodes : 0)
+       << endl;
+  return converged ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -8,6 +8,7 @@
 #include "Core.hpp"
 #include "Kapua.hpp"
 #include "Logger.hpp"
+#include "MetricsServer.hpp"
 #include "Protocol.hpp"
 #include "RSA.hpp"
 #include "UDPNetwork.hpp"
@@ -28,7 +29,7 @@ void signal_stop(int signum) {
 }
 
 int main(int ac, char** av) {
-  Kapua::IOStreamLogger stdlog(&cout, Kapua::LOG_LEVEL_DEBUG);
+  Kapua::AsyncLogger stdlog(&cout, Kapua::LOG_LEVEL_DEBUG);
   Kapua::Config config(&stdlog);
   Kapua::RSA rsa(&stdlog, &config);
   Kapua::Core core(&stdlog, &config, &rsa);
@@ -69,6 +70,12 @@ int main(int ac, char** av) {
     stdlog.error("local discover start failed");
     return EXIT_FAILURE;
   }
+
+  Kapua::MetricsServer metrics(&stdlog, &config, core.get_metrics());
+  if (config.metrics_enable && !metrics.start()) {
+    stdlog.error("metrics server start failed");
+    return EXIT_FAILURE;
+  }
   stdlog.info("Started");
 
   signal(SIGINT, signal_stop);
@@ -0,0 +1,466 @@
+//
+// Kapua AntiEntropy class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "AntiEntropy.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+AntiEntropy::AntiEntropy(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, size_t replicas, AntiEntropyLimits limits,
+                         bool repairThread)
+    : _rounds(0), _hashes_compared(0), _leaves_compared(0), _blocks_repaired(0), _bytes_repaired(0), _conflicts(0) {
+  _logger = new ScopedLogger("AntiEntropy", logger);
+  _dbs = dbs;
+  _transport = transport;
+  _replicas = replicas;
+  _limits = limits;
+  _ring_version = std::numeric_limits<uint64_t>::max();
+  _next_session = 1;
+  _repairing = false;
+  _running = true;
+  if (repairThread) _repair_thread = std::thread(&AntiEntropy::_repair_loop, this);
+}
+
+AntiEntropy::~AntiEntropy() {
+  {
+    std::lock_guard<std::mutex> lock(_repair_mutex);
+    _running = false;
+  }
+  _repair_ready.notify_all();
+  if (_repair_thread.joinable()) _repair_thread.join();
+  delete _logger;
+}
+
+void AntiEntropy::set_sender(Sender sender) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _sender = sender;
+}
+
+void AntiEntropy::add_block(uint64_t blockId, uint64_t digest) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _refresh_ranges();
+
+  auto existing = _blocks.find(blockId);
+  if (existing != _blocks.end() && existing->second == digest) return;
+
+  auto range = _ranges.lower_bound(blockId);
+  if (range == _ranges.end()) range = _ranges.begin();
+  if (range != _ranges.end() && check_in_range(range->second.start, range->first, blockId)) {
+    uint32_t leaf = get_leaf(range->second.start, range->first, blockId);
+    if (existing != _blocks.end()) range->second.tree->toggle(leaf, MerkleTree::get_item_hash(blockId, existing->second));
+    range->second.tree->toggle(leaf, MerkleTree::get_item_hash(blockId, digest));
+  }
+  _blocks[blockId] = digest;
+}
+
+void AntiEntropy::remove_block(uint64_t blockId) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _refresh_ranges();
+
+  auto existing = _blocks.find(blockId);
+  if (existing == _blocks.end()) return;
+
+  auto range = _ranges.lower_bound(blockId);
+  if (range == _ranges.end()) range = _ranges.begin();
+  if (range != _ranges.end() && check_in_range(range->second.start, range->first, blockId)) {
+    range->second.tree->toggle(get_leaf(range->second.start, range->first, blockId), MerkleTree::get_item_hash(blockId, existing->second));
+  }
+  _blocks.erase(existing);
+}
+
+bool AntiEntropy::start_round(uint64_t peerId) {
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _refresh_ranges();
+
+    // Drop rounds whose peer stopped answering
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = _sessions.begin(); it != _sessions.end();) {
+      if (now - it->second.started > std::chrono::milliseconds(KAPUA_AE_SESSION_TIMEOUT_MS)) {
+        _logger->debug("Round " + std::to_string(it->first) + " with " + Util::to_hex64_str(it->second.peer) + " timed out");
+        it = _sessions.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    std::vector<const std::pair<const uint64_t, Range>*> shared;
+    for (auto& range : _ranges) {
+      std::vector<uint64_t> nodes = _dbs->get_dbs_candidates_for_block(range.first, _replicas);
+      if (std::find(nodes.begin(), nodes.end(), peerId) != nodes.end()) shared.push_back(&range);
+    }
+    if (shared.empty()) return false;
+
+    size_t& next = _next_range[peerId];
+    const std::pair<const uint64_t, Range>& range = *shared[next++ % shared.size()];
+
+    uint32_t id = _next_session++;
+    Session& session = _sessions[id];
+    session.peer = peerId;
+    session.range_start = range.second.start;
+    session.range_end = range.first;
+    session.hashes = 1;
+    session.leaves = 0;
+    session.pending = 1;
+    session.started = now;
+    session.repair_budget = std::make_shared<std::atomic<int64_t>>(_limits.max_repair_bytes);
+
+    AntiEntropyMessage request = {};
+    request.type = AntiEntropyMessage::TreeRequest;
+    request.session = id;
+    request.range_start = session.range_start;
+    request.range_end = session.range_end;
+    request.level = 0;
+    request.index = 0;
+    request.count = 1;
+    _queue(&out, peerId, request, nullptr, 0);
+    _rounds++;
+  }
+  _flush(&out);
+  return true;
+}
+
+void AntiEntropy::handle_message(uint64_t fromId, const uint8_t* data, size_t len) {
+  if (len < sizeof(AntiEntropyMessage)) return;
+  AntiEntropyMessage msg;
+  std::memcpy(&msg, data, sizeof(msg));
+  const uint8_t* payload = data + sizeof(msg);
+  size_t payloadLen = len - sizeof(msg);
+
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _refresh_ranges();
+
+    switch (msg.type) {
+      case AntiEntropyMessage::TreeRequest:
+        _handle_tree_request(fromId, msg, &out);
+        break;
+      case AntiEntropyMessage::TreeResponse: {
+        if (payloadLen != (size_t)msg.count * sizeof(uint64_t)) return;
+        std::vector<uint64_t> hashes(msg.count);
+        if (msg.count) std::memcpy(hashes.data(), payload, payloadLen);
+        _handle_tree_response(fromId, msg, hashes.data(), &out);
+        break;
+      }
+      case AntiEntropyMessage::LeafRequest:
+        _handle_leaf_request(fromId, msg, &out);
+        break;
+      case AntiEntropyMessage::LeafResponse: {
+        if (payloadLen != (size_t)msg.count * sizeof(AntiEntropyEntry)) return;
+        std::vector<AntiEntropyEntry> entries(msg.count);
+        if (msg.count) std::memcpy(entries.data(), payload, payloadLen);
+        _handle_leaf_response(fromId, msg, entries.data());
+        break;
+      }
+      default:
+        _logger->warn("Unknown message type " + std::to_string(msg.type) + " from " + Util::to_hex64_str(fromId));
+        return;
+    }
+  }
+  _flush(&out);
+}
+
+void AntiEntropy::wait_repairs() {
+  std::unique_lock<std::mutex> lock(_repair_mutex);
+  _repair_idle.wait(lock, [this] { return _repairs.empty() && !_repairing; });
+}
+
+size_t AntiEntropy::run_repairs() {
+  std::vector<uint8_t> data;
+  size_t count = 0;
+  while (true) {
+    Repair repair;
+    {
+      std::lock_guard<std::mutex> lock(_repair_mutex);
+      if (_repairs.empty()) return count;
+      repair = _repairs.front();
+      _repairs.pop_front();
+    }
+    _repair(repair, &data);
+    count++;
+  }
+}
+
+size_t AntiEntropy::get_range_count() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _refresh_ranges();
+  return _ranges.size();
+}
+
+uint32_t AntiEntropy::get_leaf(uint64_t rangeStart, uint64_t rangeEnd, uint64_t blockId, uint8_t depth) {
+  // IDs are spread evenly over the arc, so leaves are equal slices of it. An arc that starts where it ends is the
+  // whole ring.
+  uint64_t offset = blockId - rangeStart - 1;
+  uint64_t width = rangeEnd - rangeStart;
+  if (width == 0) return (uint32_t)(depth ? offset >> (64 - depth) : 0);
+  return (uint32_t)((((unsigned __int128)offset) << depth) / width);
+}
+
+bool AntiEntropy::check_in_range(uint64_t rangeStart, uint64_t rangeEnd, uint64_t blockId) {
+  uint64_t width = rangeEnd - rangeStart;
+  return width == 0 || blockId - rangeStart - 1 < width;
+}
+
+void AntiEntropy::_refresh_ranges() {
+  uint64_t version = _dbs->get_dbs_ring_version();
+  if (version == _ring_version) return;
+  _ring_version = version;
+
+  // Membership changed, so arcs have moved. Rebuild the trees from the local inventory, which is cheap next to
+  // reading any block data. Writes may put a copy on any of a block's candidates, spares included, so those are the
+  // arcs to cover.
+  _ranges.clear();
+  for (auto& arc : _dbs->get_dbs_ranges_for_node(_dbs->get_dbs_node_id(), _replicas + KAPUA_DBS_SPARE_NODES)) {
+    Range& range = _ranges[arc.second];
+    range.start = arc.first;
+    range.tree.reset(new MerkleTree(KAPUA_AE_TREE_DEPTH));
+    _build_tree(arc.first, arc.second, range.tree.get());
+  }
+  _sessions.clear();
+}
+
+void AntiEntropy::_build_tree(uint64_t rangeStart, uint64_t rangeEnd, MerkleTree* tree) {
+  _for_each_in_range(rangeStart, rangeEnd, [&](uint64_t blockId, uint64_t digest) {
+    tree->toggle(get_leaf(rangeStart, rangeEnd, blockId, tree->get_depth()), MerkleTree::get_item_hash(blockId, digest));
+  });
+}
+
+void AntiEntropy::_for_each_in_range(uint64_t rangeStart, uint64_t rangeEnd, const std::function<void(uint64_t, uint64_t)>& fn) {
+  if (rangeStart < rangeEnd) {
+    for (auto it = _blocks.upper_bound(rangeStart); it != _blocks.end() && it->first <= rangeEnd; ++it) fn(it->first, it->second);
+    return;
+  }
+  // The arc wraps past zero, or is the whole ring
+  for (auto it = _blocks.upper_bound(rangeStart); it != _blocks.end(); ++it) fn(it->first, it->second);
+  for (auto it = _blocks.begin(); it != _blocks.end() && it->first <= rangeEnd; ++it) fn(it->first, it->second);
+}
+
+MerkleTree* AntiEntropy::_find_tree(uint64_t rangeStart, uint64_t rangeEnd) {
+  auto it = _ranges.find(rangeEnd);
+  if (it == _ranges.end() || it->second.start != rangeStart) return nullptr;
+  return it->second.tree.get();
+}
+
+void AntiEntropy::_queue(Outbox* out, uint64_t nodeId, const AntiEntropyMessage& header, const void* payload, size_t payloadLen) {
+  std::vector<uint8_t> message(sizeof(header) + payloadLen);
+  std::memcpy(message.data(), &header, sizeof(header));
+  if (payloadLen) std::memcpy(message.data() + sizeof(header), payload, payloadLen);
+  out->push_back(std::make_pair(nodeId, std::move(message)));
+}
+
+void AntiEntropy::_flush(Outbox* out) {
+  Sender sender;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    sender = _sender;
+  }
+  if (!sender) return;
+  for (auto& message : *out) {
+    if (!sender(message.first, message.second.data(), message.second.size())) {
+      _logger->debug("Cannot send to " + Util::to_hex64_str(message.first));
+    }
+  }
+}
+
+void AntiEntropy::_handle_tree_request(uint64_t fromId, const AntiEntropyMessage& msg, Outbox* out) {
+  if (msg.level > KAPUA_AE_TREE_DEPTH || msg.count > KAPUA_AE_HASHES_PER_MESSAGE || (uint64_t)msg.index + msg.count > ((uint64_t)1 << msg.level)) {
+    _logger->warn("Bad tree request from " + Util::to_hex64_str(fromId));
+    return;
+  }
+
+  // A peer with a different view of the ring may ask about an arc this node does not track
+  MerkleTree* tree = _find_tree(msg.range_start, msg.range_end);
+  std::unique_ptr<MerkleTree> temporary;
+  if (!tree) {
+    temporary.reset(new MerkleTree(KAPUA_AE_TREE_DEPTH));
+    _build_tree(msg.range_start, msg.range_end, temporary.get());
+    tree = temporary.get();
+  }
+
+  std::vector<uint64_t> hashes(msg.count);
+  for (uint16_t i = 0; i < msg.count; i++) hashes[i] = tree->get_hash(msg.level, msg.index + i);
+
+  AntiEntropyMessage response = msg;
+  response.type = AntiEntropyMessage::TreeResponse;
+  _queue(out, fromId, response, hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+void AntiEntropy::_handle_tree_response(uint64_t fromId, const AntiEntropyMessage& msg, const uint64_t* hashes, Outbox* out) {
+  auto it = _sessions.find(msg.session);
+  if (it == _sessions.end() || it->second.peer != fromId) return;
+  Session& session = it->second;
+
+  MerkleTree* tree = _find_tree(session.range_start, session.range_end);
+  if (!tree || msg.level > tree->get_depth() || (uint64_t)msg.index + msg.count > ((uint64_t)1 << msg.level)) {
+    _finish_session(msg.session);
+    return;
+  }
+  session.pending--;
+  _hashes_compared += msg.count;
+
+  AntiEntropyMessage request = {};
+  request.session = msg.session;
+  request.range_start = session.range_start;
+  request.range_end = session.range_end;
+
+  std::vector<uint32_t> children;
+  for (uint16_t i = 0; i < msg.count; i++) {
+    uint32_t index = msg.index + i;
+    if (tree->get_hash(msg.level, index) == hashes[i]) continue;
+
+    if (msg.level == tree->get_depth()) {
+      if (session.leaves >= _limits.max_leaves) continue;
+      session.leaves++;
+      session.pending++;
+      request.type = AntiEntropyMessage::LeafRequest;
+      request.level = msg.level;
+      request.index = index;
+      request.count = 0;
+      _queue(out, fromId, request, nullptr, 0);
+    } else if (session.hashes + 2 <= _limits.max_hashes) {
+      session.hashes += 2;
+      children.push_back(2 * index);
+    }
+  }
+
+  // Ask for the children of every differing node, a run of adjacent ones per message
+  request.type = AntiEntropyMessage::TreeRequest;
+  request.level = msg.level + 1;
+  for (size_t i = 0; i < children.size();) {
+    size_t j = i + 1;
+    while (j < children.size() && children[j] == children[j - 1] + 2 && (j - i + 1) * 2 <= KAPUA_AE_HASHES_PER_MESSAGE) j++;
+    request.index = children[i];
+    request.count = (uint16_t)((j - i) * 2);
+    session.pending++;
+    _queue(out, fromId, request, nullptr, 0);
+    i = j;
+  }
+
+  if (session.pending == 0) _finish_session(msg.session);
+}
+
+void AntiEntropy::_handle_leaf_request(uint64_t fromId, const AntiEntropyMessage& msg, Outbox* out) {
+  if (msg.level != KAPUA_AE_TREE_DEPTH || msg.index >= ((uint32_t)1 << KAPUA_AE_TREE_DEPTH)) {
+    _logger->warn("Bad leaf request from " + Util::to_hex64_str(fromId));
+    return;
+  }
+
+  // The leaf is the slice of offsets o in the arc with index * width <= o << depth < (index + 1) * width
+  unsigned __int128 width = msg.range_end - msg.range_start;
+  if (width == 0) width = (unsigned __int128)1 << 64;
+  unsigned __int128 scale = (unsigned __int128)1 << KAPUA_AE_TREE_DEPTH;
+  unsigned __int128 low = (msg.index * width + scale - 1) / scale;
+  unsigned __int128 high = ((msg.index + 1) * width + scale - 1) / scale;
+
+  std::vector<AntiEntropyEntry> entries;
+  if (low < high) {
+    _for_each_in_range(msg.range_start + (uint64_t)low, msg.range_start + (uint64_t)high,
+                       [&](uint64_t blockId, uint64_t digest) { entries.push_back({blockId, digest}); });
+  }
+
+  AntiEntropyMessage response = msg;
+  response.type = AntiEntropyMessage::LeafResponse;
+  response.total = (uint32_t)entries.size();
+  size_t offset = 0;
+  do {
+    size_t count = std::min(entries.size() - offset, (size_t)KAPUA_AE_ENTRIES_PER_MESSAGE);
+    response.offset = (uint32_t)offset;
+    response.count = (uint16_t)count;
+    _queue(out, fromId, response, entries.data() + offset, count * sizeof(AntiEntropyEntry));
+    offset += count;
+  } while (offset < entries.size());
+}
+
+void AntiEntropy::_handle_leaf_response(uint64_t fromId, const AntiEntropyMessage& msg, const AntiEntropyEntry* entries) {
+  auto it = _sessions.find(msg.session);
+  if (it == _sessions.end() || it->second.peer != fromId) return;
+  Session& session = it->second;
+
+  std::vector<AntiEntropyEntry>& received = session.leaf_entries[msg.index];
+  received.insert(received.end(), entries, entries + msg.count);
+  if (received.size() < msg.total) return;
+
+  // Every entry for this leaf has arrived, so pull what this node lacks where writes would now place it. Pulling
+  // onto a node that placement passes over for load would undo what bounded load did.
+  _leaves_compared++;
+  uint64_t selfId = _dbs->get_dbs_node_id();
+  size_t missing = 0;
+  for (const AntiEntropyEntry& entry : received) {
+    if (!check_in_range(session.range_start, session.range_end, entry.block_id)) continue;
+    auto local = _blocks.find(entry.block_id);
+    if (local == _blocks.end()) {
+      std::vector<uint64_t> nodes = _dbs->get_dbs_nodes_for_block(entry.block_id, _replicas);
+      if (std::find(nodes.begin(), nodes.end(), selfId) == nodes.end()) continue;
+      missing++;
+      if (_transport) {
+        std::lock_guard<std::mutex> lock(_repair_mutex);
+        _repairs.push_back({fromId, entry.block_id, entry.digest, session.repair_budget});
+      }
+    } else if (local->second != entry.digest) {
+      // Nothing here says which copy is newer, so leave it for whoever wrote the block
+      _conflicts++;
+      _logger->warn("Block " + Util::to_hex64_str(entry.block_id) + " differs from " + Util::to_hex64_str(fromId));
+    }
+  }
+  if (missing) {
+    _logger->debug(std::to_string(missing) + " blocks missing in leaf " + std::to_string(msg.index) + " held by " + Util::to_hex64_str(fromId));
+    if (_transport) _repair_ready.notify_one();
+  }
+
+  session.leaf_entries.erase(msg.index);
+  session.pending--;
+  if (session.pending == 0) _finish_session(msg.session);
+}
+
+void AntiEntropy::_finish_session(uint32_t id) {
+  auto it = _sessions.find(id);
+  if (it == _sessions.end()) return;
+  _logger->debug("Round " + std::to_string(id) + " with " + Util::to_hex64_str(it->second.peer) + " compared " + std::to_string(it->second.hashes) +
+                 " hashes and " + std::to_string(it->second.leaves) + " leaves");
+  _sessions.erase(it);
+}
+
+void AntiEntropy::_repair_loop() {
+  std::vector<uint8_t> data;
+
+  while (true) {
+    Repair repair;
+    {
+      std::unique_lock<std::mutex> lock(_repair_mutex);
+      _repair_ready.wait(lock, [this] { return !_running || !_repairs.empty(); });
+      if (!_running) return;
+      repair = _repairs.front();
+      _repairs.pop_front();
+      _repairing = true;
+    }
+
+    _repair(repair, &data);
+
+    std::lock_guard<std::mutex> lock(_repair_mutex);
+    _repairing = false;
+    if (_repairs.empty()) _repair_idle.notify_all();
+  }
+}
+
+void AntiEntropy::_repair(const Repair& repair, std::vector<uint8_t>* data) {
+  // The budget is shared by every pull in a round, so one bad arc cannot flood the network
+  if (*repair.budget <= 0 || !_transport->get_block(repair.peer, repair.block_id, data)) return;
+  *repair.budget -= (int64_t)data->size();
+  if (_transport->put_block(_dbs->get_dbs_node_id(), repair.block_id, data->data(), data->size())) {
+    add_block(repair.block_id, repair.digest);
+    _blocks_repaired++;
+    _bytes_repaired += data->size();
+  }
+}
+
+}  // namespace Kapua
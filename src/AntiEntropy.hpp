@@ -0,0 +1,183 @@
+//
+// Kapua AntiEntropy class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockTransport.hpp"
+#include "DistributedBlockStore.hpp"
+#include "Logger.hpp"
+#include "MerkleTree.hpp"
+
+namespace Kapua {
+
+#define KAPUA_AE_TREE_DEPTH 6
+#define KAPUA_AE_HASHES_PER_MESSAGE 64
+#define KAPUA_AE_ENTRIES_PER_MESSAGE 64
+#define KAPUA_AE_SESSION_TIMEOUT_MS 30000
+
+#pragma pack(push, 1)
+struct AntiEntropyMessage {
+  enum Type : uint8_t {
+    TreeRequest,   // Send the hashes at level, index .. index + count
+    TreeResponse,  // count uint64_t hashes follow
+    LeafRequest,   // Send the blocks in leaf index
+    LeafResponse,  // count AntiEntropyEntry follow, starting at offset of total
+  };
+
+  Type type;
+  uint32_t session;
+  uint64_t range_start;
+  uint64_t range_end;
+  uint8_t level;
+  uint32_t index;
+  uint16_t count;
+  uint32_t offset;
+  uint32_t total;
+};
+
+struct AntiEntropyEntry {
+  uint64_t block_id;
+  uint64_t digest;
+};
+#pragma pack(pop)
+
+struct AntiEntropyLimits {
+  uint32_t max_hashes = 4096;                    // Tree hashes compared per round
+  uint32_t max_leaves = 16;                      // Differing leaves listed per round
+  int64_t max_repair_bytes = 64 * 1024 * 1024;  // Block data pulled per round
+};
+
+// Detects and repairs replicas that have diverged. Each ring arc this node replicates has a MerkleTree over the
+// blocks held in it, updated as blocks are added and removed, so checking an arc never touches block data. A round
+// compares one arc with one peer that also replicates it: the trees are walked down from the root only where the
+// hashes differ, the blocks in differing leaves are listed, and any the peer has that this node lacks are pulled in
+// the background. Rounds are bounded in the hashes and leaves they compare and the bytes they repair.
+//
+// Messages are opaque to the network layer, which delivers them with handle_message and sends them with the
+// Sender. Repair is pull only; each side of a pair repairs itself in its own rounds. Repairs run on a thread of their
+// own, or without one, whenever the owner calls run_repairs, as the simulator does in virtual time.
+class AntiEntropy {
+ public:
+  typedef std::function<bool(uint64_t nodeId, const uint8_t* data, size_t len)> Sender;
+
+  AntiEntropy(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, size_t replicas = KAPUA_DBS_REPLICAS,
+              AntiEntropyLimits limits = AntiEntropyLimits(), bool repairThread = true);
+  ~AntiEntropy();
+
+  void set_sender(Sender sender);
+
+  // Keep the trees up to date with the blocks held locally. The digest identifies the block's contents or version.
+  void add_block(uint64_t blockId, uint64_t digest);
+  void remove_block(uint64_t blockId);
+
+  // Start comparing the next arc shared with the peer. Returns false if the peer shares none.
+  bool start_round(uint64_t peerId);
+  void handle_message(uint64_t fromId, const uint8_t* data, size_t len);
+  // Wait for queued repairs to finish. Only with the repair thread.
+  void wait_repairs();
+  // Run the queued repairs on the calling thread, without the repair thread. Returns the number run.
+  size_t run_repairs();
+
+  size_t get_range_count();
+  uint64_t get_rounds() { return _rounds; }
+  uint64_t get_hashes_compared() { return _hashes_compared; }
+  uint64_t get_leaves_compared() { return _leaves_compared; }
+  uint64_t get_blocks_repaired() { return _blocks_repaired; }
+  uint64_t get_bytes_repaired() { return _bytes_repaired; }
+  uint64_t get_conflicts() { return _conflicts; }
+
+  static uint32_t get_leaf(uint64_t rangeStart, uint64_t rangeEnd, uint64_t blockId, uint8_t depth = KAPUA_AE_TREE_DEPTH);
+  static bool check_in_range(uint64_t rangeStart, uint64_t rangeEnd, uint64_t blockId);
+
+ protected:
+  struct Range {
+    uint64_t start;
+    std::unique_ptr<MerkleTree> tree;
+  };
+
+  struct Session {
+    uint64_t peer;
+    uint64_t range_start;
+    uint64_t range_end;
+    uint32_t hashes;
+    uint32_t leaves;
+    uint32_t pending;
+    std::chrono::steady_clock::time_point started;
+    std::shared_ptr<std::atomic<int64_t>> repair_budget;
+    std::map<uint32_t, std::vector<AntiEntropyEntry>> leaf_entries;
+  };
+
+  struct Repair {
+    uint64_t peer;
+    uint64_t block_id;
+    uint64_t digest;
+    std::shared_ptr<std::atomic<int64_t>> budget;
+  };
+
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  BlockTransport* _transport;
+  size_t _replicas;
+  AntiEntropyLimits _limits;
+  Sender _sender;
+
+  // Messages are queued while the lock is held and sent after it is released, as the Sender may deliver straight
+  // back to this node
+  typedef std::vector<std::pair<uint64_t, std::vector<uint8_t>>> Outbox;
+
+  std::mutex _mutex;
+  std::map<uint64_t, uint64_t> _blocks;  // Block ID to digest
+  std::map<uint64_t, Range> _ranges;     // By end of arc
+  uint64_t _ring_version;
+  std::unordered_map<uint32_t, Session> _sessions;
+  uint32_t _next_session;
+  std::unordered_map<uint64_t, size_t> _next_range;  // Round robin position per peer
+
+  std::mutex _repair_mutex;
+  std::condition_variable _repair_ready;
+  std::condition_variable _repair_idle;
+  std::deque<Repair> _repairs;
+  bool _repairing;
+  bool _running;
+  std::thread _repair_thread;
+
+  std::atomic<uint64_t> _rounds;
+  std::atomic<uint64_t> _hashes_compared;
+  std::atomic<uint64_t> _leaves_compared;
+  std::atomic<uint64_t> _blocks_repaired;
+  std::atomic<uint64_t> _bytes_repaired;
+  std::atomic<uint64_t> _conflicts;
+
+  void _refresh_ranges();
+  void _build_tree(uint64_t rangeStart, uint64_t rangeEnd, MerkleTree* tree);
+  void _for_each_in_range(uint64_t rangeStart, uint64_t rangeEnd, const std::function<void(uint64_t, uint64_t)>& fn);
+  MerkleTree* _find_tree(uint64_t rangeStart, uint64_t rangeEnd);
+
+  void _queue(Outbox* out, uint64_t nodeId, const AntiEntropyMessage& header, const void* payload, size_t payloadLen);
+  void _flush(Outbox* out);
+  void _handle_tree_request(uint64_t fromId, const AntiEntropyMessage& msg, Outbox* out);
+  void _handle_tree_response(uint64_t fromId, const AntiEntropyMessage& msg, const uint64_t* hashes, Outbox* out);
+  void _handle_leaf_request(uint64_t fromId, const AntiEntropyMessage& msg, Outbox* out);
+  void _handle_leaf_response(uint64_t fromId, const AntiEntropyMessage& msg, const AntiEntropyEntry* entries);
+  void _finish_session(uint32_t id);
+  void _repair_loop();
+  void _repair(const Repair& repair, std::vector<uint8_t>* data);
+};
+
+}  // namespace Kapua
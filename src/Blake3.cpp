@@ -0,0 +1,248 @@
+//
+// Kapua Blake3 class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "Blake3.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <thread>
+
+namespace Kapua {
+
+namespace {
+
+const uint32_t IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+// The message word permutation applied before each round, precomputed so the message is never shuffled in memory
+const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}, {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1}, {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4}, {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+enum Flags : uint32_t {
+  CHUNK_START = 1 << 0,
+  CHUNK_END = 1 << 1,
+  PARENT = 1 << 2,
+  ROOT = 1 << 3,
+};
+
+inline uint32_t rotr(uint32_t w, int c) { return (w >> c) | (w << (32 - c)); }
+
+inline uint32_t load_le32(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+inline void store_le32(uint8_t* p, uint32_t w) {
+  p[0] = (uint8_t)w;
+  p[1] = (uint8_t)(w >> 8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+
+// The quarter round, on named state words so the whole state stays in registers
+#define KAPUA_BLAKE3_G(a, b, c, d, mx, my) \
+  a = a + b + (mx);                        \
+  d = rotr(d ^ a, 16);                     \
+  c = c + d;                               \
+  b = rotr(b ^ c, 12);                     \
+  a = a + b + (my);                        \
+  d = rotr(d ^ a, 8);                      \
+  c = c + d;                               \
+  b = rotr(b ^ c, 7);
+
+uint64_t largest_power_of_two_leq(uint64_t n) {
+  uint64_t p = 1;
+  while (p <= n / 2) p <<= 1;
+  return p;
+}
+
+}  // namespace
+
+Blake3::Blake3() {
+  _chunk.reset(0);
+  _cv_stack_len = 0;
+}
+
+void Blake3::update(const uint8_t* input, size_t len) {
+  while (len > 0) {
+    // A full chunk is only finished once more input arrives, as the last chunk must be finalised as the root
+    if (_chunk.len() == KAPUA_BLAKE3_CHUNK_LEN) {
+      uint32_t cv[8];
+      _chunk.output().chaining_value(cv);
+      uint64_t totalChunks = _chunk.chunk_counter + 1;
+      _add_chunk_cv(cv, totalChunks);
+      _chunk.reset(totalChunks);
+    }
+
+    size_t take = std::min(KAPUA_BLAKE3_CHUNK_LEN - _chunk.len(), len);
+    _chunk.update(input, take);
+    input += take;
+    len -= take;
+  }
+}
+
+void Blake3::finalize(Blake3Hash* out) const {
+  Output output = _chunk.output();
+  for (size_t remaining = _cv_stack_len; remaining > 0; remaining--) {
+    uint32_t cv[8];
+    output.chaining_value(cv);
+    output = _parent_output(_cv_stack[remaining - 1], cv);
+  }
+  output.root_bytes(out->bytes, KAPUA_BLAKE3_OUT_LEN);
+}
+
+void Blake3::hash(const uint8_t* input, size_t len, Blake3Hash* out, unsigned threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  if (len < PARALLEL_THRESHOLD) threads = 1;
+
+  _subtree_output(input, len, 0, threads).root_bytes(out->bytes, KAPUA_BLAKE3_OUT_LEN);
+}
+
+void Blake3::_add_chunk_cv(uint32_t cv[8], uint64_t totalChunks) {
+  // Merge completed subtrees: each trailing zero bit in the chunk count is a subtree that is now complete
+  uint32_t merged[8];
+  std::memcpy(merged, cv, sizeof(merged));
+  while ((totalChunks & 1) == 0) {
+    _cv_stack_len--;
+    _parent_output(_cv_stack[_cv_stack_len], merged).chaining_value(merged);
+    totalChunks >>= 1;
+  }
+  std::memcpy(_cv_stack[_cv_stack_len], merged, sizeof(merged));
+  _cv_stack_len++;
+}
+
+void Blake3::_compress(const uint32_t cv[8], const uint8_t block[KAPUA_BLAKE3_BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint32_t flags,
+                       uint32_t out[16]) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; i++) m[i] = load_le32(block + 4 * i);
+
+  uint32_t s0 = cv[0], s1 = cv[1], s2 = cv[2], s3 = cv[3], s4 = cv[4], s5 = cv[5], s6 = cv[6], s7 = cv[7];
+  uint32_t s8 = IV[0], s9 = IV[1], s10 = IV[2], s11 = IV[3];
+  uint32_t s12 = (uint32_t)counter, s13 = (uint32_t)(counter >> 32), s14 = blockLen, s15 = flags;
+
+  for (int r = 0; r < 7; r++) {
+    const uint8_t* schedule = MSG_SCHEDULE[r];
+    // Columns
+    KAPUA_BLAKE3_G(s0, s4, s8, s12, m[schedule[0]], m[schedule[1]]);
+    KAPUA_BLAKE3_G(s1, s5, s9, s13, m[schedule[2]], m[schedule[3]]);
+    KAPUA_BLAKE3_G(s2, s6, s10, s14, m[schedule[4]], m[schedule[5]]);
+    KAPUA_BLAKE3_G(s3, s7, s11, s15, m[schedule[6]], m[schedule[7]]);
+    // Diagonals
+    KAPUA_BLAKE3_G(s0, s5, s10, s15, m[schedule[8]], m[schedule[9]]);
+    KAPUA_BLAKE3_G(s1, s6, s11, s12, m[schedule[10]], m[schedule[11]]);
+    KAPUA_BLAKE3_G(s2, s7, s8, s13, m[schedule[12]], m[schedule[13]]);
+    KAPUA_BLAKE3_G(s3, s4, s9, s14, m[schedule[14]], m[schedule[15]]);
+  }
+
+  const uint32_t s[16] = {s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15};
+  for (int i = 0; i < 8; i++) {
+    out[i] = s[i] ^ s[i + 8];
+    out[i + 8] = s[i + 8] ^ cv[i];
+  }
+}
+
+Blake3::Output Blake3::_parent_output(const uint32_t left[8], const uint32_t right[8]) {
+  Output output;
+  std::memcpy(output.input_cv, IV, sizeof(IV));
+  for (int i = 0; i < 8; i++) {
+    store_le32(output.block + 4 * i, left[i]);
+    store_le32(output.block + 32 + 4 * i, right[i]);
+  }
+  output.block_len = KAPUA_BLAKE3_BLOCK_LEN;
+  output.counter = 0;
+  output.flags = PARENT;
+  return output;
+}
+
+Blake3::Output Blake3::_chunk_output(const uint8_t* input, size_t len, uint64_t counter) {
+  ChunkState chunk;
+  chunk.reset(counter);
+  chunk.update(input, len);
+  return chunk.output();
+}
+
+Blake3::Output Blake3::_subtree_output(const uint8_t* input, size_t len, uint64_t counter, unsigned threads) {
+  if (len <= KAPUA_BLAKE3_CHUNK_LEN) return _chunk_output(input, len, counter);
+
+  // The left subtree always holds the largest power of two number of chunks that leaves some input on the right
+  size_t leftLen = largest_power_of_two_leq((len - 1) / KAPUA_BLAKE3_CHUNK_LEN) * KAPUA_BLAKE3_CHUNK_LEN;
+  uint64_t rightCounter = counter + leftLen / KAPUA_BLAKE3_CHUNK_LEN;
+
+  uint32_t leftCv[8], rightCv[8];
+  if (threads > 1) {
+    unsigned leftThreads = threads / 2;
+    std::future<Output> left = std::async(std::launch::async, [=] { return _subtree_output(input, leftLen, counter, leftThreads); });
+    _subtree_output(input + leftLen, len - leftLen, rightCounter, threads - leftThreads).chaining_value(rightCv);
+    left.get().chaining_value(leftCv);
+  } else {
+    _subtree_output(input, leftLen, counter, 1).chaining_value(leftCv);
+    _subtree_output(input + leftLen, len - leftLen, rightCounter, 1).chaining_value(rightCv);
+  }
+  return _parent_output(leftCv, rightCv);
+}
+
+void Blake3::Output::chaining_value(uint32_t cv[8]) const {
+  uint32_t out[16];
+  _compress(input_cv, block, block_len, counter, flags, out);
+  std::memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+void Blake3::Output::root_bytes(uint8_t* out, size_t len) const {
+  uint64_t outputBlockCounter = 0;
+  while (len > 0) {
+    uint32_t words[16];
+    _compress(input_cv, block, block_len, outputBlockCounter, flags | ROOT, words);
+    for (int i = 0; i < 16 && len > 0; i++) {
+      uint8_t bytes[4];
+      store_le32(bytes, words[i]);
+      size_t take = std::min(len, (size_t)4);
+      std::memcpy(out, bytes, take);
+      out += take;
+      len -= take;
+    }
+    outputBlockCounter++;
+  }
+}
+
+void Blake3::ChunkState::reset(uint64_t counter) {
+  std::memcpy(cv, IV, sizeof(IV));
+  chunk_counter = counter;
+  std::memset(block, 0, sizeof(block));
+  block_len = 0;
+  blocks_compressed = 0;
+}
+
+void Blake3::ChunkState::update(const uint8_t* input, size_t len) {
+  while (len > 0) {
+    // As with chunks, a full block is only compressed once more input arrives
+    if (block_len == KAPUA_BLAKE3_BLOCK_LEN) {
+      uint32_t out[16];
+      _compress(cv, block, KAPUA_BLAKE3_BLOCK_LEN, chunk_counter, blocks_compressed == 0 ? (uint32_t)CHUNK_START : 0u, out);
+      std::memcpy(cv, out, 8 * sizeof(uint32_t));
+      blocks_compressed++;
+      std::memset(block, 0, sizeof(block));
+      block_len = 0;
+    }
+
+    size_t take = std::min((size_t)(KAPUA_BLAKE3_BLOCK_LEN - block_len), len);
+    std::memcpy(block + block_len, input, take);
+    block_len += (uint8_t)take;
+    input += take;
+    len -= take;
+  }
+}
+
+Blake3::Output Blake3::ChunkState::output() const {
+  Output output;
+  std::memcpy(output.input_cv, cv, sizeof(cv));
+  std::memcpy(output.block, block, sizeof(block));
+  output.block_len = block_len;
+  output.counter = chunk_counter;
+  output.flags = CHUNK_END | (blocks_compressed == 0 ? (uint32_t)CHUNK_START : 0u);
+  return output;
+}
+
+}  // namespace Kapua
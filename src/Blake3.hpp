@@ -0,0 +1,88 @@
+//
+// Kapua Blake3 class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Kapua {
+
+#define KAPUA_BLAKE3_OUT_LEN 32
+#define KAPUA_BLAKE3_BLOCK_LEN 64
+#define KAPUA_BLAKE3_CHUNK_LEN 1024
+
+struct Blake3Hash {
+  uint8_t bytes[KAPUA_BLAKE3_OUT_LEN];
+
+  // The first 8 bytes, little endian, as used for block IDs
+  uint64_t to_uint64() const {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | bytes[i];
+    return value;
+  }
+
+  friend bool operator==(const Blake3Hash& lhs, const Blake3Hash& rhs) {
+    for (int i = 0; i < KAPUA_BLAKE3_OUT_LEN; i++)
+      if (lhs.bytes[i] != rhs.bytes[i]) return false;
+    return true;
+  }
+};
+
+// BLAKE3 (unkeyed, 32 byte output). Use update/finalize for streaming input, or hash() for a whole buffer, which
+// hashes independent subtrees of the chunk tree on separate threads.
+class Blake3 {
+ public:
+  Blake3();
+
+  void update(const uint8_t* input, size_t len);
+  void finalize(Blake3Hash* out) const;
+
+  // Inputs under this size are hashed on the calling thread
+  static const size_t PARALLEL_THRESHOLD = 128 * KAPUA_BLAKE3_CHUNK_LEN;
+
+  static void hash(const uint8_t* input, size_t len, Blake3Hash* out, unsigned threads = 0);
+
+ protected:
+  struct Output {
+    uint32_t input_cv[8];
+    uint8_t block[KAPUA_BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint64_t counter;
+    uint32_t flags;
+
+    void chaining_value(uint32_t cv[8]) const;
+    void root_bytes(uint8_t* out, size_t len) const;
+  };
+
+  struct ChunkState {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t block[KAPUA_BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+
+    void reset(uint64_t counter);
+    size_t len() const { return KAPUA_BLAKE3_BLOCK_LEN * (size_t)blocks_compressed + block_len; }
+    void update(const uint8_t* input, size_t len);
+    Output output() const;
+  };
+
+  ChunkState _chunk;
+  uint32_t _cv_stack[54][8];
+  uint8_t _cv_stack_len;
+
+  void _add_chunk_cv(uint32_t cv[8], uint64_t totalChunks);
+
+  static void _compress(const uint32_t cv[8], const uint8_t block[KAPUA_BLAKE3_BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint32_t flags,
+                        uint32_t out[16]);
+  static Output _parent_output(const uint32_t left[8], const uint32_t right[8]);
+  static Output _chunk_output(const uint8_t* input, size_t len, uint64_t counter);
+  static Output _subtree_output(const uint8_t* input, size_t len, uint64_t counter, unsigned threads);
+};
+
+}  // namespace Kapua
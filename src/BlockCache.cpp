@@ -0,0 +1,341 @@
+//
+// Kapua BlockCache class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "BlockCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Kapua {
+
+BlockCache::BlockCache(Logger* logger, size_t capacity, size_t shards) : _hits(0), _misses(0), _evictions(0), _coalesced(0) {
+  _logger = new ScopedLogger("BlockCache", logger);
+  _capacity = capacity;
+
+  if (shards == 0) shards = 1;
+  for (size_t i = 0; i < shards; i++) {
+    Shard* shard = new Shard();
+    shard->capacity = capacity / shards;
+    shard->small_capacity = shard->capacity / 10;
+    // Small shards get smaller slabs, so one partly used slab per size class is a small part of the capacity
+    shard->slab_size = KAPUA_BLOCK_CACHE_SLAB_SIZE;
+    while (shard->slab_size > KAPUA_BLOCK_CACHE_MIN_CLASS && shard->slab_size * 16 > shard->capacity) shard->slab_size >>= 1;
+    shard->size = 0;
+    shard->small_size = 0;
+    shard->memory = 0;
+    _shards.emplace_back(shard);
+  }
+}
+
+BlockCache::~BlockCache() {
+  for (auto& shard : _shards) {
+    for (auto& pair : shard->entries) delete pair.second;
+    for (Slab* slab : shard->slabs) {
+      delete[] slab->memory;
+      delete slab;
+    }
+  }
+  delete _logger;
+}
+
+bool BlockCache::get(uint64_t blockId, std::vector<uint8_t>* data, const Loader& loader) {
+  Shard* shard = _get_shard(blockId);
+  std::promise<BlockData> promise;
+  std::shared_future<BlockData> flight;
+  bool leader = false;
+
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    if (_lookup(shard, blockId, data)) {
+      _hits++;
+      return true;
+    }
+
+    auto it = shard->inflight.find(blockId);
+    if (it != shard->inflight.end()) {
+      flight = it->second;
+      _coalesced++;
+    } else {
+      flight = promise.get_future().share();
+      shard->inflight[blockId] = flight;
+      leader = true;
+      _misses++;
+    }
+  }
+
+  // Someone else is already loading this block, wait for their result
+  if (!leader) {
+    BlockData result = flight.get();
+    if (!result) return false;
+    *data = *result;
+    return true;
+  }
+
+  // Ends the flight however the loader returns, so a loader that throws cannot leave waiters blocked on it
+  // or keep later readers of the block coalescing onto a flight that never lands
+  struct Flight {
+    Shard* shard;
+    uint64_t block_id;
+    std::promise<BlockData>* promise;
+    BlockData result;
+
+    ~Flight() {
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->inflight.erase(block_id);
+      }
+      promise->set_value(result);
+    }
+  } landing{shard, blockId, &promise, nullptr};
+
+  bool ok = loader(blockId, data);
+  if (ok) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    _insert(shard, blockId, data->data(), data->size());
+    landing.result = std::make_shared<const std::vector<uint8_t>>(*data);
+  }
+  return ok;
+}
+
+bool BlockCache::get(uint64_t blockId, std::vector<uint8_t>* data) {
+  Shard* shard = _get_shard(blockId);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  if (_lookup(shard, blockId, data)) {
+    _hits++;
+    return true;
+  }
+  _misses++;
+  return false;
+}
+
+void BlockCache::put(uint64_t blockId, const uint8_t* data, size_t len) {
+  Shard* shard = _get_shard(blockId);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  _insert(shard, blockId, data, len);
+}
+
+void BlockCache::invalidate(uint64_t blockId) {
+  Shard* shard = _get_shard(blockId);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  auto it = shard->entries.find(blockId);
+  if (it == shard->entries.end()) return;
+
+  Entry* entry = it->second;
+  std::deque<Entry*>& queue = entry->main ? shard->main : shard->small;
+  queue.erase(std::find(queue.begin(), queue.end(), entry));
+  _remove(shard, entry);
+}
+
+size_t BlockCache::get_size() {
+  size_t size = 0;
+  for (auto& shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    size += shard->size;
+  }
+  return size;
+}
+
+size_t BlockCache::get_memory() {
+  size_t memory = 0;
+  for (auto& shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    memory += shard->memory;
+  }
+  return memory;
+}
+
+size_t BlockCache::get_count() {
+  size_t count = 0;
+  for (auto& shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    count += shard->entries.size();
+  }
+  return count;
+}
+
+size_t BlockCache::get_size_class(size_t len) {
+  if (len > UINT32_MAX) return 0;
+  size_t classSize = KAPUA_BLOCK_CACHE_MIN_CLASS;
+  while (classSize < len) classSize <<= 1;
+  return classSize;
+}
+
+BlockCache::Shard* BlockCache::_get_shard(uint64_t blockId) {
+  // Block IDs are hashes or ring positions, but mix anyway so sequential IDs spread over the shards
+  blockId ^= blockId >> 33;
+  blockId *= 0xff51afd7ed558ccdULL;
+  blockId ^= blockId >> 33;
+  return _shards[blockId % _shards.size()].get();
+}
+
+bool BlockCache::_lookup(Shard* shard, uint64_t blockId, std::vector<uint8_t>* data) {
+  auto it = shard->entries.find(blockId);
+  if (it == shard->entries.end()) return false;
+
+  Entry* entry = it->second;
+  if (entry->freq < KAPUA_BLOCK_CACHE_MAX_FREQ) entry->freq++;
+  data->assign(entry->data, entry->data + entry->length);
+  return true;
+}
+
+void BlockCache::_insert(Shard* shard, uint64_t blockId, const uint8_t* data, size_t len) {
+  size_t classSize = get_size_class(len);
+  if (classSize == 0 || _get_slab_buffers(shard, classSize) * classSize > shard->capacity) return;
+
+  // Blocks are immutable, so a block already present is left where it is
+  if (shard->entries.count(blockId)) return;
+
+  if (!_make_room(shard, classSize)) return;
+
+  Entry* entry = new Entry();
+  entry->block_id = blockId;
+  entry->data = _alloc_buffer(shard, classSize, &entry->slab);
+  entry->length = (uint32_t)len;
+  entry->freq = 0;
+  std::memcpy(entry->data, data, len);
+
+  // Recently evicted from the small queue and back already, so it has earned a place in main
+  if (shard->ghost_ids.erase(blockId)) {
+    entry->main = true;
+    shard->main.push_back(entry);
+  } else {
+    entry->main = false;
+    shard->small.push_back(entry);
+    shard->small_size += classSize;
+  }
+
+  shard->size += classSize;
+  shard->entries[blockId] = entry;
+}
+
+void BlockCache::_remove(Shard* shard, Entry* entry) {
+  size_t classSize = entry->slab->class_size;
+  shard->size -= classSize;
+  if (!entry->main) shard->small_size -= classSize;
+
+  shard->entries.erase(entry->block_id);
+  _free_buffer(shard, entry->slab, entry->data);
+  delete entry;
+}
+
+bool BlockCache::_make_room(Shard* shard, size_t classSize) {
+  // A free buffer in an existing slab costs no memory
+  while (shard->partial[classSize].empty()) {
+    if (shard->memory + _get_slab_buffers(shard, classSize) * classSize <= shard->capacity) return true;
+    // Reclaim slabs kept empty for other size classes before evicting blocks. Evicting blocks of other classes
+    // only helps once one of their slabs empties, so with several classes resident this can evict more than the
+    // bytes being inserted.
+    if (!_release_empty_slab(shard) && !_evict(shard)) return false;
+  }
+  return true;
+}
+
+bool BlockCache::_evict(Shard* shard) {
+  if (!shard->small.empty() && (shard->small_size > shard->small_capacity || shard->main.empty())) return _evict_small(shard);
+  return _evict_main(shard);
+}
+
+bool BlockCache::_evict_small(Shard* shard) {
+  while (!shard->small.empty()) {
+    Entry* entry = shard->small.front();
+    shard->small.pop_front();
+
+    // Read again while in the small queue, promote it
+    if (entry->freq > 0) {
+      shard->small_size -= entry->slab->class_size;
+      entry->main = true;
+      entry->freq = 0;
+      shard->main.push_back(entry);
+      continue;
+    }
+
+    shard->ghost.push_back(entry->block_id);
+    shard->ghost_ids.insert(entry->block_id);
+    // The ghost queue remembers about as many blocks as main holds
+    while (shard->ghost.size() > std::max((size_t)16, shard->main.size())) {
+      shard->ghost_ids.erase(shard->ghost.front());
+      shard->ghost.pop_front();
+    }
+
+    _remove(shard, entry);
+    _evictions++;
+    return true;
+  }
+
+  // Everything was promoted, so make room in main instead
+  return _evict_main(shard);
+}
+
+bool BlockCache::_evict_main(Shard* shard) {
+  while (!shard->main.empty()) {
+    Entry* entry = shard->main.front();
+    shard->main.pop_front();
+
+    // Clock: a block that has been read since the hand last passed gets another lap
+    if (entry->freq > 0) {
+      entry->freq--;
+      shard->main.push_back(entry);
+      continue;
+    }
+
+    _remove(shard, entry);
+    _evictions++;
+    return true;
+  }
+  return false;
+}
+
+uint8_t* BlockCache::_alloc_buffer(Shard* shard, size_t classSize, Slab** slab) {
+  std::vector<Slab*>& partial = shard->partial[classSize];
+  if (partial.empty()) {
+    Slab* fresh = new Slab();
+    fresh->class_size = classSize;
+    fresh->buffers = _get_slab_buffers(shard, classSize);
+    fresh->memory = new uint8_t[fresh->buffers * classSize];
+    for (size_t i = fresh->buffers; i > 0; i--) fresh->free.push_back(fresh->memory + (i - 1) * classSize);
+    shard->slabs.insert(fresh);
+    shard->memory += fresh->buffers * classSize;
+    partial.push_back(fresh);
+  }
+
+  *slab = partial.back();
+  uint8_t* buffer = (*slab)->free.back();
+  (*slab)->free.pop_back();
+  if ((*slab)->free.empty()) partial.pop_back();
+  return buffer;
+}
+
+void BlockCache::_free_buffer(Shard* shard, Slab* slab, uint8_t* buffer) {
+  std::vector<Slab*>& partial = shard->partial[slab->class_size];
+  slab->free.push_back(buffer);
+  if (slab->free.size() == 1) partial.push_back(slab);
+  if (slab->free.size() < slab->buffers) return;
+
+  // Return empty slabs to the system, keeping one per size class to avoid churn
+  if (partial.size() > 1) _delete_slab(shard, slab);
+}
+
+bool BlockCache::_release_empty_slab(Shard* shard) {
+  for (auto& pair : shard->partial) {
+    for (Slab* slab : pair.second) {
+      if (slab->free.size() < slab->buffers) continue;
+      _delete_slab(shard, slab);
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlockCache::_delete_slab(Shard* shard, Slab* slab) {
+  std::vector<Slab*>& partial = shard->partial[slab->class_size];
+  partial.erase(std::find(partial.begin(), partial.end(), slab));
+  shard->slabs.erase(slab);
+  shard->memory -= slab->buffers * slab->class_size;
+  delete[] slab->memory;
+  delete slab;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,136 @@
+//
+// Kapua BlockCache class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_BLOCK_CACHE_DEFAULT_SHARDS 16
+#define KAPUA_BLOCK_CACHE_MIN_CLASS 4096
+#define KAPUA_BLOCK_CACHE_SLAB_SIZE (1024 * 1024)
+#define KAPUA_BLOCK_CACHE_MAX_FREQ 3
+
+// A sharded, memory bounded cache of immutable blocks keyed by block ID, for readers in front of the block store.
+//
+// Each shard runs S3-FIFO: new blocks enter a small FIFO (10% of the shard), and only those read again before they
+// reach its head are promoted to the main FIFO, which evicts clock-style using a 2-bit access count. Blocks evicted
+// from the small FIFO leave their ID in a ghost FIFO, and a block readmitted while its ID is still there goes
+// straight to main. One-hit wonders from scans therefore never displace the working set.
+//
+// Block data lives in power-of-two size classes carved from slabs of up to 1MiB (a sixteenth of the shard for small
+// caches). The capacity bounds the memory held in slabs, free buffers included, so a shard fragmented over several
+// size classes evicts rather than growing past it. Concurrent misses on the same block are coalesced so only one load
+// goes to the store.
+class BlockCache {
+ public:
+  typedef std::function<bool(uint64_t blockId, std::vector<uint8_t>* data)> Loader;
+
+  BlockCache(Logger* logger, size_t capacity, size_t shards = KAPUA_BLOCK_CACHE_DEFAULT_SHARDS);
+  ~BlockCache();
+
+  // Read through the cache, calling loader on a miss. Only one loader runs per block at a time.
+  bool get(uint64_t blockId, std::vector<uint8_t>* data, const Loader& loader);
+  // Cache lookup only
+  bool get(uint64_t blockId, std::vector<uint8_t>* data);
+  void put(uint64_t blockId, const uint8_t* data, size_t len);
+  void invalidate(uint64_t blockId);
+
+  size_t get_capacity() { return _capacity; }
+  // Bytes of the size classes holding cached blocks
+  size_t get_size();
+  // Bytes held in slabs, never more than the capacity
+  size_t get_memory();
+  size_t get_count();
+
+  uint64_t get_hits() { return _hits; }
+  uint64_t get_misses() { return _misses; }
+  uint64_t get_evictions() { return _evictions; }
+  uint64_t get_coalesced() { return _coalesced; }
+
+  // The size class a block of len bytes is stored in, 0 if it is too large to cache
+  static size_t get_size_class(size_t len);
+
+ protected:
+  struct Slab {
+    uint8_t* memory;
+    size_t class_size;
+    size_t buffers;
+    std::vector<uint8_t*> free;
+  };
+
+  struct Entry {
+    uint64_t block_id;
+    Slab* slab;
+    uint8_t* data;
+    uint32_t length;
+    uint8_t freq;
+    bool main;
+  };
+
+  typedef std::shared_ptr<const std::vector<uint8_t>> BlockData;
+
+  struct Shard {
+    std::mutex mutex;
+    size_t capacity;
+    size_t small_capacity;
+    size_t slab_size;
+    size_t size;
+    size_t small_size;
+    size_t memory;
+
+    std::unordered_map<uint64_t, Entry*> entries;
+    std::deque<Entry*> small;
+    std::deque<Entry*> main;
+    std::deque<uint64_t> ghost;
+    std::unordered_set<uint64_t> ghost_ids;
+
+    // Slabs with at least one free buffer, per size class
+    std::unordered_map<size_t, std::vector<Slab*>> partial;
+    std::unordered_set<Slab*> slabs;
+
+    std::unordered_map<uint64_t, std::shared_future<BlockData>> inflight;
+  };
+
+  Logger* _logger;
+  size_t _capacity;
+  std::vector<std::unique_ptr<Shard>> _shards;
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+  std::atomic<uint64_t> _evictions;
+  std::atomic<uint64_t> _coalesced;
+
+  Shard* _get_shard(uint64_t blockId);
+  bool _lookup(Shard* shard, uint64_t blockId, std::vector<uint8_t>* data);
+  void _insert(Shard* shard, uint64_t blockId, const uint8_t* data, size_t len);
+  void _remove(Shard* shard, Entry* entry);
+  bool _make_room(Shard* shard, size_t classSize);
+  bool _evict(Shard* shard);
+  bool _evict_small(Shard* shard);
+  bool _evict_main(Shard* shard);
+
+  uint8_t* _alloc_buffer(Shard* shard, size_t classSize, Slab** slab);
+  void _free_buffer(Shard* shard, Slab* slab, uint8_t* buffer);
+  bool _release_empty_slab(Shard* shard);
+  void _delete_slab(Shard* shard, Slab* slab);
+  size_t _get_slab_buffers(Shard* shard, size_t classSize) { return std::max((size_t)1, shard->slab_size / classSize); }
+};
+
+}  // namespace Kapua
@@ -0,0 +1,326 @@
+//
+// Kapua BlockCipher class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "BlockCipher.hpp"
+
+#include <openssl/crypto.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <thread>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+namespace {
+
+const char KEY_SALT[] = "kapua-block-key-v1";
+
+// The largest chunk a Decryptor will buffer, so a forged header cannot make it allocate without bound
+const uint32_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+
+void store_le64(uint8_t* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+bool gcm_init(EVP_CIPHER_CTX* ctx, bool encrypt, const BlockKey& key, uint64_t blockId, const BlockCipherHeader& header, uint64_t index) {
+  uint8_t nonce[KAPUA_BLOCK_CIPHER_NONCE_SIZE];
+  std::memcpy(nonce, header.nonce, sizeof(nonce));
+  nonce[8] ^= (uint8_t)(index >> 24);
+  nonce[9] ^= (uint8_t)(index >> 16);
+  nonce[10] ^= (uint8_t)(index >> 8);
+  nonce[11] ^= (uint8_t)index;
+
+  if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr, encrypt ? 1 : 0) != 1) return false;
+  if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, sizeof(nonce), nullptr) != 1) return false;
+  if (EVP_CipherInit_ex(ctx, nullptr, nullptr, key.key, nonce, -1) != 1) return false;
+
+  // Bind the chunk to its header, block and position
+  uint8_t aad[sizeof(BlockCipherHeader) + 16];
+  std::memcpy(aad, &header, sizeof(header));
+  store_le64(aad + sizeof(header), blockId);
+  store_le64(aad + sizeof(header) + 8, index);
+  int len;
+  return EVP_CipherUpdate(ctx, nullptr, &len, aad, sizeof(aad)) == 1;
+}
+
+}  // namespace
+
+BlockCipher::BlockCipher(Logger* logger, unsigned threads, uint32_t chunkSize) {
+  _logger = new ScopedLogger("BlockCipher", logger);
+  _threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+  _chunk_size = chunkSize;
+}
+
+BlockCipher::~BlockCipher() { delete _logger; }
+
+bool BlockCipher::derive_key(const KeyPair* keys, uint64_t originatorId, BlockKey* key) {
+  if (!keys->privateKey) {
+    _logger->error("Cannot derive block key without a private key");
+    return false;
+  }
+
+  unsigned char* der = nullptr;
+  int derLen = i2d_PrivateKey(keys->privateKey, &der);
+  if (derLen <= 0) {
+    _logger->error("Cannot serialise private key");
+    return false;
+  }
+
+  uint8_t info[8];
+  store_le64(info, originatorId);
+  size_t keyLen = sizeof(key->key);
+
+  EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+  bool ok = ctx && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+            EVP_PKEY_CTX_set1_hkdf_salt(ctx, (const unsigned char*)KEY_SALT, sizeof(KEY_SALT) - 1) > 0 &&
+            EVP_PKEY_CTX_set1_hkdf_key(ctx, der, derLen) > 0 && EVP_PKEY_CTX_add1_hkdf_info(ctx, info, sizeof(info)) > 0 &&
+            EVP_PKEY_derive(ctx, key->key, &keyLen) > 0 && keyLen == sizeof(key->key);
+
+  if (ctx) EVP_PKEY_CTX_free(ctx);
+  OPENSSL_clear_free(der, derLen);
+
+  if (!ok) _logger->error("HKDF key derivation failed");
+  return ok;
+}
+
+size_t BlockCipher::get_chunk_count(uint64_t plaintextLen, uint32_t chunkSize) {
+  // An empty block still has one (empty) chunk, so it still carries a tag
+  return plaintextLen == 0 ? 1 : (size_t)((plaintextLen + chunkSize - 1) / chunkSize);
+}
+
+size_t BlockCipher::get_encrypted_size(size_t plaintextLen) const {
+  return sizeof(BlockCipherHeader) + plaintextLen + get_chunk_count(plaintextLen, _chunk_size) * KAPUA_BLOCK_CIPHER_TAG_SIZE;
+}
+
+bool BlockCipher::encrypt(const BlockKey& key, uint64_t blockId, const uint8_t* plaintext, size_t len, std::vector<uint8_t>* ciphertext) {
+  BlockCipherHeader header = {};
+  header.version = KAPUA_BLOCK_CIPHER_VERSION;
+  header.chunk_size = _chunk_size;
+  header.plaintext_length = len;
+  RAND_bytes(header.nonce, sizeof(header.nonce));
+
+  ciphertext->resize(get_encrypted_size(len));
+  std::memcpy(ciphertext->data(), &header, sizeof(header));
+  uint8_t* out = ciphertext->data() + sizeof(header);
+
+  size_t chunkSize = _chunk_size;
+  bool ok = _run_chunks(get_chunk_count(len, _chunk_size), [&](EVP_CIPHER_CTX* ctx, size_t i) {
+    size_t offset = i * chunkSize;
+    return seal_chunk(ctx, key, blockId, header, i, plaintext + offset, std::min(chunkSize, len - offset),
+                      out + i * (chunkSize + KAPUA_BLOCK_CIPHER_TAG_SIZE));
+  });
+
+  if (!ok) _logger->error("Block encryption failed");
+  return ok;
+}
+
+bool BlockCipher::decrypt(const BlockKey& key, uint64_t blockId, const uint8_t* ciphertext, size_t len, std::vector<uint8_t>* plaintext) {
+  BlockCipherHeader header;
+  if (len < sizeof(header)) return false;
+  std::memcpy(&header, ciphertext, sizeof(header));
+
+  if (header.version != KAPUA_BLOCK_CIPHER_VERSION || header.chunk_size == 0 || header.chunk_size > MAX_CHUNK_SIZE) {
+    _logger->warn("Unsupported block cipher header");
+    return false;
+  }
+
+  // The length comes from the block, so check it fits before doing sums with it that could wrap
+  size_t chunks = get_chunk_count(header.plaintext_length, header.chunk_size);
+  size_t tags = len - sizeof(header);
+  if (header.plaintext_length > tags || (tags -= header.plaintext_length) % KAPUA_BLOCK_CIPHER_TAG_SIZE != 0 ||
+      tags / KAPUA_BLOCK_CIPHER_TAG_SIZE != chunks) {
+    _logger->warn("Encrypted block has the wrong length");
+    return false;
+  }
+
+  plaintext->resize(header.plaintext_length);
+  const uint8_t* in = ciphertext + sizeof(header);
+  size_t chunkSize = header.chunk_size, plaintextLen = header.plaintext_length;
+
+  bool ok = _run_chunks(chunks, [&](EVP_CIPHER_CTX* ctx, size_t i) {
+    size_t offset = i * chunkSize;
+    return open_chunk(ctx, key, blockId, header, i, in + i * (chunkSize + KAPUA_BLOCK_CIPHER_TAG_SIZE), std::min(chunkSize, plaintextLen - offset),
+                      plaintext->data() + offset);
+  });
+
+  if (!ok) {
+    // Never hand back partially decrypted data
+    std::fill(plaintext->begin(), plaintext->end(), 0);
+    plaintext->clear();
+    _logger->warn("Block " + Util::to_hex64_str(blockId) + " failed authentication");
+  }
+  return ok;
+}
+
+bool BlockCipher::seal_chunk(EVP_CIPHER_CTX* ctx, const BlockKey& key, uint64_t blockId, const BlockCipherHeader& header, uint64_t index,
+                             const uint8_t* in, size_t len, uint8_t* out) {
+  int outLen;
+  if (!gcm_init(ctx, true, key, blockId, header, index)) return false;
+  if (len > 0 && EVP_CipherUpdate(ctx, out, &outLen, in, (int)len) != 1) return false;
+  if (EVP_CipherFinal_ex(ctx, out + len, &outLen) != 1) return false;
+  return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, KAPUA_BLOCK_CIPHER_TAG_SIZE, out + len) == 1;
+}
+
+bool BlockCipher::open_chunk(EVP_CIPHER_CTX* ctx, const BlockKey& key, uint64_t blockId, const BlockCipherHeader& header, uint64_t index,
+                             const uint8_t* in, size_t len, uint8_t* out) {
+  int outLen;
+  uint8_t tag[KAPUA_BLOCK_CIPHER_TAG_SIZE];
+  std::memcpy(tag, in + len, sizeof(tag));
+
+  if (!gcm_init(ctx, false, key, blockId, header, index)) return false;
+  if (len > 0 && EVP_CipherUpdate(ctx, out, &outLen, in, (int)len) != 1) return false;
+  if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, sizeof(tag), tag) != 1) return false;
+  return EVP_CipherFinal_ex(ctx, out + len, &outLen) == 1;
+}
+
+bool BlockCipher::_run_chunks(size_t chunks, const std::function<bool(EVP_CIPHER_CTX*, size_t)>& work) {
+  std::atomic<size_t> next(0);
+  std::atomic<bool> ok(true);
+
+  auto worker = [&] {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+      ok = false;
+      return;
+    }
+    for (size_t i = next++; i < chunks && ok; i = next++) {
+      if (!work(ctx, i)) ok = false;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+  };
+
+  // Small blocks are not worth a thread
+  size_t threads = std::min((size_t)_threads, chunks);
+  std::vector<std::future<void>> helpers;
+  for (size_t t = 1; t < threads; t++) helpers.push_back(std::async(std::launch::async, worker));
+  worker();
+  for (auto& helper : helpers) helper.get();
+
+  return ok;
+}
+
+BlockCipher::Encryptor::Encryptor(const BlockKey& key, uint64_t blockId, uint64_t plaintextLen, uint32_t chunkSize) {
+  _key = key;
+  _block_id = blockId;
+  std::memset(&_header, 0, sizeof(_header));
+  _header.version = KAPUA_BLOCK_CIPHER_VERSION;
+  _header.chunk_size = chunkSize;
+  _header.plaintext_length = plaintextLen;
+  RAND_bytes(_header.nonce, sizeof(_header.nonce));
+
+  _ctx = EVP_CIPHER_CTX_new();
+  _chunk_index = 0;
+  _consumed = 0;
+  _header_written = false;
+}
+
+BlockCipher::Encryptor::~Encryptor() {
+  OPENSSL_cleanse(&_key, sizeof(_key));
+  EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool BlockCipher::Encryptor::update(const uint8_t* plaintext, size_t len, std::vector<uint8_t>* out) {
+  if (!_ctx || _consumed + len > _header.plaintext_length) return false;
+
+  if (!_header_written) {
+    out->insert(out->end(), (const uint8_t*)&_header, (const uint8_t*)&_header + sizeof(_header));
+    _header_written = true;
+  }
+
+  _consumed += len;
+  _buffer.insert(_buffer.end(), plaintext, plaintext + len);
+
+  // Chunk boundaries are fixed by the chunk size, so a full chunk can be sealed as soon as it is buffered
+  size_t offset = 0;
+  while (_buffer.size() - offset >= _header.chunk_size) {
+    size_t start = out->size();
+    out->resize(start + _header.chunk_size + KAPUA_BLOCK_CIPHER_TAG_SIZE);
+    if (!seal_chunk(_ctx, _key, _block_id, _header, _chunk_index++, _buffer.data() + offset, _header.chunk_size, out->data() + start)) return false;
+    offset += _header.chunk_size;
+  }
+  _buffer.erase(_buffer.begin(), _buffer.begin() + offset);
+  return true;
+}
+
+bool BlockCipher::Encryptor::finish(std::vector<uint8_t>* out) {
+  if (_consumed != _header.plaintext_length) return false;
+  if (!_header_written && !update(nullptr, 0, out)) return false;
+
+  // The final partial chunk, or the single empty chunk of an empty block
+  if (_chunk_index < get_chunk_count(_header.plaintext_length, _header.chunk_size)) {
+    size_t start = out->size();
+    out->resize(start + _buffer.size() + KAPUA_BLOCK_CIPHER_TAG_SIZE);
+    if (!seal_chunk(_ctx, _key, _block_id, _header, _chunk_index++, _buffer.data(), _buffer.size(), out->data() + start)) return false;
+    _buffer.clear();
+  }
+  return true;
+}
+
+BlockCipher::Decryptor::Decryptor(const BlockKey& key, uint64_t blockId) {
+  _key = key;
+  _block_id = blockId;
+  std::memset(&_header, 0, sizeof(_header));
+  _ctx = EVP_CIPHER_CTX_new();
+  _chunk_index = 0;
+  _produced = 0;
+  _header_read = false;
+  _failed = !_ctx;
+}
+
+BlockCipher::Decryptor::~Decryptor() {
+  OPENSSL_cleanse(&_key, sizeof(_key));
+  EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool BlockCipher::Decryptor::update(const uint8_t* ciphertext, size_t len, std::vector<uint8_t>* out) {
+  if (_failed) return false;
+  _buffer.insert(_buffer.end(), ciphertext, ciphertext + len);
+
+  size_t offset = 0;
+  if (!_header_read) {
+    if (_buffer.size() < sizeof(_header)) return true;
+    std::memcpy(&_header, _buffer.data(), sizeof(_header));
+    if (_header.version != KAPUA_BLOCK_CIPHER_VERSION || _header.chunk_size == 0 || _header.chunk_size > MAX_CHUNK_SIZE) {
+      _failed = true;
+      return false;
+    }
+    _header_read = true;
+    offset = sizeof(_header);
+  }
+
+  size_t chunks = get_chunk_count(_header.plaintext_length, _header.chunk_size);
+  while (_chunk_index < chunks) {
+    size_t plainLen = std::min((uint64_t)_header.chunk_size, _header.plaintext_length - _produced);
+    if (_buffer.size() - offset < plainLen + KAPUA_BLOCK_CIPHER_TAG_SIZE) break;
+
+    size_t start = out->size();
+    out->resize(start + plainLen);
+    if (!open_chunk(_ctx, _key, _block_id, _header, _chunk_index, _buffer.data() + offset, plainLen, out->data() + start)) {
+      out->resize(start);
+      _failed = true;
+      return false;
+    }
+    _chunk_index++;
+    _produced += plainLen;
+    offset += plainLen + KAPUA_BLOCK_CIPHER_TAG_SIZE;
+  }
+  _buffer.erase(_buffer.begin(), _buffer.begin() + offset);
+  return true;
+}
+
+bool BlockCipher::Decryptor::finish() {
+  // Every chunk must have been seen and authenticated, and nothing may follow the last one
+  return !_failed && _header_read && _chunk_index == get_chunk_count(_header.plaintext_length, _header.chunk_size) && _buffer.empty();
+}
+
+}  // namespace Kapua
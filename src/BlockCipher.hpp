@@ -0,0 +1,115 @@
+//
+// Kapua BlockCipher class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Logger.hpp"
+#include "RSA.hpp"
+
+namespace Kapua {
+
+#define KAPUA_BLOCK_CIPHER_VERSION 1
+#define KAPUA_BLOCK_CIPHER_CHUNK_SIZE (256 * 1024)
+#define KAPUA_BLOCK_CIPHER_NONCE_SIZE 12
+#define KAPUA_BLOCK_CIPHER_TAG_SIZE 16
+
+struct BlockKey {
+  uint8_t key[32];  // 256-bit AES-GCM key
+};
+
+#pragma pack(push, 1)
+struct BlockCipherHeader {
+  uint8_t version;
+  uint8_t reserved[3];
+  uint32_t chunk_size;
+  uint64_t plaintext_length;
+  uint8_t nonce[KAPUA_BLOCK_CIPHER_NONCE_SIZE];  // Base nonce, the chunk index is mixed into the last 4 bytes
+};
+#pragma pack(pop)
+
+// Encrypts and authenticates blocks with AES-256-GCM. A block is split into fixed size chunks, each sealed
+// independently with its own nonce and tag, and bound to the block ID, its index and the header so chunks cannot be
+// reordered, swapped between blocks or truncated. Independent chunks let large blocks be encrypted on several cores,
+// and let the streaming Encryptor/Decryptor produce exactly the same format a chunk at a time.
+//
+// Layout: BlockCipherHeader, then per chunk [ciphertext][tag].
+class BlockCipher {
+ public:
+  BlockCipher(Logger* logger, unsigned threads = 0, uint32_t chunkSize = KAPUA_BLOCK_CIPHER_CHUNK_SIZE);
+  ~BlockCipher();
+
+  // Derive the key for blocks from an originator, with HKDF-SHA256 keyed by the node private key
+  bool derive_key(const KeyPair* keys, uint64_t originatorId, BlockKey* key);
+
+  size_t get_encrypted_size(size_t plaintextLen) const;
+  static size_t get_chunk_count(uint64_t plaintextLen, uint32_t chunkSize);
+
+  bool encrypt(const BlockKey& key, uint64_t blockId, const uint8_t* plaintext, size_t len, std::vector<uint8_t>* ciphertext);
+  bool decrypt(const BlockKey& key, uint64_t blockId, const uint8_t* ciphertext, size_t len, std::vector<uint8_t>* plaintext);
+
+  class Encryptor {
+   public:
+    Encryptor(const BlockKey& key, uint64_t blockId, uint64_t plaintextLen, uint32_t chunkSize = KAPUA_BLOCK_CIPHER_CHUNK_SIZE);
+    ~Encryptor();
+
+    // Appends the header on the first call, then each chunk as soon as it is complete
+    bool update(const uint8_t* plaintext, size_t len, std::vector<uint8_t>* out);
+    bool finish(std::vector<uint8_t>* out);
+
+   protected:
+    BlockKey _key;
+    uint64_t _block_id;
+    BlockCipherHeader _header;
+    EVP_CIPHER_CTX* _ctx;
+    std::vector<uint8_t> _buffer;
+    uint64_t _chunk_index;
+    uint64_t _consumed;
+    bool _header_written;
+  };
+
+  class Decryptor {
+   public:
+    Decryptor(const BlockKey& key, uint64_t blockId);
+    ~Decryptor();
+
+    // Only authenticated plaintext is ever appended to out
+    bool update(const uint8_t* ciphertext, size_t len, std::vector<uint8_t>* out);
+    // Every chunk is appended by update as soon as it is authenticated, so this only checks the block was complete
+    bool finish();
+
+   protected:
+    BlockKey _key;
+    uint64_t _block_id;
+    BlockCipherHeader _header;
+    EVP_CIPHER_CTX* _ctx;
+    std::vector<uint8_t> _buffer;
+    uint64_t _chunk_index;
+    uint64_t _produced;
+    bool _header_read;
+    bool _failed;
+  };
+
+  static bool seal_chunk(EVP_CIPHER_CTX* ctx, const BlockKey& key, uint64_t blockId, const BlockCipherHeader& header, uint64_t index,
+                         const uint8_t* in, size_t len, uint8_t* out);
+  static bool open_chunk(EVP_CIPHER_CTX* ctx, const BlockKey& key, uint64_t blockId, const BlockCipherHeader& header, uint64_t index,
+                         const uint8_t* in, size_t len, uint8_t* out);
+
+ protected:
+  Logger* _logger;
+  unsigned _threads;
+  uint32_t _chunk_size;
+
+  // Run work(ctx, index) for every chunk, spread over the worker threads
+  bool _run_chunks(size_t chunks, const std::function<bool(EVP_CIPHER_CTX*, size_t)>& work);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,36 @@
+//
+// Kapua BlockTransport interface
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Kapua {
+
+// Moves block payloads to and from a given node. DistributedBlockStore decides where blocks live, implementations of
+// this interface decide how they get there.
+class BlockTransport {
+ public:
+  virtual ~BlockTransport() {}
+  virtual bool put_block(uint64_t nodeId, uint64_t blockId, const uint8_t* data, size_t len) = 0;
+  virtual bool get_block(uint64_t nodeId, uint64_t blockId, std::vector<uint8_t>* data) = 0;
+  // Returns false if the node did not hold the block
+  virtual bool remove_block(uint64_t nodeId, uint64_t blockId) = 0;
+
+  // Cheap existence check, so content addressed writes can skip sending blocks a node already holds. Transports
+  // that cannot answer without fetching the block should return false.
+  virtual bool has_block(uint64_t, uint64_t) { return false; }
+
+  // Store several blocks on one node, setting stored[i] for each that succeeded. Transports that can send a batch in
+  // one round trip should override this.
+  virtual void put_blocks(uint64_t nodeId, const uint64_t* blockIds, const uint8_t* const* data, const size_t* lens, size_t count, bool* stored) {
+    for (size_t i = 0; i < count; i++) stored[i] = put_block(nodeId, blockIds[i], data[i], lens[i]);
+  }
+};
+
+}  // namespace Kapua
@@ -0,0 +1,134 @@
+//
+// Kapua Compactor class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "Compactor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <vector>
+
+namespace Kapua {
+
+Compactor::Compactor(Logger* logger, LocalBlockStore* store, CompactorOptions options)
+    : _segments_compacted(0), _bytes_copied(0), _bytes_reclaimed(0), _throttled_us(0) {
+  _logger = new ScopedLogger("Compactor", logger);
+  _store = store;
+  _options = options;
+  _running = false;
+  _stopping = false;
+  _backoff_us = 0;
+}
+
+Compactor::~Compactor() {
+  if (_running) stop();
+  delete _logger;
+}
+
+bool Compactor::start() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_running) {
+    _logger->warn("start called, but thread already running");
+    return false;
+  }
+  _running = true;
+  _stopping = false;
+  _thread = std::thread(&Compactor::_main_loop, this);
+  return true;
+}
+
+bool Compactor::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_running) {
+      _logger->warn("stop called, but thread not running");
+      return false;
+    }
+    _stopping = true;
+  }
+  _wake.notify_all();
+  _thread.join();
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _running = false;
+  return true;
+}
+
+bool Compactor::compact_once() {
+  std::vector<SegmentStats> stats;
+  _store->get_segment_stats(&stats);
+
+  int64_t now = time(nullptr);
+  const SegmentStats* victim = nullptr;
+  double best = 0;
+  for (const SegmentStats& segment : stats) {
+    if (segment.active || (segment.size && (double)segment.live_bytes / segment.size > _options.max_utilization)) continue;
+    // Add a second so segments sealed this instant still rank by how dead they are
+    double score = get_score(segment.live_bytes, segment.size, (double)std::max<int64_t>(now - segment.modified, 0) + 1);
+    if (!victim || score > best) {
+      victim = &segment;
+      best = score;
+    }
+  }
+  if (!victim) return false;
+
+  uint64_t copied = 0, reclaimed = 0;
+  if (!_store->compact_segment(victim->id, _options.batch_bytes, [this](size_t bytes) { _pace(bytes); }, &copied, &reclaimed)) {
+    _logger->warn("Compacting segment " + std::to_string(victim->id) + " failed");
+    return false;
+  }
+
+  _segments_compacted++;
+  _bytes_copied += copied;
+  _bytes_reclaimed += reclaimed;
+  return true;
+}
+
+double Compactor::get_write_amplification() {
+  uint64_t written = _store->get_written_bytes();
+  if (written == 0) return 1.0;
+  return (double)(written + _store->get_compaction_written_bytes()) / written;
+}
+
+double Compactor::get_score(uint64_t liveBytes, uint64_t size, double ageSeconds) {
+  if (size == 0) return ageSeconds;
+  double u = std::min((double)liveBytes / size, 1.0);
+  return (1.0 - u) * ageSeconds / (1.0 + u);
+}
+
+void Compactor::_main_loop() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_stopping) {
+    lock.unlock();
+    // Work through every qualifying segment, then wait for more to accumulate
+    while (compact_once()) {
+      std::lock_guard<std::mutex> check(_mutex);
+      if (_stopping) break;
+    }
+    lock.lock();
+    _wake.wait_for(lock, std::chrono::milliseconds(_options.interval_ms), [this] { return _stopping; });
+  }
+}
+
+void Compactor::_pace(size_t bytes) {
+  // Hold to the byte rate
+  uint64_t pauseUs = _options.max_bytes_per_second ? bytes * 1000000 / _options.max_bytes_per_second : 0;
+
+  // And back off further while foreground writes are suffering
+  if (_store->get_put_latency_us() > _options.target_latency_us) {
+    _backoff_us = std::min<uint32_t>(std::max<uint32_t>(_backoff_us * 2, 1000), 1000000);
+  } else {
+    _backoff_us /= 2;
+  }
+  pauseUs += _backoff_us;
+  if (!pauseUs) return;
+
+  _throttled_us += pauseUs;
+  std::unique_lock<std::mutex> lock(_mutex);
+  _wake.wait_for(lock, std::chrono::microseconds(pauseUs), [this] { return _stopping; });
+}
+
+}  // namespace Kapua
@@ -0,0 +1,76 @@
+//
+// Kapua Compactor class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "LocalBlockStore.hpp"
+#include "Logger.hpp"
+
+namespace Kapua {
+
+struct CompactorOptions {
+  double max_utilization = 0.8;                      // Segments fuller than this are left alone
+  size_t batch_bytes = 4 * 1024 * 1024;              // Bytes read and written per step
+  uint64_t max_bytes_per_second = 64 * 1024 * 1024;  // Copy rate ceiling
+  uint32_t target_latency_us = 2000;                 // Back off while foreground puts are slower than this
+  int32_t interval_ms = 10 * 1000;                   // Between checks for work
+};
+
+// Reclaims the dead space left in a LocalBlockStore's segments by removed and overwritten blocks. Victims are chosen
+// by the LFS cost-benefit policy: a segment's score is (1 - u) * age / (1 + u), where u is the fraction of it still
+// live. Reclaiming a mostly dead segment is cheap and a cold one will not soon die further by itself, so both score
+// highly. Live records are copied with large sequential reads and batched writes.
+//
+// Copying is throttled twice over: to a fixed byte rate, and by backing off while the store's foreground put latency
+// is above target, doubling the pause between batches each time it is and halving it each time it is not.
+class Compactor {
+ public:
+  Compactor(Logger* logger, LocalBlockStore* store, CompactorOptions options = CompactorOptions());
+  ~Compactor();
+
+  bool start();
+  bool stop();
+
+  // Compact the best scoring segment, if any qualifies. Returns false when there was nothing to do.
+  bool compact_once();
+
+  uint64_t get_segments_compacted() { return _segments_compacted; }
+  uint64_t get_bytes_copied() { return _bytes_copied; }
+  uint64_t get_bytes_reclaimed() { return _bytes_reclaimed; }
+  uint64_t get_throttled_us() { return _throttled_us; }
+  double get_write_amplification();
+
+  static double get_score(uint64_t liveBytes, uint64_t size, double ageSeconds);
+
+ protected:
+  Logger* _logger;
+  LocalBlockStore* _store;
+  CompactorOptions _options;
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _running;
+  bool _stopping;
+  std::thread _thread;
+
+  uint32_t _backoff_us;
+
+  std::atomic<uint64_t> _segments_compacted;
+  std::atomic<uint64_t> _bytes_copied;
+  std::atomic<uint64_t> _bytes_reclaimed;
+  std::atomic<uint64_t> _throttled_us;
+
+  void _main_loop();
+  void _pace(size_t bytes);
+};
+
+}  // namespace Kapua
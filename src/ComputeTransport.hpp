@@ -0,0 +1,62 @@
+//
+// Kapua ComputeTransport interface
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "TaskScheduler.hpp"
+
+namespace Kapua {
+
+// Carries compute tasks to a given node. TaskScheduler decides where a task runs, implementations of this interface
+// decide how it gets there.
+class ComputeTransport {
+ public:
+  virtual ~ComputeTransport() {}
+  // Returns false if the node could not be asked to run the task, otherwise done is called when it ends
+  virtual bool compute_run(uint64_t nodeId, const ComputeTask& task, ComputeCallback done) = 0;
+};
+
+// Delivers tasks directly to TaskSchedulers in this process, for single node use and in-process clusters
+class LoopbackComputeTransport : public ComputeTransport {
+ public:
+  void add_node(uint64_t nodeId, TaskScheduler* scheduler) {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    _nodes[nodeId] = {scheduler, false};
+  }
+
+  void set_node_down(uint64_t nodeId, bool down) {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _nodes.find(nodeId);
+    if (it != _nodes.end()) it->second.down = down;
+  }
+
+  bool compute_run(uint64_t nodeId, const ComputeTask& task, ComputeCallback done) override {
+    TaskScheduler* scheduler = _find(nodeId);
+    return scheduler && scheduler->run_local(task, done);
+  }
+
+ protected:
+  struct Node {
+    TaskScheduler* scheduler;
+    bool down;
+  };
+
+  std::unordered_map<uint64_t, Node> _nodes;
+  std::shared_timed_mutex _mutex;
+
+  TaskScheduler* _find(uint64_t nodeId) {
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _nodes.find(nodeId);
+    return it == _nodes.end() || it->second.down ? nullptr : it->second.scheduler;
+  }
+};
+
+}  // namespace Kapua
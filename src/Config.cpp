@@ -20,6 +20,43 @@ Config::Config(Logger* logger) {
   server_ip4_sockaddr.sin_family = AF_INET;
   inet_pton(AF_INET, "0.0.0.0", &server_ip4_sockaddr.sin_addr);
   server_ip4_sockaddr.sin_port = htons(KAPUA_DEFAULT_PORT);
+  server_ping_interval_ms = 16 * 1000;
+  server_node_timeout_ms = 60 * 1000;
+  server_transport = "socket";
+  server_xdp_interface = "";
+
+  trackers_enable = false;
+  trackers_cache_file = "trackers.cache";
+
+  storage_capacity = 1024ULL * 1024 * 1024;
+  storage_virtual_nodes = 64;
+  storage_anti_entropy_interval_ms = 60 * 1000;
+  storage_directory = "";
+
+  memcached_enable = false;
+  memcached_ip4_sockaddr.sin_family = AF_INET;
+  inet_pton(AF_INET, "0.0.0.0", &memcached_ip4_sockaddr.sin_addr);
+  memcached_ip4_sockaddr.sin_port = htons(11211);
+  memcached_extensions = false;
+  memcached_connection_limit = 20;
+  memcached_inactivity_timeout_ms = 30 * 1000;
+
+  dns_enable = false;
+  dns_ip4_sockaddr.sin_family = AF_INET;
+  inet_pton(AF_INET, "0.0.0.0", &dns_ip4_sockaddr.sin_addr);
+  dns_ip4_sockaddr.sin_port = htons(53);
+  dns_cache_size = 16 * 1024 * 1024;
+
+  compute_threads = 0;
+
+  // Metrics are only served locally unless configured otherwise
+  metrics_enable = false;
+  metrics_ip4_sockaddr.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &metrics_ip4_sockaddr.sin_addr);
+  metrics_ip4_sockaddr.sin_port = htons(9464);
+
+  tracing_sample_every = 0;
+  tracing_capture_duration_ms = 10 * 1000;
 }
 
 Config::~Config() { delete _logger; }
@@ -44,12 +81,20 @@ bool Config::load_yaml(std::string filename) {
 
     if (config["logging"]["disable_splash"])
       ok &= parse_bool(source, "logging.disable_splash", config["logging"]["disable_splash"].as<std::string>(), &logging_disable_splash);
+    if (config["logging"]["events_file"]) logging_events_file = config["logging"]["events_file"].as<std::string>();
 
     // server.*
     if (config["server"]["id"]) ok &= parse_hex_uint64(source, "server.id", config["server"]["id"].as<std::string>(), &server_id);
     if (config["server"]["ip4_address"])
       ok &= parse_ipv4(source, "server.ip4_address", config["server"]["ip4_address"].as<std::string>(), &server_ip4_sockaddr.sin_addr);
     if (config["server"]["port"]) ok &= parse_port(source, "server.port", config["server"]["port"].as<std::string>(), &server_ip4_sockaddr.sin_port);
+    if (config["server"]["ping_interval"])
+      ok &= parse_duration(source, "server.ping_interval", config["server"]["ping_interval"].as<std::string>(), false, &server_ping_interval_ms);
+    if (config["server"]["node_timeout"])
+      ok &= parse_duration(source, "server.node_timeout", config["server"]["node_timeout"].as<std::string>(), false, &server_node_timeout_ms);
+    if (config["server"]["transport"])
+      ok &= parse_transport(source, "server.transport", config["server"]["transport"].as<std::string>(), &server_transport);
+    if (config["server"]["xdp_interface"]) server_xdp_interface = config["server"]["xdp_interface"].as<std::string>();
 
     // local_discovery.*
     if (config["local_discovery"]["enable"])
@@ -57,9 +102,63 @@ bool Config::load_yaml(std::string filename) {
     if (config["local_discovery"]["interval"])
       ok &= parse_duration(source, "local_discovery.interval", config["local_discovery"]["interval"].as<std::string>(), false, &local_discovery_interval_ms);
 
-    // memcache
-    if (config["memcache"]["enable"]) ok &= parse_bool(source, "memcache.enable", config["memcache"]["enable"].as<std::string>(), &memcached_enable);
-    if (config["memcache"]["port"]) ok &= parse_port(source, "memcache.port", config["memcache"]["port"].as<std::string>(), &memcached_ip4_sockaddr.sin_port);
+    // trackers.*
+    if (config["trackers"]["enable"]) ok &= parse_bool(source, "trackers.enable", config["trackers"]["enable"].as<std::string>(), &trackers_enable);
+    if (config["trackers"]["servers"]) {
+      if (config["trackers"]["servers"].Type() != YAML::NodeType::Sequence) {
+        _logger->error("(" + source + ") trackers.servers - invalid format - must be a list");
+        ok = false;
+      } else {
+        trackers_servers.clear();
+        for (const YAML::Node& server : config["trackers"]["servers"]) trackers_servers.push_back(server.as<std::string>());
+      }
+    }
+    if (config["trackers"]["cache_file"]) trackers_cache_file = config["trackers"]["cache_file"].as<std::string>();
+
+    // storage.*
+    if (config["storage"]["capacity"]) ok &= parse_size(source, "storage.capacity", config["storage"]["capacity"].as<std::string>(), &storage_capacity);
+    if (config["storage"]["virtual_nodes"])
+      ok &= parse_uint16(source, "storage.virtual_nodes", config["storage"]["virtual_nodes"].as<std::string>(), &storage_virtual_nodes);
+    if (config["storage"]["anti_entropy_interval"])
+      ok &= parse_duration(source, "storage.anti_entropy_interval", config["storage"]["anti_entropy_interval"].as<std::string>(), false,
+                           &storage_anti_entropy_interval_ms);
+    if (config["storage"]["directory"]) storage_directory = config["storage"]["directory"].as<std::string>();
+
+    // memcached
+    if (config["memcached"]["enable"]) ok &= parse_bool(source, "memcached.enable", config["memcached"]["enable"].as<std::string>(), &memcached_enable);
+    if (config["memcached"]["ip4_address"])
+      ok &= parse_ipv4(source, "memcached.ip4_address", config["memcached"]["ip4_address"].as<std::string>(), &memcached_ip4_sockaddr.sin_addr);
+    if (config["memcached"]["port"])
+      ok &= parse_port(source, "memcached.port", config["memcached"]["port"].as<std::string>(), &memcached_ip4_sockaddr.sin_port);
+    if (config["memcached"]["extensions"])
+      ok &= parse_bool(source, "memcached.extensions", config["memcached"]["extensions"].as<std::string>(), &memcached_extensions);
+    if (config["memcached"]["connection_limit"])
+      ok &= parse_uint16(source, "memcached.connection_limit", config["memcached"]["connection_limit"].as<std::string>(), &memcached_connection_limit);
+    if (config["memcached"]["inactivity_timeout"])
+      ok &= parse_duration(source, "memcached.inactivity_timeout", config["memcached"]["inactivity_timeout"].as<std::string>(), false,
+                           &memcached_inactivity_timeout_ms);
+
+    // dns
+    if (config["dns"]["enable"]) ok &= parse_bool(source, "dns.enable", config["dns"]["enable"].as<std::string>(), &dns_enable);
+    if (config["dns"]["ip4_address"]) ok &= parse_ipv4(source, "dns.ip4_address", config["dns"]["ip4_address"].as<std::string>(), &dns_ip4_sockaddr.sin_addr);
+    if (config["dns"]["port"]) ok &= parse_port(source, "dns.port", config["dns"]["port"].as<std::string>(), &dns_ip4_sockaddr.sin_port);
+    if (config["dns"]["cache_size"]) ok &= parse_size(source, "dns.cache_size", config["dns"]["cache_size"].as<std::string>(), &dns_cache_size);
+
+    // compute
+    if (config["compute"]["threads"]) ok &= parse_uint16(source, "compute.threads", config["compute"]["threads"].as<std::string>(), &compute_threads);
+
+    // metrics
+    if (config["metrics"]["enable"]) ok &= parse_bool(source, "metrics.enable", config["metrics"]["enable"].as<std::string>(), &metrics_enable);
+    if (config["metrics"]["ip4_address"])
+      ok &= parse_ipv4(source, "metrics.ip4_address", config["metrics"]["ip4_address"].as<std::string>(), &metrics_ip4_sockaddr.sin_addr);
+    if (config["metrics"]["port"]) ok &= parse_port(source, "metrics.port", config["metrics"]["port"].as<std::string>(), &metrics_ip4_sockaddr.sin_port);
+
+    // tracing
+    if (config["tracing"]["sample_every"])
+      ok &= parse_uint16(source, "tracing.sample_every", config["tracing"]["sample_every"].as<std::string>(), &tracing_sample_every);
+    if (config["tracing"]["capture_file"]) tracing_capture_file = config["tracing"]["capture_file"].as<std::string>();
+    if (config["tracing"]["capture_duration"])
+      ok &= parse_duration(source, "tracing.capture_duration", config["tracing"]["capture_duration"].as<std::string>(), false, &tracing_capture_duration_ms);
 
     if (!ok) {
       _logger->error(std::string("Errors while parsing parsing configuration YAML"));
@@ -95,9 +194,32 @@ bool Config::load_cmd_line(int ac, char** av) {
       ("server.id", po::value<std::string>(), "server id, 64-bit hex [0x123456789abcdef0]")
       ("server.ip4_address", po::value<std::string>(), "server ipv4 address [x.x.x.x]")
       ("server.port", po::value<uint16_t>(), "server ipv4 port [0-65535]")
+      ("server.ping_interval", po::value<std::string>(), "interval between pings to connected nodes [1h2m3s]")
+      ("server.node_timeout", po::value<std::string>(), "time after which a silent connected node is forgotten [1h2m3s]")
+      ("server.transport", po::value<std::string>(), "how datagrams are sent and received [socket,io_uring,xdp]")
+      ("server.xdp_interface", po::value<std::string>(), "interface to receive from with the xdp transport [eth0]")
       ("local_discovery.enable", po::value<std::string>(), "enable UDP local discovery [true,false]")
+      ("trackers.enable", po::value<std::string>(), "enable peer lookup through trackers [true,false]")
+      ("storage.capacity", po::value<std::string>(), "storage capacity donated to the block store [512M,1G,2T]")
+      ("storage.anti_entropy_interval", po::value<std::string>(), "interval between replica comparisons with a peer [1h2m3s]")
+      ("storage.directory", po::value<std::string>(), "directory holding the blocks stored on this node, empty for none")
+      ("memcached.enable", po::value<std::string>(), "enable the memcached server [true,false]")
+      ("memcached.ip4_address", po::value<std::string>(), "memcached server ipv4 address [x.x.x.x]")
+      ("memcached.port", po::value<std::string>(), "memcached server port [0-65535]")
+      ("dns.enable", po::value<std::string>(), "enable the DNS server [true,false]")
+      ("dns.ip4_address", po::value<std::string>(), "DNS server ipv4 address [x.x.x.x]")
+      ("dns.port", po::value<std::string>(), "DNS server port [0-65535]")
+      ("dns.cache_size", po::value<std::string>(), "memory used to cache DNS answers [16M,1G]")
+      ("compute.threads", po::value<std::string>(), "compute worker threads, 0 for one per core [0-65535]")
+      ("metrics.enable", po::value<std::string>(), "enable the Prometheus metrics endpoint [true,false]")
+      ("metrics.ip4_address", po::value<std::string>(), "metrics endpoint ipv4 address [x.x.x.x]")
+      ("metrics.port", po::value<std::string>(), "metrics endpoint port [0-65535]")
+      ("tracing.sample_every", po::value<std::string>(), "trace one packet in this many, 0 for none [0-65535]")
+      ("tracing.capture_file", po::value<std::string>(), "write a Chrome trace of sampled packets to this file, empty for none")
+      ("tracing.capture_duration", po::value<std::string>(), "how long to capture packet traces for [1h2m3s]")
       ("logging.level", po::value<std::string>(), "set the logging level [debug,info,warn,error]")
-      ("logging.disable_splash", po::value<std::string>(), "disable the log header splash");
+      ("logging.disable_splash", po::value<std::string>(), "disable the log header splash")
+      ("logging.events_file", po::value<std::string>(), "record binary events to this file, empty for none");
 
     // clang-format on
 
@@ -118,12 +240,19 @@ bool Config::load_cmd_line(int ac, char** av) {
     if (ok) _logger->set_log_level(logging_level);
     if (vm.count("logging.disable_splash"))
       ok &= parse_bool(source, "logging.disable_splash", vm["logging.disable_splash"].as<std::string>(), &logging_disable_splash);
+    if (vm.count("logging.events_file")) logging_events_file = vm["logging.events_file"].as<std::string>();
 
     // server_ip4_sockaddr
     if (vm.count("server.id")) ok &= parse_hex_uint64(source, "server.id", vm["server.id"].as<std::string>(), &server_id);
     if (vm.count("server.ip4_address"))
       ok &= parse_ipv4(source, "server.ip4_address", vm["server.ip4_address"].as<std::string>(), &server_ip4_sockaddr.sin_addr);
     if (vm.count("server.port")) ok &= parse_port(source, "server.port", vm["server.port"].as<std::string>(), &server_ip4_sockaddr.sin_port);
+    if (vm.count("server.ping_interval"))
+      ok &= parse_duration(source, "server.ping_interval", vm["server.ping_interval"].as<std::string>(), false, &server_ping_interval_ms);
+    if (vm.count("server.node_timeout"))
+      ok &= parse_duration(source, "server.node_timeout", vm["server.node_timeout"].as<std::string>(), false, &server_node_timeout_ms);
+    if (vm.count("server.transport")) ok &= parse_transport(source, "server.transport", vm["server.transport"].as<std::string>(), &server_transport);
+    if (vm.count("server.xdp_interface")) server_xdp_interface = vm["server.xdp_interface"].as<std::string>();
 
     // local_discovery
     if (vm.count("local_discovery.enable"))
@@ -131,11 +260,41 @@ bool Config::load_cmd_line(int ac, char** av) {
     if (vm.count("local_discovery.interval"))
       ok &= parse_duration(source, "local_discovery.interval", vm["local_discovery.interval"].as<std::string>(), false, &local_discovery_interval_ms);
 
-    // memcache
-    if (vm.count("memcache.enable")) ok &= parse_bool(source, "memcache.enable", vm["memcache.enable"].as<std::string>(), &memcached_enable);
-    if (vm.count("memcache.ip4_address"))
-      ok &= parse_ipv4(source, "memcache.ip4_address", vm["memcache.ip4_address"].as<std::string>(), &memcached_ip4_sockaddr.sin_addr);
-    if (vm.count("memcache.port")) ok &= parse_port(source, "memcache.port", vm["memcache.port"].as<std::string>(), &memcached_ip4_sockaddr.sin_port);
+    // trackers
+    if (vm.count("trackers.enable")) ok &= parse_bool(source, "trackers.enable", vm["trackers.enable"].as<std::string>(), &trackers_enable);
+
+    // storage
+    if (vm.count("storage.capacity")) ok &= parse_size(source, "storage.capacity", vm["storage.capacity"].as<std::string>(), &storage_capacity);
+    if (vm.count("storage.anti_entropy_interval"))
+      ok &= parse_duration(source, "storage.anti_entropy_interval", vm["storage.anti_entropy_interval"].as<std::string>(), false,
+                           &storage_anti_entropy_interval_ms);
+    if (vm.count("storage.directory")) storage_directory = vm["storage.directory"].as<std::string>();
+
+    // memcached
+    if (vm.count("memcached.enable")) ok &= parse_bool(source, "memcached.enable", vm["memcached.enable"].as<std::string>(), &memcached_enable);
+    if (vm.count("memcached.ip4_address"))
+      ok &= parse_ipv4(source, "memcached.ip4_address", vm["memcached.ip4_address"].as<std::string>(), &memcached_ip4_sockaddr.sin_addr);
+    if (vm.count("memcached.port")) ok &= parse_port(source, "memcached.port", vm["memcached.port"].as<std::string>(), &memcached_ip4_sockaddr.sin_port);
+
+    // dns
+    if (vm.count("dns.enable")) ok &= parse_bool(source, "dns.enable", vm["dns.enable"].as<std::string>(), &dns_enable);
+    if (vm.count("dns.ip4_address")) ok &= parse_ipv4(source, "dns.ip4_address", vm["dns.ip4_address"].as<std::string>(), &dns_ip4_sockaddr.sin_addr);
+    if (vm.count("dns.port")) ok &= parse_port(source, "dns.port", vm["dns.port"].as<std::string>(), &dns_ip4_sockaddr.sin_port);
+    if (vm.count("dns.cache_size")) ok &= parse_size(source, "dns.cache_size", vm["dns.cache_size"].as<std::string>(), &dns_cache_size);
+    if (vm.count("compute.threads")) ok &= parse_uint16(source, "compute.threads", vm["compute.threads"].as<std::string>(), &compute_threads);
+
+    // metrics
+    if (vm.count("metrics.enable")) ok &= parse_bool(source, "metrics.enable", vm["metrics.enable"].as<std::string>(), &metrics_enable);
+    if (vm.count("metrics.ip4_address"))
+      ok &= parse_ipv4(source, "metrics.ip4_address", vm["metrics.ip4_address"].as<std::string>(), &metrics_ip4_sockaddr.sin_addr);
+    if (vm.count("metrics.port")) ok &= parse_port(source, "metrics.port", vm["metrics.port"].as<std::string>(), &metrics_ip4_sockaddr.sin_port);
+
+    // tracing
+    if (vm.count("tracing.sample_every"))
+      ok &= parse_uint16(source, "tracing.sample_every", vm["tracing.sample_every"].as<std::string>(), &tracing_sample_every);
+    if (vm.count("tracing.capture_file")) tracing_capture_file = vm["tracing.capture_file"].as<std::string>();
+    if (vm.count("tracing.capture_duration"))
+      ok &= parse_duration(source, "tracing.capture_duration", vm["tracing.capture_duration"].as<std::string>(), false, &tracing_capture_duration_ms);
 
     if (!ok) {
       _logger->error(std::string("Errors while parsing command line options"));
@@ -314,6 +473,48 @@ bool Config::parse_uint16(const std::string& source, const std::string& name, co
   return true;
 }
 
+bool Config::parse_size(const std::string& source, const std::string& name, const std::string& input, uint64_t* bytes) {
+  std::string sizeInput = input;
+  boost::algorithm::to_upper(sizeInput);
+
+  // Accept an optional trailing B, as in "1GB"
+  if (sizeInput.size() > 1 && sizeInput.back() == 'B') sizeInput.pop_back();
+
+  uint64_t multiplier = 1;
+  if (!sizeInput.empty()) {
+    switch (sizeInput.back()) {
+      case 'K':
+        multiplier = 1024ULL;
+        break;
+      case 'M':
+        multiplier = 1024ULL * 1024;
+        break;
+      case 'G':
+        multiplier = 1024ULL * 1024 * 1024;
+        break;
+      case 'T':
+        multiplier = 1024ULL * 1024 * 1024 * 1024;
+        break;
+    }
+    if (multiplier != 1) sizeInput.pop_back();
+  }
+
+  if (sizeInput.empty() || !boost::algorithm::all(sizeInput, ::isdigit)) {
+    _logger->error("(" + source + ") " + name + " - invalid format: " + input + " - must be an integer with an optional K,M,G,T unit");
+    return false;
+  }
+
+  try {
+    *bytes = std::stoull(sizeInput) * multiplier;
+  } catch (const std::exception& e) {
+    _logger->error("(" + source + ") " + name + " - invalid format: " + input + " - out of range");
+    return false;
+  }
+
+  _logger->debug("(" + source + ") " + name + " = " + std::to_string(*bytes) + " bytes");
+  return true;
+}
+
 bool Config::parse_port(const std::string& source, const std::string& name, const std::string& input, uint16_t* port) {
   uint16_t pPort;
   if (!parse_uint16(source, name, input, &pPort)) return false;
@@ -321,4 +522,18 @@ bool Config::parse_port(const std::string& source, const std::string& name, cons
   return true;
 }
 
+bool Config::parse_transport(const std::string& source, const std::string& name, const std::string& input, std::string* transport) {
+  std::string lowercaseInput = input;
+  boost::algorithm::to_lower(lowercaseInput);
+
+  if (lowercaseInput != "socket" && lowercaseInput != "io_uring" && lowercaseInput != "xdp") {
+    _logger->error("(" + source + ") " + name + " - invalid format: " + input + " - must be 'socket','io_uring','xdp'");
+    return false;
+  }
+
+  *transport = lowercaseInput;
+  _logger->debug("(" + source + ") " + name + " = " + lowercaseInput);
+  return true;
+}
+
 }  // namespace Kapua
@@ -41,9 +41,13 @@ class Config {
   enum class ParseResult { Success, InvalidFormat, InvalidUnit };
 
   // Config Parameters
-  uint64_t server_id;               // server.id
-  sockaddr_in server_ip4_sockaddr;  // server.ip4_address
-  uint16_t server_port;             // server.port
+  uint64_t server_id;                // server.id
+  sockaddr_in server_ip4_sockaddr;   // server.ip4_address
+  uint16_t server_port;              // server.port
+  int32_t server_ping_interval_ms;   // server.ping_interval
+  int32_t server_node_timeout_ms;    // server.node_timeout
+  std::string server_transport;      // server.transport
+  std::string server_xdp_interface;  // server.xdp_interface
 
   bool local_discovery_enable;              // local_discovery.emable
   sockaddr_in local_discovery_ip4_address;  // local_discovery.ip4_address
@@ -52,15 +56,35 @@ class Config {
 
   bool trackers_enable;                       // trackers.emable
   std::vector<std::string> trackers_servers;  // trackers.servers
+  std::string trackers_cache_file;            // trackers.cache_file
+
+  uint64_t storage_capacity;                 // storage.capacity
+  uint16_t storage_virtual_nodes;            // storage.virtual_nodes
+  int32_t storage_anti_entropy_interval_ms;  // storage.anti_entropy_interval
+  std::string storage_directory;             // storage.directory
 
   bool memcached_enable;                     // memcached.enable
   sockaddr_in memcached_ip4_sockaddr;        // memcached.ip4_address
   bool memcached_extensions;                 // memcached.extensions
   uint16_t memcached_connection_limit;       // memcached.connection_limit
-  uint32_t memcached_inactivity_timeout_ms;  // memcached.inactivity_timeout
+  int32_t memcached_inactivity_timeout_ms;   // memcached.inactivity_timeout
+
+  bool dns_enable;               // dns.enable
+  sockaddr_in dns_ip4_sockaddr;  // dns.ip4_address
+  uint64_t dns_cache_size;       // dns.cache_size
+
+  uint16_t compute_threads;  // compute.threads
+
+  bool metrics_enable;               // metrics.enable
+  sockaddr_in metrics_ip4_sockaddr;  // metrics.ip4_address
+
+  uint16_t tracing_sample_every;        // tracing.sample_every
+  std::string tracing_capture_file;     // tracing.capture_file
+  int32_t tracing_capture_duration_ms;  // tracing.capture_duration
 
-  LogLevel_t logging_level;     // logging.level
-  bool logging_disable_splash;  // logging.disable_splash
+  LogLevel_t logging_level;         // logging.level
+  bool logging_disable_splash;      // logging.disable_splash
+  std::string logging_events_file;  // logging.events_file
 
  protected:
   Logger* _logger;
@@ -72,6 +96,8 @@ class Config {
   bool parse_port(const std::string& source, const std::string& name, const std::string& input, uint16_t* port);
   bool parse_log_level(const std::string& source, const std::string& name, const std::string& input, LogLevel_t* level);
   bool parse_hex_uint64(const std::string& source, const std::string& name, const std::string& input, uint64_t* value);
+  bool parse_size(const std::string& source, const std::string& name, const std::string& input, uint64_t* bytes);
+  bool parse_transport(const std::string& source, const std::string& name, const std::string& input, std::string* transport);
 
   bool parse_uint16(const std::string& source, const std::string& name, const std::string& input, uint16_t* value);
 };
@@ -0,0 +1,113 @@
+//
+// Kapua ContentStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "ContentStore.hpp"
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+ContentStore::ContentStore(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, DedupIndex* index, BlockCache* cache,
+                           ReplicationPipeline* pipeline)
+    : _bytes_sent(0), _bytes_skipped(0) {
+  _logger = new ScopedLogger("ContentStore", logger);
+  _dbs = dbs;
+  _transport = transport;
+  _index = index;
+  _cache = cache;
+  _pipeline = pipeline;
+}
+
+ContentStore::~ContentStore() { delete _logger; }
+
+bool ContentStore::put(const uint8_t* data, size_t len, uint64_t* blockId) {
+  Blake3Hash hash;
+  *blockId = get_content_block_id(data, len, &hash);
+
+  switch (_index->acquire(hash, (uint32_t)len, blockId)) {
+    case DedupIndex::Result::Duplicate:
+      // Already written from this node, nothing to send
+      _bytes_skipped += len;
+      return true;
+    case DedupIndex::Result::Collision:
+      return false;
+    case DedupIndex::Result::Added:
+      break;
+  }
+
+  if (_pipeline) {
+    if (_pipeline->write(*blockId, data, len, ReplicationPipeline::Consistency::Quorum, true)) {
+      _index->commit(*blockId);
+      return true;
+    }
+    _logger->error("Failed to store block " + Util::to_hex64_str(*blockId) + " on a quorum of nodes");
+    _index->abort(*blockId);
+    return false;
+  }
+
+  std::vector<uint64_t> nodes = _dbs->get_dbs_nodes_for_block(*blockId);
+  size_t stored = 0;
+  for (uint64_t nodeId : nodes) {
+    // Another originator may already have stored the same content on this node
+    if (_transport->has_block(nodeId, *blockId)) {
+      _bytes_skipped += len;
+      stored++;
+      continue;
+    }
+
+    if (_transport->put_block(nodeId, *blockId, data, len)) {
+      _bytes_sent += len;
+      _dbs->add_dbs_node_usage(nodeId, (int64_t)len);
+      stored++;
+    } else {
+      _logger->warn("Failed to store block " + Util::to_hex64_str(*blockId) + " on node " + Util::to_hex64_str(nodeId));
+    }
+  }
+
+  if (stored == 0) {
+    _logger->error("Failed to store block " + Util::to_hex64_str(*blockId) + " on any node");
+    _index->abort(*blockId);
+    return false;
+  }
+  _index->commit(*blockId);
+  return true;
+}
+
+bool ContentStore::get(uint64_t blockId, std::vector<uint8_t>* data) {
+  if (_cache) return _cache->get(blockId, data, [this](uint64_t id, std::vector<uint8_t>* block) { return _fetch(id, block); });
+  return _fetch(blockId, data);
+}
+
+bool ContentStore::release(uint64_t blockId) { return _index->release(blockId); }
+
+bool ContentStore::_fetch(uint64_t blockId, std::vector<uint8_t>* data) {
+  for (uint64_t nodeId : _dbs->get_dbs_candidates_for_block(blockId)) {
+    if (!_transport->get_block(nodeId, blockId, data)) continue;
+
+    // The ID is the content hash, so a replica can be verified without trusting the node that served it
+    Blake3Hash hash;
+    if (get_content_block_id(data->data(), data->size(), &hash) != blockId) {
+      _logger->warn("Block " + Util::to_hex64_str(blockId) + " from node " + Util::to_hex64_str(nodeId) + " failed verification");
+      continue;
+    }
+    Blake3Hash expected;
+    if (_index->get_hash(blockId, &expected) && !(expected == hash)) {
+      _logger->warn("Block " + Util::to_hex64_str(blockId) + " from node " + Util::to_hex64_str(nodeId) + " failed verification");
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+uint64_t ContentStore::get_content_block_id(const uint8_t* data, size_t len, Blake3Hash* hash) {
+  Blake3Hash local;
+  if (!hash) hash = &local;
+  Blake3::hash(data, len, hash);
+  return hash->to_uint64();
+}
+
+}  // namespace Kapua
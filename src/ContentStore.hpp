@@ -0,0 +1,58 @@
+//
+// Kapua ContentStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Blake3.hpp"
+#include "BlockCache.hpp"
+#include "BlockTransport.hpp"
+#include "DedupIndex.hpp"
+#include "DistributedBlockStore.hpp"
+#include "Logger.hpp"
+#include "ReplicationPipeline.hpp"
+
+namespace Kapua {
+
+// Content addressed block storage: the block ID is derived from the BLAKE3 hash of the block, so identical data gets
+// the same ID and the same placement no matter who writes it. Duplicate writes are resolved against the local
+// DedupIndex, then against the replica nodes, before any block data is sent. Content blocks never change, so verified
+// reads can be kept in an optional BlockCache. With a ReplicationPipeline, replicas are written in parallel and put
+// returns at quorum, and the pipeline keeps the replica level byte counters.
+class ContentStore {
+ public:
+  ContentStore(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, DedupIndex* index, BlockCache* cache = nullptr,
+               ReplicationPipeline* pipeline = nullptr);
+  ~ContentStore();
+
+  bool put(const uint8_t* data, size_t len, uint64_t* blockId);
+  bool get(uint64_t blockId, std::vector<uint8_t>* data);
+  // Drop a reference, returns true when the block is no longer referenced locally
+  bool release(uint64_t blockId);
+
+  uint64_t get_bytes_sent() { return _bytes_sent; }
+  uint64_t get_bytes_skipped() { return _bytes_skipped; }
+
+  static uint64_t get_content_block_id(const uint8_t* data, size_t len, Blake3Hash* hash = nullptr);
+
+ protected:
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  BlockTransport* _transport;
+  DedupIndex* _index;
+  BlockCache* _cache;
+  ReplicationPipeline* _pipeline;
+
+  std::atomic<uint64_t> _bytes_sent;
+  std::atomic<uint64_t> _bytes_skipped;
+
+  bool _fetch(uint64_t blockId, std::vector<uint8_t>* data);
+};
+
+}  // namespace Kapua
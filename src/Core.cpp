@@ -11,10 +11,18 @@
 using namespace std;
 
 namespace Kapua {
-Core ::Core(Logger* logger, Config* config, RSA* rsa) : _running(false) {
+Core ::Core(Logger* logger, Config* config, RSA* rsa, MetricsRegistry* metrics) : _running(false) {
   _logger = new Kapua::ScopedLogger("Core", logger);
   _config = config;
   _rsa = rsa;
+  _block_store = nullptr;
+  _local_store = nullptr;
+  _compactor = nullptr;
+  _anti_entropy = nullptr;
+  _task_scheduler = nullptr;
+  _event_log = nullptr;
+  _own_metrics = metrics == nullptr;
+  _metrics = _own_metrics ? new MetricsRegistry() : metrics;
 }
 
 Core ::~Core() {
@@ -24,16 +32,66 @@ Core ::~Core() {
     delete pair.second;
   }
 
+  delete _event_log;
+  delete _task_scheduler;
+  if (_local_store) _local_store->set_change_callback(nullptr);
+  delete _anti_entropy;
+  delete _compactor;
+  delete _local_store;
+  delete _block_store;
+  if (_own_metrics) delete _metrics;
+
   _logger->debug("Stopped");
 }
 
 bool Core::start() {
+  if (_running) {
+    _logger->error("Start called but already running");
+    return false;
+  }
   _logger->debug("Starting...");
   _my_id = _get_random_id();
+  _block_store = new DistributedBlockStore(_my_id, DistributedBlockStore::get_dbs_virtual_ids(_my_id, _config->storage_virtual_nodes), _config->storage_capacity);
+  if (!_config->storage_directory.empty()) {
+    _local_store = new LocalBlockStore(_logger);
+    if (!_local_store->open(_config->storage_directory)) return false;
+    _compactor = new Compactor(_logger, _local_store);
+    _compactor->start();
+  }
+  // There is no block transport between nodes yet, so rounds find divergence but cannot repair it
+  _anti_entropy = new AntiEntropy(_logger, _block_store, nullptr);
+  if (_local_store) {
+    // Seed the trees with the blocks already on disk, then keep them in step as blocks are stored and removed
+    _local_store->set_change_callback([this](uint64_t blockId, uint64_t digest, bool removed) {
+      if (removed) {
+        _anti_entropy->remove_block(blockId);
+      } else {
+        _anti_entropy->add_block(blockId, digest);
+      }
+    });
+    _local_store->for_each_block([this](uint64_t blockId, uint64_t digest) { _anti_entropy->add_block(blockId, digest); });
+  }
+  // Likewise there is no compute transport, so every task runs here
+  _task_scheduler = new TaskScheduler(_logger, _block_store, nullptr, _config->compute_threads);
+  if (!_config->logging_events_file.empty()) {
+    _event_log = new EventLog(_logger, _config->logging_events_file);
+    if (!_event_log->start()) return false;
+  }
+  _register_metrics();
+  // Set before the thread starts, so a stop() straight after start() is not lost
+  _running = true;
   _thread = boost::thread(&Core::_main_loop, this);
   return true;
 }
 
+bool Core::start_simulated(uint64_t id) {
+  _my_id = id;
+  _block_store = new DistributedBlockStore(_my_id, DistributedBlockStore::get_dbs_virtual_ids(_my_id, _config->storage_virtual_nodes), _config->storage_capacity);
+  // The simulator runs repairs in virtual time, rather than each of its nodes having a repair thread
+  _anti_entropy = new AntiEntropy(_logger, _block_store, nullptr, KAPUA_DBS_REPLICAS, AntiEntropyLimits(), false);
+  return true;
+}
+
 bool Core::stop() {
   _running = false;
   _thread.join();
@@ -50,12 +108,20 @@ Node* Core::add_node(uint64_t id, sockaddr_in addr) {
 }
 
 void Core::remove_node(uint64_t id) {
-  std::lock_guard<std::mutex> lock(_nodes_mutex);
-  Node* node = find_node(id);
-  if (!node) return;
-  _nodes_by_addr.erase(node->addr);
-  _nodes.erase(id);
-  delete node;
+  {
+    std::lock_guard<std::mutex> lock(_nodes_mutex);
+    auto search = _nodes.find(id);
+    if (search == _nodes.end()) return;
+    Node* node = search->second;
+    _nodes_by_addr.erase(node->addr);
+    _nodes.erase(search);
+    delete node;
+  }
+
+  // Its blocks are now found on the next nodes round the ring, and anti-entropy moves copies to match
+  if (_block_store && _block_store->has_dbs_node(id)) _block_store->remove_dbs_node(id);
+  // Nor is it sent any more tasks
+  if (_task_scheduler) _task_scheduler->remove_node(id);
 }
 
 Node* Core::find_node(uint64_t id) {
@@ -72,6 +138,59 @@ Node* Core::find_node(sockaddr_in addr) {
   return nullptr;
 }
 
+std::vector<Node*> Core::get_connected_nodes() {
+  std::lock_guard<std::mutex> lock(_nodes_mutex);
+  std::vector<Node*> nodes;
+  for (const auto& pair : _nodes) {
+    if (pair.second->state == Node::State::Connected) nodes.push_back(pair.second);
+  }
+  return nodes;
+}
+
+void Core::update_node_load(uint64_t id, const NodeLoadReport& report) {
+  if (!_block_store) return;
+
+  // The first report from a node places it on the ring
+  if (!_block_store->has_dbs_node(id)) {
+    _block_store->add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, _config->storage_virtual_nodes), report.capacity);
+  } else {
+    _block_store->update_dbs_node_capacity(id, report.capacity);
+  }
+  _block_store->update_dbs_node_load(id, report.usage, report.iops, report.queue_depth);
+  if (_task_scheduler) _task_scheduler->update_node_capacity(id, report.compute_slots, report.compute_running);
+}
+
+void Core::get_my_load(NodeLoadReport* report) {
+  NodeLoad load = {};
+  if (_block_store) _block_store->get_dbs_node_load(_my_id, &load);
+  // What is held on disk is the real usage. Our own view of the ring takes it too, as no Ping brings it back to us.
+  if (_local_store) {
+    load.usage = _local_store->get_live_bytes();
+    _block_store->update_dbs_node_load(_my_id, load.usage, load.iops, load.queue_depth);
+  }
+  report->capacity = load.capacity;
+  report->usage = load.usage;
+  report->iops = load.iops;
+  report->queue_depth = load.queue_depth;
+  report->compute_slots = 0;
+  report->compute_running = 0;
+  if (_task_scheduler) _task_scheduler->get_my_capacity(&report->compute_slots, &report->compute_running);
+}
+
+DistributedBlockStore* Core::get_block_store() { return _block_store; }
+
+LocalBlockStore* Core::get_local_store() { return _local_store; }
+
+Compactor* Core::get_compactor() { return _compactor; }
+
+AntiEntropy* Core::get_anti_entropy() { return _anti_entropy; }
+
+TaskScheduler* Core::get_task_scheduler() { return _task_scheduler; }
+
+EventLog* Core::get_event_log() { return _event_log; }
+
+MetricsRegistry* Core::get_metrics() { return _metrics; }
+
 bool Core::queue_action(Action action) {
   std::lock_guard<std::mutex> lock(_action_mutex);
   _actions.push(action);
@@ -83,12 +202,47 @@ uint64_t Core::get_my_id() { return _my_id; }
 
 KeyPair* Core::get_my_public_key() { return &_keys; }
 
-void Core::_main_loop() {
-  if (_running) {
-    _logger->error("Start called but already running");
-    return;
+void Core::_register_metrics() {
+  static const std::pair<Node::State, const char*> states[] = {{Node::State::Initialised, "initialised"},
+                                                                 {Node::State::KeyExchange, "key_exchange"},
+                                                                 {Node::State::Handshake, "handshake"},
+                                                                 {Node::State::CheckEncryption, "check_encryption"},
+                                                                 {Node::State::Connected, "connected"}};
+  for (const auto& state : states) {
+    Node::State wanted = state.first;
+    _metrics->gauge_callback("kapua_nodes", "Known nodes, by handshake state",
+                             [this, wanted] {
+                               std::lock_guard<std::mutex> lock(_nodes_mutex);
+                               int64_t count = 0;
+                               for (const auto& pair : _nodes) count += pair.second->state == wanted;
+                               return count;
+                             },
+                             std::string("state=\"") + state.second + "\"");
   }
-  _running = true;
+  _metrics->gauge_callback("kapua_action_queue_depth", "Actions waiting for the core thread", [this] {
+    std::lock_guard<std::mutex> lock(_action_mutex);
+    return (int64_t)_actions.size();
+  });
+
+  _metrics->gauge_callback("kapua_dbs_nodes", "Nodes in the block store ring", [this] { return (int64_t)_block_store->get_dbs_node_count(); });
+  _metrics->gauge_callback("kapua_dbs_capacity_bytes", "Storage capacity of all nodes in the ring",
+                           [this] { return (int64_t)_block_store->get_dbs_total_capacity(); });
+  _metrics->gauge_callback("kapua_dbs_usage_bytes", "Storage used on all nodes in the ring", [this] { return (int64_t)_block_store->get_dbs_total_usage(); });
+  _metrics->gauge_callback("kapua_dbs_ring_version", "Changes to ring membership", [this] { return (int64_t)_block_store->get_dbs_ring_version(); });
+
+  if (_compactor) {
+    _metrics->gauge_callback("kapua_compaction_segments", "Segments compacted", [this] { return (int64_t)_compactor->get_segments_compacted(); });
+    _metrics->gauge_callback("kapua_compaction_copied_bytes", "Live bytes copied by compaction",
+                             [this] { return (int64_t)_compactor->get_bytes_copied(); });
+    _metrics->gauge_callback("kapua_compaction_reclaimed_bytes", "Disk space reclaimed by compaction",
+                             [this] { return (int64_t)_compactor->get_bytes_reclaimed(); });
+    // Gauges are integers, so the ratio is scaled by 1000
+    _metrics->gauge_callback("kapua_compaction_write_amplification_permille", "Bytes written to disk per thousand bytes stored",
+                             [this] { return (int64_t)(_compactor->get_write_amplification() * 1000); });
+  }
+}
+
+void Core::_main_loop() {
   _logger->debug("Started");
 
   while (_running) {
@@ -21,11 +21,19 @@
 #include <vector>
 
 #include "Actions.hpp"
+#include "AntiEntropy.hpp"
+#include "Compactor.hpp"
 #include "Config.hpp"
+#include "DistributedBlockStore.hpp"
+#include "EventLog.hpp"
+#include "LocalBlockStore.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
 #include "Node.hpp"
+#include "Protocol.hpp"
 #include "RSA.hpp"
 #include "SockaddrHashable.hpp"
+#include "TaskScheduler.hpp"
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -46,16 +54,35 @@ typedef struct Version {
 
 class Core {
  public:
-  Core(Logger* logger, Config* config, RSA* rsa);
+  // Metrics go to the given registry if there is one, such as one shared by every node in a simulation
+  Core(Logger* logger, Config* config, RSA* rsa, MetricsRegistry* metrics = nullptr);
   ~Core();
 
   bool start();
   bool stop();
+  // Sets up the node with the given ID as start does, but without the core thread, compute pool or block cache, for a
+  // simulator to drive
+  bool start_simulated(uint64_t id);
 
   Node* add_node(uint64_t id, sockaddr_in addr);
+  // Forgets the node, taking it off the block store ring and out of task placement. Any pointer to it is invalid
+  // afterwards.
   void remove_node(uint64_t id);
   Node* find_node(uint64_t id);
   Node* find_node(sockaddr_in addr);
+  std::vector<Node*> get_connected_nodes();
+
+  void update_node_load(uint64_t id, const NodeLoadReport& report);
+  void get_my_load(NodeLoadReport* report);
+  DistributedBlockStore* get_block_store();
+  // The blocks this node holds, or null without storage.directory
+  LocalBlockStore* get_local_store();
+  // Reclaims dead space in the local store, or null without one
+  Compactor* get_compactor();
+  AntiEntropy* get_anti_entropy();
+  TaskScheduler* get_task_scheduler();
+  EventLog* get_event_log();
+  MetricsRegistry* get_metrics();
 
   bool queue_action(Action action);
 
@@ -85,6 +112,15 @@ class Core {
   std::unordered_map<uint64_t, std::vector<Node>> _groups;
   std::mutex _groups_mutex;
 
+  DistributedBlockStore* _block_store;
+  LocalBlockStore* _local_store;
+  Compactor* _compactor;
+  AntiEntropy* _anti_entropy;
+  TaskScheduler* _task_scheduler;
+  EventLog* _event_log;
+  MetricsRegistry* _metrics;
+  bool _own_metrics;
+
   std::queue<Action> _actions;
   std::condition_variable _action_waiting;
   std::mutex _action_mutex;
@@ -92,6 +128,7 @@ class Core {
   boost::thread _thread;
 
   uint64_t _get_random_id();
+  void _register_metrics();
 
   void _main_loop();
 
@@ -0,0 +1,515 @@
+//
+// Kapua DNSServer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "DNSServer.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+namespace {
+
+const int POLL_INTERVAL_MS = 100;
+const size_t MAX_QUERY_LENGTH = 1024;
+
+const uint16_t FLAG_QR = 0x8000;
+const uint16_t FLAG_AA = 0x0400;
+const uint16_t FLAG_TC = 0x0200;
+const uint16_t FLAG_RD = 0x0100;
+const uint16_t CLASS_IN = 1;
+const uint16_t CLASS_ANY = 255;
+
+void put16(uint8_t* buffer, uint16_t value) {
+  buffer[0] = value >> 8;
+  buffer[1] = value;
+}
+
+void put32(uint8_t* buffer, uint32_t value) {
+  buffer[0] = value >> 24;
+  buffer[1] = value >> 16;
+  buffer[2] = value >> 8;
+  buffer[3] = value;
+}
+
+uint16_t get16(const uint8_t* buffer) { return (uint16_t)(buffer[0] << 8 | buffer[1]); }
+
+uint8_t lower(uint8_t c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
+}  // namespace
+
+const uint16_t DNSServer::TYPE_A;
+const uint16_t DNSServer::TYPE_NS;
+const uint16_t DNSServer::TYPE_CNAME;
+const uint16_t DNSServer::TYPE_MX;
+const uint16_t DNSServer::TYPE_TXT;
+const uint16_t DNSServer::TYPE_AAAA;
+const uint16_t DNSServer::TYPE_ANY;
+
+const uint8_t DNSServer::RCODE_NOERROR;
+const uint8_t DNSServer::RCODE_FORMERR;
+const uint8_t DNSServer::RCODE_SERVFAIL;
+const uint8_t DNSServer::RCODE_NXDOMAIN;
+const uint8_t DNSServer::RCODE_NOTIMP;
+const uint8_t DNSServer::RCODE_REFUSED;
+
+DNSServer::DNSServer(Logger* logger, Config* config, KVStore* kv) : _running(false), _cache_generation(0), _queries(0), _cache_hits(0), _dropped(0) {
+  _logger = new ScopedLogger("DNSServer", logger);
+  _config = config;
+  _kv = kv;
+  _socket_fd = -1;
+  _port = 0;
+  _main_thread = nullptr;
+  _slot_count = 0;
+}
+
+DNSServer::~DNSServer() {
+  if (_running) stop();
+  delete _logger;
+}
+
+bool DNSServer::start() {
+  if (_running) {
+    _logger->warn("start called, but thread already running");
+    return false;
+  }
+
+  _socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (_socket_fd == -1) {
+    _logger->error("Failed creating server socket");
+    return false;
+  }
+
+  sockaddr_in addr = _config->dns_ip4_sockaddr;
+  if (bind(_socket_fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+    _logger->error("Failed binding server socket to " + Util::sockaddr_to_string(addr) + ": " + strerror(errno));
+    close(_socket_fd);
+    _socket_fd = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(_socket_fd, (sockaddr*)&addr, &len);
+  _port = ntohs(addr.sin_port);
+
+  // A power of two number of buckets, each of KAPUA_DNS_CACHE_WAYS slots
+  size_t buckets = _config->dns_cache_size / sizeof(Slot) / KAPUA_DNS_CACHE_WAYS;
+  while (buckets & (buckets - 1)) buckets &= buckets - 1;
+  if (buckets * KAPUA_DNS_CACHE_WAYS != _slot_count) {
+    _slot_count = buckets * KAPUA_DNS_CACHE_WAYS;
+    _slots.reset(_slot_count ? new Slot[_slot_count] : nullptr);
+  }
+
+  _running = true;
+  _main_thread = new std::thread(&DNSServer::_main_loop, this);
+  for (int i = 0; i < KAPUA_DNS_WORKERS; i++) _workers.emplace_back(&DNSServer::_worker, this);
+  _logger->info("Listening on " + Util::sockaddr_to_string(addr));
+  return true;
+}
+
+bool DNSServer::stop() {
+  if (!_running) {
+    _logger->warn("stop called, but thread not running");
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    _running = false;
+  }
+  _pending_ready.notify_all();
+
+  _main_thread->join();
+  delete _main_thread;
+  _main_thread = nullptr;
+  for (std::thread& worker : _workers) worker.join();
+  _workers.clear();
+  _pending.clear();
+
+  close(_socket_fd);
+  _socket_fd = -1;
+  _logger->debug("Stopped");
+  return true;
+}
+
+bool DNSServer::set_records(const std::string& name, const std::vector<DNSRecord>& records) {
+  std::vector<uint8_t> wire;
+  if (!encode_name(name, &wire)) return false;
+
+  std::vector<uint8_t> value;
+  for (const DNSRecord& record : records) {
+    if (record.rdata.size() > UINT16_MAX) return false;
+    RecordHeader header = {record.type, record.ttl, (uint16_t)record.rdata.size()};
+    value.insert(value.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    value.insert(value.end(), record.rdata.begin(), record.rdata.end());
+  }
+
+  std::string dotted;
+  for (size_t pos = 0; wire[pos]; pos += wire[pos] + 1) {
+    if (pos) dotted += '.';
+    dotted.append((const char*)&wire[pos + 1], wire[pos]);
+  }
+  bool ok = records.empty() ? _kv->remove(_record_key(dotted)) : _kv->set(_record_key(dotted), value.data(), value.size());
+  _cache_generation++;
+  _cache_drop(_hash_name(wire.data(), wire.size()));
+  return ok;
+}
+
+bool DNSServer::remove_records(const std::string& name) { return set_records(name, std::vector<DNSRecord>()); }
+
+bool DNSServer::encode_name(const std::string& name, std::vector<uint8_t>* wire) {
+  wire->clear();
+  std::string trimmed = (!name.empty() && name.back() == '.') ? name.substr(0, name.size() - 1) : name;
+
+  size_t start = 0;
+  while (!trimmed.empty() && start <= trimmed.size()) {
+    size_t end = trimmed.find('.', start);
+    if (end == std::string::npos) end = trimmed.size();
+    size_t length = end - start;
+    if (length == 0 || length > 63) return false;
+    wire->push_back((uint8_t)length);
+    for (size_t i = start; i < end; i++) wire->push_back(lower(trimmed[i]));
+    start = end + 1;
+  }
+  wire->push_back(0);
+  return wire->size() <= KAPUA_DNS_MAX_NAME_LENGTH;
+}
+
+void DNSServer::_main_loop() {
+  mmsghdr messages[KAPUA_DNS_BATCH], replies[KAPUA_DNS_BATCH];
+  iovec queryVecs[KAPUA_DNS_BATCH], replyVecs[KAPUA_DNS_BATCH];
+  sockaddr_in addrs[KAPUA_DNS_BATCH];
+  std::vector<uint8_t> queries(KAPUA_DNS_BATCH * MAX_QUERY_LENGTH), responses(KAPUA_DNS_BATCH * KAPUA_DNS_MAX_UDP_LENGTH);
+
+  std::memset(messages, 0, sizeof(messages));
+  std::memset(replies, 0, sizeof(replies));
+  for (int i = 0; i < KAPUA_DNS_BATCH; i++) {
+    queryVecs[i] = {&queries[i * MAX_QUERY_LENGTH], MAX_QUERY_LENGTH};
+    messages[i].msg_hdr.msg_iov = &queryVecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    messages[i].msg_hdr.msg_name = &addrs[i];
+    replies[i].msg_hdr.msg_iov = &replyVecs[i];
+    replies[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (_running) {
+    pollfd pfd = {_socket_fd, POLLIN, 0};
+    if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) continue;
+
+    // Drain the socket a batch at a time
+    while (_running) {
+      for (int i = 0; i < KAPUA_DNS_BATCH; i++) messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      int received = recvmmsg(_socket_fd, messages, KAPUA_DNS_BATCH, MSG_DONTWAIT, nullptr);
+      if (received <= 0) break;
+
+      int count = 0;
+      bool queued = false;
+      for (int i = 0; i < received; i++) {
+        const uint8_t* query = &queries[i * MAX_QUERY_LENGTH];
+        uint8_t* response = &responses[count * KAPUA_DNS_MAX_UDP_LENGTH];
+        Question question;
+        size_t length;
+        if (_answer_fast(query, messages[i].msg_len, &question, response, &length)) {
+          if (length == 0) continue;
+          replyVecs[count] = {response, length};
+          replies[count].msg_hdr.msg_name = &addrs[i];
+          replies[count].msg_hdr.msg_namelen = messages[i].msg_hdr.msg_namelen;
+          count++;
+          continue;
+        }
+
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        if (_pending.size() >= KAPUA_DNS_MAX_PENDING) {
+          _dropped++;
+          continue;
+        }
+        _pending.push_back({addrs[i], std::vector<uint8_t>(query, query + messages[i].msg_len), question});
+        queued = true;
+      }
+      if (queued) _pending_ready.notify_all();
+
+      for (int sent = 0; sent < count;) {
+        int n = sendmmsg(_socket_fd, replies + sent, count - sent, 0);
+        if (n <= 0) break;
+        sent += n;
+      }
+      if (received < KAPUA_DNS_BATCH) break;
+    }
+  }
+}
+
+void DNSServer::_worker() {
+  uint8_t response[KAPUA_DNS_MAX_UDP_LENGTH];
+  while (true) {
+    Pending pending;
+    {
+      std::unique_lock<std::mutex> lock(_pending_mutex);
+      _pending_ready.wait(lock, [this] { return !_running || !_pending.empty(); });
+      if (!_running) return;
+      pending = std::move(_pending.front());
+      _pending.pop_front();
+    }
+
+    size_t length = _answer_from_store(pending.query.data(), pending.question, response);
+    sendto(_socket_fd, response, length, 0, (sockaddr*)&pending.from, sizeof(pending.from));
+  }
+}
+
+bool DNSServer::_answer_fast(const uint8_t* query, size_t len, Question* question, uint8_t* response, size_t* responseLength) {
+  *responseLength = 0;
+  if (len < sizeof(Header)) return true;
+  _queries++;
+
+  // Responses are never answered
+  uint16_t flags = get16(query + 2);
+  if (flags & FLAG_QR) return true;
+
+  if ((flags >> 11) & 0xf) {
+    *responseLength = _error(query, nullptr, RCODE_NOTIMP, response);
+    return true;
+  }
+  if (!_parse_question(query, len, question)) {
+    *responseLength = _error(query, nullptr, RCODE_FORMERR, response);
+    return true;
+  }
+  if (question->klass != CLASS_IN && question->klass != CLASS_ANY) {
+    *responseLength = _error(query, question, RCODE_REFUSED, response);
+    return true;
+  }
+  if (_cache_get(query, *question, response, responseLength)) {
+    _cache_hits++;
+    return true;
+  }
+  return false;
+}
+
+size_t DNSServer::_answer_from_store(const uint8_t* query, const Question& question, uint8_t* response) {
+  uint64_t generation = _cache_generation.load();
+  std::vector<uint8_t> value;
+  KVStore::Result result = _kv->get(_record_key(question.name), &value);
+  if (result == KVStore::Result::Unavailable) return _error(query, &question, RCODE_SERVFAIL, response);
+
+  // Parse the stored records, picking out those that answer the question, or failing that any CNAME
+  std::vector<std::pair<size_t, const RecordHeader*>> matched, cnames;
+  size_t offset = 0;
+  while (offset + sizeof(RecordHeader) <= value.size()) {
+    const RecordHeader* record = (const RecordHeader*)&value[offset];
+    if (offset + sizeof(RecordHeader) + record->length > value.size()) break;
+    if (record->type == question.type || question.type == TYPE_ANY) matched.push_back({offset, record});
+    if (record->type == TYPE_CNAME) cnames.push_back({offset, record});
+    offset += sizeof(RecordHeader) + record->length;
+  }
+  if (offset != value.size()) {
+    _logger->error("Records for " + question.name + " are damaged");
+    return _error(query, &question, RCODE_SERVFAIL, response);
+  }
+  if (matched.empty() && question.type != TYPE_CNAME) matched = cnames;
+
+  size_t length = _error(query, &question, result == KVStore::Result::Found ? RCODE_NOERROR : RCODE_NXDOMAIN, response);
+  put16(response + 2, get16(response + 2) | FLAG_AA);
+
+  uint32_t ttl = KAPUA_DNS_NEGATIVE_TTL;
+  std::vector<std::pair<uint16_t, uint32_t>> ttls;
+  for (size_t i = 0; i < matched.size(); i++) {
+    const RecordHeader* record = matched[i].second;
+    if (length + 12 + record->length > KAPUA_DNS_MAX_UDP_LENGTH) {
+      // Too big for UDP, the client should retry over TCP
+      put16(response + 2, get16(response + 2) | FLAG_TC);
+      return sizeof(Header) + question.length;
+    }
+
+    // The owner is the question name, as a pointer to it
+    uint8_t* answer = response + length;
+    put16(answer, 0xc000 | sizeof(Header));
+    put16(answer + 2, record->type);
+    put16(answer + 4, CLASS_IN);
+    put32(answer + 6, record->ttl);
+    put16(answer + 10, record->length);
+    std::memcpy(answer + 12, &value[matched[i].first + sizeof(RecordHeader)], record->length);
+    ttls.push_back({(uint16_t)(length + 6), record->ttl});
+    ttl = i ? std::min(ttl, record->ttl) : record->ttl;
+    length += 12 + record->length;
+  }
+  put16(response + 6, matched.size());
+
+  _cache_put(question, response, length, ttl, ttls, generation);
+  return length;
+}
+
+bool DNSServer::_parse_question(const uint8_t* query, size_t len, Question* question) {
+  if (get16(query + 4) != 1) return false;
+
+  uint8_t wire[KAPUA_DNS_MAX_NAME_LENGTH];
+  size_t pos = sizeof(Header), wireLength = 0;
+  question->name.clear();
+  while (true) {
+    if (pos >= len) return false;
+    uint8_t label = query[pos];
+    if (label == 0) break;
+    // Compression has no place in a question, and a name has at most 255 bytes
+    if (label > 63 || wireLength + label + 2 > KAPUA_DNS_MAX_NAME_LENGTH || pos + 1 + label > len) return false;
+
+    if (!question->name.empty()) question->name += '.';
+    wire[wireLength++] = label;
+    for (size_t i = 0; i < label; i++) {
+      uint8_t c = lower(query[pos + 1 + i]);
+      if (c == '.') return false;
+      wire[wireLength++] = c;
+      question->name += (char)c;
+    }
+    pos += 1 + label;
+  }
+  wire[wireLength++] = 0;
+  pos++;
+  if (pos + 4 > len) return false;
+
+  question->name_length = wireLength;
+  question->length = wireLength + 4;
+  question->type = get16(query + pos);
+  question->klass = get16(query + pos + 2);
+  question->hash = _hash_name(wire, wireLength);
+  return true;
+}
+
+size_t DNSServer::_error(const uint8_t* query, const Question* question, uint8_t rcode, uint8_t* response) {
+  // Echo the ID, opcode and RD bit, and the question if there is one
+  Header header = {0, 0, 0, 0, 0, 0};
+  std::memcpy(&header.id, query, 2);
+  put16((uint8_t*)&header.flags, FLAG_QR | (get16(query + 2) & (0x7800 | FLAG_RD)) | rcode);
+  put16((uint8_t*)&header.qdcount, question ? 1 : 0);
+  std::memcpy(response, &header, sizeof(header));
+  if (!question) return sizeof(Header);
+
+  std::memcpy(response + sizeof(Header), query + sizeof(Header), question->length);
+  return sizeof(Header) + question->length;
+}
+
+uint64_t DNSServer::_hash_name(const uint8_t* wire, size_t len) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ wire[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+int64_t DNSServer::_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool DNSServer::_cache_get(const uint8_t* query, const Question& question, uint8_t* response, size_t* length) {
+  if (_slot_count == 0) return false;
+
+  Slot* bucket = &_slots[(question.hash & (_slot_count / KAPUA_DNS_CACHE_WAYS - 1)) * KAPUA_DNS_CACHE_WAYS];
+  int64_t now = _now_ms();
+  for (int way = 0; way < KAPUA_DNS_CACHE_WAYS; way++) {
+    Slot& slot = bucket[way];
+
+    // Copy the entry out, then check no writer touched it meanwhile
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if ((sequence & 1) || slot.hash != question.hash || slot.type != question.type) continue;
+    size_t slotLength = slot.length;
+    int64_t stored = slot.stored_ms, expires = slot.expires_ms;
+    uint8_t answers = slot.answers;
+    uint16_t offsets[KAPUA_DNS_CACHE_MAX_ANSWERS];
+    uint32_t ttls[KAPUA_DNS_CACHE_MAX_ANSWERS];
+    if (slotLength > KAPUA_DNS_MAX_UDP_LENGTH || answers > KAPUA_DNS_CACHE_MAX_ANSWERS) continue;
+    std::memcpy(response, slot.response, slotLength);
+    std::memcpy(offsets, slot.ttl_offsets, sizeof(offsets));
+    std::memcpy(ttls, slot.ttls, sizeof(ttls));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+
+    if (expires <= now || slotLength < sizeof(Header) + question.length) continue;
+    // The hash could collide, so the names must match too
+    bool match = true;
+    for (size_t i = 0; i < question.name_length && match; i++) match = lower(response[sizeof(Header) + i]) == lower(query[sizeof(Header) + i]);
+    if (!match) continue;
+
+    // Patch in the ID, the RD bit, the question as asked and the time left to live
+    std::memcpy(response, query, 2);
+    response[2] = (response[2] & ~0x01) | (query[2] & 0x01);
+    std::memcpy(response + sizeof(Header), query + sizeof(Header), question.length);
+    uint32_t elapsed = (uint32_t)((now - stored) / 1000);
+    for (uint8_t i = 0; i < answers; i++) put32(response + offsets[i], ttls[i] > elapsed ? ttls[i] - elapsed : 0);
+    *length = slotLength;
+    return true;
+  }
+  return false;
+}
+
+void DNSServer::_cache_put(const Question& question, const uint8_t* response, size_t length, uint32_t ttl,
+                           const std::vector<std::pair<uint16_t, uint32_t>>& ttls, uint64_t generation) {
+  if (_slot_count == 0 || ttl == 0 || length > KAPUA_DNS_MAX_UDP_LENGTH || ttls.size() > KAPUA_DNS_CACHE_MAX_ANSWERS) return;
+
+  // Replace the same entry, else an expired one, else whichever expires first
+  Slot* bucket = &_slots[(question.hash & (_slot_count / KAPUA_DNS_CACHE_WAYS - 1)) * KAPUA_DNS_CACHE_WAYS];
+  int64_t now = _now_ms();
+  Slot* victim = &bucket[0];
+  for (int way = 0; way < KAPUA_DNS_CACHE_WAYS; way++) {
+    Slot* slot = &bucket[way];
+    if (slot->hash == question.hash && slot->type == question.type) {
+      victim = slot;
+      break;
+    }
+    if (slot->expires_ms <= now || slot->expires_ms < victim->expires_ms) victim = slot;
+  }
+
+  uint32_t sequence = victim->sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) || !victim->sequence.compare_exchange_strong(sequence, sequence + 1)) return;
+
+  // The records changed while this answer was being read. Checked with the slot held, so a change after this point
+  // finds the slot's new hash once the write is done, and drops it.
+  if (_cache_generation.load() != generation) {
+    victim->sequence.store(sequence + 2, std::memory_order_release);
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  victim->hash = question.hash;
+  victim->type = question.type;
+  victim->stored_ms = now;
+  victim->expires_ms = now + (int64_t)ttl * 1000;
+  victim->length = length;
+  victim->answers = ttls.size();
+  for (size_t i = 0; i < ttls.size(); i++) {
+    victim->ttl_offsets[i] = ttls[i].first;
+    victim->ttls[i] = ttls[i].second;
+  }
+  std::memcpy(victim->response, response, length);
+
+  victim->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void DNSServer::_cache_drop(uint64_t hash) {
+  if (_slot_count == 0) return;
+
+  Slot* bucket = &_slots[(hash & (_slot_count / KAPUA_DNS_CACHE_WAYS - 1)) * KAPUA_DNS_CACHE_WAYS];
+  for (int way = 0; way < KAPUA_DNS_CACHE_WAYS; way++) {
+    Slot* slot = &bucket[way];
+
+    // Wait out a writer before looking at the hash, as the writer may be storing this entry, which must not survive
+    uint32_t sequence;
+    do {
+      sequence = slot->sequence.load() & ~1u;
+    } while (!slot->sequence.compare_exchange_weak(sequence, sequence + 1));
+    if (slot->hash != hash) {
+      slot->sequence.store(sequence, std::memory_order_release);
+      continue;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->hash = 0;
+    slot->expires_ms = 0;
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+  }
+}
+
+}  // namespace Kapua
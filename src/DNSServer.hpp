@@ -0,0 +1,182 @@
+//
+// Kapua DNSServer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "KVStore.hpp"
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_DNS_MAX_UDP_LENGTH 512
+#define KAPUA_DNS_MAX_NAME_LENGTH 255
+#define KAPUA_DNS_BATCH 64
+#define KAPUA_DNS_WORKERS 4
+#define KAPUA_DNS_MAX_PENDING 4096
+#define KAPUA_DNS_NEGATIVE_TTL 30
+#define KAPUA_DNS_CACHE_WAYS 4
+#define KAPUA_DNS_CACHE_MAX_ANSWERS 16
+
+struct DNSRecord {
+  uint16_t type;
+  uint32_t ttl;
+  std::vector<uint8_t> rdata;  // Wire format, names uncompressed
+};
+
+// Answers DNS queries over UDP from records held in the KVStore, as the authority for every name stored there. Each
+// name's records are one key, so a lookup is one quorum read. Queries are received and answered in batches with
+// recvmmsg and sendmmsg.
+//
+// Complete responses are cached in wire format, keyed by name and type, so a cached query is answered by copying the
+// response and patching in the query ID, the question's letter case and the remaining TTLs, without touching the store
+// or re-encoding anything. The cache is a set-associative table of fixed size slots, each guarded by a sequence
+// number: readers never block or take a lock, and a writer that finds a slot busy simply does not cache. Entries expire
+// with the smallest TTL in the answer, or after a fixed time for names and types that do not exist. Misses are looked
+// up by a pool of workers so a slow read never holds up cached answers.
+class DNSServer {
+ public:
+  static const uint16_t TYPE_A = 1;
+  static const uint16_t TYPE_NS = 2;
+  static const uint16_t TYPE_CNAME = 5;
+  static const uint16_t TYPE_MX = 15;
+  static const uint16_t TYPE_TXT = 16;
+  static const uint16_t TYPE_AAAA = 28;
+  static const uint16_t TYPE_ANY = 255;
+
+  static const uint8_t RCODE_NOERROR = 0;
+  static const uint8_t RCODE_FORMERR = 1;
+  static const uint8_t RCODE_SERVFAIL = 2;
+  static const uint8_t RCODE_NXDOMAIN = 3;
+  static const uint8_t RCODE_NOTIMP = 4;
+  static const uint8_t RCODE_REFUSED = 5;
+
+  DNSServer(Logger* logger, Config* config, KVStore* kv);
+  ~DNSServer();
+
+  bool start();
+  bool stop();
+
+  // The bound port, useful when configured with port 0
+  uint16_t get_port() { return _port; }
+
+  // Replace or remove every record for a name. This node's cached answers for it are dropped; other nodes serve theirs
+  // until they expire.
+  bool set_records(const std::string& name, const std::vector<DNSRecord>& records);
+  bool remove_records(const std::string& name);
+
+  uint64_t get_queries() { return _queries; }
+  uint64_t get_cache_hits() { return _cache_hits; }
+  uint64_t get_dropped() { return _dropped; }
+
+  // Lowercase wire format, from a dotted name with or without the trailing dot
+  static bool encode_name(const std::string& name, std::vector<uint8_t>* wire);
+
+ protected:
+#pragma pack(push, 1)
+  struct Header {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+  };
+
+  struct RecordHeader {
+    uint16_t type;
+    uint32_t ttl;
+    uint16_t length;
+  };
+#pragma pack(pop)
+
+  struct Question {
+    size_t name_length;  // Of the wire format name, starting after the header
+    size_t length;       // Of the whole question
+    uint16_t type;
+    uint16_t klass;
+    uint64_t hash;  // Of the lowercased name
+    std::string name;
+  };
+
+  struct Slot {
+    std::atomic<uint32_t> sequence;  // Odd while being written
+    uint64_t hash;
+    uint16_t type;
+    int64_t stored_ms;
+    int64_t expires_ms;
+    uint16_t length;
+    uint8_t answers;
+    uint16_t ttl_offsets[KAPUA_DNS_CACHE_MAX_ANSWERS];
+    uint32_t ttls[KAPUA_DNS_CACHE_MAX_ANSWERS];
+    uint8_t response[KAPUA_DNS_MAX_UDP_LENGTH];
+
+    Slot() : sequence(0), hash(0), type(0), stored_ms(0), expires_ms(0), length(0), answers(0) {}
+  };
+
+  struct Pending {
+    sockaddr_in from;
+    std::vector<uint8_t> query;
+    Question question;
+  };
+
+  Logger* _logger;
+  Config* _config;
+  KVStore* _kv;
+
+  int _socket_fd;
+  uint16_t _port;
+  std::thread* _main_thread;
+  std::vector<std::thread> _workers;
+  std::atomic_bool _running;
+
+  std::mutex _pending_mutex;
+  std::condition_variable _pending_ready;
+  std::deque<Pending> _pending;
+
+  std::unique_ptr<Slot[]> _slots;
+  size_t _slot_count;
+  // Bumped by every change made through the server, so an answer read from the store before a change is not cached
+  std::atomic<uint64_t> _cache_generation;
+
+  std::atomic<uint64_t> _queries;
+  std::atomic<uint64_t> _cache_hits;
+  std::atomic<uint64_t> _dropped;
+
+  void _main_loop();
+  void _worker();
+
+  // Answer from the cache or with an error. Returns false if the store must be asked, and sets a response length of 0
+  // for queries that get no answer at all.
+  bool _answer_fast(const uint8_t* query, size_t len, Question* question, uint8_t* response, size_t* responseLength);
+  size_t _answer_from_store(const uint8_t* query, const Question& question, uint8_t* response);
+
+  static bool _parse_question(const uint8_t* query, size_t len, Question* question);
+  static size_t _error(const uint8_t* query, const Question* question, uint8_t rcode, uint8_t* response);
+  static std::string _record_key(const std::string& name) { return "dns:" + name; }
+  static uint64_t _hash_name(const uint8_t* wire, size_t len);
+  static int64_t _now_ms();
+
+  bool _cache_get(const uint8_t* query, const Question& question, uint8_t* response, size_t* length);
+  // ttls holds the offset and TTL of each answer. generation is _cache_generation from before the store was read.
+  void _cache_put(const Question& question, const uint8_t* response, size_t length, uint32_t ttl, const std::vector<std::pair<uint16_t, uint32_t>>& ttls,
+                  uint64_t generation);
+  void _cache_drop(uint64_t hash);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,157 @@
+//
+// Kapua DedupIndex class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "DedupIndex.hpp"
+
+#include <cstdio>
+
+namespace Kapua {
+
+DedupIndex::DedupIndex(Logger* logger) : _duplicates(0), _duplicate_bytes(0) { _logger = new ScopedLogger("DedupIndex", logger); }
+
+DedupIndex::~DedupIndex() { delete _logger; }
+
+DedupIndex::Result DedupIndex::acquire(const Blake3Hash& hash, uint32_t length, uint64_t* blockId) {
+  *blockId = hash.to_uint64();
+  Shard& shard = _shard(*blockId);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+
+  while (true) {
+    auto pending = shard.pending.find(*blockId);
+    if (pending == shard.pending.end()) break;
+    if (!(pending->second.hash == hash)) {
+      _logger->error("Block ID collision between different content");
+      return Result::Collision;
+    }
+    // Someone else is storing the same content, see how they get on
+    shard.settled.wait(lock);
+  }
+
+  auto search = shard.entries.find(*blockId);
+  if (search == shard.entries.end()) {
+    shard.pending.insert({*blockId, Entry{hash, length, 1}});
+    return Result::Added;
+  }
+
+  // 64-bit block IDs are a truncated hash, so the full hash decides whether this really is the same content
+  if (!(search->second.hash == hash)) {
+    _logger->error("Block ID collision between different content");
+    return Result::Collision;
+  }
+
+  search->second.refs++;
+  _duplicates++;
+  _duplicate_bytes += length;
+  return Result::Duplicate;
+}
+
+void DedupIndex::commit(uint64_t blockId) {
+  Shard& shard = _shard(blockId);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto search = shard.pending.find(blockId);
+    if (search == shard.pending.end()) return;
+    shard.entries.insert(*search);
+    shard.pending.erase(search);
+  }
+  shard.settled.notify_all();
+}
+
+void DedupIndex::abort(uint64_t blockId) {
+  Shard& shard = _shard(blockId);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.pending.erase(blockId);
+  }
+  shard.settled.notify_all();
+}
+
+bool DedupIndex::release(uint64_t blockId) {
+  Shard& shard = _shard(blockId);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto search = shard.entries.find(blockId);
+  if (search == shard.entries.end()) return false;
+  if (--search->second.refs > 0) return false;
+
+  shard.entries.erase(search);
+  return true;
+}
+
+bool DedupIndex::contains(uint64_t blockId) {
+  Shard& shard = _shard(blockId);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  return shard.entries.find(blockId) != shard.entries.end();
+}
+
+bool DedupIndex::get_hash(uint64_t blockId, Blake3Hash* hash) {
+  Shard& shard = _shard(blockId);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  auto search = shard.entries.find(blockId);
+  if (search == shard.entries.end()) return false;
+  *hash = search->second.hash;
+  return true;
+}
+
+size_t DedupIndex::size() {
+  size_t total = 0;
+  for (Shard& shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    total += shard.entries.size();
+  }
+  return total;
+}
+
+bool DedupIndex::load(const std::string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    _logger->debug("No index file " + filename);
+    return false;
+  }
+
+  Entry entry;
+  size_t count = 0;
+  while (fread(&entry, sizeof(entry), 1, file) == 1) {
+    uint64_t blockId = entry.hash.to_uint64();
+    Shard& shard = _shard(blockId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries[blockId] = entry;
+    count++;
+  }
+  fclose(file);
+
+  _logger->debug("Loaded " + std::to_string(count) + " entries from " + filename);
+  return true;
+}
+
+bool DedupIndex::save(const std::string& filename) {
+  std::string tempFilename = filename + ".tmp";
+  FILE* file = fopen(tempFilename.c_str(), "wb");
+  if (!file) {
+    _logger->error("Cannot open " + tempFilename + " for writing");
+    return false;
+  }
+
+  bool ok = true;
+  for (Shard& shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& pair : shard.entries) {
+      ok &= fwrite(&pair.second, sizeof(Entry), 1, file) == 1;
+    }
+  }
+  ok &= fclose(file) == 0;
+
+  // Replace the old index only once the new one is complete
+  if (!ok || rename(tempFilename.c_str(), filename.c_str()) != 0) {
+    _logger->error("Error writing index file " + filename);
+    remove(tempFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,80 @@
+//
+// Kapua DedupIndex class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Blake3.hpp"
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_DEDUP_SHARDS 16
+
+// Local index of content addressed blocks this node has written, with a reference count per block. Lookups are
+// sharded by block ID so concurrent writers rarely contend.
+//
+// New content is pending until its writer has stored it and calls commit(), or gives up and calls abort(). Writers of
+// the same content meanwhile wait in acquire(), so nobody is handed the ID of a block that is not stored yet, and a
+// failed store leaves nothing behind.
+class DedupIndex {
+ public:
+  enum class Result {
+    Added,      // New content, the caller must store it and then commit or abort
+    Duplicate,  // Already stored, the reference count was incremented
+    Collision,  // The block ID is in use by different content
+  };
+
+  DedupIndex(Logger* logger);
+  ~DedupIndex();
+
+  Result acquire(const Blake3Hash& hash, uint32_t length, uint64_t* blockId);
+  // The block acquire() returned Added for has been stored
+  void commit(uint64_t blockId);
+  // It could not be stored, so forget it and let a waiting writer try
+  void abort(uint64_t blockId);
+  // Returns true when the last reference was released and the block can be deleted
+  bool release(uint64_t blockId);
+  bool contains(uint64_t blockId);
+  bool get_hash(uint64_t blockId, Blake3Hash* hash);
+
+  size_t size();
+  uint64_t get_duplicate_count() { return _duplicates; }
+  uint64_t get_duplicate_bytes() { return _duplicate_bytes; }
+
+  bool load(const std::string& filename);
+  bool save(const std::string& filename);
+
+ protected:
+  struct Entry {
+    Blake3Hash hash;
+    uint32_t length;
+    uint32_t refs;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::unordered_map<uint64_t, Entry> pending;
+    std::condition_variable settled;
+  };
+
+  Logger* _logger;
+  Shard _shards[KAPUA_DEDUP_SHARDS];
+
+  std::atomic<uint64_t> _duplicates;
+  std::atomic<uint64_t> _duplicate_bytes;
+
+  Shard& _shard(uint64_t blockId) { return _shards[blockId % KAPUA_DEDUP_SHARDS]; }
+};
+
+}  // namespace Kapua
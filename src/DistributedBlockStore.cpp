@@ -8,26 +8,22 @@
 
 #include <algorithm>
 #include <limits>
+#include <mutex>
 
 namespace Kapua {
 
-DistributedBlockStore::DistributedBlockStore(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity) : nodeId(id) {
-  for (auto vid : virtualIds) {
-    ring.insert(vid);
-    virtual_to_real[vid] = id;
-  }
-  node_capacities[id] = std::make_pair(capacity, 0);
+DistributedBlockStore::DistributedBlockStore(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity, double loadEpsilon)
+    : nodeId(id), loadEpsilon(loadEpsilon), total_capacity(0), total_usage(0), ring_version(0) {
+  insert_node(id, virtualIds, capacity);
 }
 
 void DistributedBlockStore::add_dbs_node(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity) {
-  for (auto vid : virtualIds) {
-    ring.insert(vid);
-    virtual_to_real[vid] = id;
-  }
-  node_capacities[id] = std::make_pair(capacity, 0);
+  std::unique_lock<std::shared_timed_mutex> lock(ring_mutex);
+  insert_node(id, virtualIds, capacity);
 }
 
 void DistributedBlockStore::remove_dbs_node(uint64_t id) {
+  std::unique_lock<std::shared_timed_mutex> lock(ring_mutex);
   for (auto it = virtual_to_real.begin(); it != virtual_to_real.end();) {
     if (it->second == id) {
       ring.erase(it->first);
@@ -36,35 +32,163 @@ void DistributedBlockStore::remove_dbs_node(uint64_t id) {
       ++it;
     }
   }
-  node_capacities.erase(id);
+
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity != node_capacities.end()) {
+    total_capacity -= nodeCapacity->second->capacity;
+    total_usage -= nodeCapacity->second->usage;
+    node_capacities.erase(nodeCapacity);
+  }
+  ring_version++;
+}
+
+size_t DistributedBlockStore::get_dbs_node_count() const {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  return node_capacities.size();
+}
+
+bool DistributedBlockStore::has_dbs_node(uint64_t id) const {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  return node_capacities.find(id) != node_capacities.end();
 }
 
 void DistributedBlockStore::update_dbs_node_capacity(uint64_t id, uint64_t newCapacity) {
-  if (node_capacities.find(id) != node_capacities.end()) {
-    node_capacities[id].first = newCapacity;
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity != node_capacities.end()) {
+    uint64_t oldCapacity = nodeCapacity->second->capacity.exchange(newCapacity);
+    total_capacity += newCapacity - oldCapacity;
   }
 }
 
-std::vector<uint64_t> DistributedBlockStore::get_dbs_nodes_for_block(uint64_t blockId) const {
+void DistributedBlockStore::update_dbs_node_load(uint64_t id, uint64_t usage, uint32_t iops, uint32_t queueDepth) {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity != node_capacities.end()) {
+    uint64_t oldUsage = nodeCapacity->second->usage.exchange(usage);
+    total_usage += usage - oldUsage;
+    nodeCapacity->second->iops = iops;
+    nodeCapacity->second->queue_depth = queueDepth;
+  }
+}
+
+void DistributedBlockStore::add_dbs_node_usage(uint64_t id, int64_t delta) {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity == node_capacities.end()) return;
+
+  // Deletes counted after a report may take off more than it included, so stop at zero rather than wrap
+  std::atomic<uint64_t>& usage = nodeCapacity->second->usage;
+  uint64_t current = usage, next;
+  do {
+    next = delta < 0 && (uint64_t)-delta > current ? 0 : current + delta;
+  } while (!usage.compare_exchange_weak(current, next));
+  total_usage += next - current;
+}
+
+bool DistributedBlockStore::get_dbs_node_load(uint64_t id, NodeLoad* load) const {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity == node_capacities.end()) return false;
+
+  load->capacity = nodeCapacity->second->capacity;
+  load->usage = nodeCapacity->second->usage;
+  load->iops = nodeCapacity->second->iops;
+  load->queue_depth = nodeCapacity->second->queue_depth;
+  return true;
+}
+
+std::vector<uint64_t> DistributedBlockStore::get_dbs_nodes_for_block(uint64_t blockId, size_t replicas) const {
   std::vector<uint64_t> nodes;
-  if (ring.empty()) {
-    return nodes;
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  std::vector<uint64_t> candidates = walk_ring(blockId, replicas + KAPUA_DBS_SPARE_NODES);
+
+  // Take candidates in ring order. The first pass applies the bounded-load limit of (1 + epsilon) x average
+  // utilisation; the second only skips nodes that are completely full, so that a skewed ring still gets as many
+  // replicas as it can hold.
+  for (int pass = 0; pass < 2 && nodes.size() < replicas; ++pass) {
+    for (size_t i = 0; i < candidates.size() && nodes.size() < replicas; ++i) {
+      uint64_t nodeId = candidates[i];
+      if (std::find(nodes.begin(), nodes.end(), nodeId) == nodes.end() && !check_node_overloaded(nodeId) &&
+          (pass == 1 || !check_node_over_bound(nodeId))) {
+        nodes.push_back(nodeId);
+      }
+    }
   }
+  return nodes;
+}
+
+std::vector<uint64_t> DistributedBlockStore::get_dbs_candidates_for_block(uint64_t blockId, size_t replicas) const {
+  return get_dbs_preference_list(blockId, replicas + KAPUA_DBS_SPARE_NODES);
+}
 
-  auto it = ring.lower_bound(blockId);
-  if (it == ring.end()) {
-    it = ring.begin();
+std::vector<uint64_t> DistributedBlockStore::get_dbs_preference_list(uint64_t id, size_t count) const {
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  return walk_ring(id, count);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> DistributedBlockStore::get_dbs_ranges_for_node(uint64_t id, size_t replicas) const {
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  std::shared_lock<std::shared_timed_mutex> lock(ring_mutex);
+  if (ring.empty()) {
+    return ranges;
   }
 
-  for (int i = 0; i < 5 && it != ring.end(); ++i) {
-    uint64_t nodeId = virtual_to_real.at(*it);
-    if (!check_node_overloaded(nodeId)) {
-      nodes.push_back(*it);
+  // Every ID in (previous token, token] walks the ring from the same token, so shares a preference list
+  uint64_t previous = *ring.rbegin();
+  for (auto token = ring.begin(); token != ring.end(); ++token) {
+    std::vector<uint64_t> nodes;
+    auto it = token;
+    for (size_t i = 0; i < ring.size() && nodes.size() < replicas; ++i) {
+      uint64_t realId = virtual_to_real.at(*it);
+      if (std::find(nodes.begin(), nodes.end(), realId) == nodes.end()) {
+        nodes.push_back(realId);
+      }
+      if (++it == ring.end()) {
+        it = ring.begin();
+      }
     }
-    ++it;
+
+    if (std::find(nodes.begin(), nodes.end(), id) != nodes.end()) {
+      ranges.push_back(std::make_pair(previous, *token));
+    }
+    previous = *token;
+  }
+  return ranges;
+}
+
+std::vector<uint64_t> DistributedBlockStore::get_dbs_virtual_ids(uint64_t id, size_t count) {
+  std::vector<uint64_t> virtualIds;
+  virtualIds.reserve(count);
+
+  // splitmix64 seeded with the node ID
+  uint64_t state = id;
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    virtualIds.push_back(z ^ (z >> 31));
+  }
+  return virtualIds;
+}
+
+// The first count distinct real nodes clockwise from id. The ring lock must be held.
+std::vector<uint64_t> DistributedBlockStore::walk_ring(uint64_t id, size_t count) const {
+  std::vector<uint64_t> nodes;
+  if (ring.empty()) {
+    return nodes;
+  }
+
+  auto it = ring.lower_bound(id);
+  for (size_t i = 0; i < ring.size() && nodes.size() < count; ++i) {
     if (it == ring.end()) {
       it = ring.begin();
     }
+    uint64_t nodeId = virtual_to_real.at(*it);
+    if (std::find(nodes.begin(), nodes.end(), nodeId) == nodes.end()) {
+      nodes.push_back(nodeId);
+    }
+    ++it;
   }
   return nodes;
 }
@@ -72,8 +196,35 @@ std::vector<uint64_t> DistributedBlockStore::get_dbs_nodes_for_block(uint64_t bl
 bool DistributedBlockStore::check_node_overloaded(uint64_t nodeId) const {
   auto nodeCapacity = node_capacities.find(nodeId);
   if (nodeCapacity != node_capacities.end()) {
-    return nodeCapacity->second.second >= nodeCapacity->second.first;
+    return nodeCapacity->second->usage >= nodeCapacity->second->capacity;
   }
   return false;  // Assume not overloaded if node is not found
 }
+
+bool DistributedBlockStore::check_node_over_bound(uint64_t nodeId) const {
+  auto nodeCapacity = node_capacities.find(nodeId);
+  uint64_t totalCapacity = total_capacity;
+  if (nodeCapacity == node_capacities.end() || totalCapacity == 0) return false;
+
+  // A node may hold at most (1 + epsilon) times its share of the total usage, counting the incoming block
+  double bound = (1.0 + loadEpsilon) * (double)nodeCapacity->second->capacity * (double)(total_usage + 1) / (double)totalCapacity;
+  return (double)nodeCapacity->second->usage > bound;
+}
+
+void DistributedBlockStore::insert_node(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity) {
+  for (auto vid : virtualIds) {
+    ring.insert(vid);
+    virtual_to_real[vid] = id;
+  }
+  ring_version++;
+
+  auto nodeCapacity = node_capacities.find(id);
+  if (nodeCapacity != node_capacities.end()) {
+    uint64_t oldCapacity = nodeCapacity->second->capacity.exchange(capacity);
+    total_capacity += capacity - oldCapacity;
+    return;
+  }
+  node_capacities[id] = std::unique_ptr<NodeCapacity>(new NodeCapacity(capacity));
+  total_capacity += capacity;
+}
 }  // namespace Kapua
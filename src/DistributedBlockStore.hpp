@@ -6,29 +6,88 @@
 //
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <set>
+#include <shared_mutex>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace Kapua {
 
+#define KAPUA_DBS_REPLICAS 5
+#define KAPUA_DBS_DEFAULT_LOAD_EPSILON 0.25
+// Nodes past a block's replicas that bounded load may put a new copy on in place of one over its bound
+#define KAPUA_DBS_SPARE_NODES 2
+
+// A point-in-time copy of a node's capacity and load, as reported in its Ping packets
+struct NodeLoad {
+  uint64_t capacity;     // Storage capacity in bytes
+  uint64_t usage;        // Storage used in bytes
+  uint32_t iops;         // Block operations per second
+  uint32_t queue_depth;  // Outstanding block operations
+};
+
 class DistributedBlockStore {
  public:
-  DistributedBlockStore(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity);
+  DistributedBlockStore(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity, double loadEpsilon = KAPUA_DBS_DEFAULT_LOAD_EPSILON);
   void add_dbs_node(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity);
   void remove_dbs_node(uint64_t id);
+  bool has_dbs_node(uint64_t id) const;
   void update_dbs_node_capacity(uint64_t id, uint64_t newCapacity);
-  std::vector<uint64_t> get_dbs_nodes_for_block(uint64_t blockId) const;
+  void update_dbs_node_load(uint64_t id, uint64_t usage, uint32_t iops, uint32_t queueDepth);
+  void add_dbs_node_usage(uint64_t id, int64_t delta);
+  bool get_dbs_node_load(uint64_t id, NodeLoad* load) const;
+  // Where a new copy of a block goes: replicas of its candidates, in ring order, passing over nodes above the
+  // bounded-load limit. This depends on load, so it is for writes only. Readers look through the candidates.
+  std::vector<uint64_t> get_dbs_nodes_for_block(uint64_t blockId, size_t replicas = KAPUA_DBS_REPLICAS) const;
+  // Every node get_dbs_nodes_for_block may choose for a block: its first replicas nodes clockwise, where copies
+  // usually are, then the spares. Ignores load, so readers and writers agree on it.
+  std::vector<uint64_t> get_dbs_candidates_for_block(uint64_t blockId, size_t replicas = KAPUA_DBS_REPLICAS) const;
+  // The first distinct nodes clockwise from id, ignoring load, so the answer only changes when membership does
+  std::vector<uint64_t> get_dbs_preference_list(uint64_t id, size_t count) const;
+  // The ring arcs (start, end] whose preference list of length replicas includes the node
+  std::vector<std::pair<uint64_t, uint64_t>> get_dbs_ranges_for_node(uint64_t id, size_t replicas) const;
+  // Incremented whenever ring membership changes
+  uint64_t get_dbs_ring_version() const { return ring_version; }
+  size_t get_dbs_node_count() const;
+  uint64_t get_dbs_total_capacity() const { return total_capacity; }
+  uint64_t get_dbs_total_usage() const { return total_usage; }
+
+  uint64_t get_dbs_node_id() const { return nodeId; }
+  double get_dbs_load_epsilon() const { return loadEpsilon; }
+
+  // Deterministic virtual IDs for a node, so all nodes agree on the ring position of a peer
+  static std::vector<uint64_t> get_dbs_virtual_ids(uint64_t id, size_t count);
 
  private:
+  // Capacity and usage counters are atomic so Ping handlers can update them without taking the ring lock exclusively
+  struct NodeCapacity {
+    std::atomic<uint64_t> capacity;
+    std::atomic<uint64_t> usage;
+    std::atomic<uint32_t> iops;
+    std::atomic<uint32_t> queue_depth;
+
+    NodeCapacity(uint64_t cap) : capacity(cap), usage(0), iops(0), queue_depth(0) {}
+  };
+
   uint64_t nodeId;
+  double loadEpsilon;
   std::set<uint64_t> ring;                                                      // Ring structure
   std::unordered_map<uint64_t, uint64_t> virtual_to_real;                       // Map virtual to real node IDs
-  std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> node_capacities;  // Node capacities and usage
+  std::unordered_map<uint64_t, std::unique_ptr<NodeCapacity>> node_capacities;  // Node capacities and usage
+  mutable std::shared_timed_mutex ring_mutex;                                   // Guards the structure of the above, not the counters
+
+  std::atomic<uint64_t> total_capacity;
+  std::atomic<uint64_t> total_usage;
+  std::atomic<uint64_t> ring_version;
 
+  std::vector<uint64_t> walk_ring(uint64_t id, size_t count) const;
   bool check_node_overloaded(uint64_t nodeId) const;
+  bool check_node_over_bound(uint64_t nodeId) const;
+  void insert_node(uint64_t id, const std::vector<uint64_t>& virtualIds, uint64_t capacity);
 };
 
 }  // namespace Kapua
@@ -0,0 +1,181 @@
+//
+// Kapua ErasureCodedStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "ErasureCodedStore.hpp"
+
+#include <cstring>
+#include <future>
+#include <memory>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+ErasureCodedStore::ErasureCodedStore(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, uint8_t dataFragments,
+                                     uint8_t parityFragments)
+    : _codec(dataFragments, parityFragments) {
+  _logger = new ScopedLogger("ErasureCodedStore", logger);
+  _dbs = dbs;
+  _transport = transport;
+
+  if (!_codec.is_valid()) {
+    _logger->error("Invalid RS(" + std::to_string(dataFragments) + ", " + std::to_string(parityFragments) + "), needs at least 1 data fragment and at most " +
+                   std::to_string(KAPUA_RS_MAX_FRAGMENTS) + " fragments in all");
+    return;
+  }
+  _logger->debug("RS(" + std::to_string(dataFragments) + ", " + std::to_string(parityFragments) + ") using " +
+                 ReedSolomon::kernel_to_string(_codec.get_kernel()) + " kernel");
+}
+
+ErasureCodedStore::~ErasureCodedStore() { delete _logger; }
+
+bool ErasureCodedStore::write_block(uint64_t blockId, const uint8_t* data, size_t len) {
+  if (!_codec.is_valid()) return false;
+  size_t k = _codec.get_data_fragments(), m = _codec.get_parity_fragments();
+  size_t fragmentSize = (len + k - 1) / k;
+
+  // Each fragment has a fixed node, the block's first k + m nodes clockwise, so reads find it without knowing the load
+  // at the time of writing. Bounded load doesn't apply to fragments.
+  std::vector<uint64_t> nodes = _dbs->get_dbs_preference_list(blockId, k + m);
+  if (nodes.empty()) {
+    _logger->error("No nodes available for block " + Util::to_hex64_str(blockId));
+    return false;
+  }
+  if (nodes.size() < k + m) {
+    _logger->warn("Only " + std::to_string(nodes.size()) + " nodes for " + std::to_string(k + m) + " fragments, some nodes will hold several");
+  }
+
+  // Each fragment is a header followed by its share of the block, the last data fragment zero padded
+  std::vector<std::vector<uint8_t>> fragments(k + m, std::vector<uint8_t>(sizeof(FragmentHeader) + fragmentSize, 0));
+  std::vector<uint8_t*> payloads(k + m);
+  for (size_t i = 0; i < k + m; i++) {
+    FragmentHeader header = {(uint32_t)len, (uint8_t)i, (uint8_t)k, (uint8_t)m, 0};
+    std::memcpy(fragments[i].data(), &header, sizeof(header));
+    payloads[i] = fragments[i].data() + sizeof(FragmentHeader);
+    if (i < k) {
+      size_t offset = i * fragmentSize;
+      if (offset < len) std::memcpy(payloads[i], data + offset, std::min(fragmentSize, len - offset));
+    }
+  }
+
+  _codec.encode(payloads.data(), payloads.data() + k, fragmentSize);
+
+  // Send all fragments in parallel
+  std::vector<std::future<bool>> puts;
+  for (size_t i = 0; i < k + m; i++) {
+    uint64_t nodeId = nodes[i % nodes.size()];
+    const std::vector<uint8_t>* fragment = &fragments[i];
+    puts.push_back(std::async(std::launch::async, [this, nodeId, blockId, i, fragment] {
+      if (!_transport->put_block(nodeId, get_fragment_id(blockId, (uint8_t)i), fragment->data(), fragment->size())) return false;
+      _dbs->add_dbs_node_usage(nodeId, (int64_t)fragment->size());
+      return true;
+    }));
+  }
+
+  size_t stored = 0;
+  for (auto& put : puts) stored += put.get() ? 1 : 0;
+
+  if (stored < k) {
+    _logger->error("Block " + Util::to_hex64_str(blockId) + " unrecoverable, only " + std::to_string(stored) + " fragments stored");
+    return false;
+  }
+  if (stored < k + m) {
+    _logger->warn("Block " + Util::to_hex64_str(blockId) + " degraded, " + std::to_string(stored) + "/" + std::to_string(k + m) + " fragments stored");
+  }
+  return true;
+}
+
+bool ErasureCodedStore::read_block(uint64_t blockId, std::vector<uint8_t>* data) {
+  if (!_codec.is_valid()) return false;
+  size_t k = _codec.get_data_fragments(), m = _codec.get_parity_fragments();
+
+  std::vector<uint64_t> nodes = _dbs->get_dbs_preference_list(blockId, k + m);
+  if (nodes.empty()) return false;
+
+  std::vector<std::vector<uint8_t>> fragments(k + m);
+  std::vector<bool> present(k + m, false);
+  size_t have = 0, next = 0;
+
+  // Fetch the data fragments first, as a full set needs no decoding. Each failed fetch is replaced by the next
+  // untried fragment, so a degraded read costs only as many extra fetches as there were failures.
+  size_t wanted = k;
+  while (have < k && next < k + m) {
+    std::vector<std::pair<size_t, std::future<bool>>> fetches;
+    for (; next < k + m && fetches.size() < wanted; next++) {
+      size_t index = next;
+      uint64_t nodeId = nodes[index % nodes.size()];
+      std::vector<uint8_t>* fragment = &fragments[index];
+      fetches.push_back(std::make_pair(index, std::async(std::launch::async, [this, nodeId, blockId, index, fragment] {
+                                         return _fetch_fragment(nodeId, blockId, (uint8_t)index, fragment);
+                                       })));
+    }
+
+    for (auto& fetch : fetches) {
+      if (fetch.second.get()) {
+        present[fetch.first] = true;
+        have++;
+      }
+    }
+    wanted = k - have;
+  }
+
+  if (have < k) {
+    _logger->error("Block " + Util::to_hex64_str(blockId) + " unreadable, only " + std::to_string(have) + " fragments available");
+    return false;
+  }
+
+  // Take the block layout from the first fragment, fragments of any other size are treated as missing
+  FragmentHeader header = {};
+  size_t fragmentSize = 0;
+  for (size_t i = 0; i < k + m; i++) {
+    if (!present[i]) continue;
+    std::memcpy(&header, fragments[i].data(), sizeof(header));
+    fragmentSize = fragments[i].size() - sizeof(FragmentHeader);
+    break;
+  }
+  if (header.block_length > fragmentSize * k) {
+    _logger->error("Block " + Util::to_hex64_str(blockId) + " has an invalid fragment header");
+    return false;
+  }
+
+  std::vector<uint8_t*> payloads(k + m);
+  std::unique_ptr<bool[]> presentFlags(new bool[k + m]);
+  for (size_t i = 0; i < k + m; i++) {
+    presentFlags[i] = present[i] && fragments[i].size() == sizeof(FragmentHeader) + fragmentSize;
+    if (!presentFlags[i]) fragments[i].assign(sizeof(FragmentHeader) + fragmentSize, 0);
+    payloads[i] = fragments[i].data() + sizeof(FragmentHeader);
+  }
+
+  if (!_codec.reconstruct(payloads.data(), presentFlags.get(), fragmentSize)) {
+    _logger->error("Block " + Util::to_hex64_str(blockId) + " reconstruction failed");
+    return false;
+  }
+
+  data->resize(header.block_length);
+  for (size_t i = 0; i < k && i * fragmentSize < header.block_length; i++) {
+    std::memcpy(data->data() + i * fragmentSize, payloads[i], std::min(fragmentSize, (size_t)header.block_length - i * fragmentSize));
+  }
+  return true;
+}
+
+uint64_t ErasureCodedStore::get_fragment_id(uint64_t blockId, uint8_t index) {
+  // Mix the index into the block ID so fragments of neighbouring blocks do not collide
+  uint64_t z = blockId ^ (((uint64_t)index + 1) * 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+bool ErasureCodedStore::_fetch_fragment(uint64_t nodeId, uint64_t blockId, uint8_t index, std::vector<uint8_t>* fragment) {
+  if (!_transport->get_block(nodeId, get_fragment_id(blockId, index), fragment)) return false;
+  if (fragment->size() < sizeof(FragmentHeader)) return false;
+
+  FragmentHeader header;
+  std::memcpy(&header, fragment->data(), sizeof(header));
+  return header.index == index && header.data_fragments == _codec.get_data_fragments() && header.parity_fragments == _codec.get_parity_fragments();
+}
+
+}  // namespace Kapua
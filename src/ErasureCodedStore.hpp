@@ -0,0 +1,52 @@
+//
+// Kapua ErasureCodedStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BlockTransport.hpp"
+#include "DistributedBlockStore.hpp"
+#include "Logger.hpp"
+#include "ReedSolomon.hpp"
+
+namespace Kapua {
+
+// Stores blocks as RS(k, m) fragments on k + m distinct nodes instead of as full replicas. Reads fetch the data
+// fragments in parallel and fall back to parity fragments for any that are missing.
+class ErasureCodedStore {
+ public:
+  ErasureCodedStore(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, uint8_t dataFragments, uint8_t parityFragments);
+  ~ErasureCodedStore();
+
+  bool write_block(uint64_t blockId, const uint8_t* data, size_t len);
+  bool read_block(uint64_t blockId, std::vector<uint8_t>* data);
+
+  ReedSolomon* get_codec() { return &_codec; }
+
+  static uint64_t get_fragment_id(uint64_t blockId, uint8_t index);
+
+ protected:
+#pragma pack(push, 1)
+  struct FragmentHeader {
+    uint32_t block_length;
+    uint8_t index;
+    uint8_t data_fragments;
+    uint8_t parity_fragments;
+    uint8_t reserved;
+  };
+#pragma pack(pop)
+
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  BlockTransport* _transport;
+  ReedSolomon _codec;
+
+  bool _fetch_fragment(uint64_t nodeId, uint64_t blockId, uint8_t index, std::vector<uint8_t>* fragment);
+};
+
+}  // namespace Kapua
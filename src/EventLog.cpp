@@ -0,0 +1,208 @@
+//
+// Kapua EventLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "EventLog.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include "Protocol.hpp"
+#include "Util.hpp"
+
+namespace Kapua {
+
+namespace {
+const char file_magic[4] = {'K', 'E', 'V', 'T'};
+const uint32_t file_version = 1;
+
+// Only the arguments an event has are written
+const size_t record_header_size = offsetof(EventLog::Record, args);
+
+// Indexed by EventId
+const EventLog::Format formats[EVENT_ID_COUNT] = {
+    {"None", ""},
+    {"PacketReceived", "Packet From {x}, {u} bytes ({p})"},
+    {"PacketSent", "Packet To {x}, {u} bytes ({p})"},
+    {"PacketRejected", "Packet From {a}:{n}, {u} bytes rejected"},
+    {"NodeAdded", "New node {x} at {a}:{n}"},
+    {"HandshakeComplete", "Node {x} Completed AES Handshake"},
+    {"NodeExpired", "Node {x} expired"},
+};
+}  // namespace
+
+EventLog::EventLog(Logger* logger, const std::string& filename, size_t ringSize)
+    : _running(false), _recorded(0), _dropped(0), _rings(ringSize, [this](std::vector<Record>& records) { _write(records); }) {
+  _logger = new ScopedLogger("EventLog", logger);
+  _filename = filename;
+  _file = nullptr;
+}
+
+EventLog::~EventLog() {
+  stop();
+  delete _logger;
+}
+
+bool EventLog::start() {
+  if (_file) {
+    _logger->warn("start called, but already running");
+    return false;
+  }
+
+  _file = fopen(_filename.c_str(), "wb");
+  if (!_file) {
+    _logger->error("Cannot open event log " + _filename + ": " + strerror(errno));
+    return false;
+  }
+  if (fwrite(file_magic, sizeof(file_magic), 1, _file) != 1 || fwrite(&file_version, sizeof(file_version), 1, _file) != 1) {
+    _logger->error("Cannot write event log " + _filename);
+    fclose(_file);
+    _file = nullptr;
+    return false;
+  }
+
+  _rings.start();
+  _running = true;
+  _logger->debug("Recording events to " + _filename);
+  return true;
+}
+
+void EventLog::stop() {
+  if (!_file) return;
+  _running = false;
+  _rings.stop();
+  fclose(_file);
+  _file = nullptr;
+}
+
+void EventLog::flush() {
+  if (!_running) return;
+  _rings.flush();
+}
+
+const EventLog::Format* EventLog::get_format(uint16_t id) {
+  if (id == EVENT_NONE || id >= EVENT_ID_COUNT) return nullptr;
+  return &formats[id];
+}
+
+std::string EventLog::format(const Record& record) {
+  char timestamp[sizeof "2011-10-08T07:07:09"];
+  time_t seconds = record.time_ns / 1000000000;
+  tm parts;
+  gmtime_r(&seconds, &parts);
+  strftime(timestamp, sizeof timestamp, "%FT%T", &parts);
+  char nanoseconds[sizeof ".000000000Z"];
+  snprintf(nanoseconds, sizeof nanoseconds, ".%09lluZ", (unsigned long long)(record.time_ns % 1000000000));
+
+  std::string line = std::string(timestamp) + nanoseconds + " [" + std::to_string(record.thread) + "] ";
+
+  const Format* format = get_format(record.id);
+  if (!format) {
+    line += "Unknown event " + std::to_string(record.id);
+    for (uint8_t i = 0; i < record.arg_count && i < KAPUA_EVENT_MAX_ARGS; i++) line += " " + std::to_string(record.args[i]);
+    return line;
+  }
+
+  line += format->name;
+  line += ": ";
+  uint8_t arg = 0;
+  for (const char* c = format->text; *c; c++) {
+    if (*c != '{' || !c[1] || c[2] != '}') {
+      line += *c;
+      continue;
+    }
+    uint64_t value = arg < record.arg_count ? record.args[arg] : 0;
+    arg++;
+    switch (c[1]) {
+      case 'x':
+        line += Util::to_hex64_str(value);
+        break;
+      case 'p':
+        line += Packet::packet_type_to_string((Packet::PacketType)value);
+        break;
+      case 'a': {
+        in_addr addr;
+        addr.s_addr = (uint32_t)value;
+        line += inet_ntoa(addr);
+        break;
+      }
+      case 'n':
+        line += std::to_string(ntohs((uint16_t)value));
+        break;
+      default:
+        line += std::to_string(value);
+    }
+    c += 2;
+  }
+  return line;
+}
+
+bool EventLog::read_file(Logger* logger, const std::string& filename, RecordCallback callback) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    logger->error("Cannot open event log " + filename + ": " + strerror(errno));
+    return false;
+  }
+
+  char magic[4];
+  uint32_t version;
+  if (fread(magic, sizeof(magic), 1, file) != 1 || std::memcmp(magic, file_magic, sizeof(magic)) != 0 || fread(&version, sizeof(version), 1, file) != 1) {
+    logger->error(filename + " is not an event log");
+    fclose(file);
+    return false;
+  }
+  if (version != file_version) {
+    logger->error(filename + " is event log version " + std::to_string(version) + ", expected " + std::to_string(file_version));
+    fclose(file);
+    return false;
+  }
+
+  Record record;
+  bool ok = true;
+  while (fread(&record, record_header_size, 1, file) == 1) {
+    if (record.arg_count > KAPUA_EVENT_MAX_ARGS || fread(record.args, sizeof(uint64_t), record.arg_count, file) != record.arg_count) {
+      // A node that died mid-write leaves a partial last record
+      logger->warn(filename + " ends with a damaged record");
+      ok = false;
+      break;
+    }
+    callback(record);
+  }
+  fclose(file);
+  return ok;
+}
+
+void EventLog::_record(EventId id, const uint64_t* args, uint8_t count) {
+  ThreadRings<Record>::Ring* ring = _rings.get_ring();
+  Record* record = _rings.reserve(ring);
+  if (!record) {
+    _dropped++;
+    return;
+  }
+
+  record->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  record->id = id;
+  record->arg_count = count;
+  record->reserved = 0;
+  record->thread = ring->thread;
+  std::memcpy(record->args, args, count * sizeof(uint64_t));
+  _rings.publish(ring);
+  _recorded++;
+}
+
+void EventLog::_write(std::vector<Record>& records) {
+  if (records.empty()) return;
+  std::vector<uint8_t> out;
+  out.reserve(records.size() * sizeof(Record));
+  for (const Record& record : records) {
+    const uint8_t* data = (const uint8_t*)&record;
+    out.insert(out.end(), data, data + record_header_size + record.arg_count * sizeof(uint64_t));
+  }
+  if (fwrite(out.data(), out.size(), 1, _file) != 1 || fflush(_file) != 0) _logger->error("Cannot write event log " + _filename);
+}
+
+}  // namespace Kapua
@@ -0,0 +1,102 @@
+//
+// Kapua EventLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "ThreadRings.hpp"
+
+namespace Kapua {
+
+#define KAPUA_EVENT_LOG_RING_SIZE 8192
+#define KAPUA_EVENT_MAX_ARGS 4
+
+// Every event the node records. IDs are written to event files, so never renumber them - only add new ones at the end.
+enum EventId : uint16_t {
+  EVENT_NONE = 0,
+  EVENT_PACKET_RECEIVED = 1,    // from node, bytes, packet type
+  EVENT_PACKET_SENT = 2,        // to node, bytes, packet type
+  EVENT_PACKET_REJECTED = 3,    // ip4 address, port, bytes
+  EVENT_NODE_ADDED = 4,         // node, ip4 address, port
+  EVENT_HANDSHAKE_COMPLETE = 5, // node
+  EVENT_NODE_EXPIRED = 6,       // node
+  EVENT_ID_COUNT
+};
+
+// Records events as a format ID plus raw arguments, leaving the formatting into text to whoever reads the file later.
+//
+// Recording is cheap enough to leave on for every packet: each thread writes fixed size records into its own ring, with
+// no lock and no string building, and a writer thread appends them to the file in batches. A record's text comes from
+// its format, where each {} placeholder takes the next argument: {x} as a node ID, {u} as a number, {p} as a packet
+// type, {a} as an IPv4 address and {n} as a port, both in network order.
+class EventLog {
+ public:
+#pragma pack(push, 1)
+  struct Record {
+    uint64_t time_ns;  // Since the Unix epoch
+    uint16_t id;
+    uint8_t arg_count;
+    uint8_t reserved;
+    uint32_t thread;  // Numbered from 1 in the order threads first record
+    uint64_t args[KAPUA_EVENT_MAX_ARGS];
+  };
+#pragma pack(pop)
+
+  struct Format {
+    const char* name;
+    const char* text;
+  };
+
+  typedef std::function<void(const Record& record)> RecordCallback;
+
+  EventLog(Logger* logger, const std::string& filename, size_t ringSize = KAPUA_EVENT_LOG_RING_SIZE);
+  ~EventLog();
+
+  bool start();
+  void stop();
+
+  // Does nothing unless started
+  template <class... Args>
+  void record(EventId id, Args... args) {
+    static_assert(sizeof...(Args) <= KAPUA_EVENT_MAX_ARGS, "Too many event arguments");
+    if (!_running.load(std::memory_order_relaxed)) return;
+    uint64_t values[] = {0, (uint64_t)args...};
+    _record(id, values + 1, sizeof...(Args));
+  }
+
+  // Wait until every event recorded before the call is in the file
+  void flush();
+
+  uint64_t get_recorded() { return _recorded; }
+  uint64_t get_dropped() { return _dropped; }
+
+  // Reading files back
+  static const Format* get_format(uint16_t id);
+  static std::string format(const Record& record);
+  static bool read_file(Logger* logger, const std::string& filename, RecordCallback callback);
+
+ protected:
+  Logger* _logger;
+  std::string _filename;
+  FILE* _file;
+
+  std::atomic<bool> _running;
+  std::atomic<uint64_t> _recorded;
+  std::atomic<uint64_t> _dropped;
+
+  ThreadRings<Record> _rings;
+
+  void _record(EventId id, const uint64_t* args, uint8_t count);
+  void _write(std::vector<Record>& records);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,462 @@
+//
+// Kapua FileSystem class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "FileSystem.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#include "Blake3.hpp"
+#include "Util.hpp"
+
+namespace Kapua {
+
+FileReader::FileReader(FileSystem* fs, const FileInode& inode) : _fs(fs), _inode(inode), _position(0) {}
+
+FileReader::~FileReader() {
+  // Wait for fetches still in flight, which happens as their futures are destroyed, before the version can be deleted
+  _chunks.clear();
+  _fs->_release_reader(_inode);
+}
+
+ssize_t FileReader::read(uint8_t* buffer, size_t len) {
+  if (_position >= _inode.size || len == 0) return 0;
+
+  uint64_t index = _position / _inode.chunk_size;
+  size_t within = _position % _inode.chunk_size;
+
+  // Chunks behind the reader are done with; keep the window ahead of it full
+  _chunks.erase(_chunks.begin(), _chunks.lower_bound(index));
+  uint64_t last = (_inode.size - 1) / _inode.chunk_size;
+  for (uint64_t i = index; i <= last && i < index + std::max(_fs->_options.readahead, (size_t)1); i++) _prefetch(i);
+
+  std::shared_ptr<std::vector<uint8_t>> chunk = _chunks[index].get();
+  if (!chunk) {
+    _chunks.erase(index);
+    return -1;
+  }
+
+  size_t count = std::min(len, chunk->size() - within);
+  std::memcpy(buffer, chunk->data() + within, count);
+  _position += count;
+  return count;
+}
+
+bool FileReader::seek(uint64_t offset) {
+  if (offset > _inode.size) return false;
+  _position = offset;
+
+  // Drop anything outside the new window
+  uint64_t index = offset / _inode.chunk_size;
+  for (auto it = _chunks.begin(); it != _chunks.end();) {
+    if (it->first < index || it->first >= index + _fs->_options.readahead) {
+      it = _chunks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return true;
+}
+
+void FileReader::_prefetch(uint64_t index) {
+  if (_chunks.find(index) != _chunks.end()) return;
+
+  FileSystem* fs = _fs;
+  FileInode inode = _inode;
+  _chunks[index] = std::async(std::launch::async, [fs, inode, index]() {
+                     std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
+                     if (!fs->_fetch_chunk(inode, index, data.get())) data.reset();
+                     return data;
+                   }).share();
+}
+
+FileWriter::FileWriter(FileSystem* fs, uint64_t parent, const std::string& name, const FileInode& inode, bool exists)
+    : _fs(fs), _parent(parent), _name(name), _inode(inode), _exists(exists), _next_chunk(0), _failed(false), _closed(false) {
+  _buffer.reserve(_inode.chunk_size);
+}
+
+FileWriter::~FileWriter() {
+  // An unclosed writer publishes nothing, but must not leave writes running against it
+  if (!_closed) _drain(0);
+}
+
+bool FileWriter::write(const uint8_t* data, size_t len) {
+  if (_closed || _failed) return false;
+
+  while (len > 0) {
+    size_t count = std::min(len, (size_t)_inode.chunk_size - _buffer.size());
+    _buffer.insert(_buffer.end(), data, data + count);
+    data += count;
+    len -= count;
+    _inode.size += count;
+    if (_buffer.size() == _inode.chunk_size && !_submit()) return false;
+  }
+  return true;
+}
+
+bool FileWriter::close() {
+  if (_closed) return !_failed;
+  if (!_buffer.empty()) _submit();
+  _drain(0);
+  _closed = true;
+  if (_failed) {
+    _fs->_logger->warn("Write of " + _name + " failed, file not changed");
+    return false;
+  }
+
+  // The new contents are in place, so switch the inode over to them, and then retire what they replace. That is read
+  // again here, as another writer may have replaced the file since this one started.
+  FileInode previous;
+  bool replacing = _exists && _fs->_load_inode(_inode.id, &previous) && previous.generation != _inode.generation;
+  _inode.mtime = time(nullptr);
+  if (!_fs->_store_inode(_inode) || (!_exists && !_fs->_link(_parent, _name, _inode))) {
+    _failed = true;
+    return false;
+  }
+  if (replacing) _fs->_retire(previous);
+  return true;
+}
+
+bool FileWriter::_submit() {
+  if (!_drain(std::max(_fs->_options.write_behind, (size_t)1) - 1)) return false;
+
+  FileSystem* fs = _fs;
+  FileInode inode = _inode;
+  uint64_t index = _next_chunk++;
+  std::shared_ptr<std::vector<uint8_t>> chunk = std::make_shared<std::vector<uint8_t>>();
+  chunk->swap(_buffer);
+  _buffer.reserve(_inode.chunk_size);
+
+  _in_flight.push_back(std::async(std::launch::async, [fs, inode, index, chunk]() { return fs->_store_chunk(inode, index, *chunk); }));
+  return true;
+}
+
+bool FileWriter::_drain(size_t limit) {
+  while (_in_flight.size() > limit) {
+    if (!_in_flight.front().get()) _failed = true;
+    _in_flight.pop_front();
+  }
+  return !_failed;
+}
+
+FileSystem::FileSystem(Logger* logger, KVStore* kv, DistributedBlockStore* dbs, BlockTransport* transport, ReplicationPipeline* pipeline,
+                       FileSystemOptions options)
+    : _random(std::random_device()()), _chunks_read(0), _chunks_written(0), _read_retries(0), _chunks_removed(0) {
+  _logger = new ScopedLogger("FileSystem", logger);
+  _kv = kv;
+  _dbs = dbs;
+  _transport = transport;
+  _pipeline = pipeline;
+  _options = options;
+  if (_options.chunk_size == 0) _options.chunk_size = KAPUA_FS_DEFAULT_CHUNK_SIZE;
+}
+
+FileSystem::~FileSystem() { delete _logger; }
+
+bool FileSystem::mkdir(const std::string& path) {
+  std::vector<std::string> components;
+  if (!split_path(path, &components) || components.empty()) return false;
+
+  FileInode parent;
+  if (!_resolve(components, components.size() - 1, &parent) || !parent.directory) return false;
+
+  std::vector<DirEntry> entries;
+  if (!_load_dir(parent.id, &entries)) return false;
+  for (const DirEntry& entry : entries) {
+    if (entry.name == components.back()) return false;
+  }
+
+  FileInode inode = {_random_id(), true, 0, 0, 0, (int64_t)time(nullptr)};
+  return _store_inode(inode) && _link(parent.id, components.back(), inode);
+}
+
+bool FileSystem::stat(const std::string& path, FileStat* stat) {
+  std::vector<std::string> components;
+  FileInode inode;
+  if (!split_path(path, &components) || !_resolve(components, components.size(), &inode)) return false;
+
+  *stat = {inode.id, inode.directory, inode.size, inode.chunk_size, inode.generation, inode.mtime};
+  return true;
+}
+
+bool FileSystem::list(const std::string& path, std::vector<DirEntry>* entries) {
+  std::vector<std::string> components;
+  FileInode inode;
+  if (!split_path(path, &components) || !_resolve(components, components.size(), &inode) || !inode.directory) return false;
+  return _load_dir(inode.id, entries);
+}
+
+bool FileSystem::remove(const std::string& path) {
+  std::vector<std::string> components;
+  if (!split_path(path, &components) || components.empty()) return false;
+
+  FileInode parent;
+  if (!_resolve(components, components.size() - 1, &parent) || !parent.directory) return false;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  std::vector<DirEntry> entries;
+  if (!_load_dir(parent.id, &entries)) return false;
+  auto it = std::find_if(entries.begin(), entries.end(), [&](const DirEntry& entry) { return entry.name == components.back(); });
+  if (it == entries.end()) return false;
+
+  uint64_t id = it->inode;
+  FileInode inode;
+  if (!_load_inode(id, &inode)) return false;
+  if (it->directory) {
+    std::vector<DirEntry> children;
+    if (!_load_dir(id, &children) || !children.empty()) return false;
+  }
+
+  entries.erase(it);
+  if (!_store_dir(parent.id, entries)) return false;
+  _kv->remove(_inode_key(id));
+  _kv->remove(_dir_key(id));
+  lock.unlock();
+  if (!inode.directory) _retire(inode);
+  return true;
+}
+
+std::unique_ptr<FileWriter> FileSystem::create(const std::string& path) {
+  std::vector<std::string> components;
+  if (!split_path(path, &components) || components.empty()) return nullptr;
+
+  FileInode parent;
+  if (!_resolve(components, components.size() - 1, &parent) || !parent.directory) return nullptr;
+
+  std::vector<DirEntry> entries;
+  if (!_load_dir(parent.id, &entries)) return nullptr;
+
+  FileInode inode = {_random_id(), false, 0, _options.chunk_size, 0, 0};
+  bool exists = false;
+  for (const DirEntry& entry : entries) {
+    if (entry.name != components.back()) continue;
+    if (entry.directory || !_load_inode(entry.inode, &inode)) return nullptr;
+    exists = true;
+  }
+
+  // A new generation gives the new contents their own chunk IDs
+  inode.size = 0;
+  inode.chunk_size = _options.chunk_size;
+  inode.generation = _random_id();
+  return std::unique_ptr<FileWriter>(new FileWriter(this, parent.id, components.back(), inode, exists));
+}
+
+std::unique_ptr<FileReader> FileSystem::open(const std::string& path) {
+  std::vector<std::string> components;
+  FileInode inode;
+  if (!split_path(path, &components) || !_resolve(components, components.size(), &inode) || inode.directory) return nullptr;
+
+  std::lock_guard<std::mutex> lock(_versions_mutex);
+  _readers[std::make_pair(inode.id, inode.generation)]++;
+  return std::unique_ptr<FileReader>(new FileReader(this, inode));
+}
+
+uint64_t FileSystem::get_chunk_id(uint64_t inode, uint64_t generation, uint64_t index) {
+  uint64_t key[3] = {inode, generation, index};
+  Blake3Hash hash;
+  Blake3::hash((const uint8_t*)key, sizeof(key), &hash);
+  return hash.to_uint64();
+}
+
+bool FileSystem::split_path(const std::string& path, std::vector<std::string>* components) {
+  components->clear();
+  if (path.empty() || path[0] != '/') return false;
+
+  size_t start = 1;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    std::string name = path.substr(start, end - start);
+    if (name == "." || name == ".." || name.size() > KAPUA_FS_MAX_NAME_LENGTH) return false;
+    if (!name.empty()) components->push_back(name);
+    start = end + 1;
+  }
+  return true;
+}
+
+bool FileSystem::_resolve(const std::vector<std::string>& components, size_t count, FileInode* inode) {
+  uint64_t id = KAPUA_FS_ROOT_INODE;
+  std::vector<DirEntry> entries;
+
+  // Walk the directories, loading only the final inode
+  for (size_t i = 0; i < count; i++) {
+    if (!_load_dir(id, &entries)) return false;
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const DirEntry& entry) { return entry.name == components[i]; });
+    if (it == entries.end() || (i + 1 < count && !it->directory)) return false;
+    id = it->inode;
+  }
+  return _load_inode(id, inode);
+}
+
+bool FileSystem::_load_inode(uint64_t id, FileInode* inode) {
+  std::vector<uint8_t> value;
+  KVStore::Result result = _kv->get(_inode_key(id), &value);
+
+  // The root exists without being created
+  if (result == KVStore::Result::NotFound && id == KAPUA_FS_ROOT_INODE) {
+    *inode = {KAPUA_FS_ROOT_INODE, true, 0, 0, 0, 0};
+    return true;
+  }
+  if (result != KVStore::Result::Found) return false;
+  if (value.size() != sizeof(InodeRecord)) {
+    _logger->error("Inode " + Util::to_hex64_str(id) + " is damaged");
+    return false;
+  }
+
+  InodeRecord record;
+  std::memcpy(&record, value.data(), sizeof(record));
+  // Reads divide by the chunk size
+  if (!record.directory && record.chunk_size == 0) {
+    _logger->error("Inode " + Util::to_hex64_str(id) + " has no chunk size");
+    return false;
+  }
+  *inode = {id, record.directory != 0, record.size, record.chunk_size, record.generation, record.mtime};
+  return true;
+}
+
+bool FileSystem::_store_inode(const FileInode& inode) {
+  InodeRecord record = {inode.directory, inode.size, inode.chunk_size, inode.generation, inode.mtime};
+  return _kv->set(_inode_key(inode.id), (const uint8_t*)&record, sizeof(record));
+}
+
+bool FileSystem::_load_dir(uint64_t id, std::vector<DirEntry>* entries) {
+  entries->clear();
+  std::vector<uint8_t> value;
+  KVStore::Result result = _kv->get(_dir_key(id), &value);
+  if (result == KVStore::Result::NotFound) return true;
+  if (result != KVStore::Result::Found) return false;
+
+  size_t offset = 0;
+  while (offset + sizeof(DirRecord) <= value.size()) {
+    DirRecord record;
+    std::memcpy(&record, value.data() + offset, sizeof(record));
+    offset += sizeof(record);
+    if (offset + record.name_length > value.size()) break;
+    entries->push_back({std::string((const char*)value.data() + offset, record.name_length), record.inode, record.directory != 0});
+    offset += record.name_length;
+  }
+  if (offset != value.size()) {
+    _logger->error("Directory " + Util::to_hex64_str(id) + " is damaged");
+    return false;
+  }
+  return true;
+}
+
+bool FileSystem::_store_dir(uint64_t id, const std::vector<DirEntry>& entries) {
+  std::vector<uint8_t> value;
+  for (const DirEntry& entry : entries) {
+    DirRecord record = {entry.inode, entry.directory, (uint8_t)entry.name.size()};
+    value.insert(value.end(), (const uint8_t*)&record, (const uint8_t*)&record + sizeof(record));
+    value.insert(value.end(), entry.name.begin(), entry.name.end());
+  }
+  if (value.size() > KAPUA_KV_MAX_VALUE_LENGTH) {
+    _logger->error("Directory " + Util::to_hex64_str(id) + " is full");
+    return false;
+  }
+  return _kv->set(_dir_key(id), value.data(), value.size());
+}
+
+bool FileSystem::_link(uint64_t parent, const std::string& name, const FileInode& inode) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::vector<DirEntry> entries;
+  if (!_load_dir(parent, &entries)) return false;
+
+  auto it = std::find_if(entries.begin(), entries.end(), [&](const DirEntry& entry) { return entry.name == name; });
+  if (it != entries.end()) {
+    *it = {name, inode.id, inode.directory};
+  } else {
+    entries.push_back({name, inode.id, inode.directory});
+  }
+  return _store_dir(parent, entries);
+}
+
+uint64_t FileSystem::_random_id() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  uint64_t id;
+  do {
+    id = _random();
+  } while (id == KAPUA_FS_ROOT_INODE || id == 0);
+  return id;
+}
+
+bool FileSystem::_fetch_chunk(const FileInode& inode, uint64_t index, std::vector<uint8_t>* data) {
+  uint64_t id = get_chunk_id(inode.id, inode.generation, index);
+  size_t expected = (size_t)std::min<uint64_t>(inode.chunk_size, inode.size - index * inode.chunk_size);
+
+  std::vector<uint64_t> nodes = _dbs->get_dbs_candidates_for_block(id, _options.replicas);
+  if (nodes.empty()) return false;
+
+  // Start each chunk on a different one of the replicas, so a reader's window of fetches is spread over every node
+  // holding the file. The spares after them are tried last, as bounded load only sometimes puts a copy there.
+  size_t replicas = std::min(nodes.size(), _options.replicas);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    uint64_t nodeId = i < replicas ? nodes[(index + i) % replicas] : nodes[i];
+    if (_transport->get_block(nodeId, id, data) && data->size() == expected) {
+      _chunks_read++;
+      return true;
+    }
+    _read_retries++;
+  }
+  _logger->warn("Chunk " + std::to_string(index) + " of inode " + Util::to_hex64_str(inode.id) + " unreadable");
+  return false;
+}
+
+bool FileSystem::_store_chunk(const FileInode& inode, uint64_t index, const std::vector<uint8_t>& data) {
+  uint64_t id = get_chunk_id(inode.id, inode.generation, index);
+  if (!_pipeline->write(id, data.data(), data.size(), ReplicationPipeline::Consistency::Quorum)) return false;
+  _chunks_written++;
+  return true;
+}
+
+void FileSystem::_retire(const FileInode& inode) {
+  {
+    std::lock_guard<std::mutex> lock(_versions_mutex);
+    auto key = std::make_pair(inode.id, inode.generation);
+    if (_readers.find(key) != _readers.end()) {
+      _retired[key] = inode;
+      return;
+    }
+  }
+  _remove_chunks(inode);
+}
+
+void FileSystem::_release_reader(const FileInode& inode) {
+  FileInode retired;
+  {
+    std::lock_guard<std::mutex> lock(_versions_mutex);
+    auto key = std::make_pair(inode.id, inode.generation);
+    auto readers = _readers.find(key);
+    if (readers == _readers.end() || --readers->second > 0) return;
+    _readers.erase(readers);
+
+    auto it = _retired.find(key);
+    if (it == _retired.end()) return;
+    retired = it->second;
+    _retired.erase(it);
+  }
+  _remove_chunks(retired);
+}
+
+void FileSystem::_remove_chunks(const FileInode& inode) {
+  // A copy may be on any candidate, as bounded load chose among them when the chunk was written
+  uint64_t chunks = (inode.size + inode.chunk_size - 1) / inode.chunk_size;
+  for (uint64_t index = 0; index < chunks; index++) {
+    uint64_t id = get_chunk_id(inode.id, inode.generation, index);
+    int64_t len = (int64_t)std::min<uint64_t>(inode.chunk_size, inode.size - index * inode.chunk_size);
+    for (uint64_t nodeId : _dbs->get_dbs_candidates_for_block(id, _options.replicas)) {
+      if (!_transport->remove_block(nodeId, id)) continue;
+      _dbs->add_dbs_node_usage(nodeId, -len);
+      _chunks_removed++;
+    }
+  }
+}
+
+std::string FileSystem::_inode_key(uint64_t id) { return "fs:inode:" + Util::to_hex64_str(id); }
+
+std::string FileSystem::_dir_key(uint64_t id) { return "fs:dir:" + Util::to_hex64_str(id); }
+
+}  // namespace Kapua
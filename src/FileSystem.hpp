@@ -0,0 +1,220 @@
+//
+// Kapua FileSystem class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BlockTransport.hpp"
+#include "DistributedBlockStore.hpp"
+#include "KVStore.hpp"
+#include "Logger.hpp"
+#include "ReplicationPipeline.hpp"
+
+namespace Kapua {
+
+#define KAPUA_FS_ROOT_INODE 1
+#define KAPUA_FS_DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+#define KAPUA_FS_DEFAULT_READAHEAD 8
+#define KAPUA_FS_DEFAULT_WRITE_BEHIND 8
+#define KAPUA_FS_MAX_NAME_LENGTH 255
+
+struct FileSystemOptions {
+  uint32_t chunk_size = KAPUA_FS_DEFAULT_CHUNK_SIZE;   // For new files
+  size_t readahead = KAPUA_FS_DEFAULT_READAHEAD;        // Chunks fetched ahead of a reader
+  size_t write_behind = KAPUA_FS_DEFAULT_WRITE_BEHIND;  // Chunk writes a writer keeps in flight
+  size_t replicas = KAPUA_DBS_REPLICAS;
+};
+
+struct FileStat {
+  uint64_t inode;
+  bool directory;
+  uint64_t size;
+  uint32_t chunk_size;
+  uint64_t generation;  // Changes whenever the contents are rewritten
+  int64_t mtime;
+};
+
+struct DirEntry {
+  std::string name;
+  uint64_t inode;
+  bool directory;
+};
+
+struct FileInode {
+  uint64_t id;
+  bool directory;
+  uint64_t size;
+  uint32_t chunk_size;
+  uint64_t generation;  // Chunk IDs derive from this, so rewriting a file never disturbs readers of the old contents
+  int64_t mtime;
+};
+
+class FileSystem;
+
+// Streams a file from the start or any offset. Up to readahead chunks are fetched in parallel ahead of the read
+// position, each from a different replica where possible, so a sequential read draws on many nodes at once. A reader
+// sees the file as it was when opened, as the chunks of a version are kept until the last reader of it on this node
+// is destroyed.
+class FileReader {
+ public:
+  ~FileReader();
+
+  // Read up to len bytes. Returns the bytes read, 0 at the end of the file, or -1 if a chunk could not be fetched.
+  ssize_t read(uint8_t* buffer, size_t len);
+  bool seek(uint64_t offset);
+  uint64_t tell() const { return _position; }
+  uint64_t get_size() const { return _inode.size; }
+
+ protected:
+  friend class FileSystem;
+  typedef std::shared_future<std::shared_ptr<std::vector<uint8_t>>> Chunk;
+
+  FileReader(FileSystem* fs, const FileInode& inode);
+
+  FileSystem* _fs;
+  FileInode _inode;
+  uint64_t _position;
+  std::map<uint64_t, Chunk> _chunks;  // Fetched or in flight, by index
+
+  void _prefetch(uint64_t index);
+};
+
+// Writes a new version of a file. Data is cut into chunks, and up to write_behind of them are replicated in parallel
+// while the caller carries on writing. The file only changes when close succeeds, which waits for every chunk to reach
+// a quorum of its replicas and then publishes the new inode. The version it replaces is then deleted.
+class FileWriter {
+ public:
+  ~FileWriter();
+
+  bool write(const uint8_t* data, size_t len);
+  bool close();
+
+ protected:
+  friend class FileSystem;
+
+  FileWriter(FileSystem* fs, uint64_t parent, const std::string& name, const FileInode& inode, bool exists);
+
+  FileSystem* _fs;
+  uint64_t _parent;
+  std::string _name;
+  FileInode _inode;
+  bool _exists;
+  std::vector<uint8_t> _buffer;
+  uint64_t _next_chunk;
+  std::deque<std::future<bool>> _in_flight;
+  bool _failed;
+  bool _closed;
+
+  bool _submit();
+  bool _drain(size_t limit);
+};
+
+// A file system over the block and key-value stores. File contents are cut into fixed size chunks, stored as blocks
+// whose IDs derive from the inode, so block placement comes from DistributedBlockStore and no per-chunk metadata is
+// kept. Inodes and directories are key-value records. Directory updates are read-modify-write and last writer wins,
+// like the key-value store beneath them.
+//
+// Chunks of a version that has been replaced or removed are deleted from every candidate node, unless a reader on this
+// node still has it open, in which case they go when the last such reader does. Readers on other nodes are not
+// tracked, and fail if their version is deleted under them.
+class FileSystem {
+ public:
+  FileSystem(Logger* logger, KVStore* kv, DistributedBlockStore* dbs, BlockTransport* transport, ReplicationPipeline* pipeline,
+             FileSystemOptions options = FileSystemOptions());
+  ~FileSystem();
+
+  bool mkdir(const std::string& path);
+  bool stat(const std::string& path, FileStat* stat);
+  bool list(const std::string& path, std::vector<DirEntry>* entries);
+  // Remove a file or an empty directory
+  bool remove(const std::string& path);
+
+  // Create a file, or replace its contents once the writer is closed
+  std::unique_ptr<FileWriter> create(const std::string& path);
+  std::unique_ptr<FileReader> open(const std::string& path);
+
+  uint64_t get_chunks_read() { return _chunks_read; }
+  uint64_t get_chunks_written() { return _chunks_written; }
+  uint64_t get_read_retries() { return _read_retries; }
+  uint64_t get_chunks_removed() { return _chunks_removed; }
+
+  static uint64_t get_chunk_id(uint64_t inode, uint64_t generation, uint64_t index);
+  static bool split_path(const std::string& path, std::vector<std::string>* components);
+
+ protected:
+  friend class FileReader;
+  friend class FileWriter;
+
+#pragma pack(push, 1)
+  struct InodeRecord {
+    uint8_t directory;
+    uint64_t size;
+    uint32_t chunk_size;
+    uint64_t generation;
+    int64_t mtime;
+  };
+
+  struct DirRecord {
+    uint64_t inode;
+    uint8_t directory;
+    uint8_t name_length;
+  };
+#pragma pack(pop)
+
+  Logger* _logger;
+  KVStore* _kv;
+  DistributedBlockStore* _dbs;
+  BlockTransport* _transport;
+  ReplicationPipeline* _pipeline;
+  FileSystemOptions _options;
+
+  std::mutex _mutex;  // Serialises this node's directory updates
+  std::mt19937_64 _random;
+
+  std::atomic<uint64_t> _chunks_read;
+  std::atomic<uint64_t> _chunks_written;
+  std::atomic<uint64_t> _read_retries;
+  std::atomic<uint64_t> _chunks_removed;
+
+  // Versions open for reading on this node, and those of them that have been replaced or removed since, by inode and
+  // generation
+  std::mutex _versions_mutex;
+  std::map<std::pair<uint64_t, uint64_t>, size_t> _readers;
+  std::map<std::pair<uint64_t, uint64_t>, FileInode> _retired;
+
+  bool _resolve(const std::vector<std::string>& components, size_t count, FileInode* inode);
+  bool _load_inode(uint64_t id, FileInode* inode);
+  bool _store_inode(const FileInode& inode);
+  bool _load_dir(uint64_t id, std::vector<DirEntry>* entries);
+  bool _store_dir(uint64_t id, const std::vector<DirEntry>& entries);
+  bool _link(uint64_t parent, const std::string& name, const FileInode& inode);
+  uint64_t _random_id();
+
+  bool _fetch_chunk(const FileInode& inode, uint64_t index, std::vector<uint8_t>* data);
+  bool _store_chunk(const FileInode& inode, uint64_t index, const std::vector<uint8_t>& data);
+
+  // A version is no longer the file's. Its chunks are deleted once no reader here has it open.
+  void _retire(const FileInode& inode);
+  void _release_reader(const FileInode& inode);
+  void _remove_chunks(const FileInode& inode);
+
+  static std::string _inode_key(uint64_t id);
+  static std::string _dir_key(uint64_t id);
+};
+
+}  // namespace Kapua
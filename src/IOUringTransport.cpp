@@ -0,0 +1,439 @@
+//
+// Kapua IOUringTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "IOUringTransport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// Provided buffer rings and multishot recvmsg arrived together, in the headers and kernels of Linux 6.0
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define KAPUA_IO_URING
+#endif
+#endif
+#endif
+
+namespace Kapua {
+
+#ifdef KAPUA_IO_URING
+
+namespace {
+
+// Marks the multishot receive's completions, and its cancellation's. Sends are marked with their slot.
+const uint64_t RECV_USER_DATA = UINT64_MAX;
+const uint64_t CANCEL_USER_DATA = UINT64_MAX - 1;
+const uint16_t BUFFER_GROUP = 0;
+
+// Each receive buffer holds the kernel's header, the sender's address, then the datagram, which is read as a Packet
+const size_t BUFFER_PAYLOAD_OFFSET = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in);
+const size_t BUFFER_SIZE = (BUFFER_PAYLOAD_OFFSET + sizeof(Packet) + 63) & ~(size_t)63;
+
+// Room for an encrypted packet, which is longer than the plaintext by its IV and padding
+const size_t SEND_BUFFER_SIZE = 2048;
+
+struct SendSlot {
+  msghdr msg;
+  iovec iov;
+  sockaddr_in addr;
+  uint8_t data[SEND_BUFFER_SIZE];
+};
+
+uint32_t load_acquire(uint32_t* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+void store_release(uint32_t* p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+}  // namespace
+
+#endif
+
+IOUringTransport::IOUringTransport(Logger* logger) : SocketTransport(logger, "IOUringTransport") {
+  _ring_fd = -1;
+  _sq_map = _cq_map = _sqes = nullptr;
+  _sq_map_size = _cq_map_size = _sqes_size = 0;
+  _sq_head = _sq_tail = _sq_mask = _sq_array = nullptr;
+  _cq_head = _cq_tail = _cq_mask = nullptr;
+  _cqes = nullptr;
+  _sq_local_tail = _sq_entries = 0;
+  _buffer_ring = nullptr;
+  _buffer_pool = nullptr;
+  _buffer_pool_size = 0;
+  _buffer_ring_tail = 0;
+  _completed_head = 0;
+  _recv_armed = false;
+  _recv_msg = nullptr;
+}
+
+IOUringTransport::~IOUringTransport() { close(); }
+
+bool IOUringTransport::open(uint16_t port) {
+  if (!SocketTransport::open(port)) return false;
+  if (!_setup_ring()) _logger->warn("io_uring unavailable, using plain socket calls");
+  return true;
+}
+
+void IOUringTransport::close() {
+  flush();
+  _teardown_ring();
+  SocketTransport::close();
+}
+
+#ifdef KAPUA_IO_URING
+
+bool IOUringTransport::_setup_ring() {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  // Completions are only looked for when the network thread enters the ring, so the kernel needn't interrupt it. Not
+  // IORING_SETUP_DEFER_TASKRUN, under which a multishot receive that has run out of buffers waits for the next datagram
+  // to arrive rather than ending, and those already waiting in the socket are stranded.
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  int fd = syscall(__NR_io_uring_setup, KAPUA_IO_URING_ENTRIES, &params);
+  if (fd < 0 && errno == EINVAL) {
+    std::memset(&params, 0, sizeof(params));
+    fd = syscall(__NR_io_uring_setup, KAPUA_IO_URING_ENTRIES, &params);
+  }
+  if (fd < 0) {
+    _logger->warn(std::string("io_uring_setup failed: ") + strerror(errno));
+    return false;
+  }
+  _ring_fd = fd;
+
+  // Map the queues
+  _sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  _cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) _sq_map_size = _cq_map_size = std::max(_sq_map_size, _cq_map_size);
+  _sq_map = mmap(nullptr, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (_sq_map == MAP_FAILED) {
+    _sq_map = nullptr;
+    _logger->warn(std::string("io_uring queue mapping failed: ") + strerror(errno));
+    _teardown_ring();
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    _cq_map = _sq_map;
+  } else {
+    _cq_map = mmap(nullptr, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (_cq_map == MAP_FAILED) {
+      _cq_map = nullptr;
+      _logger->warn(std::string("io_uring queue mapping failed: ") + strerror(errno));
+      _teardown_ring();
+      return false;
+    }
+  }
+  _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  _sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (_sqes == MAP_FAILED) {
+    _sqes = nullptr;
+    _logger->warn(std::string("io_uring queue mapping failed: ") + strerror(errno));
+    _teardown_ring();
+    return false;
+  }
+
+  uint8_t* sq = static_cast<uint8_t*>(_sq_map);
+  uint8_t* cq = static_cast<uint8_t*>(_cq_map);
+  _sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+  _sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+  _sq_mask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  _sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+  _cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+  _cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+  _cq_mask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  _cqes = cq + params.cq_off.cqes;
+  _sq_entries = params.sq_entries;
+  _sq_local_tail = *_sq_tail;
+
+  // The receive buffers, and the ring they are handed to the kernel through. Both are page aligned.
+  _buffer_pool_size = KAPUA_IO_URING_BUFFERS * BUFFER_SIZE + KAPUA_IO_URING_BUFFERS * sizeof(io_uring_buf);
+  void* pool = mmap(nullptr, _buffer_pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (pool == MAP_FAILED) {
+    _logger->warn(std::string("io_uring buffer allocation failed: ") + strerror(errno));
+    _teardown_ring();
+    return false;
+  }
+  _buffer_ring = pool;
+  _buffer_pool = static_cast<uint8_t*>(pool) + KAPUA_IO_URING_BUFFERS * sizeof(io_uring_buf);
+
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)_buffer_ring;
+  reg.ring_entries = KAPUA_IO_URING_BUFFERS;
+  reg.bgid = BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    _logger->warn(std::string("io_uring buffer ring registration failed: ") + strerror(errno));
+    // Not registered, so not to be unregistered
+    munmap(_buffer_ring, _buffer_pool_size);
+    _buffer_ring = nullptr;
+    _buffer_pool = nullptr;
+    _teardown_ring();
+    return false;
+  }
+  _buffer_ring_tail = 0;
+  for (uint16_t i = 0; i < KAPUA_IO_URING_BUFFERS; i++) _recycle(i);
+
+  _send_pool.assign(KAPUA_IO_URING_SEND_SLOTS * sizeof(SendSlot), 0);
+  _send_free.clear();
+  for (uint16_t i = 0; i < KAPUA_IO_URING_SEND_SLOTS; i++) _send_free.push_back(KAPUA_IO_URING_SEND_SLOTS - 1 - i);
+  _completed.clear();
+  _completed.reserve(KAPUA_IO_URING_BUFFERS);
+  _completed_head = 0;
+  _handed_out.clear();
+
+  msghdr* msg = new msghdr;
+  std::memset(msg, 0, sizeof(msghdr));
+  msg->msg_namelen = sizeof(sockaddr_in);
+  _recv_msg = msg;
+
+  // Kernels without multishot recvmsg fail it as soon as it is submitted, so give that a moment to show now, rather
+  // than mid run
+  if (!_arm_receive() || _enter(_sq_local_tail - *_sq_tail, 1, 1000) < 0) {
+    _logger->warn(std::string("io_uring submit failed: ") + strerror(errno));
+    _teardown_ring();
+    return false;
+  }
+  _reap();
+  if (!_recv_armed) {
+    _logger->warn("io_uring multishot recvmsg is not supported");
+    _teardown_ring();
+    return false;
+  }
+
+  _logger->debug("Using io_uring");
+  return true;
+}
+
+void IOUringTransport::_teardown_ring() {
+  if (_ring_fd == -1) return;
+
+  // The receive holds the socket open until it is cancelled, which closing the ring would leave to the kernel to do in its
+  // own time. Sends still queued are dropped.
+  if (_recv_armed && _sqes) {
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_get_sqe());
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = RECV_USER_DATA;
+    sqe->user_data = CANCEL_USER_DATA;
+    for (int tries = 0; _recv_armed && tries < 10; tries++) {
+      if (_enter(_sq_local_tail - *_sq_tail, 1, 10000) < 0) break;
+      _reap();
+    }
+  }
+  ::close(_ring_fd);
+  _ring_fd = -1;
+  if (_sqes) munmap(_sqes, _sqes_size);
+  if (_cq_map && _cq_map != _sq_map) munmap(_cq_map, _cq_map_size);
+  if (_sq_map) munmap(_sq_map, _sq_map_size);
+  if (_buffer_ring) munmap(_buffer_ring, _buffer_pool_size);
+  _sq_map = _cq_map = _sqes = _cqes = _buffer_ring = nullptr;
+  _buffer_pool = nullptr;
+  delete static_cast<msghdr*>(_recv_msg);
+  _recv_msg = nullptr;
+  _recv_armed = false;
+  _completed.clear();
+  _completed_head = 0;
+  _handed_out.clear();
+}
+
+bool IOUringTransport::wait(uint32_t timeoutUs) {
+  if (_ring_fd == -1) return SocketTransport::wait(timeoutUs);
+
+  _reap();
+  if (_completed_head < _completed.size()) return true;
+  if (!_recv_armed) _arm_receive();
+
+  // Submits anything queued at the same time
+  _enter(_sq_local_tail - *_sq_tail, 1, timeoutUs);
+  _reap();
+  return _completed_head < _completed.size();
+}
+
+size_t IOUringTransport::receive(Datagram* datagrams, size_t count) {
+  if (_ring_fd == -1) return SocketTransport::receive(datagrams, count);
+
+  // The caller is done with the last batch
+  for (uint16_t buffer : _handed_out) _recycle(buffer);
+  _handed_out.clear();
+  if (!_recv_armed) _arm_receive();
+
+  _reap();
+  size_t received = 0;
+  while (received < count && _completed_head < _completed.size()) {
+    uint16_t index = _completed[_completed_head++];
+    uint8_t* buffer = _buffer_pool + (size_t)index * BUFFER_SIZE;
+    io_uring_recvmsg_out* out = reinterpret_cast<io_uring_recvmsg_out*>(buffer);
+    _handed_out.push_back(index);
+
+    Datagram& datagram = datagrams[received++];
+    std::memset(&datagram.addr, 0, sizeof(sockaddr_in));
+    std::memcpy(&datagram.addr, buffer + sizeof(io_uring_recvmsg_out), std::min<size_t>(out->namelen, sizeof(sockaddr_in)));
+    datagram.data = buffer + BUFFER_PAYLOAD_OFFSET;
+    // As recvfrom would, a datagram too long for the buffer is cut short
+    datagram.size = std::min<size_t>(out->payloadlen, KAPUA_MAX_PACKET_SIZE);
+  }
+  if (_completed_head == _completed.size()) {
+    _completed.clear();
+    _completed_head = 0;
+  }
+  return received;
+}
+
+size_t IOUringTransport::send(const Datagram* datagrams, size_t count) {
+  if (_ring_fd == -1) return SocketTransport::send(datagrams, count);
+
+  for (size_t i = 0; i < count; i++) {
+    const Datagram& datagram = datagrams[i];
+    if (datagram.size > SEND_BUFFER_SIZE) return i;
+
+    // Out of slots or queue space, push what is queued and wait for some to complete
+    if (_send_free.empty() || _sq_local_tail - load_acquire(_sq_head) >= _sq_entries) {
+      _enter(_sq_local_tail - *_sq_tail, 1, 0);
+      _reap();
+      if (_send_free.empty() || _sq_local_tail - load_acquire(_sq_head) >= _sq_entries) return i;
+    }
+
+    uint16_t slot_index = _send_free.back();
+    _send_free.pop_back();
+    SendSlot* slot = reinterpret_cast<SendSlot*>(_send_pool.data()) + slot_index;
+    std::memcpy(slot->data, datagram.data, datagram.size);
+    slot->addr = datagram.addr;
+    slot->iov.iov_base = slot->data;
+    slot->iov.iov_len = datagram.size;
+    std::memset(&slot->msg, 0, sizeof(msghdr));
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = sizeof(sockaddr_in);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_get_sqe());
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = _socket_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = slot_index;
+  }
+  return count;
+}
+
+void IOUringTransport::flush() {
+  if (_ring_fd == -1 || _sq_local_tail == *_sq_tail) return;
+  _enter(_sq_local_tail - *_sq_tail, 0, 0);
+}
+
+bool IOUringTransport::_arm_receive() {
+  if (_sq_local_tail - load_acquire(_sq_head) >= _sq_entries) return false;
+
+  io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_get_sqe());
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = _socket_fd;
+  sqe->addr = (uint64_t)(uintptr_t)_recv_msg;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = RECV_USER_DATA;
+  _recv_armed = true;
+  return true;
+}
+
+void* IOUringTransport::_get_sqe() {
+  uint32_t index = _sq_local_tail & *_sq_mask;
+  io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_sqes) + index;
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  _sq_array[index] = index;
+  _sq_local_tail++;
+  return sqe;
+}
+
+int IOUringTransport::_enter(uint32_t toSubmit, uint32_t minComplete, uint32_t timeoutUs) {
+  // The kernel may read the entries once the tail moves
+  store_release(_sq_tail, _sq_local_tail);
+
+  unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+  if (!minComplete) return syscall(__NR_io_uring_enter, _ring_fd, toSubmit, 0, flags, nullptr, 0);
+
+  __kernel_timespec ts;
+  ts.tv_sec = timeoutUs / 1000000;
+  ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.ts = (uint64_t)(uintptr_t)&ts;
+  int result = syscall(__NR_io_uring_enter, _ring_fd, toSubmit, minComplete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  // Timing out, or a signal, isn't an error here
+  if (result < 0 && (errno == ETIME || errno == EINTR)) return 0;
+  return result;
+}
+
+void IOUringTransport::_reap() {
+  uint32_t head = *_cq_head;
+  uint32_t tail = load_acquire(_cq_tail);
+
+  for (; head != tail; head++) {
+    io_uring_cqe* cqe = static_cast<io_uring_cqe*>(_cqes) + (head & *_cq_mask);
+
+    if (cqe->user_data == CANCEL_USER_DATA) continue;
+    if (cqe->user_data != RECV_USER_DATA) {
+      // A send is done with its slot, whether it went or not
+      if (cqe->res < 0) _logger->debug(std::string("io_uring send failed: ") + strerror(-cqe->res));
+      _send_free.push_back((uint16_t)cqe->user_data);
+      continue;
+    }
+
+    // The receive stops when it runs out of buffers or fails, and is armed again at the next receive
+    if (!(cqe->flags & IORING_CQE_F_MORE)) _recv_armed = false;
+    if (cqe->res < 0) {
+      if (cqe->res != -ENOBUFS) _logger->debug(std::string("io_uring recvmsg failed: ") + strerror(-cqe->res));
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) continue;
+
+    uint16_t buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    io_uring_recvmsg_out* out = reinterpret_cast<io_uring_recvmsg_out*>(_buffer_pool + (size_t)buffer * BUFFER_SIZE);
+    // Nothing to read from a zero length datagram, or the headers alone
+    if (out->payloadlen == 0) {
+      _recycle(buffer);
+      continue;
+    }
+    _completed.push_back(buffer);
+  }
+
+  store_release(_cq_head, head);
+}
+
+void IOUringTransport::_recycle(uint16_t buffer) {
+  // The ring is an array of io_uring_buf, with the tail in the first one's reserved field. io_uring_buf_ring says as
+  // much, but its flexible array member lands at the wrong offset when compiled as C++, so it is only used for the tail.
+  io_uring_buf* entry = static_cast<io_uring_buf*>(_buffer_ring) + (_buffer_ring_tail & (KAPUA_IO_URING_BUFFERS - 1));
+  entry->addr = (uint64_t)(uintptr_t)(_buffer_pool + (size_t)buffer * BUFFER_SIZE);
+  entry->len = BUFFER_SIZE;
+  entry->bid = buffer;
+  _buffer_ring_tail++;
+  __atomic_store_n(&static_cast<io_uring_buf_ring*>(_buffer_ring)->tail, _buffer_ring_tail, __ATOMIC_RELEASE);
+}
+
+#else
+
+bool IOUringTransport::_setup_ring() {
+  _logger->warn("Built without io_uring");
+  return false;
+}
+
+void IOUringTransport::_teardown_ring() {}
+bool IOUringTransport::wait(uint32_t timeoutUs) { return SocketTransport::wait(timeoutUs); }
+size_t IOUringTransport::receive(Datagram* datagrams, size_t count) { return SocketTransport::receive(datagrams, count); }
+size_t IOUringTransport::send(const Datagram* datagrams, size_t count) { return SocketTransport::send(datagrams, count); }
+void IOUringTransport::flush() {}
+bool IOUringTransport::_arm_receive() { return false; }
+void* IOUringTransport::_get_sqe() { return nullptr; }
+int IOUringTransport::_enter(uint32_t toSubmit, uint32_t minComplete, uint32_t timeoutUs) { return -1; }
+void IOUringTransport::_reap() {}
+void IOUringTransport::_recycle(uint16_t buffer) {}
+
+#endif
+
+}  // namespace Kapua
@@ -0,0 +1,217 @@
+//
+// Kapua KVLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "KVLog.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+KVLog::KVLog(Logger* logger, uint64_t tombstoneGraceMs) : _log_bytes(0), _dead_bytes(0) {
+  _logger = new ScopedLogger("KVLog", logger);
+  _fd = -1;
+  _sync_writes = false;
+  _tombstone_grace_ms = tombstoneGraceMs;
+}
+
+KVLog::~KVLog() {
+  close();
+  delete _logger;
+}
+
+bool KVLog::open(const std::string& filename, bool syncWrites) {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  _filename = filename;
+  _sync_writes = syncWrites;
+
+  _fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    _logger->error("Cannot open " + filename + ": " + strerror(errno));
+    return false;
+  }
+  return _scan();
+}
+
+void KVLog::close() {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  if (_fd >= 0) ::close(_fd);
+  _fd = -1;
+  _index.clear();
+}
+
+bool KVLog::apply(const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len) {
+  if (key.empty() || key.size() > KAPUA_KV_MAX_KEY_LENGTH || len > KAPUA_KV_MAX_VALUE_LENGTH) return false;
+  if (deleted) len = 0;
+
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  if (_fd < 0) return false;
+
+  auto it = _index.find(key);
+  if (it != _index.end() && it->second.version >= version) return true;
+
+  uint64_t offset = _log_bytes;
+  if (!_append(_fd, offset, key, version, deleted, value, len)) return false;
+  _log_bytes += _record_size(key.size(), len);
+
+  if (it != _index.end()) {
+    _dead_bytes += _record_size(key.size(), it->second.value_length);
+    it->second = {offset, version, (uint32_t)len, deleted};
+  } else {
+    _index[key] = {offset, version, (uint32_t)len, deleted};
+  }
+  return true;
+}
+
+bool KVLog::get(const std::string& key, KVRecord* record) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  auto it = _index.find(key);
+  if (it == _index.end()) return false;
+
+  const Location& location = it->second;
+  record->version = location.version;
+  record->deleted = location.deleted;
+  record->value.resize(location.value_length);
+  if (location.value_length == 0) return true;
+
+  off_t valueOffset = location.offset + sizeof(RecordHeader) + key.size();
+  if (pread(_fd, record->value.data(), location.value_length, valueOffset) != (ssize_t)location.value_length) {
+    _logger->error("Short read from " + _filename);
+    return false;
+  }
+  return true;
+}
+
+bool KVLog::compact() {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  if (_fd < 0) return false;
+
+  std::string tempFilename = _filename + ".compact";
+  int fd = ::open(tempFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    _logger->error("Cannot open " + tempFilename + ": " + strerror(errno));
+    return false;
+  }
+
+  std::unordered_map<std::string, Location> index;
+  std::vector<uint8_t> value;
+  uint64_t offset = 0;
+  bool ok = true;
+
+  // Versions are microseconds since the epoch shifted left 12 bits, see KVStore::_next_version
+  uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t graceUs = _tombstone_grace_ms * 1000;
+
+  for (auto& pair : _index) {
+    const Location& location = pair.second;
+    // A tombstone outlives the grace period, so replicas that missed the delete have time to be repaired rather than
+    // repairing others with the value it deleted
+    if (location.deleted && (location.version >> 12) + graceUs <= now) continue;
+
+    value.resize(location.value_length);
+    if (pread(_fd, value.data(), value.size(), location.offset + sizeof(RecordHeader) + pair.first.size()) != (ssize_t)value.size() ||
+        !_append(fd, offset, pair.first, location.version, location.deleted, value.data(), value.size())) {
+      ok = false;
+      break;
+    }
+    index[pair.first] = {offset, location.version, location.value_length, location.deleted};
+    offset += _record_size(pair.first.size(), value.size());
+  }
+
+  if (!ok || fsync(fd) != 0 || rename(tempFilename.c_str(), _filename.c_str()) != 0) {
+    _logger->error("Compaction of " + _filename + " failed");
+    ::close(fd);
+    unlink(tempFilename.c_str());
+    return false;
+  }
+
+  ::close(_fd);
+  _fd = fd;
+  _index.swap(index);
+  _log_bytes = offset;
+  _dead_bytes = 0;
+  return true;
+}
+
+size_t KVLog::size() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _index.size();
+}
+
+bool KVLog::_scan() {
+  _index.clear();
+  _log_bytes = 0;
+  _dead_bytes = 0;
+
+  uint64_t offset = 0;
+  std::vector<uint8_t> body;
+  RecordHeader header;
+
+  while (pread(_fd, &header, sizeof(header), offset) == sizeof(header)) {
+    if (header.key_length == 0 || header.value_length > KAPUA_KV_MAX_VALUE_LENGTH) break;
+
+    // The CRC covers the header after the crc field as well as the key and value
+    size_t headerTail = sizeof(header) - offsetof(RecordHeader, version);
+    body.resize(headerTail + header.key_length + header.value_length);
+    std::memcpy(body.data(), &header.version, headerTail);
+    if (pread(_fd, body.data() + headerTail, header.key_length + header.value_length, offset + sizeof(header)) !=
+        (ssize_t)(header.key_length + header.value_length))
+      break;
+    if (Util::crc32c(body.data(), body.size()) != header.crc) break;
+
+    std::string key((const char*)body.data() + headerTail, header.key_length);
+    size_t recordSize = _record_size(header.key_length, header.value_length);
+
+    auto it = _index.find(key);
+    if (it == _index.end() || it->second.version < header.version) {
+      if (it != _index.end()) _dead_bytes += _record_size(key.size(), it->second.value_length);
+      _index[key] = {offset, header.version, header.value_length, (header.flags & FLAG_DELETED) != 0};
+    } else {
+      _dead_bytes += recordSize;
+    }
+    offset += recordSize;
+  }
+
+  // Anything after the last good record is a torn write from a crash
+  off_t end = lseek(_fd, 0, SEEK_END);
+  if (end > (off_t)offset) {
+    _logger->warn("Truncating " + std::to_string(end - offset) + " bytes of damaged log from " + _filename);
+    if (ftruncate(_fd, offset) != 0) return false;
+  }
+
+  _log_bytes = offset;
+  return true;
+}
+
+bool KVLog::_append(int fd, uint64_t offset, const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len) {
+  std::vector<uint8_t> record(_record_size(key.size(), len));
+  RecordHeader* header = (RecordHeader*)record.data();
+  header->version = version;
+  header->value_length = (uint32_t)len;
+  header->key_length = (uint8_t)key.size();
+  header->flags = deleted ? FLAG_DELETED : 0;
+  std::memcpy(record.data() + sizeof(RecordHeader), key.data(), key.size());
+  if (len) std::memcpy(record.data() + sizeof(RecordHeader) + key.size(), value, len);
+
+  size_t crcOffset = offsetof(RecordHeader, version);
+  header->crc = Util::crc32c(record.data() + crcOffset, record.size() - crcOffset);
+
+  if (pwrite(fd, record.data(), record.size(), offset) != (ssize_t)record.size()) {
+    _logger->error("Write to " + _filename + " failed: " + strerror(errno));
+    return false;
+  }
+  if (_sync_writes && fdatasync(fd) != 0) return false;
+  return true;
+}
+
+}  // namespace Kapua
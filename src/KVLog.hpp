@@ -0,0 +1,94 @@
+//
+// Kapua KVLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_KV_MAX_KEY_LENGTH 250
+#define KAPUA_KV_MAX_VALUE_LENGTH (1024 * 1024)
+#define KAPUA_KV_TOMBSTONE_GRACE_MS (24 * 60 * 60 * 1000)
+
+struct KVRecord {
+  uint64_t version;
+  bool deleted;
+  std::vector<uint8_t> value;
+};
+
+// A node's local share of the key-value store: a log-structured hash table. Every write is appended to a single log
+// file and an in-memory hash index maps each key to the offset of its newest record, so a read is one index lookup
+// and one pread. The index is rebuilt by scanning the log on open, which stops at the first torn or corrupt record.
+//
+// Writes carry a version and are last-writer-wins, so replicas converge no matter what order writes arrive in.
+// Deletes are tombstones. Compaction keeps a tombstone until it is older than the grace period, going by the time in its
+// version, so a replica that missed the delete cannot bring the old value back through read repair meanwhile.
+class KVLog {
+ public:
+  KVLog(Logger* logger, uint64_t tombstoneGraceMs = KAPUA_KV_TOMBSTONE_GRACE_MS);
+  ~KVLog();
+
+  bool open(const std::string& filename, bool syncWrites = false);
+  void close();
+
+  // Apply a write if it is newer than what is stored. Returns true once the stored version is at least this one.
+  bool apply(const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len);
+  // Returns the newest record for a key, including tombstones
+  bool get(const std::string& key, KVRecord* record);
+
+  // Rewrite the log with only the newest record for each key, dropping tombstones past the grace period
+  bool compact();
+
+  size_t size();
+  uint64_t get_log_bytes() { return _log_bytes; }
+  uint64_t get_dead_bytes() { return _dead_bytes; }
+
+ protected:
+#pragma pack(push, 1)
+  struct RecordHeader {
+    uint32_t crc;  // CRC-32C of everything after this field, including key and value
+    uint64_t version;
+    uint32_t value_length;
+    uint8_t key_length;
+    uint8_t flags;
+  };
+#pragma pack(pop)
+
+  static const uint8_t FLAG_DELETED = 1;
+
+  struct Location {
+    uint64_t offset;
+    uint64_t version;
+    uint32_t value_length;
+    bool deleted;
+  };
+
+  Logger* _logger;
+  std::string _filename;
+  int _fd;
+  bool _sync_writes;
+  uint64_t _tombstone_grace_ms;
+
+  std::unordered_map<std::string, Location> _index;
+  std::shared_timed_mutex _mutex;
+
+  std::atomic<uint64_t> _log_bytes;
+  std::atomic<uint64_t> _dead_bytes;
+
+  bool _scan();
+  bool _append(int fd, uint64_t offset, const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len);
+  static size_t _record_size(size_t keyLen, size_t valueLen) { return sizeof(RecordHeader) + keyLen + valueLen; }
+};
+
+}  // namespace Kapua
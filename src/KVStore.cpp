@@ -0,0 +1,114 @@
+//
+// Kapua KVStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "KVStore.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+#include "Blake3.hpp"
+
+namespace Kapua {
+
+KVStore::KVStore(Logger* logger, DistributedBlockStore* dbs, KVTransport* transport, uint8_t replicas, uint8_t readQuorum, uint8_t writeQuorum)
+    : _last_version(0), _read_repairs(0), _quorum_failures(0) {
+  _logger = new ScopedLogger("KVStore", logger);
+  _dbs = dbs;
+  _transport = transport;
+  _replicas = std::max((uint8_t)1, replicas);
+  _read_quorum = std::min(std::max((uint8_t)1, readQuorum), _replicas);
+  _write_quorum = std::min(std::max((uint8_t)1, writeQuorum), _replicas);
+
+  if (_read_quorum + _write_quorum <= _replicas) _logger->warn("R + W <= N, reads may not see the latest write");
+}
+
+KVStore::~KVStore() { delete _logger; }
+
+bool KVStore::set(const std::string& key, const uint8_t* value, size_t len) { return _write(key, false, value, len); }
+
+bool KVStore::remove(const std::string& key) { return _write(key, true, nullptr, 0); }
+
+KVStore::Result KVStore::get(const std::string& key, std::vector<uint8_t>* value) {
+  std::vector<uint64_t> nodes = _dbs->get_dbs_preference_list(get_key_id(key), _replicas);
+  size_t count = nodes.size();
+  std::vector<KVRecord> records(count);
+  std::vector<char> answered(count, 0), found(count, 0);
+
+  auto ask = [&](size_t i) {
+    bool f = false;
+    answered[i] = _transport->kv_get(nodes[i], key, &f, &records[i]);
+    found[i] = f;
+  };
+
+  // Ask every replica, the first on this thread
+  std::vector<std::future<void>> pending;
+  for (size_t i = 1; i < count; i++) pending.push_back(std::async(std::launch::async, ask, i));
+  if (count) ask(0);
+  for (auto& p : pending) p.get();
+
+  size_t answers = std::count(answered.begin(), answered.end(), 1);
+  if (answers < _read_quorum) {
+    _quorum_failures++;
+    _logger->warn("Read of '" + key + "' reached " + std::to_string(answers) + " of " + std::to_string(_read_quorum) + " replicas");
+    return Result::Unavailable;
+  }
+
+  int newest = -1;
+  for (size_t i = 0; i < count; i++) {
+    if (answered[i] && found[i] && (newest < 0 || records[i].version > records[newest].version)) newest = (int)i;
+  }
+  if (newest < 0) return Result::NotFound;
+
+  // Read repair: bring replicas that answered with an older version, or none, up to date
+  const KVRecord& latest = records[newest];
+  for (size_t i = 0; i < count; i++) {
+    if (!answered[i] || (found[i] && records[i].version >= latest.version)) continue;
+    if (_transport->kv_apply(nodes[i], key, latest.version, latest.deleted, latest.value.data(), latest.value.size())) _read_repairs++;
+  }
+
+  if (latest.deleted) return Result::NotFound;
+  value->swap(records[newest].value);
+  return Result::Found;
+}
+
+uint64_t KVStore::get_key_id(const std::string& key) {
+  Blake3Hash hash;
+  Blake3::hash((const uint8_t*)key.data(), key.size(), &hash);
+  return hash.to_uint64();
+}
+
+bool KVStore::_write(const std::string& key, bool deleted, const uint8_t* value, size_t len) {
+  std::vector<uint64_t> nodes = _dbs->get_dbs_preference_list(get_key_id(key), _replicas);
+  uint64_t version = _next_version();
+
+  auto apply = [&](size_t i) { return _transport->kv_apply(nodes[i], key, version, deleted, value, len); };
+
+  std::vector<std::future<bool>> pending;
+  for (size_t i = 1; i < nodes.size(); i++) pending.push_back(std::async(std::launch::async, apply, i));
+  size_t acks = !nodes.empty() && apply(0);
+  for (auto& p : pending) acks += p.get();
+
+  if (acks < _write_quorum) {
+    _quorum_failures++;
+    _logger->warn("Write of '" + key + "' reached " + std::to_string(acks) + " of " + std::to_string(_write_quorum) + " replicas");
+    return false;
+  }
+  return true;
+}
+
+uint64_t KVStore::_next_version() {
+  // Microseconds since the epoch, with the low 12 bits of the node ID as a tie break between coordinators
+  uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t version = (now << 12) | (_dbs->get_dbs_node_id() & 0xfff);
+
+  std::lock_guard<std::mutex> lock(_version_mutex);
+  if (version <= _last_version) version = _last_version + (1 << 12);
+  _last_version = version;
+  return version;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,68 @@
+//
+// Kapua KVStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DistributedBlockStore.hpp"
+#include "KVTransport.hpp"
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_KV_DEFAULT_REPLICAS 3
+#define KAPUA_KV_DEFAULT_QUORUM 2
+
+// Distributed key-value store on the block store ring. Each key is hashed onto the ring and held by the first N
+// distinct nodes clockwise from it, each in its own KVLog. Writes are versioned by the coordinating node and succeed
+// once W replicas have applied them; reads ask the replicas, succeed once R have answered, return the newest
+// version and write it back to any replica that answered with an older one. With R + W > N every read sees the
+// latest successful write.
+class KVStore {
+ public:
+  enum class Result {
+    Found,
+    NotFound,
+    Unavailable,  // Fewer than R replicas answered
+  };
+
+  KVStore(Logger* logger, DistributedBlockStore* dbs, KVTransport* transport, uint8_t replicas = KAPUA_KV_DEFAULT_REPLICAS,
+          uint8_t readQuorum = KAPUA_KV_DEFAULT_QUORUM, uint8_t writeQuorum = KAPUA_KV_DEFAULT_QUORUM);
+  ~KVStore();
+
+  bool set(const std::string& key, const uint8_t* value, size_t len);
+  Result get(const std::string& key, std::vector<uint8_t>* value);
+  bool remove(const std::string& key);
+
+  uint64_t get_read_repairs() { return _read_repairs; }
+  uint64_t get_quorum_failures() { return _quorum_failures; }
+
+  static uint64_t get_key_id(const std::string& key);
+
+ protected:
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  KVTransport* _transport;
+  uint8_t _replicas;
+  uint8_t _read_quorum;
+  uint8_t _write_quorum;
+
+  std::mutex _version_mutex;
+  uint64_t _last_version;
+
+  std::atomic<uint64_t> _read_repairs;
+  std::atomic<uint64_t> _quorum_failures;
+
+  bool _write(const std::string& key, bool deleted, const uint8_t* value, size_t len);
+  uint64_t _next_version();
+};
+
+}  // namespace Kapua
@@ -0,0 +1,72 @@
+//
+// Kapua KVTransport interface
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "KVLog.hpp"
+
+namespace Kapua {
+
+// Carries key-value replica operations to a given node. KVStore decides which nodes hold a key, implementations of
+// this interface decide how the operations get there.
+class KVTransport {
+ public:
+  virtual ~KVTransport() {}
+  virtual bool kv_apply(uint64_t nodeId, const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len) = 0;
+  // Returns false if the node could not be asked, and true with found = false if it has no record of the key
+  virtual bool kv_get(uint64_t nodeId, const std::string& key, bool* found, KVRecord* record) = 0;
+};
+
+// Delivers operations directly to KVLogs in this process, for single node use and in-process clusters
+class LoopbackKVTransport : public KVTransport {
+ public:
+  void add_node(uint64_t nodeId, KVLog* log) {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    _nodes[nodeId] = {log, false};
+  }
+
+  void set_node_down(uint64_t nodeId, bool down) {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _nodes.find(nodeId);
+    if (it != _nodes.end()) it->second.down = down;
+  }
+
+  bool kv_apply(uint64_t nodeId, const std::string& key, uint64_t version, bool deleted, const uint8_t* value, size_t len) override {
+    KVLog* log = _find(nodeId);
+    return log && log->apply(key, version, deleted, value, len);
+  }
+
+  bool kv_get(uint64_t nodeId, const std::string& key, bool* found, KVRecord* record) override {
+    KVLog* log = _find(nodeId);
+    if (!log) return false;
+    *found = log->get(key, record);
+    return true;
+  }
+
+ protected:
+  struct Node {
+    KVLog* log;
+    bool down;
+  };
+
+  std::unordered_map<uint64_t, Node> _nodes;
+  std::shared_timed_mutex _mutex;
+
+  KVLog* _find(uint64_t nodeId) {
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _nodes.find(nodeId);
+    return it == _nodes.end() || it->second.down ? nullptr : it->second.log;
+  }
+};
+
+}  // namespace Kapua
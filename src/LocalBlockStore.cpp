@@ -0,0 +1,464 @@
+//
+// Kapua LocalBlockStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "LocalBlockStore.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+LocalBlockStore::Segment::~Segment() {
+  if (map) munmap(map, map_length);
+  if (fd >= 0) ::close(fd);
+}
+
+LocalBlockStore::LocalBlockStore(Logger* logger, size_t segmentSize)
+    : _live_bytes(0), _written_bytes(0), _compaction_written_bytes(0), _put_latency_us(0) {
+  _logger = new ScopedLogger("LocalBlockStore", logger);
+  _segment_size = segmentSize;
+  _sync_writes = false;
+}
+
+LocalBlockStore::~LocalBlockStore() {
+  close();
+  delete _logger;
+}
+
+bool LocalBlockStore::open(const std::string& directory, bool syncWrites) {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  _directory = directory;
+  _sync_writes = syncWrites;
+
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    _logger->error("Cannot create " + directory + ": " + strerror(errno));
+    return false;
+  }
+
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    _logger->error("Cannot open " + directory + ": " + strerror(errno));
+    return false;
+  }
+  std::vector<uint32_t> ids;
+  while (dirent* entry = readdir(dir)) {
+    uint32_t id;
+    char suffix[5] = {};
+    if (sscanf(entry->d_name, "%8u.%4s", &id, suffix) == 2 && strcmp(suffix, "seg") == 0 && _segment_filename(id) == directory + "/" + entry->d_name) {
+      ids.push_back(id);
+    }
+  }
+  closedir(dir);
+  std::sort(ids.begin(), ids.end());
+
+  // Replay segments oldest first, so later records win
+  for (size_t i = 0; i < ids.size(); i++) {
+    std::shared_ptr<Segment> segment = _open_segment(ids[i], false);
+    if (!segment) return false;
+    _segments[segment->id] = segment;
+    if (!_scan_segment(segment.get(), i == ids.size() - 1)) return false;
+  }
+
+  if (!_segments.empty() && _segments.rbegin()->second->size < _segment_size) {
+    _active = _segments.rbegin()->second;
+  } else {
+    _active = _open_segment(_segments.empty() ? 1 : _segments.rbegin()->first + 1, true);
+    if (!_active) return false;
+    _segments[_active->id] = _active;
+  }
+
+  _logger->debug("Opened " + directory + ", " + std::to_string(_index.size()) + " blocks in " + std::to_string(_segments.size()) + " segments");
+  return true;
+}
+
+void LocalBlockStore::close() {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  // Segments still pinned by views are unmapped when the last view is dropped
+  _index.clear();
+  _segments.clear();
+  _active.reset();
+  _live_bytes = 0;
+}
+
+bool LocalBlockStore::put(uint64_t blockId, const uint8_t* data, size_t len) {
+  if (len > get_max_block_size()) {
+    _logger->error("Block " + Util::to_hex64_str(blockId) + " of " + std::to_string(len) + " bytes is larger than a segment");
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t crc;
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    if (!_active) return false;
+
+    Location location;
+    if (!_append(blockId, data, len, 0, &location)) return false;
+    _set_location(blockId, &location);
+    crc = _get_crc(location);
+  }
+  _written_bytes += _record_size(len);
+  if (_on_change) _on_change(blockId, crc, false);
+
+  uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  _put_latency_us = (_put_latency_us * 7 + latency) / 8;
+  return true;
+}
+
+bool LocalBlockStore::remove(uint64_t blockId) {
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _index.find(blockId);
+    if (it == _index.end() || !_active) return false;
+
+    Location location;
+    if (!_append(blockId, nullptr, 0, FLAG_DELETED, &location)) return false;
+    _set_location(blockId, nullptr);
+  }
+  _written_bytes += _record_size(0);
+  if (_on_change) _on_change(blockId, 0, true);
+  return true;
+}
+
+bool LocalBlockStore::has(uint64_t blockId) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _index.find(blockId) != _index.end();
+}
+
+void LocalBlockStore::for_each_block(const std::function<void(uint64_t blockId, uint64_t digest)>& fn) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  for (const auto& entry : _index) fn(entry.first, _get_crc(entry.second));
+}
+
+bool LocalBlockStore::get(uint64_t blockId, std::vector<uint8_t>* data) {
+  BlockView view;
+  if (!get_view(blockId, &view)) return false;
+  data->assign(view.data(), view.data() + view.size());
+  return true;
+}
+
+bool LocalBlockStore::get_view(uint64_t blockId, BlockView* view) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _find(blockId, view);
+}
+
+bool LocalBlockStore::send_block(uint64_t blockId, int fd) {
+  BlockView view;
+  if (!get_view(blockId, &view)) return false;
+  return send_view(view, fd);
+}
+
+bool LocalBlockStore::send_view(const BlockView& view, int fd) {
+  off_t offset = (off_t)view._offset;
+  size_t remaining = view._length;
+
+  while (remaining > 0) {
+    ssize_t n = sendfile(fd, view._fd, &offset, remaining);
+    if (n > 0) {
+      remaining -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+    return false;
+  }
+
+  // Some descriptors cannot take sendfile; write from the mapping instead, which still avoids a copy into a buffer
+  const uint8_t* data = view._data + (view._length - remaining);
+  while (remaining > 0) {
+    ssize_t n = write(fd, data, remaining);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    remaining -= n;
+  }
+  return true;
+}
+
+size_t LocalBlockStore::get_block_count() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _index.size();
+}
+
+size_t LocalBlockStore::get_segment_count() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _segments.size();
+}
+
+void LocalBlockStore::get_segment_stats(std::vector<SegmentStats>* stats) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  stats->clear();
+  for (auto& pair : _segments) {
+    const Segment& segment = *pair.second;
+    stats->push_back({segment.id, segment.size, segment.live_bytes, segment.modified, pair.second == _active});
+  }
+}
+
+bool LocalBlockStore::compact_segment(uint32_t id, size_t batchBytes, const std::function<void(size_t)>& pace, uint64_t* copiedBytes,
+                                      uint64_t* reclaimedBytes) {
+  std::shared_ptr<Segment> victim;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    auto it = _segments.find(id);
+    if (it == _segments.end() || it->second == _active) return false;
+    victim = it->second;
+  }
+
+  // Sealed segments never change, so they are read without the lock, front to back
+  if (victim->size) madvise(victim->map, victim->size, MADV_SEQUENTIAL);
+
+  uint64_t copied = 0;
+  uint64_t offset = 0;
+  std::vector<uint64_t> batch;
+  std::vector<struct iovec> iov;
+  std::vector<std::pair<RecordHeader, uint64_t>> placed;  // Copied record and its new offset
+
+  while (offset < victim->size) {
+    batch.clear();
+    size_t bytes = 0;
+    while (offset < victim->size && (batch.empty() || bytes < batchBytes)) {
+      RecordHeader header;
+      std::memcpy(&header, victim->map + offset, sizeof(header));
+      batch.push_back(offset);
+      bytes += _record_size(header.length);
+      offset += _record_size(header.length);
+    }
+
+    // Records still live are gathered straight from the mapping into as few writes as the active segment allows
+    size_t written = 0;
+    {
+      std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+      // A tombstone must outlive any older segment that could still hold the record it deletes
+      bool keepTombstones = _segments.begin()->first < id;
+      uint64_t pending = 0;
+
+      auto flush = [&]() {
+        if (iov.empty()) return true;
+        if (pwritev(_active->fd, iov.data(), iov.size(), _active->size) != (ssize_t)pending) {
+          _logger->error("Write to " + _active->filename + " failed: " + strerror(errno));
+          return false;
+        }
+        for (auto& record : placed) {
+          if (record.first.flags & FLAG_DELETED) continue;
+          Location location = {_active->id, record.second, record.first.length};
+          _set_location(record.first.block_id, &location);
+        }
+        _active->size += pending;
+        _active->modified = time(nullptr);
+        written += pending;
+        pending = 0;
+        iov.clear();
+        placed.clear();
+        return true;
+      };
+
+      for (uint64_t recordOffset : batch) {
+        RecordHeader header;
+        std::memcpy(&header, victim->map + recordOffset, sizeof(header));
+        if (header.flags & FLAG_DELETED) {
+          if (!keepTombstones || _index.find(header.block_id) != _index.end()) continue;
+        } else {
+          auto it = _index.find(header.block_id);
+          if (it == _index.end() || it->second.segment != id || it->second.offset != recordOffset) continue;
+        }
+
+        size_t size = _record_size(header.length);
+        if (_active->size + pending + size > _segment_size || iov.size() >= IOV_MAX) {
+          if (!flush() || !_roll_segment(size)) return false;
+        }
+        placed.push_back(std::make_pair(header, _active->size + pending));
+        iov.push_back({victim->map + recordOffset, size});
+        pending += size;
+      }
+      if (!flush()) return false;
+    }
+
+    copied += written;
+    _compaction_written_bytes += written;
+    if (pace) pace(written);
+  }
+
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    // The copies must be durable before the originals go
+    if (fdatasync(_active->fd) != 0) return false;
+    _segments.erase(id);
+    if (unlink(victim->filename.c_str()) != 0) _logger->warn("Cannot remove " + victim->filename + ": " + strerror(errno));
+  }
+
+  // Views of the segment keep it mapped until they are dropped
+  *copiedBytes = copied;
+  *reclaimedBytes = victim->size - copied;
+  _logger->debug("Compacted " + victim->filename + ", copied " + std::to_string(copied) + " bytes, reclaimed " + std::to_string(*reclaimedBytes));
+  return true;
+}
+
+size_t LocalBlockStore::get_max_block_size() const { return _segment_size - sizeof(RecordHeader); }
+
+std::shared_ptr<LocalBlockStore::Segment> LocalBlockStore::_open_segment(uint32_t id, bool create) {
+  std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+  segment->id = id;
+  segment->filename = _segment_filename(id);
+  segment->fd = ::open(segment->filename.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+  if (segment->fd < 0) {
+    _logger->error("Cannot open " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(segment->fd, &st) != 0) {
+    _logger->error("Cannot stat " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+  segment->size = st.st_size;
+  segment->modified = st.st_mtime;
+
+  // Map the whole segment up front, so views of the active segment stay valid as it grows. Pages past the end of
+  // the file are never touched.
+  segment->map_length = std::max((size_t)st.st_size, _segment_size);
+  void* map = mmap(nullptr, segment->map_length, PROT_READ, MAP_SHARED, segment->fd, 0);
+  if (map == MAP_FAILED) {
+    _logger->error("Cannot map " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+  segment->map = (uint8_t*)map;
+  return segment;
+}
+
+bool LocalBlockStore::_scan_segment(Segment* segment, bool last) {
+  uint64_t offset = 0;
+  RecordHeader header;
+
+  while (offset + sizeof(header) <= segment->size) {
+    std::memcpy(&header, segment->map + offset, sizeof(header));
+    if (header.length > segment->size - offset - sizeof(header)) break;
+
+    size_t crcOffset = offsetof(RecordHeader, block_id);
+    if (Util::crc32c(segment->map + offset + crcOffset, _record_size(header.length) - crcOffset) != header.crc) break;
+
+    if (header.flags & FLAG_DELETED) {
+      _set_location(header.block_id, nullptr);
+    } else {
+      Location location = {segment->id, offset, header.length};
+      _set_location(header.block_id, &location);
+    }
+    offset += _record_size(header.length);
+  }
+
+  if (offset < segment->size) {
+    // A torn write from a crash can only be at the end of the newest segment
+    if (!last) {
+      _logger->error("Segment " + segment->filename + " is damaged at offset " + std::to_string(offset));
+      return false;
+    }
+    _logger->warn("Truncating " + std::to_string(segment->size - offset) + " bytes of damaged segment " + segment->filename);
+    if (ftruncate(segment->fd, offset) != 0) return false;
+    segment->size = offset;
+  }
+  return true;
+}
+
+bool LocalBlockStore::_roll_segment(size_t needed) {
+  if (_active->size + needed <= _segment_size) return true;
+
+  std::shared_ptr<Segment> segment = _open_segment(_active->id + 1, true);
+  if (!segment) return false;
+  if (_sync_writes) fdatasync(_active->fd);
+  _segments[segment->id] = segment;
+  _active = segment;
+  return true;
+}
+
+bool LocalBlockStore::_append(uint64_t blockId, const uint8_t* data, size_t len, uint8_t flags, Location* location) {
+  if (!_roll_segment(_record_size(len))) return false;
+
+  RecordHeader header;
+  header.block_id = blockId;
+  header.length = (uint32_t)len;
+  header.flags = flags;
+  size_t crcOffset = offsetof(RecordHeader, block_id);
+  header.crc = Util::crc32c((const uint8_t*)&header + crcOffset, sizeof(header) - crcOffset);
+  if (len) header.crc = Util::crc32c(data, len, header.crc);
+
+  // Write the header and data together, without assembling them in a buffer first
+  struct iovec iov[2] = {{&header, sizeof(header)}, {(void*)data, len}};
+  if (pwritev(_active->fd, iov, len ? 2 : 1, _active->size) != (ssize_t)_record_size(len)) {
+    _logger->error("Write to " + _active->filename + " failed: " + strerror(errno));
+    return false;
+  }
+  if (_sync_writes && fdatasync(_active->fd) != 0) return false;
+
+  *location = {_active->id, _active->size, (uint32_t)len};
+  _active->size += _record_size(len);
+  _active->modified = time(nullptr);
+  return true;
+}
+
+void LocalBlockStore::_set_location(uint64_t blockId, const Location* location) {
+  auto it = _index.find(blockId);
+  if (it != _index.end()) {
+    auto segment = _segments.find(it->second.segment);
+    if (segment != _segments.end()) segment->second->live_bytes -= _record_size(it->second.length);
+    _live_bytes -= it->second.length;
+    if (!location) {
+      _index.erase(it);
+      return;
+    }
+  } else if (!location) {
+    return;
+  }
+
+  _index[blockId] = *location;
+  _segments[location->segment]->live_bytes += _record_size(location->length);
+  _live_bytes += location->length;
+}
+
+bool LocalBlockStore::_find(uint64_t blockId, BlockView* view) {
+  auto it = _index.find(blockId);
+  if (it == _index.end()) return false;
+  auto segment = _segments.find(it->second.segment);
+  if (segment == _segments.end()) return false;
+
+  view->_pin = segment->second;
+  view->_data = segment->second->map + it->second.offset + sizeof(RecordHeader);
+  view->_length = it->second.length;
+  view->_fd = segment->second->fd;
+  view->_offset = it->second.offset + sizeof(RecordHeader);
+  return true;
+}
+
+uint32_t LocalBlockStore::_get_crc(const Location& location) {
+  auto segment = _segments.find(location.segment);
+  if (segment == _segments.end()) return 0;
+  uint32_t crc;
+  memcpy(&crc, segment->second->map + location.offset + offsetof(RecordHeader, crc), sizeof(crc));
+  return crc;
+}
+
+std::string LocalBlockStore::_segment_filename(uint32_t id) const {
+  char name[16];
+  snprintf(name, sizeof(name), "%08u.seg", id);
+  return _directory + "/" + name;
+}
+
+}  // namespace Kapua
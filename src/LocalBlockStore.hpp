@@ -0,0 +1,165 @@
+//
+// Kapua LocalBlockStore class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_LBS_DEFAULT_SEGMENT_SIZE (256 * 1024 * 1024)
+
+class LocalBlockStore;
+
+struct SegmentStats {
+  uint32_t id;
+  uint64_t size;        // Bytes of records, live or dead
+  uint64_t live_bytes;  // Bytes of records still in the index
+  int64_t modified;     // Unix time of the last write
+  bool active;          // Still being appended to
+};
+
+// A read-only view of a stored block, straight into the page cache. The view pins the segment holding the block, so
+// the data stays valid while the view is held even if the block is removed or its segment is compacted away.
+class BlockView {
+ public:
+  BlockView() : _data(nullptr), _length(0), _fd(-1), _offset(0) {}
+
+  const uint8_t* data() const { return _data; }
+  size_t size() const { return _length; }
+  bool empty() const { return _data == nullptr; }
+  void reset() { *this = BlockView(); }
+
+ protected:
+  friend class LocalBlockStore;
+
+  std::shared_ptr<const void> _pin;
+  const uint8_t* _data;
+  size_t _length;
+  int _fd;
+  uint64_t _offset;
+};
+
+// The blocks this node holds, stored on local disk. Blocks are appended to segment files of a fixed maximum size,
+// each record carrying a CRC-32C, and an in-memory index maps each block ID to its record. The index is rebuilt by
+// scanning the segments on open. Removal appends a tombstone.
+//
+// Every segment is mapped read-only, so reads can hand out views of the page cache rather than copies, and
+// send_block moves a block from the page cache to a socket with sendfile without it passing through user space.
+class LocalBlockStore {
+ public:
+  // Called after a block is put or removed, outside the store's lock. The digest is the CRC-32C of the block's record.
+  typedef std::function<void(uint64_t blockId, uint64_t digest, bool removed)> ChangeCallback;
+
+  LocalBlockStore(Logger* logger, size_t segmentSize = KAPUA_LBS_DEFAULT_SEGMENT_SIZE);
+  ~LocalBlockStore();
+
+  bool open(const std::string& directory, bool syncWrites = false);
+  void close();
+
+  bool put(uint64_t blockId, const uint8_t* data, size_t len);
+  bool remove(uint64_t blockId);
+  bool has(uint64_t blockId);
+  // Set before the store is shared between threads
+  void set_change_callback(ChangeCallback callback) { _on_change = callback; }
+  // Call fn with every block held and its digest
+  void for_each_block(const std::function<void(uint64_t blockId, uint64_t digest)>& fn);
+
+  // Copy a block out
+  bool get(uint64_t blockId, std::vector<uint8_t>* data);
+  // View a block in place, with no copy
+  bool get_view(uint64_t blockId, BlockView* view);
+  // Write a block to a file descriptor, usually a socket, with no copy through user space
+  bool send_block(uint64_t blockId, int fd);
+  static bool send_view(const BlockView& view, int fd);
+
+  size_t get_block_count();
+  size_t get_segment_count();
+  uint64_t get_live_bytes() { return _live_bytes; }
+  size_t get_max_block_size() const;
+
+  // Write amplification is (written + compaction written) / written
+  uint64_t get_written_bytes() { return _written_bytes; }
+  uint64_t get_compaction_written_bytes() { return _compaction_written_bytes; }
+  // Moving average of put latency, which compaction watches to stay out of the way of foreground writes
+  uint64_t get_put_latency_us() { return _put_latency_us; }
+
+  void get_segment_stats(std::vector<SegmentStats>* stats);
+  // Copy the live records out of a sealed segment and delete it. Records are read sequentially and written in
+  // batches of up to batchBytes, and pace is called between batches with the bytes copied so the caller can throttle.
+  // Returns false if the segment is active or missing, or on I/O failure.
+  bool compact_segment(uint32_t id, size_t batchBytes, const std::function<void(size_t)>& pace, uint64_t* copiedBytes, uint64_t* reclaimedBytes);
+
+ protected:
+#pragma pack(push, 1)
+  struct RecordHeader {
+    uint32_t crc;  // CRC-32C of everything after this field, including the block data
+    uint64_t block_id;
+    uint32_t length;
+    uint8_t flags;
+  };
+#pragma pack(pop)
+
+  static const uint8_t FLAG_DELETED = 1;
+
+  struct Segment {
+    uint32_t id;
+    std::string filename;
+    int fd;
+    uint8_t* map;
+    size_t map_length;
+    uint64_t size;
+    uint64_t live_bytes;
+    int64_t modified;
+
+    Segment() : id(0), fd(-1), map(nullptr), map_length(0), size(0), live_bytes(0), modified(0) {}
+    ~Segment();
+  };
+
+  struct Location {
+    uint32_t segment;
+    uint64_t offset;  // Of the record header
+    uint32_t length;
+  };
+
+  Logger* _logger;
+  std::string _directory;
+  size_t _segment_size;
+  bool _sync_writes;
+  ChangeCallback _on_change;
+
+  std::shared_timed_mutex _mutex;
+  std::map<uint32_t, std::shared_ptr<Segment>> _segments;
+  std::unordered_map<uint64_t, Location> _index;
+  std::shared_ptr<Segment> _active;
+
+  std::atomic<uint64_t> _live_bytes;
+  std::atomic<uint64_t> _written_bytes;
+  std::atomic<uint64_t> _compaction_written_bytes;
+  std::atomic<uint64_t> _put_latency_us;
+
+  std::shared_ptr<Segment> _open_segment(uint32_t id, bool create);
+  bool _scan_segment(Segment* segment, bool last);
+  bool _roll_segment(size_t needed);
+  bool _append(uint64_t blockId, const uint8_t* data, size_t len, uint8_t flags, Location* location);
+  void _set_location(uint64_t blockId, const Location* location);
+  bool _find(uint64_t blockId, BlockView* view);
+  uint32_t _get_crc(const Location& location);
+  std::string _segment_filename(uint32_t id) const;
+  static size_t _record_size(size_t len) { return sizeof(RecordHeader) + len; }
+};
+
+}  // namespace Kapua
@@ -6,10 +6,33 @@
 //
 #include "Logger.hpp"
 
+#include <chrono>
+#include <utility>
+
 using namespace std;
 
 namespace Kapua {
 
+namespace {
+const char* const marker_raw = " [     ] ";
+const char* const marker_debug = " [DEBUG] ";
+const char* const marker_info = " [INFO ] ";
+const char* const marker_warn = " [WARN ] ";
+const char* const marker_error = " [ERROR] ";
+}  // namespace
+
+const std::string& LogTimestamp::format(time_t second) {
+  if (second != _second) {
+    char buf[sizeof "2011-10-08T07:07:09Z"];
+    tm parts;
+    gmtime_r(&second, &parts);
+    strftime(buf, sizeof buf, "%FT%TZ", &parts);
+    _formatted = buf;
+    _second = second;
+  }
+  return _formatted;
+}
+
 IOStreamLogger::IOStreamLogger(std::ostream* stream, LogLevel_t level) {
   _output_stream = stream;
   _log_level = level;
@@ -19,38 +42,100 @@ void IOStreamLogger::set_log_level(LogLevel_t level) { _log_level = level; }
 
 void IOStreamLogger::debug(std::string log) {
   if (_log_level < LogLevel_t::LOG_LEVEL_DEBUG) return;
-  std::lock_guard<std::mutex> lock(_logging_mutex);
-  cout << _getTimeStr() << " [DEBUG] " << log << "\n";
+  _write(marker_debug, log);
 }
 
 void IOStreamLogger::info(std::string log) {
   if (_log_level < LogLevel_t::LOG_LEVEL_INFO) return;
-  std::lock_guard<std::mutex> lock(_logging_mutex);
-  cout << _getTimeStr() << " [INFO ] " << log << "\n";
+  _write(marker_info, log);
 }
 
 void IOStreamLogger::warn(std::string log) {
   if (_log_level < LogLevel_t::LOG_LEVEL_WARN) return;
-  std::lock_guard<std::mutex> lock(_logging_mutex);
-  cout << _getTimeStr() << " [WARN ] " << log << "\n";
+  _write(marker_warn, log);
 }
 
-void IOStreamLogger::error(std::string log) {
+void IOStreamLogger::error(std::string log) { _write(marker_error, log); }
+
+void IOStreamLogger::raw(std::string log) { _write(marker_raw, log); }
+
+void IOStreamLogger::_write(const char* marker, const std::string& log) {
   std::lock_guard<std::mutex> lock(_logging_mutex);
-  cerr << _getTimeStr() << " [ERROR] " << log << "\n";
+  *_output_stream << _timestamp.format(time(nullptr)) << marker << log << "\n";
 }
 
-void IOStreamLogger::raw(std::string log) {
-  std::lock_guard<std::mutex> lock(_logging_mutex);
-  cerr << _getTimeStr() << " [     ] " << log << "\n";
+AsyncLogger::AsyncLogger(std::ostream* stream, LogLevel_t level, size_t ringSize)
+    : _dropped(0), _dropped_reported(0), _rings(ringSize, [this](std::vector<Line>& lines) { _write(lines); }) {
+  _output_stream = stream;
+  _log_level = level;
+  _rings.start();
 }
 
-std::string IOStreamLogger::_getTimeStr() {
-  time_t now;
-  time(&now);
-  char buf[sizeof "2011-10-08T07:07:09Z"];
-  strftime(buf, sizeof buf, "%FT%TZ", gmtime(&now));
-  return std::string(buf);
+AsyncLogger::~AsyncLogger() { _rings.stop(); }
+
+void AsyncLogger::set_log_level(LogLevel_t level) { _log_level = level; }
+
+void AsyncLogger::debug(std::string log) {
+  if (!is_enabled(LOG_LEVEL_DEBUG)) return;
+  _log(marker_debug, false, std::move(log));
+}
+
+void AsyncLogger::info(std::string log) {
+  if (!is_enabled(LOG_LEVEL_INFO)) return;
+  _log(marker_info, false, std::move(log));
+}
+
+void AsyncLogger::warn(std::string log) {
+  if (!is_enabled(LOG_LEVEL_WARN)) return;
+  _log(marker_warn, false, std::move(log));
+}
+
+void AsyncLogger::error(std::string log) { _log(marker_error, true, std::move(log)); }
+
+void AsyncLogger::raw(std::string log) { _log(marker_raw, true, std::move(log)); }
+
+void AsyncLogger::flush() { _rings.flush(); }
+
+void AsyncLogger::_log(const char* marker, bool mustWrite, std::string&& log) {
+  ThreadRings<Line>::Ring* ring = _rings.get_ring();
+  Line* line = _rings.reserve(ring);
+  if (!line) {
+    if (!mustWrite) {
+      _dropped++;
+      _rings.wake();
+      return;
+    }
+    while (!(line = _rings.reserve(ring))) {
+      _rings.wake();
+      std::this_thread::yield();
+    }
+  }
+
+  line->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  line->marker = marker;
+  line->message = std::move(log);
+  _rings.publish(ring);
+}
+
+void AsyncLogger::_write(std::vector<Line>& lines) {
+  std::string out;
+  for (const Line& line : lines) {
+    out += _timestamp.format(line.time_ns / 1000000000);
+    out += line.marker;
+    out += line.message;
+    out += '\n';
+  }
+  uint64_t dropped = _dropped;
+  if (dropped != _dropped_reported) {
+    out += _timestamp.format(time(nullptr));
+    out += marker_warn;
+    out += "(AsyncLogger) " + std::to_string(dropped - _dropped_reported) + " lines dropped\n";
+    _dropped_reported = dropped;
+  }
+  if (!out.empty()) {
+    _output_stream->write(out.data(), out.size());
+    _output_stream->flush();
+  }
 }
 
 ScopedLogger::ScopedLogger(std::string prefix, Logger* logger) {
@@ -68,25 +153,44 @@ ScopedLogger::ScopedLogger(std::string prefix, Logger* logger, LogLevel_t level)
 
 void ScopedLogger::debug(std::string log) {
   if (_using_log_level && _log_level < LogLevel_t::LOG_LEVEL_DEBUG) return;
-  _logger->debug("(" + _prefix + ") " + log);
+  if (!_logger->is_enabled(LOG_LEVEL_DEBUG)) return;
+  _logger->debug(_scoped(log));
 }
 
 void ScopedLogger::info(std::string log) {
   if (_using_log_level && _log_level < LogLevel_t::LOG_LEVEL_INFO) return;
-  _logger->info("(" + _prefix + ") " + log);
+  if (!_logger->is_enabled(LOG_LEVEL_INFO)) return;
+  _logger->info(_scoped(log));
 }
 
 void ScopedLogger::warn(std::string log) {
   if (_using_log_level && _log_level < LogLevel_t::LOG_LEVEL_WARN) return;
-  _logger->warn("(" + _prefix + ") " + log);
+  if (!_logger->is_enabled(LOG_LEVEL_WARN)) return;
+  _logger->warn(_scoped(log));
 }
 
-void ScopedLogger::error(std::string log) { _logger->error("(" + _prefix + ") " + log); }
-void ScopedLogger::raw(std::string log) { _logger->raw("(" + _prefix + ") " + log); }
+void ScopedLogger::error(std::string log) { _logger->error(_scoped(log)); }
+void ScopedLogger::raw(std::string log) { _logger->raw(_scoped(log)); }
 
 void ScopedLogger::set_log_level(LogLevel_t level) {
   _log_level = level;
   _using_log_level = true;
 }
 
-}  // namespace Kapua
\ No newline at end of file
+bool ScopedLogger::is_enabled(LogLevel_t level) {
+  if (_using_log_level && _log_level < level) return false;
+  return _logger->is_enabled(level);
+}
+
+std::string ScopedLogger::_scoped(const std::string& log) const {
+  // One allocation, rather than one per concatenation
+  std::string scoped;
+  scoped.reserve(_prefix.size() + log.size() + 3);
+  scoped += '(';
+  scoped += _prefix;
+  scoped += ") ";
+  scoped += log;
+  return scoped;
+}
+
+}  // namespace Kapua
@@ -6,13 +6,20 @@
 //
 #pragma once
 
+#include <atomic>
 #include <ctime>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
+
+#include "ThreadRings.hpp"
 
 namespace Kapua {
 
+#define KAPUA_ASYNC_LOGGER_RING_SIZE 4096
+
 enum LogLevel_t : uint8_t {
   LOG_LEVEL_ERROR = 0,
   LOG_LEVEL_WARN = 1,
@@ -30,8 +37,23 @@ class Logger {
   virtual void warn(std::string log) = 0;
   virtual void error(std::string log) = 0;
   virtual void set_log_level(LogLevel_t level) = 0;
+
+  // Whether a message at level would be written. Check this before building an expensive message on a hot path.
+  virtual bool is_enabled(LogLevel_t) { return true; }
+};
+
+// Formats the "2011-10-08T07:07:09Z" timestamp, only calling strftime when the second changes
+class LogTimestamp {
+ public:
+  LogTimestamp() : _second(-1) {}
+  const std::string& format(time_t second);
+
+ protected:
+  time_t _second;
+  std::string _formatted;
 };
 
+// Writes each line to the stream as it is logged, under a lock
 class IOStreamLogger : public Logger {
  public:
   IOStreamLogger(std::ostream* stream, LogLevel_t level);
@@ -43,14 +65,60 @@ class IOStreamLogger : public Logger {
   virtual void warn(std::string log) override;
   virtual void error(std::string log) override;
   virtual void set_log_level(LogLevel_t level) override;
+  virtual bool is_enabled(LogLevel_t level) override { return level <= _log_level; }
 
  private:
   std::ostream* _output_stream;
-  LogLevel_t _log_level;
+  std::atomic<uint8_t> _log_level;
 
   std::mutex _logging_mutex;
+  LogTimestamp _timestamp;
 
-  std::string _getTimeStr();
+  void _write(const char* marker, const std::string& log);
+};
+
+// Hands each line to a background thread to write, so logging never waits on the stream.
+//
+// Each logging thread has its own single-producer ring of lines, so logging takes no lock and shares no cache line
+// with other threads: a disabled level costs one load, and an enabled one a clock read and a move of the message into
+// the ring. The writer thread wakes every few milliseconds, or sooner if a ring is filling, takes every ring's lines,
+// merges them by time and writes them to the stream in one go. If a ring is full, lines are dropped and counted,
+// except errors, which wait for room.
+class AsyncLogger : public Logger {
+ public:
+  AsyncLogger(std::ostream* stream, LogLevel_t level, size_t ringSize = KAPUA_ASYNC_LOGGER_RING_SIZE);
+  ~AsyncLogger();
+
+  virtual void raw(std::string log) override;
+  virtual void debug(std::string log) override;
+  virtual void info(std::string log) override;
+  virtual void warn(std::string log) override;
+  virtual void error(std::string log) override;
+  virtual void set_log_level(LogLevel_t level) override;
+  virtual bool is_enabled(LogLevel_t level) override { return level <= _log_level.load(std::memory_order_relaxed); }
+
+  // Wait until every line logged before the call has been written
+  void flush();
+  uint64_t get_dropped() { return _dropped; }
+
+ protected:
+  struct Line {
+    int64_t time_ns;
+    const char* marker;
+    std::string message;
+  };
+
+  std::ostream* _output_stream;
+  std::atomic<uint8_t> _log_level;
+
+  std::atomic<uint64_t> _dropped;
+  uint64_t _dropped_reported;
+  LogTimestamp _timestamp;
+
+  ThreadRings<Line> _rings;
+
+  void _log(const char* marker, bool mustWrite, std::string&& log);
+  void _write(std::vector<Line>& lines);
 };
 
 class ScopedLogger : public Logger {
@@ -65,6 +133,7 @@ class ScopedLogger : public Logger {
   virtual void warn(std::string log) override;
   virtual void error(std::string log) override;
   virtual void set_log_level(LogLevel_t level) override;
+  virtual bool is_enabled(LogLevel_t level) override;
 
  protected:
   std::string _prefix;
@@ -72,5 +141,7 @@ class ScopedLogger : public Logger {
 
   LogLevel_t _log_level;
   bool _using_log_level = false;
+
+  std::string _scoped(const std::string& log) const;
 };
-};  // namespace Kapua
\ No newline at end of file
+};  // namespace Kapua
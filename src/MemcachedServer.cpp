@@ -1,25 +1,327 @@
+//
+// Kapua MemcachedServer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
 #include "MemcachedServer.hpp"
 
-#include <iostream>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#include "Kapua.hpp"
+#include "Util.hpp"
 
 namespace Kapua {
 
-MemcachedServer::MemcachedServer(Logger* logger, Config* config, Core* core) {
-  _logger = new ScopedLogger("Settingsuration", logger);
+namespace {
+
+const size_t MAX_LINE_LENGTH = 2048;
+const int POLL_INTERVAL_MS = 100;
+
+bool send_all(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+bool valid_key(const std::string& key) {
+  if (key.empty() || key.size() > KAPUA_KV_MAX_KEY_LENGTH) return false;
+  for (char c : key) {
+    if ((unsigned char)c <= 32 || c == 127) return false;
+  }
+  return true;
+}
 
+bool parse_uint(const std::string& token, uint64_t max, uint64_t* value) {
+  if (token.empty()) return false;
+  uint64_t result = 0;
+  for (char c : token) {
+    if (c < '0' || c > '9') return false;
+    // Checked per digit, so a long count cannot wrap around to a small one
+    if (result > (max - (c - '0')) / 10) return false;
+    result = result * 10 + (c - '0');
+  }
+  *value = result;
+  return true;
+}
+
+}  // namespace
+
+MemcachedServer::MemcachedServer(Logger* logger, Config* config, KVStore* kv) : _running(false) {
+  _logger = new ScopedLogger("MemcachedServer", logger);
   _config = config;
-  _core = core;
-  start();
+  _kv = kv;
+  _server_socket_fd = -1;
+  _port = 0;
+  _main_thread = nullptr;
 }
 
 MemcachedServer::~MemcachedServer() {
-  stop();
-
+  if (_running) stop();
   delete _logger;
 }
 
-void MemcachedServer::start() {}
+bool MemcachedServer::start() {
+  if (_running) {
+    _logger->warn("start called, but thread already running");
+    return false;
+  }
+
+  _server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_server_socket_fd == -1) {
+    _logger->error("Failed creating server socket");
+    return false;
+  }
+
+  int reuse = 1;
+  setsockopt(_server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in addr = _config->memcached_ip4_sockaddr;
+  if (bind(_server_socket_fd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(_server_socket_fd, 64) == -1) {
+    _logger->error("Failed binding server socket to " + Util::sockaddr_to_string(addr) + ": " + strerror(errno));
+    close(_server_socket_fd);
+    _server_socket_fd = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(_server_socket_fd, (sockaddr*)&addr, &len);
+  _port = ntohs(addr.sin_port);
+
+  _running = true;
+  _main_thread = new std::thread(&MemcachedServer::_main_loop, this);
+  _logger->info("Listening on " + Util::sockaddr_to_string(addr));
+  return true;
+}
+
+bool MemcachedServer::stop() {
+  if (!_running) {
+    _logger->warn("stop called, but thread not running");
+    return false;
+  }
+  _running = false;
+
+  _main_thread->join();
+  delete _main_thread;
+  _main_thread = nullptr;
 
-void MemcachedServer::stop() {}
+  return true;
+}
+
+void MemcachedServer::_main_loop() {
+  while (_running) {
+    pollfd pfd = {_server_socket_fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, POLL_INTERVAL_MS);
+    _reap_connections(false);
+    if (ready <= 0) continue;
+
+    int fd = accept(_server_socket_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+
+    std::lock_guard<std::mutex> lock(_connections_mutex);
+    if (_connections.size() >= _config->memcached_connection_limit) {
+      send_all(fd, "SERVER_ERROR too many open connections\r\n");
+      close(fd);
+      continue;
+    }
+
+    Connection* connection = new Connection();
+    connection->fd = fd;
+    connection->done = false;
+    _connections.emplace_back(connection);
+    connection->thread = std::thread(&MemcachedServer::_serve, this, connection);
+  }
+
+  // Connections notice _running is false within a poll interval
+  _reap_connections(true);
+  close(_server_socket_fd);
+  _server_socket_fd = -1;
+  _logger->debug("Stopped");
+}
+
+void MemcachedServer::_reap_connections(bool all) {
+  std::lock_guard<std::mutex> lock(_connections_mutex);
+  for (auto it = _connections.begin(); it != _connections.end();) {
+    if (all || (*it)->done) {
+      (*it)->thread.join();
+      it = _connections.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void MemcachedServer::_serve(Connection* connection) {
+  std::string buffer, response;
+  char chunk[16384];
+  auto lastActivity = std::chrono::steady_clock::now();
+  bool open = true;
+
+  while (_running && open) {
+    pollfd pfd = {connection->fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, POLL_INTERVAL_MS);
+    if (ready < 0) break;
+    if (ready == 0) {
+      auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastActivity).count();
+      if (_config->memcached_inactivity_timeout_ms > 0 && idle > _config->memcached_inactivity_timeout_ms) break;
+      continue;
+    }
+
+    ssize_t received = recv(connection->fd, chunk, sizeof(chunk), 0);
+    if (received <= 0) break;
+    lastActivity = std::chrono::steady_clock::now();
+    buffer.append(chunk, received);
+
+    // Handle every complete command in the buffer, pipelined commands get one combined response
+    size_t pos = 0;
+    while (open) {
+      size_t eol = buffer.find("\r\n", pos);
+      if (eol == std::string::npos) {
+        if (buffer.size() - pos > MAX_LINE_LENGTH) {
+          response += "CLIENT_ERROR line too long\r\n";
+          open = false;
+        }
+        break;
+      }
+
+      std::string line = buffer.substr(pos, eol - pos);
+      size_t next = eol + 2;
+      int64_t dataLen = _get_data_length(line);
+
+      if (dataLen > KAPUA_MEMCACHED_MAX_DATA_LENGTH) {
+        response += "SERVER_ERROR object too large for cache\r\n";
+        open = false;
+      } else if (dataLen >= 0) {
+        // Wait for the whole data block and its trailing CRLF
+        if (buffer.size() < next + dataLen + 2) break;
+        if (buffer.compare(next + dataLen, 2, "\r\n") != 0) {
+          response += "CLIENT_ERROR bad data chunk\r\n";
+          open = false;
+        } else {
+          open = _process_command(line, (const uint8_t*)buffer.data() + next, dataLen, &response);
+        }
+        next += dataLen + 2;
+      } else {
+        open = _process_command(line, nullptr, 0, &response);
+      }
+      pos = next;
+    }
+    buffer.erase(0, pos);
+
+    if (!response.empty() && !send_all(connection->fd, response)) break;
+    response.clear();
+  }
+
+  close(connection->fd);
+  connection->done = true;
+}
+
+bool MemcachedServer::_process_command(const std::string& line, const uint8_t* data, size_t len, std::string* response) {
+  std::istringstream stream(line);
+  std::vector<std::string> tokens;
+  std::string token;
+  while (stream >> token) tokens.push_back(token);
+
+  if (tokens.empty()) {
+    *response += "ERROR\r\n";
+    return true;
+  }
+  const std::string& command = tokens[0];
+
+  if (command == "get" || command == "gets") {
+    if (tokens.size() < 2) {
+      *response += "ERROR\r\n";
+      return true;
+    }
+    std::string values;
+    std::vector<uint8_t> value;
+    for (size_t i = 1; i < tokens.size(); i++) {
+      if (!valid_key(tokens[i])) {
+        *response += "CLIENT_ERROR bad key\r\n";
+        return true;
+      }
+      KVStore::Result result = _kv->get(tokens[i], &value);
+      if (result == KVStore::Result::Unavailable) {
+        *response += "SERVER_ERROR replicas unavailable\r\n";
+        return true;
+      }
+      // Values are stored as 4 bytes of flags followed by the data
+      if (result != KVStore::Result::Found || value.size() < 4) continue;
+      uint32_t flags;
+      std::memcpy(&flags, value.data(), 4);
+      values += "VALUE " + tokens[i] + " " + std::to_string(flags) + " " + std::to_string(value.size() - 4) + "\r\n";
+      values.append((const char*)value.data() + 4, value.size() - 4);
+      values += "\r\n";
+    }
+    *response += values + "END\r\n";
+    return true;
+  }
+
+  if (command == "set") {
+    uint64_t flags, exptime, bytes;
+    bool noreply = tokens.size() == 6 && tokens[5] == "noreply";
+    if ((tokens.size() != 5 && !noreply) || !valid_key(tokens[1]) || !parse_uint(tokens[2], UINT32_MAX, &flags) ||
+        !parse_uint(tokens[3], UINT32_MAX, &exptime) || !parse_uint(tokens[4], KAPUA_MEMCACHED_MAX_DATA_LENGTH, &bytes) || bytes != len) {
+      *response += "CLIENT_ERROR bad command line format\r\n";
+      return true;
+    }
+
+    std::vector<uint8_t> value(4 + len);
+    uint32_t flags32 = (uint32_t)flags;
+    std::memcpy(value.data(), &flags32, 4);
+    if (len) std::memcpy(value.data() + 4, data, len);
+
+    bool stored = _kv->set(tokens[1], value.data(), value.size());
+    if (!noreply) *response += stored ? "STORED\r\n" : "SERVER_ERROR replicas unavailable\r\n";
+    return true;
+  }
+
+  if (command == "delete") {
+    bool noreply = tokens.size() == 3 && tokens[2] == "noreply";
+    if ((tokens.size() != 2 && !noreply) || !valid_key(tokens[1])) {
+      *response += "CLIENT_ERROR bad command line format\r\n";
+      return true;
+    }
+    // Deletes are blind tombstone writes, so they cannot report NOT_FOUND
+    bool deleted = _kv->remove(tokens[1]);
+    if (!noreply) *response += deleted ? "DELETED\r\n" : "SERVER_ERROR replicas unavailable\r\n";
+    return true;
+  }
+
+  if (command == "version") {
+    *response += "VERSION " + KAPUA_VERSION_STRING + "\r\n";
+    return true;
+  }
+
+  if (command == "quit") return false;
+
+  *response += "ERROR\r\n";
+  return true;
+}
+
+int64_t MemcachedServer::_get_data_length(const std::string& line) {
+  if (line.compare(0, 4, "set ") != 0) return -1;
+
+  // The byte count is the fifth token
+  std::istringstream stream(line);
+  std::string token;
+  for (int i = 0; i < 5; i++) {
+    if (!(stream >> token)) return -1;
+  }
+  uint64_t bytes;
+  if (!parse_uint(token, UINT32_MAX, &bytes)) return -1;
+  return (int64_t)bytes;
+}
 
-}  // namespace Kapua
\ No newline at end of file
+}  // namespace Kapua
@@ -6,28 +6,62 @@
 //
 #pragma once
 
+#include <atomic>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "Config.hpp"
-#include "Core.hpp"
+#include "KVStore.hpp"
 #include "Logger.hpp"
 
 namespace Kapua {
 
+// Values are stored with 4 bytes of flags in front, which count towards the store's limit
+#define KAPUA_MEMCACHED_MAX_DATA_LENGTH (KAPUA_KV_MAX_VALUE_LENGTH - 4)
+
+// Serves the KVStore over the memcached text protocol: get, set, delete, version and quit. Item flags are stored
+// with the value; expiry times are accepted but not applied.
 class MemcachedServer {
  public:
-  MemcachedServer(Logger* logger, Config* config, Core* core);
+  MemcachedServer(Logger* logger, Config* config, KVStore* kv);
   ~MemcachedServer();
 
-  void start();
-  void stop();
+  bool start();
+  bool stop();
+
+  // The bound port, useful when configured with port 0
+  uint16_t get_port() { return _port; }
+
+ protected:
+  struct Connection {
+    int fd;
+    std::thread thread;
+    std::atomic_bool done;
+  };
 
- private:
   Logger* _logger;
   Config* _config;
-  Core* _core;
+  KVStore* _kv;
+
+  int _server_socket_fd;
+  uint16_t _port;
+  std::thread* _main_thread;
+  std::atomic_bool _running;
+
+  std::list<std::unique_ptr<Connection>> _connections;
+  std::mutex _connections_mutex;
+
+  void _main_loop();
+  void _reap_connections(bool all);
+  void _serve(Connection* connection);
+  // Handle one command line, with its data block for storage commands. Returns false to close the connection.
+  bool _process_command(const std::string& line, const uint8_t* data, size_t len, std::string* response);
+  // For storage commands, the length of the data block that follows the command line, or -1
+  static int64_t _get_data_length(const std::string& line);
 };
 
 }  // namespace Kapua
@@ -0,0 +1,119 @@
+//
+// Kapua MemoryTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "MemoryTransport.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Kapua {
+
+uint64_t MemoryNetwork::get_delivered() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _delivered;
+}
+
+uint64_t MemoryNetwork::get_dropped() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _dropped;
+}
+
+void MemoryNetwork::_send(const Transport::Datagram& datagram, const sockaddr_in& from) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (datagram.addr.sin_addr.s_addr == htonl(INADDR_BROADCAST)) {
+    for (auto& it : _transports) {
+      if (it.first.second != datagram.addr.sin_port || it.first.first == from.sin_addr.s_addr) continue;
+      if (it.second->_deliver(datagram.data, datagram.size, from)) {
+        _delivered++;
+      } else {
+        _dropped++;
+      }
+    }
+    return;
+  }
+
+  auto it = _transports.find(std::make_pair((uint32_t)datagram.addr.sin_addr.s_addr, (uint16_t)datagram.addr.sin_port));
+  if (it != _transports.end() && it->second->_deliver(datagram.data, datagram.size, from)) {
+    _delivered++;
+  } else {
+    _dropped++;
+  }
+}
+
+MemoryTransport::MemoryTransport(MemoryNetwork* network, uint32_t address) {
+  _network = network;
+  std::memset(&_addr, 0, sizeof(_addr));
+  _addr.sin_family = AF_INET;
+  _addr.sin_addr.s_addr = htonl(address);
+  _open = false;
+  _buffers.resize(KAPUA_RECEIVE_BATCH);
+}
+
+MemoryTransport::~MemoryTransport() { close(); }
+
+bool MemoryTransport::open(uint16_t port) {
+  std::lock_guard<std::mutex> lock(_network->_mutex);
+  if (_open) return false;
+
+  _addr.sin_port = htons(port);
+  auto key = std::make_pair((uint32_t)_addr.sin_addr.s_addr, (uint16_t)_addr.sin_port);
+  if (_network->_transports.count(key)) return false;
+  _network->_transports[key] = this;
+  _open = true;
+  return true;
+}
+
+void MemoryTransport::close() {
+  {
+    std::lock_guard<std::mutex> lock(_network->_mutex);
+    if (!_open) return;
+    _network->_transports.erase(std::make_pair((uint32_t)_addr.sin_addr.s_addr, (uint16_t)_addr.sin_port));
+    _open = false;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _queue.clear();
+}
+
+bool MemoryTransport::wait(uint32_t timeoutUs) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _arrived.wait_for(lock, std::chrono::microseconds(timeoutUs), [this] { return !_queue.empty(); });
+}
+
+size_t MemoryTransport::receive(Datagram* datagrams, size_t count) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  size_t received = std::min(std::min(count, _buffers.size()), _queue.size());
+  for (size_t i = 0; i < received; i++) {
+    Queued& queued = _queue.front();
+    std::memcpy(&_buffers[i], queued.data.data(), queued.data.size());
+    datagrams[i].data = reinterpret_cast<uint8_t*>(&_buffers[i]);
+    datagrams[i].size = queued.data.size();
+    datagrams[i].addr = queued.from;
+    _queue.pop_front();
+  }
+  return received;
+}
+
+size_t MemoryTransport::send(const Datagram* datagrams, size_t count) {
+  if (!_open) return 0;
+  for (size_t i = 0; i < count; i++) _network->_send(datagrams[i], _addr);
+  // As with UDP, a datagram is sent whether or not it arrives
+  return count;
+}
+
+bool MemoryTransport::_deliver(const uint8_t* data, size_t size, const sockaddr_in& from) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_queue.size() >= KAPUA_MEMORY_TRANSPORT_QUEUE) return false;
+
+  // As recvfrom would, a datagram too long for the buffer is cut short
+  size = std::min(size, (size_t)KAPUA_MAX_PACKET_SIZE);
+  _queue.push_back({from, std::vector<uint8_t>(data, data + size)});
+  _arrived.notify_one();
+  return true;
+}
+
+}  // namespace Kapua
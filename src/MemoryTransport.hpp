@@ -0,0 +1,81 @@
+//
+// Kapua MemoryTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Protocol.hpp"
+#include "Transport.hpp"
+
+namespace Kapua {
+
+// Datagrams a MemoryTransport holds before it drops more, as a socket's receive buffer would
+#define KAPUA_MEMORY_TRANSPORT_QUEUE 4096
+
+class MemoryTransport;
+
+// Joins MemoryTransports in one process as if they shared a LAN. A datagram goes to the transport open on its address
+// and port, and a broadcast to every other transport open on its port. Nothing is lost unless a queue is full.
+class MemoryNetwork {
+ public:
+  uint64_t get_delivered();
+  uint64_t get_dropped();
+
+ protected:
+  friend class MemoryTransport;
+
+  std::mutex _mutex;
+  std::map<std::pair<uint32_t, uint16_t>, MemoryTransport*> _transports;  // By address and port, in network order
+  uint64_t _delivered = 0;
+  uint64_t _dropped = 0;
+
+  void _send(const Transport::Datagram& datagram, const sockaddr_in& from);
+};
+
+// A Transport that moves datagrams through memory, for tests and benchmarks that run several nodes in one process
+class MemoryTransport : public Transport {
+ public:
+  // address is in host order, such as 0x7f000001 for 127.0.0.1
+  MemoryTransport(MemoryNetwork* network, uint32_t address);
+  ~MemoryTransport();
+
+  bool open(uint16_t port) override;
+  void close() override;
+  bool wait(uint32_t timeoutUs) override;
+  size_t receive(Datagram* datagrams, size_t count) override;
+  size_t send(const Datagram* datagrams, size_t count) override;
+
+  sockaddr_in get_addr() { return _addr; }
+
+ protected:
+  friend class MemoryNetwork;
+
+  struct Queued {
+    sockaddr_in from;
+    std::vector<uint8_t> data;
+  };
+
+  MemoryNetwork* _network;
+  sockaddr_in _addr;
+  bool _open;
+
+  std::mutex _mutex;
+  std::condition_variable _arrived;
+  std::deque<Queued> _queue;
+  std::vector<Packet> _buffers;
+
+  // Called by the network with its lock held. Returns false if the queue is full.
+  bool _deliver(const uint8_t* data, size_t size, const sockaddr_in& from);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,34 @@
+//
+// Kapua MerkleTree class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "MerkleTree.hpp"
+
+namespace Kapua {
+
+MerkleTree::MerkleTree(uint8_t depth) : _depth(depth), _nodes(((size_t)2 << depth) - 1, 0) {}
+
+void MerkleTree::toggle(uint32_t leaf, uint64_t itemHash) {
+  size_t node = ((size_t)1 << _depth) - 1 + leaf;
+  _nodes[node] ^= itemHash;
+
+  // Rehash the path to the root. Interior nodes are ordered, so swapping two subtrees changes the root.
+  while (node > 0) {
+    node = (node - 1) / 2;
+    uint64_t left = _nodes[2 * node + 1], right = _nodes[2 * node + 2];
+    _nodes[node] = (left | right) ? _mix(left ^ _mix(right + 0x9e3779b97f4a7c15ULL)) : 0;
+  }
+}
+
+uint64_t MerkleTree::get_item_hash(uint64_t id, uint64_t digest) { return _mix(id ^ _mix(digest)); }
+
+uint64_t MerkleTree::_mix(uint64_t x) {
+  // splitmix64 finaliser
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace Kapua
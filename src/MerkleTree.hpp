@@ -0,0 +1,40 @@
+//
+// Kapua MerkleTree class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Kapua {
+
+// A fixed shape hash tree over a range of 2^depth leaves, kept up to date as blocks come and go. Each leaf is the XOR
+// of the hashes of the blocks in it, so adding and removing a block are the same O(depth) operation and the tree
+// never needs rebuilding from the data. Level 0 is the root; level depth holds the leaves.
+class MerkleTree {
+ public:
+  MerkleTree(uint8_t depth);
+
+  // Add or remove an item from a leaf. Toggling the same item twice removes it.
+  void toggle(uint32_t leaf, uint64_t itemHash);
+
+  uint64_t get_hash(uint8_t level, uint32_t index) const { return _nodes[((size_t)1 << level) - 1 + index]; }
+  uint64_t get_root() const { return _nodes[0]; }
+  uint8_t get_depth() const { return _depth; }
+  uint32_t get_leaf_count() const { return (uint32_t)1 << _depth; }
+
+  // Hash an item for a leaf, mixing the ID and digest so neither can cancel the other
+  static uint64_t get_item_hash(uint64_t id, uint64_t digest);
+
+ protected:
+  uint8_t _depth;
+  std::vector<uint64_t> _nodes;
+
+  static uint64_t _mix(uint64_t x);
+};
+
+}  // namespace Kapua
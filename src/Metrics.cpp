@@ -0,0 +1,164 @@
+//
+// Kapua Metrics classes
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace Kapua {
+
+namespace {
+std::atomic<size_t> next_stripe(0);
+
+std::string with_label(const std::string& labels, const std::string& extra) {
+  if (labels.empty()) return "{" + extra + "}";
+  return "{" + labels + "," + extra + "}";
+}
+}  // namespace
+
+MetricCounter::MetricCounter() {
+  for (Stripe& stripe : _stripes) stripe.value = 0;
+}
+
+uint64_t MetricCounter::get() const {
+  uint64_t total = 0;
+  for (const Stripe& stripe : _stripes) total += stripe.value.load(std::memory_order_relaxed);
+  return total;
+}
+
+size_t MetricCounter::_get_stripe() {
+  // Threads take stripes in turn, so the first few threads never share one. Constant initialised, so reading it
+  // needs no guard.
+  static thread_local size_t stripe = KAPUA_METRICS_STRIPES;
+  if (stripe == KAPUA_METRICS_STRIPES) stripe = next_stripe++ % KAPUA_METRICS_STRIPES;
+  return stripe;
+}
+
+MetricHistogram::MetricHistogram() {
+  for (std::atomic<uint64_t>& bucket : _buckets) bucket = 0;
+}
+
+size_t MetricHistogram::get_bucket(uint64_t value) {
+  const uint64_t subBuckets = 1 << KAPUA_HISTOGRAM_SUB_BUCKET_BITS;
+  if (value < subBuckets) return value;
+  int exponent = 63 - __builtin_clzll(value);
+  uint64_t sub = (value >> (exponent - KAPUA_HISTOGRAM_SUB_BUCKET_BITS)) & (subBuckets - 1);
+  return ((exponent - KAPUA_HISTOGRAM_SUB_BUCKET_BITS + 1) << KAPUA_HISTOGRAM_SUB_BUCKET_BITS) + sub;
+}
+
+uint64_t MetricHistogram::get_bucket_upper(size_t bucket) {
+  const uint64_t subBuckets = 1 << KAPUA_HISTOGRAM_SUB_BUCKET_BITS;
+  if (bucket < subBuckets) return bucket;
+  int shift = (bucket >> KAPUA_HISTOGRAM_SUB_BUCKET_BITS) - 1;
+  uint64_t lower = (subBuckets + (bucket & (subBuckets - 1))) << shift;
+  return lower + ((1ULL << shift) - 1);
+}
+
+uint64_t MetricHistogram::get_percentile(double fraction) const {
+  uint64_t counts[KAPUA_HISTOGRAM_BUCKETS];
+  uint64_t total = 0;
+  for (size_t i = 0; i < KAPUA_HISTOGRAM_BUCKETS; i++) {
+    counts[i] = _buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+
+  uint64_t wanted = (uint64_t)(fraction * total + 0.5);
+  if (wanted < 1) wanted = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < KAPUA_HISTOGRAM_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= wanted) return get_bucket_upper(i);
+  }
+  return get_bucket_upper(KAPUA_HISTOGRAM_BUCKETS - 1);
+}
+
+MetricCounter* MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+  return _get(COUNTER, name, help, labels)->counter.get();
+}
+
+MetricGauge* MetricsRegistry::gauge(const std::string& name, const std::string& help, const std::string& labels) {
+  return _get(GAUGE, name, help, labels)->gauge.get();
+}
+
+MetricHistogram* MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+  return _get(HISTOGRAM, name, help, labels)->histogram.get();
+}
+
+void MetricsRegistry::gauge_callback(const std::string& name, const std::string& help, GaugeCallback callback, const std::string& labels) {
+  Metric* metric = _get(GAUGE, name, help, labels);
+  std::lock_guard<std::mutex> lock(_mutex);
+  metric->callback = callback;
+}
+
+std::string MetricsRegistry::to_prometheus() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::ostringstream out;
+  const std::string* lastName = nullptr;
+
+  for (auto& entry : _metrics) {
+    Metric& metric = entry.second;
+    std::string labels = metric.labels.empty() ? "" : "{" + metric.labels + "}";
+
+    if (!lastName || *lastName != metric.name) {
+      static const char* const types[] = {"counter", "gauge", "histogram"};
+      out << "# HELP " << metric.name << " " << metric.help << "\n";
+      out << "# TYPE " << metric.name << " " << types[metric.type] << "\n";
+      lastName = &metric.name;
+    }
+
+    switch (metric.type) {
+      case COUNTER:
+        out << metric.name << labels << " " << metric.counter->get() << "\n";
+        break;
+      case GAUGE:
+        out << metric.name << labels << " " << (metric.callback ? metric.callback() : metric.gauge->get()) << "\n";
+        break;
+      case HISTOGRAM: {
+        // Buckets are cumulative, and only written at each power of two less one, up to the largest value seen
+        MetricHistogram* histogram = metric.histogram.get();
+        size_t last = 0;
+        for (size_t i = 0; i < KAPUA_HISTOGRAM_BUCKETS; i++) {
+          if (histogram->get_bucket_count(i)) last = i;
+        }
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i <= last; i++) {
+          cumulative += histogram->get_bucket_count(i);
+          uint64_t upper = MetricHistogram::get_bucket_upper(i);
+          if (upper > 0 && ((upper + 1) & upper) == 0) {
+            out << metric.name << "_bucket" << with_label(metric.labels, "le=\"" + std::to_string(upper) + "\"") << " " << cumulative << "\n";
+          }
+        }
+        // Recorded while writing, the count may trail the buckets
+        uint64_t count = std::max(histogram->get_count(), cumulative);
+        out << metric.name << "_bucket" << with_label(metric.labels, "le=\"+Inf\"") << " " << count << "\n";
+        out << metric.name << "_sum" << labels << " " << histogram->get_sum() << "\n";
+        out << metric.name << "_count" << labels << " " << count << "\n";
+        break;
+      }
+    }
+  }
+  return out.str();
+}
+
+MetricsRegistry::Metric* MetricsRegistry::_get(Type type, const std::string& name, const std::string& help, const std::string& labels) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  Metric& metric = _metrics[name + "{" + labels + "}"];
+  if (metric.name.empty()) {
+    metric.type = type;
+    metric.name = name;
+    metric.labels = labels;
+    metric.help = help;
+  }
+  // Asking for a name as a different type gets a metric that is never written, rather than a null
+  if (type == COUNTER && !metric.counter) metric.counter.reset(new MetricCounter());
+  if (type == GAUGE && !metric.gauge) metric.gauge.reset(new MetricGauge());
+  if (type == HISTOGRAM && !metric.histogram) metric.histogram.reset(new MetricHistogram());
+  return &metric;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,118 @@
+//
+// Kapua Metrics classes
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Kapua {
+
+#define KAPUA_METRICS_STRIPES 16
+#define KAPUA_HISTOGRAM_SUB_BUCKET_BITS 3
+#define KAPUA_HISTOGRAM_BUCKETS ((64 - KAPUA_HISTOGRAM_SUB_BUCKET_BITS + 1) << KAPUA_HISTOGRAM_SUB_BUCKET_BITS)
+
+// A count that only goes up. Each thread adds to one of several counters on its own cache line, so threads counting
+// the same thing don't contend, and reading sums them.
+class MetricCounter {
+ public:
+  MetricCounter();
+
+  void add(uint64_t n = 1) { _stripes[_get_stripe()].value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get() const;
+
+ protected:
+  struct Stripe {
+    std::atomic<uint64_t> value;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  Stripe _stripes[KAPUA_METRICS_STRIPES];
+
+  static size_t _get_stripe();
+};
+
+// A value that goes up and down, such as a queue depth
+class MetricGauge {
+ public:
+  MetricGauge() : _value(0) {}
+
+  void set(int64_t value) { _value.store(value, std::memory_order_relaxed); }
+  void add(int64_t delta) { _value.fetch_add(delta, std::memory_order_relaxed); }
+  int64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+ protected:
+  std::atomic<int64_t> _value;
+};
+
+// A distribution of values such as latencies in nanoseconds, HDR style: values below 8 are counted exactly, and above
+// that each power of two is split into 8 buckets, so any value is known to within 12.5% with a fixed 500 buckets.
+class MetricHistogram {
+ public:
+  MetricHistogram();
+
+  void record(uint64_t value) {
+    _buckets[get_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.add();
+    _sum.add(value);
+  }
+
+  uint64_t get_count() const { return _count.get(); }
+  uint64_t get_sum() const { return _sum.get(); }
+  uint64_t get_bucket_count(size_t bucket) const { return _buckets[bucket].load(std::memory_order_relaxed); }
+  // The largest value in the bucket holding the given fraction of values, or 0 if there are none
+  uint64_t get_percentile(double fraction) const;
+
+  static size_t get_bucket(uint64_t value);
+  static uint64_t get_bucket_upper(size_t bucket);
+
+ protected:
+  std::atomic<uint64_t> _buckets[KAPUA_HISTOGRAM_BUCKETS];
+  MetricCounter _count;
+  MetricCounter _sum;
+};
+
+// Names metrics and writes them out in the Prometheus text format. Metrics are created on first use and live as long
+// as the registry, so callers look them up once and keep the pointer. Labels are given as Prometheus writes them,
+// e.g. type="Ping".
+class MetricsRegistry {
+ public:
+  typedef std::function<int64_t()> GaugeCallback;
+
+  MetricCounter* counter(const std::string& name, const std::string& help, const std::string& labels = "");
+  MetricGauge* gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+  MetricHistogram* histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+  // A gauge read by calling back when the metrics are written, for values already kept elsewhere
+  void gauge_callback(const std::string& name, const std::string& help, GaugeCallback callback, const std::string& labels = "");
+
+  std::string to_prometheus();
+
+ protected:
+  enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+  struct Metric {
+    Type type;
+    std::string name;
+    std::string labels;
+    std::string help;
+    std::unique_ptr<MetricCounter> counter;
+    std::unique_ptr<MetricGauge> gauge;
+    std::unique_ptr<MetricHistogram> histogram;
+    GaugeCallback callback;
+  };
+
+  std::mutex _mutex;
+  // Keyed by name then labels, so each name's series are written together
+  std::map<std::string, Metric> _metrics;
+
+  Metric* _get(Type type, const std::string& name, const std::string& help, const std::string& labels);
+};
+
+}  // namespace Kapua
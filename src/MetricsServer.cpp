@@ -0,0 +1,149 @@
+//
+// Kapua MetricsServer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "MetricsServer.hpp"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+namespace {
+
+const size_t MAX_REQUEST_LENGTH = 8192;
+const int POLL_INTERVAL_MS = 100;
+const int REQUEST_TIMEOUT_MS = 1000;
+
+bool send_all(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+std::string http_response(const std::string& status, const std::string& contentType, const std::string& body) {
+  return "HTTP/1.1 " + status + "\r\nContent-Type: " + contentType + "\r\nContent-Length: " + std::to_string(body.size()) +
+         "\r\nConnection: close\r\n\r\n" + body;
+}
+
+}  // namespace
+
+MetricsServer::MetricsServer(Logger* logger, Config* config, MetricsRegistry* metrics) : _running(false) {
+  _logger = new ScopedLogger("MetricsServer", logger);
+  _config = config;
+  _metrics = metrics;
+  _server_socket_fd = -1;
+  _port = 0;
+  _main_thread = nullptr;
+}
+
+MetricsServer::~MetricsServer() {
+  if (_running) stop();
+  delete _logger;
+}
+
+bool MetricsServer::start() {
+  if (_running) {
+    _logger->warn("start called, but thread already running");
+    return false;
+  }
+
+  _server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_server_socket_fd == -1) {
+    _logger->error("Failed creating server socket");
+    return false;
+  }
+
+  int reuse = 1;
+  setsockopt(_server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in addr = _config->metrics_ip4_sockaddr;
+  if (bind(_server_socket_fd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(_server_socket_fd, 16) == -1) {
+    _logger->error("Failed binding server socket to " + Util::sockaddr_to_string(addr) + ": " + strerror(errno));
+    close(_server_socket_fd);
+    _server_socket_fd = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(_server_socket_fd, (sockaddr*)&addr, &len);
+  _port = ntohs(addr.sin_port);
+
+  _running = true;
+  _main_thread = new std::thread(&MetricsServer::_main_loop, this);
+  _logger->info("Listening on " + Util::sockaddr_to_string(addr));
+  return true;
+}
+
+bool MetricsServer::stop() {
+  if (!_running) {
+    _logger->warn("stop called, but thread not running");
+    return false;
+  }
+  _running = false;
+
+  _main_thread->join();
+  delete _main_thread;
+  _main_thread = nullptr;
+
+  return true;
+}
+
+void MetricsServer::_main_loop() {
+  while (_running) {
+    pollfd pfd = {_server_socket_fd, POLLIN, 0};
+    if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) continue;
+
+    int fd = accept(_server_socket_fd, nullptr, nullptr);
+    if (fd < 0) continue;
+    _serve(fd);
+    close(fd);
+  }
+
+  close(_server_socket_fd);
+  _server_socket_fd = -1;
+  _logger->debug("Stopped");
+}
+
+void MetricsServer::_serve(int fd) {
+  // Only the request line matters, but wait for the end of the headers so the client isn't reset mid-request
+  std::string request;
+  char chunk[2048];
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0 || request.size() > MAX_REQUEST_LENGTH) return;
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, remaining) <= 0) continue;
+    ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+    if (received <= 0) return;
+    request.append(chunk, received);
+  }
+
+  std::string line = request.substr(0, request.find("\r\n"));
+  if (line.compare(0, 4, "GET ") != 0) {
+    send_all(fd, http_response("405 Method Not Allowed", "text/plain", "Method not allowed\n"));
+    return;
+  }
+  std::string path = line.substr(4, line.find(' ', 4) - 4);
+  if (path != "/metrics") {
+    send_all(fd, http_response("404 Not Found", "text/plain", "Not found\n"));
+    return;
+  }
+  send_all(fd, http_response("200 OK", "text/plain; version=0.0.4", _metrics->to_prometheus()));
+}
+
+}  // namespace Kapua
@@ -0,0 +1,47 @@
+//
+// Kapua MetricsServer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "Config.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace Kapua {
+
+// Serves the registry's metrics in the Prometheus text format at GET /metrics. Scrapes are infrequent and small, so
+// connections are answered one at a time on the server's own thread.
+class MetricsServer {
+ public:
+  MetricsServer(Logger* logger, Config* config, MetricsRegistry* metrics);
+  ~MetricsServer();
+
+  bool start();
+  bool stop();
+
+  // The bound port, useful when configured with port 0
+  uint16_t get_port() { return _port; }
+
+ protected:
+  Logger* _logger;
+  Config* _config;
+  MetricsRegistry* _metrics;
+
+  int _server_socket_fd;
+  uint16_t _port;
+
+  std::thread* _main_thread;
+  std::atomic_bool _running;
+
+  void _main_loop();
+  void _serve(int fd);
+};
+
+}  // namespace Kapua
@@ -39,7 +39,8 @@ class Node {
   }
   ~Node() {}
 
-  void update_last_contact() { last_contact_time = std::chrono::steady_clock::now(); }
+  // The time is the network's, which a simulator runs virtually
+  void update_last_contact(std::chrono::steady_clock::time_point now) { last_contact_time = now; }
 
   SockaddrHashable addr;
   uint64_t id;
@@ -0,0 +1,173 @@
+//
+// Kapua PacketTracer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "PacketTracer.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "Protocol.hpp"
+
+namespace Kapua {
+
+namespace {
+const char* const stage_names[PacketTracer::STAGE_COUNT] = {"receive", "lookup", "decrypt", "process", "send"};
+
+std::atomic<uint32_t> next_thread(1);
+thread_local uint32_t thread_number = 0;
+
+// Microseconds with nanosecond precision, as Chrome traces expect
+std::string to_us(uint64_t ns) {
+  char buf[32];
+  snprintf(buf, sizeof buf, "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+  return buf;
+}
+}  // namespace
+
+void PacketTracer::Span::_start(PacketTracer* tracer) {
+  if (!_get_trace(tracer)) return;
+  _tracer = tracer;
+  _start_ns = _now_ns();
+}
+
+void PacketTracer::Span::_finish() {
+  Trace* trace = _get_trace(_tracer);
+  if (!trace || trace->span_count == KAPUA_TRACE_MAX_SPANS) return;
+  trace->spans[trace->span_count++] = {_stage, _start_ns, _now_ns() - _start_ns};
+}
+
+PacketTracer::PacketTracer(Logger* logger, MetricsRegistry* metrics, uint32_t sampleEvery) : _sample_count(0), _active(0), _capturing(false) {
+  _logger = new ScopedLogger("PacketTracer", logger);
+  _sample_every = sampleEvery;
+  _packet_number = 0;
+  _capture_start_ns = 0;
+  _capture_end_ns = 0;
+
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    _stage_ns[stage] = metrics->histogram("kapua_trace_stage_ns", "Time in each stage of traced packets, in nanoseconds",
+                                          std::string("stage=\"") + stage_names[stage] + "\"");
+  }
+  _packet_ns = metrics->histogram("kapua_trace_packet_ns", "Time from receiving a traced packet to finishing with it, in nanoseconds");
+  _traced = metrics->counter("kapua_trace_packets_total", "Packets traced");
+}
+
+PacketTracer::~PacketTracer() { delete _logger; }
+
+void PacketTracer::_begin() {
+  Trace* trace = _get_trace(nullptr);
+  // A trace left unfinished on this thread is replaced
+  if (trace->tracer != this) _active++;
+  trace->tracer = this;
+  trace->start_ns = _now_ns();
+  trace->span_count = 0;
+}
+
+void PacketTracer::_end(bool accepted, uint16_t packetType) {
+  Trace* trace = _get_trace(this);
+  if (!trace) return;
+  trace->tracer = nullptr;
+  _active--;
+
+  uint64_t endNs = _now_ns();
+  _traced->add();
+  _packet_ns->record(endNs - trace->start_ns);
+  for (uint8_t i = 0; i < trace->span_count; i++) _stage_ns[trace->spans[i].stage]->record(trace->spans[i].duration_ns);
+
+  if (!_capturing.load(std::memory_order_relaxed)) return;
+  std::lock_guard<std::mutex> lock(_capture_mutex);
+  // Packets begun before the capture are left out too, as their times would come before its start
+  if (!_capturing || trace->start_ns < _capture_start_ns || endNs >= _capture_end_ns || _captured.size() >= KAPUA_TRACE_MAX_CAPTURE) return;
+  if (thread_number == 0) thread_number = next_thread++;
+  CapturedPacket packet;
+  packet.number = ++_packet_number;
+  packet.thread = thread_number;
+  packet.accepted = accepted;
+  packet.type = packetType;
+  packet.start_ns = trace->start_ns;
+  packet.end_ns = endNs;
+  packet.spans.assign(trace->spans, trace->spans + trace->span_count);
+  _captured.push_back(std::move(packet));
+}
+
+bool PacketTracer::start_capture(const std::string& filename, int32_t durationMs) {
+  std::lock_guard<std::mutex> lock(_capture_mutex);
+  if (_capturing) {
+    _logger->warn("start_capture called, but already capturing");
+    return false;
+  }
+  if (_sample_every == 0) _logger->warn("Capturing with tracing off, so nothing will be captured");
+  _capture_filename = filename;
+  _capture_start_ns = _now_ns();
+  _capture_end_ns = _capture_start_ns + (uint64_t)durationMs * 1000000;
+  _captured.clear();
+  _packet_number = 0;
+  _capturing = true;
+  _logger->info("Capturing packet traces for " + std::to_string(durationMs) + "ms to " + filename);
+  return true;
+}
+
+bool PacketTracer::check_capture() {
+  if (!_capturing.load(std::memory_order_relaxed)) return false;
+  std::lock_guard<std::mutex> lock(_capture_mutex);
+  if (!_capturing || _now_ns() < _capture_end_ns) return false;
+  _capturing = false;
+  _write_capture();
+  _captured.clear();
+  return true;
+}
+
+bool PacketTracer::is_capturing() { return _capturing; }
+
+const char* PacketTracer::get_stage_name(Stage stage) { return stage_names[stage]; }
+
+uint64_t PacketTracer::_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PacketTracer::Trace* PacketTracer::_get_trace(PacketTracer* tracer) {
+  // A thread traces at most one packet at a time
+  static thread_local Trace trace = {nullptr, 0, 0, {}};
+  if (tracer && trace.tracer != tracer) return nullptr;
+  return &trace;
+}
+
+void PacketTracer::_write_capture() {
+  FILE* file = fopen(_capture_filename.c_str(), "w");
+  if (!file) {
+    _logger->error("Cannot write packet trace " + _capture_filename + ": " + strerror(errno));
+    return;
+  }
+
+  // Complete ("X") events, with times in microseconds from the start of the capture
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  for (const CapturedPacket& packet : _captured) {
+    std::string common = ",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(packet.thread);
+    std::string type = packet.accepted ? Packet::packet_type_to_string((Packet::PacketType)packet.type) : "rejected";
+    out += first ? "\n" : ",\n";
+    first = false;
+    out += "{\"name\":\"packet\",\"cat\":\"packet\"" + common + ",\"ts\":" + to_us(packet.start_ns - _capture_start_ns) +
+           ",\"dur\":" + to_us(packet.end_ns - packet.start_ns) + ",\"args\":{\"number\":" + std::to_string(packet.number) + ",\"type\":\"" + type +
+           "\"}}";
+    for (const SpanRecord& span : packet.spans) {
+      out += ",\n{\"name\":\"" + std::string(stage_names[span.stage]) + "\",\"cat\":\"stage\"" + common +
+             ",\"ts\":" + to_us(span.start_ns - _capture_start_ns) + ",\"dur\":" + to_us(span.duration_ns) +
+             ",\"args\":{\"number\":" + std::to_string(packet.number) + "}}";
+    }
+  }
+  out += "\n]}\n";
+
+  bool ok = fwrite(out.data(), out.size(), 1, file) == 1;
+  ok &= fclose(file) == 0;
+  if (!ok) {
+    _logger->error("Cannot write packet trace " + _capture_filename);
+    return;
+  }
+  _logger->info("Wrote " + std::to_string(_captured.size()) + " packet traces to " + _capture_filename);
+}
+
+}  // namespace Kapua
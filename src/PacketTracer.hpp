@@ -0,0 +1,120 @@
+//
+// Kapua PacketTracer class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+namespace Kapua {
+
+#define KAPUA_TRACE_MAX_SPANS 16
+#define KAPUA_TRACE_MAX_CAPTURE 100000
+
+// Times the stages a sample of packets go through, from recvfrom to the sends made in reply.
+//
+// The receiving thread calls begin before reading a packet and end once it has been handled. In between, each stage is
+// timed with a Span, and spans may nest: the process stage includes any sends it makes. Only one packet in every
+// sampleEvery is traced, and for the rest begin, Span and end cost a counter and a few loads. Each traced span
+// goes into a per stage histogram, and while a capture is running, into a Chrome trace that chrome://tracing or
+// Perfetto can open.
+class PacketTracer {
+ public:
+  enum Stage { STAGE_RECEIVE, STAGE_LOOKUP, STAGE_DECRYPT, STAGE_PROCESS, STAGE_SEND, STAGE_COUNT };
+
+  // Times a stage of the packet being traced on this thread, if there is one
+  class Span {
+   public:
+    Span(PacketTracer* tracer, Stage stage) : _tracer(nullptr), _stage(stage) {
+      if (tracer && tracer->_active.load(std::memory_order_relaxed)) _start(tracer);
+    }
+    ~Span() {
+      if (_tracer) _finish();
+    }
+
+   protected:
+    PacketTracer* _tracer;
+    Stage _stage;
+    uint64_t _start_ns;
+
+    void _start(PacketTracer* tracer);
+    void _finish();
+  };
+
+  PacketTracer(Logger* logger, MetricsRegistry* metrics, uint32_t sampleEvery);
+  ~PacketTracer();
+
+  void begin() {
+    if (_sample_every && _sample_count.fetch_add(1, std::memory_order_relaxed) % _sample_every == 0) _begin();
+  }
+  void end(bool accepted, uint16_t packetType) {
+    if (_active.load(std::memory_order_relaxed)) _end(accepted, packetType);
+  }
+
+  // Keeps traced packets for the given time, then writes them to filename as a Chrome trace
+  bool start_capture(const std::string& filename, int32_t durationMs);
+  // Writes the capture once its time is up. Returns true when it has.
+  bool check_capture();
+  bool is_capturing();
+
+  static const char* get_stage_name(Stage stage);
+
+ protected:
+  struct SpanRecord {
+    Stage stage;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+  };
+
+  struct Trace {
+    PacketTracer* tracer;
+    uint64_t start_ns;
+    uint8_t span_count;
+    SpanRecord spans[KAPUA_TRACE_MAX_SPANS];
+  };
+
+  struct CapturedPacket {
+    uint64_t number;
+    uint32_t thread;
+    bool accepted;
+    uint16_t type;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    std::vector<SpanRecord> spans;
+  };
+
+  Logger* _logger;
+  uint32_t _sample_every;
+  std::atomic<uint32_t> _sample_count;
+  // Packets being traced, on any thread. Spans and end only look for this thread's trace when there are some.
+  std::atomic<uint32_t> _active;
+
+  MetricHistogram* _stage_ns[STAGE_COUNT];
+  MetricHistogram* _packet_ns;
+  MetricCounter* _traced;
+
+  std::mutex _capture_mutex;
+  std::atomic<bool> _capturing;
+  std::string _capture_filename;
+  uint64_t _capture_start_ns;
+  uint64_t _capture_end_ns;
+  std::vector<CapturedPacket> _captured;
+  uint64_t _packet_number;
+
+  void _begin();
+  void _end(bool accepted, uint16_t packetType);
+  static uint64_t _now_ns();
+  static Trace* _get_trace(PacketTracer* tracer);
+  void _write_capture();
+};
+
+}  // namespace Kapua
@@ -6,7 +6,9 @@
 //
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -22,6 +24,7 @@
 
 #include "Kapua.hpp"
 #include "RSA.hpp"
+#include "Wire.hpp"
 
 namespace Kapua {
 
@@ -39,6 +42,17 @@ typedef struct Peer {
 } Peer_t;
 
 #pragma pack(push, 1)
+
+// Capacity and load report, piggybacked on Ping packets
+struct NodeLoadReport {
+  uint64_t capacity;     // Storage capacity in bytes
+  uint64_t usage;        // Storage used in bytes
+  uint32_t iops;         // Block operations per second
+  uint32_t queue_depth;  // Outstanding block operations
+  uint32_t compute_slots;    // Compute tasks the node will run at once
+  uint32_t compute_running;  // Compute tasks running
+};
+
 struct Packet {
   enum PacketType : uint16_t {
     Ping,
@@ -46,6 +60,7 @@ struct Packet {
     PublicKeyReply,
     EncryptionContext,
     Ready,
+    AntiEntropy,
 
     Discovery = 0xFFFF,
   };
@@ -98,45 +113,62 @@ struct Packet {
 
   std::string get_version_string() { return std::to_string(version.major) + "." + std::to_string(version.minor) + "." + std::to_string(version.patch); }
 
-  // Packet PublicKeyReply
-  bool write_public_key(KeyPair *key_pair) {
-    if (key_pair->publicKey == nullptr) {
-      // Handle error: public key is not initialized
-      throw std::runtime_error("Public key is null");
-    }
-
-    int len = i2d_PublicKey(key_pair->publicKey, nullptr);
-    if (len <= 0) {
-      // Handle error: failed to get the length
-      throw std::runtime_error("Failed to get the length of the public key");
-    }
+  // A writer over the payload. set_payload takes the length from it once it is written.
+  WireWriter get_payload_writer() { return WireWriter(data, KAPUA_MAX_DATA_SIZE); }
 
-    if (len > KAPUA_MAX_DATA_SIZE) {
-      throw std::runtime_error("Length of encoded public key is larger than KAPUA_MAX_DATA_SIZE");
-    }
+  bool set_payload(const WireWriter &writer) {
+    if (!writer.ok()) return false;
+    length = writer.size();
+    return true;
+  }
 
-    unsigned char *buffer = (unsigned char *)&data;
-    unsigned char **ptrToBuffer = &buffer;
+  // A reader over the payload as received, size being the header's length once it has been checked against the bytes
+  // that arrived. Never reads past the end of the packet.
+  WireReader get_payload_reader(size_t size) const { return WireReader(data, std::min<size_t>(size, KAPUA_MAX_DATA_SIZE)); }
 
-    if (i2d_PublicKey(key_pair->publicKey, ptrToBuffer) != len) {
-      // Handle error: failed to serialize the key
-      throw std::runtime_error("Failed to serialize the public key");
-    }
+  // Packet PublicKeyReply, the key in DER
+  bool write_public_key(KeyPair *key_pair) {
+    if (key_pair->publicKey == nullptr) return false;
 
-    length = len;
+    int len = i2d_PublicKey(key_pair->publicKey, nullptr);
+    WireWriter writer = get_payload_writer();
+    unsigned char *buffer = len > 0 ? writer.reserve(len) : nullptr;
+    if (!buffer || i2d_PublicKey(key_pair->publicKey, &buffer) != len) return false;
 
-    return true;
+    return set_payload(writer);
   }
 
-  bool read_public_key(KeyPair *key_pair) {
-    const unsigned char *buf = (unsigned char *)&data;
+  bool read_public_key(KeyPair *key_pair, size_t size) {
+    WireReader reader = get_payload_reader(size);
+    size_t len = reader.remaining();
+    const unsigned char *buffer = reader.get_bytes(len);
 
-    key_pair->publicKey = d2i_PublicKey(EVP_PKEY_RSA, nullptr, &buf, length);
-    if (key_pair->publicKey == nullptr) {
-      // Handle error: deserialization failed
-      throw std::runtime_error("Failed to deserialize the public key");
-    }
+    key_pair->publicKey = d2i_PublicKey(EVP_PKEY_RSA, nullptr, &buffer, len);
+    return key_pair->publicKey != nullptr;
+  }
+
+  // Packet Ping
+  bool write_load_report(const NodeLoadReport *report) {
+    WireWriter writer = get_payload_writer();
+    writer.put_u64(report->capacity);
+    writer.put_u64(report->usage);
+    writer.put_u32(report->iops);
+    writer.put_u32(report->queue_depth);
+    writer.put_u32(report->compute_slots);
+    writer.put_u32(report->compute_running);
+    return set_payload(writer);
+  }
 
+  bool read_load_report(NodeLoadReport *report, size_t size) {
+    WireReader reader = get_payload_reader(size);
+    report->capacity = reader.get_u64();
+    report->usage = reader.get_u64();
+    report->iops = reader.get_u32();
+    report->queue_depth = reader.get_u32();
+    // Pings from older nodes carry no report, or one without the compute fields, which are then left zero
+    if (!reader.ok()) return false;
+    report->compute_slots = reader.get_u32();
+    report->compute_running = reader.get_u32();
     return true;
   }
 
@@ -152,6 +184,8 @@ struct Packet {
         return "EncryptionContext";
       case PacketType::Ready:
         return "Ready";
+      case PacketType::AntiEntropy:
+        return "AntiEntropy";
       case PacketType::Discovery:
         return "Discovery";
       default:
@@ -0,0 +1,121 @@
+//
+// Kapua Queue class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "Queue.hpp"
+
+#include <sys/stat.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "Blake3.hpp"
+
+namespace Kapua {
+
+Queue::Queue(Logger* logger, DistributedBlockStore* dbs, KVStore* kv, const std::string& directory, QueueOptions options) {
+  _logger = new ScopedLogger("Queue", logger);
+  _dbs = dbs;
+  _kv = kv;
+  _directory = directory;
+  _options = options;
+}
+
+Queue::~Queue() {
+  _logs.clear();
+  delete _logger;
+}
+
+bool Queue::is_local(const std::string& topic, uint32_t partition) { return get_partition_node(topic, partition) == _dbs->get_dbs_node_id(); }
+
+uint64_t Queue::get_partition_node(const std::string& topic, uint32_t partition) {
+  std::vector<uint64_t> nodes = _dbs->get_dbs_preference_list(get_partition_id(topic, partition), 1);
+  return nodes.empty() ? 0 : nodes[0];
+}
+
+bool Queue::produce(const std::string& topic, uint32_t partition, const uint8_t* const* data, const size_t* lens, size_t count, uint64_t* firstOffset) {
+  QueueLog* log = _get_log(topic, partition);
+  return log && log->append(data, lens, count, firstOffset);
+}
+
+bool Queue::fetch(const std::string& topic, uint32_t partition, uint64_t offset, size_t maxBytes, QueueSlice* slice) {
+  QueueLog* log = _get_log(topic, partition);
+  return log && log->fetch(offset, maxBytes, slice);
+}
+
+bool Queue::poll(const std::string& group, const std::string& topic, uint32_t partition, size_t maxBytes, QueueSlice* slice) {
+  QueueLog* log = _get_log(topic, partition);
+  if (!log) return false;
+
+  uint64_t offset;
+  KVStore::Result result = get_committed(group, topic, partition, &offset);
+  if (result == KVStore::Result::Unavailable) return false;
+  // Messages trimmed away since the group last committed are skipped
+  if (result == KVStore::Result::NotFound || offset < log->get_start_offset()) offset = log->get_start_offset();
+  return log->fetch(offset, maxBytes, slice);
+}
+
+bool Queue::commit(const std::string& group, const std::string& topic, uint32_t partition, uint64_t offset) {
+  if (!valid_name(group) || !valid_name(topic)) return false;
+  return _kv->set(_offset_key(group, topic, partition), (const uint8_t*)&offset, sizeof(offset));
+}
+
+KVStore::Result Queue::get_committed(const std::string& group, const std::string& topic, uint32_t partition, uint64_t* offset) {
+  if (!valid_name(group) || !valid_name(topic)) return KVStore::Result::NotFound;
+
+  std::vector<uint8_t> value;
+  KVStore::Result result = _kv->get(_offset_key(group, topic, partition), &value);
+  if (result != KVStore::Result::Found) return result;
+  if (value.size() != sizeof(*offset)) {
+    _logger->error("Committed offset for " + group + " on " + topic + "-" + std::to_string(partition) + " is damaged");
+    return KVStore::Result::NotFound;
+  }
+  std::memcpy(offset, value.data(), sizeof(*offset));
+  return result;
+}
+
+uint32_t Queue::get_partition_for_key(const std::string& key, uint32_t partitions) { return partitions ? KVStore::get_key_id(key) % partitions : 0; }
+
+uint64_t Queue::get_partition_id(const std::string& topic, uint32_t partition) {
+  std::string name = topic + "-" + std::to_string(partition);
+  Blake3Hash hash;
+  Blake3::hash((const uint8_t*)name.data(), name.size(), &hash);
+  return hash.to_uint64();
+}
+
+bool Queue::valid_name(const std::string& name) {
+  if (name.empty() || name.size() > KAPUA_QUEUE_MAX_TOPIC_LENGTH || name == "." || name == "..") return false;
+  for (char c : name) {
+    if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-') return false;
+  }
+  return true;
+}
+
+QueueLog* Queue::_get_log(const std::string& topic, uint32_t partition) {
+  if (!valid_name(topic) || !is_local(topic, partition)) return nullptr;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::unique_ptr<QueueLog>& log = _logs[std::make_pair(topic, partition)];
+  if (log) return log.get();
+
+  if (mkdir(_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    _logger->error("Cannot create " + _directory + ": " + strerror(errno));
+    return nullptr;
+  }
+  log.reset(new QueueLog(_logger, _options.segment_size));
+  if (!log->open(_directory + "/" + topic + "-" + std::to_string(partition), _options.sync_writes)) {
+    log.reset();
+    return nullptr;
+  }
+  return log.get();
+}
+
+std::string Queue::_offset_key(const std::string& group, const std::string& topic, uint32_t partition) {
+  return "queue:offset:" + group + ":" + topic + ":" + std::to_string(partition);
+}
+
+}  // namespace Kapua
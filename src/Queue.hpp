@@ -0,0 +1,76 @@
+//
+// Kapua Queue class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "DistributedBlockStore.hpp"
+#include "KVStore.hpp"
+#include "Logger.hpp"
+#include "QueueLog.hpp"
+
+namespace Kapua {
+
+#define KAPUA_QUEUE_MAX_TOPIC_LENGTH 200
+
+struct QueueOptions {
+  size_t segment_size = KAPUA_QUEUE_DEFAULT_SEGMENT_SIZE;
+  bool sync_writes = true;  // fdatasync each group commit
+};
+
+// Topics split into numbered partitions, each an append-only log. Every partition has a home node, the first node on
+// the ring for its ID, which holds its log and takes its appends, so a partition only moves when ring membership
+// changes. Partitions spread a topic's load over the cluster, and a partition's messages keep their order.
+//
+// Consumers in a group share a committed offset per partition, kept in the key-value store, so any member can carry
+// on from where the group left off.
+class Queue {
+ public:
+  Queue(Logger* logger, DistributedBlockStore* dbs, KVStore* kv, const std::string& directory, QueueOptions options = QueueOptions());
+  ~Queue();
+
+  // Whether this node is home to a partition, and so can take appends and serve fetches for it
+  bool is_local(const std::string& topic, uint32_t partition);
+  uint64_t get_partition_node(const std::string& topic, uint32_t partition);
+
+  bool produce(const std::string& topic, uint32_t partition, const uint8_t* const* data, const size_t* lens, size_t count, uint64_t* firstOffset);
+  bool produce(const std::string& topic, uint32_t partition, const uint8_t* data, size_t len, uint64_t* offset) {
+    return produce(topic, partition, &data, &len, 1, offset);
+  }
+  bool fetch(const std::string& topic, uint32_t partition, uint64_t offset, size_t maxBytes, QueueSlice* slice);
+
+  // Fetch from the group's committed offset, or the start of the partition if it has none
+  bool poll(const std::string& group, const std::string& topic, uint32_t partition, size_t maxBytes, QueueSlice* slice);
+  bool commit(const std::string& group, const std::string& topic, uint32_t partition, uint64_t offset);
+  KVStore::Result get_committed(const std::string& group, const std::string& topic, uint32_t partition, uint64_t* offset);
+
+  // The partition for a message key, so messages with the same key stay in order
+  static uint32_t get_partition_for_key(const std::string& key, uint32_t partitions);
+  static uint64_t get_partition_id(const std::string& topic, uint32_t partition);
+  static bool valid_name(const std::string& name);
+
+ protected:
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  KVStore* _kv;
+  std::string _directory;
+  QueueOptions _options;
+
+  std::mutex _mutex;
+  std::map<std::pair<std::string, uint32_t>, std::unique_ptr<QueueLog>> _logs;
+
+  // The partition's log, opened on first use, or null if it is not local
+  QueueLog* _get_log(const std::string& topic, uint32_t partition);
+  static std::string _offset_key(const std::string& group, const std::string& topic, uint32_t partition);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,396 @@
+//
+// Kapua QueueLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "QueueLog.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+bool QueueSlice::next(QueueMessage* message) {
+  QueueLog::RecordHeader header;
+  if (_position + sizeof(header) > _length) return false;
+
+  std::memcpy(&header, _data + _position, sizeof(header));
+  message->offset = header.offset;
+  message->data = _data + _position + sizeof(header);
+  message->length = header.length;
+  _position += sizeof(header) + header.length;
+  return true;
+}
+
+QueueLog::Segment::~Segment() {
+  if (map) munmap(map, map_length);
+  if (fd >= 0) ::close(fd);
+}
+
+QueueLog::QueueLog(Logger* logger, size_t segmentSize) : _end_offset(0), _writing(false), _commits(0), _appends(0), _appended_bytes(0) {
+  _logger = new ScopedLogger("QueueLog", logger);
+  _segment_size = segmentSize;
+  _sync_writes = true;
+}
+
+QueueLog::~QueueLog() {
+  close();
+  delete _logger;
+}
+
+bool QueueLog::open(const std::string& directory, bool syncWrites) {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  _directory = directory;
+  _sync_writes = syncWrites;
+
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    _logger->error("Cannot create " + directory + ": " + strerror(errno));
+    return false;
+  }
+
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    _logger->error("Cannot open " + directory + ": " + strerror(errno));
+    return false;
+  }
+  std::vector<uint64_t> bases;
+  while (dirent* entry = readdir(dir)) {
+    uint64_t base;
+    char suffix[6] = {};
+    if (sscanf(entry->d_name, "%20" SCNu64 ".%5s", &base, suffix) == 2 && strcmp(suffix, "qlog") == 0 &&
+        _segment_filename(base) == directory + "/" + entry->d_name) {
+      bases.push_back(base);
+    }
+  }
+  closedir(dir);
+  std::sort(bases.begin(), bases.end());
+
+  for (size_t i = 0; i < bases.size(); i++) {
+    std::shared_ptr<Segment> segment = _open_segment(bases[i], false);
+    if (!segment || !_scan_segment(segment.get(), i == bases.size() - 1)) return false;
+    // Trimming removes segments from the front only, so the rest must follow on from one another
+    if (i > 0 && segment->base_offset != _end_offset) {
+      _logger->error("Segment " + segment->filename + " does not follow on from the one before");
+      return false;
+    }
+    _segments[segment->base_offset] = segment;
+    _end_offset = segment->base_offset + segment->positions.size();
+  }
+
+  if (_segments.empty()) {
+    _active = _open_segment(0, true);
+    if (!_active) return false;
+    _segments[0] = _active;
+  } else {
+    _active = _segments.rbegin()->second;
+  }
+
+  _logger->debug("Opened " + directory + ", offsets " + std::to_string(_segments.begin()->first) + " to " + std::to_string(_end_offset));
+  return true;
+}
+
+void QueueLog::close() {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  // Segments still pinned by slices are unmapped when the last slice is dropped
+  _segments.clear();
+  _active.reset();
+  _end_offset = 0;
+}
+
+bool QueueLog::append(const uint8_t* const* data, const size_t* lens, size_t count, uint64_t* firstOffset) {
+  if (count == 0) return false;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (lens[i] > get_max_message_size()) {
+      _logger->error("Message of " + std::to_string(lens[i]) + " bytes is larger than a segment");
+      return false;
+    }
+    bytes += lens[i];
+  }
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+    if (!_active) return false;
+  }
+
+  Append append = {data, lens, count, 0, false, false};
+  std::unique_lock<std::mutex> lock(_append_mutex);
+  _queued.push_back(&append);
+
+  // Either write everything queued so far, or wait for whoever is writing to do so
+  while (!append.done) {
+    if (_writing) {
+      _append_done.wait(lock);
+      continue;
+    }
+
+    _writing = true;
+    std::vector<Append*> group(_queued.begin(), _queued.end());
+    _queued.clear();
+    lock.unlock();
+    bool ok = _commit(group);
+    lock.lock();
+
+    for (Append* queued : group) {
+      queued->ok = ok;
+      queued->done = true;
+    }
+    _writing = false;
+    _append_done.notify_all();
+  }
+
+  if (!append.ok) return false;
+  *firstOffset = append.first_offset;
+  _appends += count;
+  _appended_bytes += bytes;
+  return true;
+}
+
+bool QueueLog::fetch(uint64_t offset, size_t maxBytes, QueueSlice* slice) {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  *slice = QueueSlice();
+  if (_segments.empty() || offset < _segments.begin()->first || offset > _end_offset) return false;
+
+  slice->_first_offset = slice->_next_offset = offset;
+  if (offset == _end_offset) return true;
+
+  auto it = --_segments.upper_bound(offset);
+  const std::shared_ptr<Segment>& segment = it->second;
+  size_t index = offset - segment->base_offset;
+  if (index >= segment->positions.size()) return false;
+
+  // Whole records only, and never past the end of the segment
+  uint64_t start = segment->positions[index], end = start;
+  size_t next = index;
+  while (next < segment->positions.size()) {
+    uint64_t recordEnd = next + 1 < segment->positions.size() ? segment->positions[next + 1] : segment->size;
+    if (next > index && recordEnd - start > maxBytes) break;
+    end = recordEnd;
+    next++;
+  }
+
+  slice->_pin = segment;
+  slice->_data = segment->map + start;
+  slice->_length = end - start;
+  slice->_fd = segment->fd;
+  slice->_file_offset = start;
+  slice->_next_offset = segment->base_offset + next;
+  return true;
+}
+
+bool QueueLog::send_slice(const QueueSlice& slice, int fd) {
+  off_t offset = (off_t)slice._file_offset;
+  size_t remaining = slice._length;
+
+  while (remaining > 0) {
+    ssize_t n = sendfile(fd, slice._fd, &offset, remaining);
+    if (n > 0) {
+      remaining -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+    return false;
+  }
+
+  // Some descriptors cannot take sendfile; write from the mapping instead
+  const uint8_t* data = slice._data + (slice._length - remaining);
+  while (remaining > 0) {
+    ssize_t n = write(fd, data, remaining);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    remaining -= n;
+  }
+  return true;
+}
+
+void QueueLog::trim(uint64_t offset) {
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  while (_segments.size() > 1 && std::next(_segments.begin())->first <= offset) {
+    std::shared_ptr<Segment> segment = _segments.begin()->second;
+    _segments.erase(_segments.begin());
+    if (unlink(segment->filename.c_str()) != 0) _logger->warn("Cannot remove " + segment->filename + ": " + strerror(errno));
+  }
+}
+
+uint64_t QueueLog::get_start_offset() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _segments.empty() ? 0 : _segments.begin()->first;
+}
+
+uint64_t QueueLog::get_end_offset() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _end_offset;
+}
+
+size_t QueueLog::get_segment_count() {
+  std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+  return _segments.size();
+}
+
+size_t QueueLog::get_max_message_size() const { return _segment_size - sizeof(RecordHeader); }
+
+std::shared_ptr<QueueLog::Segment> QueueLog::_open_segment(uint64_t baseOffset, bool create) {
+  std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+  segment->base_offset = baseOffset;
+  segment->filename = _segment_filename(baseOffset);
+  segment->fd = ::open(segment->filename.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+  if (segment->fd < 0) {
+    _logger->error("Cannot open " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(segment->fd, &st) != 0) {
+    _logger->error("Cannot stat " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+  segment->size = st.st_size;
+
+  // Mapped at full size up front, so slices of the active segment stay valid as it grows
+  segment->map_length = std::max((size_t)st.st_size, _segment_size);
+  void* map = mmap(nullptr, segment->map_length, PROT_READ, MAP_SHARED, segment->fd, 0);
+  if (map == MAP_FAILED) {
+    _logger->error("Cannot map " + segment->filename + ": " + strerror(errno));
+    return nullptr;
+  }
+  segment->map = (uint8_t*)map;
+  return segment;
+}
+
+bool QueueLog::_scan_segment(Segment* segment, bool last) {
+  uint64_t position = 0;
+  RecordHeader header;
+
+  while (position + sizeof(header) <= segment->size) {
+    std::memcpy(&header, segment->map + position, sizeof(header));
+    if (header.length > segment->size - position - sizeof(header)) break;
+    if (header.offset != segment->base_offset + segment->positions.size()) break;
+
+    size_t crcOffset = offsetof(RecordHeader, length);
+    if (Util::crc32c(segment->map + position + crcOffset, _record_size(header.length) - crcOffset) != header.crc) break;
+
+    segment->positions.push_back((uint32_t)position);
+    position += _record_size(header.length);
+  }
+
+  if (position < segment->size) {
+    // A torn write from a crash can only be at the end of the newest segment
+    if (!last) {
+      _logger->error("Segment " + segment->filename + " is damaged at position " + std::to_string(position));
+      return false;
+    }
+    _logger->warn("Truncating " + std::to_string(segment->size - position) + " bytes of damaged segment " + segment->filename);
+    if (ftruncate(segment->fd, position) != 0) return false;
+    segment->size = position;
+  }
+  return true;
+}
+
+bool QueueLog::_commit(const std::vector<Append*>& group) {
+  // Only one commit runs at a time, so the active segment and end offset are only read here, never raced
+  std::shared_ptr<Segment> segment = _active;
+  uint64_t offset = _end_offset;
+  uint64_t position = segment->size, writeAt = segment->size;
+
+  size_t total = 0;
+  for (Append* append : group) total += append->count;
+  std::vector<RecordHeader> headers(total);
+  std::vector<struct iovec> iov;
+  std::vector<std::tuple<Segment*, uint32_t, uint64_t>> placed;  // Segment, position and end of each record
+  std::vector<std::shared_ptr<Segment>> opened;                   // Segments started by this commit, not yet published
+
+  auto flush = [&]() {
+    for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+      size_t count = std::min(iov.size() - i, (size_t)IOV_MAX);
+      ssize_t expected = 0;
+      for (size_t j = i; j < i + count; j++) expected += iov[j].iov_len;
+      if (pwritev(segment->fd, &iov[i], count, writeAt) != expected) {
+        _logger->error("Write to " + segment->filename + " failed: " + strerror(errno));
+        return false;
+      }
+      writeAt += expected;
+    }
+    iov.clear();
+    return !_sync_writes || fdatasync(segment->fd) == 0;
+  };
+
+  // Nothing this commit wrote has been published, so a failure removes the segments it started and cuts the old
+  // active segment back to its published size. Records left past it would be found again by the next open, and a
+  // smaller commit writing over part of them would leave the segment looking damaged once it is no longer the last.
+  auto fail = [&]() {
+    for (auto& started : opened) {
+      if (unlink(started->filename.c_str()) != 0) _logger->warn("Cannot remove " + started->filename + ": " + strerror(errno));
+    }
+    if (ftruncate(_active->fd, _active->size) != 0) _logger->error("Cannot truncate " + _active->filename + ": " + strerror(errno));
+    return false;
+  };
+
+  size_t h = 0;
+  for (Append* append : group) {
+    append->first_offset = offset;
+    for (size_t i = 0; i < append->count; i++, h++, offset++) {
+      size_t len = append->lens[i];
+      if (position + _record_size(len) > _segment_size) {
+        // Finish this segment and start the next at the offset of the record that did not fit. The new segment is
+        // published with the records, once they are all written.
+        if (!flush()) return fail();
+        std::shared_ptr<Segment> next = _open_segment(offset, true);
+        if (!next) return fail();
+        opened.push_back(next);
+        segment = next;
+        position = writeAt = 0;
+      }
+
+      RecordHeader& header = headers[h];
+      header.length = (uint32_t)len;
+      header.offset = offset;
+      size_t crcOffset = offsetof(RecordHeader, length);
+      header.crc = Util::crc32c((const uint8_t*)&header + crcOffset, sizeof(header) - crcOffset);
+      if (len) header.crc = Util::crc32c(append->data[i], len, header.crc);
+
+      iov.push_back({&header, sizeof(header)});
+      if (len) iov.push_back({(void*)append->data[i], len});
+      placed.emplace_back(segment.get(), (uint32_t)position, position + _record_size(len));
+      position += _record_size(len);
+    }
+  }
+  if (!flush()) return fail();
+  _commits++;
+
+  // Readers see the records only once they are durable
+  std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+  for (auto& started : opened) _segments[started->base_offset] = started;
+  if (!opened.empty()) _active = opened.back();
+  for (auto& record : placed) {
+    std::get<0>(record)->positions.push_back(std::get<1>(record));
+    std::get<0>(record)->size = std::get<2>(record);
+  }
+  _end_offset = offset;
+  return true;
+}
+
+std::string QueueLog::_segment_filename(uint64_t baseOffset) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%020" PRIu64 ".qlog", baseOffset);
+  return _directory + "/" + name;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,163 @@
+//
+// Kapua QueueLog class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_QUEUE_DEFAULT_SEGMENT_SIZE (256 * 1024 * 1024)
+
+class QueueLog;
+
+struct QueueMessage {
+  uint64_t offset;
+  const uint8_t* data;
+  size_t length;
+};
+
+// A run of consecutive records fetched from a QueueLog, straight from the page cache. Like a BlockView, it pins the
+// segment it points into. Iterate it with next, or send the raw records to a socket with QueueLog::send_slice.
+class QueueSlice {
+ public:
+  QueueSlice() : _data(nullptr), _length(0), _fd(-1), _file_offset(0), _first_offset(0), _next_offset(0), _position(0) {}
+
+  // Records in wire format: a header then the message, back to back
+  const uint8_t* data() const { return _data; }
+  size_t size() const { return _length; }
+  bool empty() const { return _length == 0; }
+  uint64_t get_first_offset() const { return _first_offset; }
+  // The offset to fetch from next
+  uint64_t get_next_offset() const { return _next_offset; }
+
+  bool next(QueueMessage* message);
+
+ protected:
+  friend class QueueLog;
+
+  std::shared_ptr<const void> _pin;
+  const uint8_t* _data;
+  size_t _length;
+  int _fd;
+  uint64_t _file_offset;
+  uint64_t _first_offset;
+  uint64_t _next_offset;
+  size_t _position;
+};
+
+// One queue partition's log on local disk. Messages are appended to segment files, each record carrying its offset and
+// a CRC-32C, and each segment is named for the offset of its first record. On open the segments are scanned to rebuild
+// the offset index, and a torn write at the end of the newest segment is truncated.
+//
+// Appends are group committed. Concurrent appenders queue their batches, and whichever finds no write in progress
+// writes every queued batch with gathered writes and a single fdatasync, then wakes the others. Under load, one sync
+// covers many producers' batches.
+//
+// Segments are memory mapped read-only, so fetching hands out a slice of whole records from the page cache, which can
+// be parsed in place or sent on to a socket with sendfile.
+class QueueLog {
+ public:
+  QueueLog(Logger* logger, size_t segmentSize = KAPUA_QUEUE_DEFAULT_SEGMENT_SIZE);
+  ~QueueLog();
+
+  bool open(const std::string& directory, bool syncWrites = true);
+  void close();
+
+  // Append a batch of messages at consecutive offsets, returning once they are written, and synced if so configured
+  bool append(const uint8_t* const* data, const size_t* lens, size_t count, uint64_t* firstOffset);
+  bool append(const uint8_t* data, size_t len, uint64_t* offset) { return append(&data, &len, 1, offset); }
+
+  // Fetch whole records from offset, up to maxBytes but always at least one. Fetching at the end offset gives an empty
+  // slice. Fails if offset has been trimmed away or is past the end.
+  bool fetch(uint64_t offset, size_t maxBytes, QueueSlice* slice);
+  static bool send_slice(const QueueSlice& slice, int fd);
+
+  // Remove whole segments that hold only records before offset
+  void trim(uint64_t offset);
+
+  uint64_t get_start_offset();
+  uint64_t get_end_offset();
+  size_t get_segment_count();
+  size_t get_max_message_size() const;
+
+  uint64_t get_commits() { return _commits; }
+  uint64_t get_appends() { return _appends; }
+  uint64_t get_appended_bytes() { return _appended_bytes; }
+
+ protected:
+  friend class QueueSlice;
+
+#pragma pack(push, 1)
+  struct RecordHeader {
+    uint32_t crc;  // CRC-32C of everything after this field, including the message
+    uint32_t length;
+    uint64_t offset;
+  };
+#pragma pack(pop)
+
+  struct Segment {
+    uint64_t base_offset;
+    std::string filename;
+    int fd;
+    uint8_t* map;
+    size_t map_length;
+    uint64_t size;
+    std::vector<uint32_t> positions;  // Of each record, by offset - base_offset
+
+    Segment() : base_offset(0), fd(-1), map(nullptr), map_length(0), size(0) {}
+    ~Segment();
+  };
+
+  struct Append {
+    const uint8_t* const* data;
+    const size_t* lens;
+    size_t count;
+    uint64_t first_offset;
+    bool done;
+    bool ok;
+  };
+
+  Logger* _logger;
+  std::string _directory;
+  size_t _segment_size;
+  bool _sync_writes;
+
+  // Guards the published state that readers see
+  std::shared_timed_mutex _mutex;
+  std::map<uint64_t, std::shared_ptr<Segment>> _segments;
+  std::shared_ptr<Segment> _active;
+  uint64_t _end_offset;
+
+  // Group commit
+  std::mutex _append_mutex;
+  std::condition_variable _append_done;
+  std::deque<Append*> _queued;
+  bool _writing;
+
+  std::atomic<uint64_t> _commits;
+  std::atomic<uint64_t> _appends;
+  std::atomic<uint64_t> _appended_bytes;
+
+  std::shared_ptr<Segment> _open_segment(uint64_t baseOffset, bool create);
+  bool _scan_segment(Segment* segment, bool last);
+  bool _commit(const std::vector<Append*>& group);
+  std::string _segment_filename(uint64_t baseOffset) const;
+  static size_t _record_size(size_t len) { return sizeof(RecordHeader) + len; }
+};
+
+}  // namespace Kapua
@@ -11,6 +11,9 @@
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 
+#include <cstring>
+#include <vector>
+
 #include "Util.hpp"
 
 namespace Kapua {
@@ -152,7 +155,10 @@ bool RSA::decrypt_aes_context(AESKey* context, EVP_PKEY* privateKey, const uint8
     return false;
   }
 
-  if (EVP_PKEY_decrypt(ctx, reinterpret_cast<uint8_t*>(context), out_size, in_buffer, in_size) != 1) {
+  // Decrypt into a buffer the size of the key, as OpenSSL may need the room, and only then check it holds an AESKey
+  std::vector<uint8_t> plaintext(EVP_PKEY_size(privateKey));
+  *out_size = plaintext.size();
+  if (EVP_PKEY_decrypt(ctx, plaintext.data(), out_size, in_buffer, in_size) != 1) {
     _logger->error("Error decrypting context.");
     EVP_PKEY_CTX_free(ctx);
     return false;
@@ -164,6 +170,7 @@ bool RSA::decrypt_aes_context(AESKey* context, EVP_PKEY* privateKey, const uint8
     return false;
   }
 
+  std::memcpy(context, plaintext.data(), sizeof(AESKey));
   EVP_PKEY_CTX_free(ctx);
   return true;
 }
@@ -0,0 +1,288 @@
+//
+// Kapua ReedSolomon class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "ReedSolomon.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KAPUA_RS_X86 1
+#endif
+
+namespace Kapua {
+
+namespace {
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d)
+struct GFTables {
+  uint8_t exp[512];
+  uint8_t log[256];
+  uint8_t mul[256][256];
+
+  GFTables() {
+    uint16_t x = 1;
+    for (int i = 0; i < 255; i++) {
+      exp[i] = (uint8_t)x;
+      log[x] = (uint8_t)i;
+      x <<= 1;
+      if (x & 0x100) x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++) exp[i] = exp[i - 255];
+    log[0] = 0;
+
+    for (int a = 0; a < 256; a++) {
+      for (int b = 0; b < 256; b++) {
+        mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+      }
+    }
+  }
+};
+
+const GFTables& gf() {
+  static const GFTables tables;
+  return tables;
+}
+
+void mul_add_scalar(uint8_t coef, const uint8_t* src, uint8_t* dst, size_t len) {
+  const uint8_t* row = gf().mul[coef];
+  for (size_t i = 0; i < len; i++) dst[i] ^= row[src[i]];
+}
+
+void xor_scalar(const uint8_t* src, uint8_t* dst, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t a, b;
+    std::memcpy(&a, src + i, 8);
+    std::memcpy(&b, dst + i, 8);
+    b ^= a;
+    std::memcpy(dst + i, &b, 8);
+  }
+  for (; i < len; i++) dst[i] ^= src[i];
+}
+
+#ifdef KAPUA_RS_X86
+// Split-nibble multiply: coef * x = lo[x & 0x0f] ^ hi[x >> 4], with both 16 entry tables looked up by pshufb
+__attribute__((target("ssse3"))) void mul_add_ssse3(uint8_t coef, const uint8_t* src, uint8_t* dst, size_t len) {
+  const uint8_t* row = gf().mul[coef];
+  uint8_t lo[16], hi[16];
+  for (int i = 0; i < 16; i++) {
+    lo[i] = row[i];
+    hi[i] = row[i << 4];
+  }
+  const __m128i tlo = _mm_loadu_si128((const __m128i*)lo);
+  const __m128i thi = _mm_loadu_si128((const __m128i*)hi);
+  const __m128i mask = _mm_set1_epi8(0x0f);
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i l = _mm_and_si128(s, mask);
+    __m128i h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+    __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, l), _mm_shuffle_epi8(thi, h));
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, p));
+  }
+  mul_add_scalar(coef, src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx2"))) void mul_add_avx2(uint8_t coef, const uint8_t* src, uint8_t* dst, size_t len) {
+  const uint8_t* row = gf().mul[coef];
+  uint8_t lo[16], hi[16];
+  for (int i = 0; i < 16; i++) {
+    lo[i] = row[i];
+    hi[i] = row[i << 4];
+  }
+  // vpshufb works per 128-bit lane, so the tables are duplicated into both lanes
+  const __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo));
+  const __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hi));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i l = _mm256_and_si256(s, mask);
+    __m256i h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+    __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, l), _mm256_shuffle_epi8(thi, h));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, p));
+  }
+  mul_add_scalar(coef, src + i, dst + i, len - i);
+}
+#endif
+
+}  // namespace
+
+ReedSolomon::ReedSolomon(uint8_t dataFragments, uint8_t parityFragments) {
+  _data_fragments = dataFragments;
+  _parity_fragments = parityFragments;
+  _kernel = get_best_kernel();
+  if (!is_valid(dataFragments, parityFragments)) return;
+
+  size_t k = dataFragments, m = parityFragments;
+  _matrix.assign((k + m) * k, 0);
+
+  // Identity for the data fragments
+  for (size_t i = 0; i < k; i++) _matrix[i * k + i] = 1;
+
+  // Cauchy rows for the parity fragments: 1 / (x_i + y_j) with x_i = k + i, y_j = j. Every square submatrix of a
+  // Cauchy matrix is invertible, which is what makes any k fragments sufficient.
+  for (size_t i = 0; i < m; i++) {
+    for (size_t j = 0; j < k; j++) {
+      _matrix[(k + i) * k + j] = gf_inv((uint8_t)((k + i) ^ j));
+    }
+  }
+}
+
+void ReedSolomon::encode(const uint8_t* const* data, uint8_t* const* parity, size_t len) const {
+  if (!is_valid()) return;
+  size_t k = _data_fragments;
+  for (size_t i = 0; i < _parity_fragments; i++) {
+    std::memset(parity[i], 0, len);
+    for (size_t j = 0; j < k; j++) {
+      gf_mul_add_region(_kernel, _matrix[(k + i) * k + j], data[j], parity[i], len);
+    }
+  }
+}
+
+bool ReedSolomon::reconstruct(uint8_t* const* fragments, const bool* present, size_t len) const {
+  if (!is_valid()) return false;
+  size_t k = _data_fragments, total = (size_t)_data_fragments + _parity_fragments;
+
+  // Pick the first k present fragments, preferring data fragments as they come first
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < total && selected.size() < k; i++) {
+    if (present[i]) selected.push_back(i);
+  }
+  if (selected.size() < k) return false;
+
+  bool dataMissing = false;
+  for (size_t i = 0; i < k; i++) dataMissing |= !present[i];
+
+  if (dataMissing) {
+    // Rows of the generator for the selected fragments, inverted, map those fragments back to the data
+    std::vector<uint8_t> decode(k * k);
+    for (size_t r = 0; r < k; r++) std::memcpy(&decode[r * k], &_matrix[selected[r] * k], k);
+    if (!_invert_matrix(decode, k)) return false;
+
+    for (size_t d = 0; d < k; d++) {
+      if (present[d]) continue;
+      std::memset(fragments[d], 0, len);
+      for (size_t j = 0; j < k; j++) {
+        gf_mul_add_region(_kernel, decode[d * k + j], fragments[selected[j]], fragments[d], len);
+      }
+    }
+  }
+
+  // With all data available, missing parity is just re-encoded
+  for (size_t p = k; p < total; p++) {
+    if (present[p]) continue;
+    std::memset(fragments[p], 0, len);
+    for (size_t j = 0; j < k; j++) {
+      gf_mul_add_region(_kernel, _matrix[p * k + j], fragments[j], fragments[p], len);
+    }
+  }
+
+  return true;
+}
+
+ReedSolomon::Kernel ReedSolomon::get_best_kernel() {
+  if (is_kernel_supported(Kernel::AVX2)) return Kernel::AVX2;
+  if (is_kernel_supported(Kernel::SSSE3)) return Kernel::SSSE3;
+  return Kernel::Scalar;
+}
+
+bool ReedSolomon::is_kernel_supported(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::Scalar:
+      return true;
+#ifdef KAPUA_RS_X86
+    case Kernel::SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    case Kernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* ReedSolomon::kernel_to_string(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::Scalar:
+      return "Scalar";
+    case Kernel::SSSE3:
+      return "SSSE3";
+    case Kernel::AVX2:
+      return "AVX2";
+    default:
+      return "Unknown";
+  }
+}
+
+uint8_t ReedSolomon::gf_mul(uint8_t a, uint8_t b) { return gf().mul[a][b]; }
+
+uint8_t ReedSolomon::gf_inv(uint8_t a) {
+  if (a == 0) return 0;
+  return gf().exp[255 - gf().log[a]];
+}
+
+void ReedSolomon::gf_mul_add_region(Kernel kernel, uint8_t coef, const uint8_t* src, uint8_t* dst, size_t len) {
+  if (coef == 0) return;
+  if (coef == 1) {
+    xor_scalar(src, dst, len);
+    return;
+  }
+
+  switch (kernel) {
+#ifdef KAPUA_RS_X86
+    case Kernel::AVX2:
+      mul_add_avx2(coef, src, dst, len);
+      return;
+    case Kernel::SSSE3:
+      mul_add_ssse3(coef, src, dst, len);
+      return;
+#endif
+    default:
+      mul_add_scalar(coef, src, dst, len);
+      return;
+  }
+}
+
+bool ReedSolomon::_invert_matrix(std::vector<uint8_t>& matrix, size_t n) const {
+  // Gauss-Jordan elimination over GF(2^8), on [matrix | identity]
+  std::vector<uint8_t> work(n * 2 * n, 0);
+  for (size_t r = 0; r < n; r++) {
+    std::memcpy(&work[r * 2 * n], &matrix[r * n], n);
+    work[r * 2 * n + n + r] = 1;
+  }
+
+  for (size_t col = 0; col < n; col++) {
+    // Find a pivot
+    size_t pivot = col;
+    while (pivot < n && work[pivot * 2 * n + col] == 0) pivot++;
+    if (pivot == n) return false;
+    if (pivot != col) {
+      for (size_t c = 0; c < 2 * n; c++) std::swap(work[pivot * 2 * n + c], work[col * 2 * n + c]);
+    }
+
+    // Scale the pivot row to 1
+    uint8_t scale = gf_inv(work[col * 2 * n + col]);
+    for (size_t c = 0; c < 2 * n; c++) work[col * 2 * n + c] = gf_mul(work[col * 2 * n + c], scale);
+
+    // Eliminate the column from every other row
+    for (size_t r = 0; r < n; r++) {
+      uint8_t factor = work[r * 2 * n + col];
+      if (r == col || factor == 0) continue;
+      for (size_t c = 0; c < 2 * n; c++) work[r * 2 * n + c] ^= gf_mul(factor, work[col * 2 * n + c]);
+    }
+  }
+
+  for (size_t r = 0; r < n; r++) std::memcpy(&matrix[r * n], &work[r * 2 * n + n], n);
+  return true;
+}
+
+}  // namespace Kapua
@@ -0,0 +1,73 @@
+//
+// Kapua ReedSolomon class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Kapua {
+
+#define KAPUA_RS_MAX_FRAGMENTS 255
+
+// Systematic Reed-Solomon RS(k, m) over GF(2^8). The first k fragments are the data itself, the last m are parity
+// computed with a Cauchy matrix, so any k of the k + m fragments are enough to rebuild the rest.
+//
+// The Cauchy points must all be distinct field elements, so k + m is at most KAPUA_RS_MAX_FRAGMENTS, and k is at least
+// 1. A codec built with other values is invalid: it encodes nothing and reconstructs nothing.
+class ReedSolomon {
+ public:
+  enum class Kernel {
+    Scalar,
+    SSSE3,
+    AVX2,
+  };
+
+  ReedSolomon(uint8_t dataFragments, uint8_t parityFragments);
+
+  static bool is_valid(size_t dataFragments, size_t parityFragments) {
+    return dataFragments >= 1 && dataFragments + parityFragments <= KAPUA_RS_MAX_FRAGMENTS;
+  }
+  bool is_valid() const { return !_matrix.empty(); }
+
+  // Compute m parity fragments of len bytes from k data fragments
+  void encode(const uint8_t* const* data, uint8_t* const* parity, size_t len) const;
+
+  // Rebuild every fragment whose present[i] is false, given at least k present fragments. Returns false if there are
+  // too few fragments to reconstruct.
+  bool reconstruct(uint8_t* const* fragments, const bool* present, size_t len) const;
+
+  uint8_t get_data_fragments() const { return _data_fragments; }
+  uint8_t get_parity_fragments() const { return _parity_fragments; }
+
+  void set_kernel(Kernel kernel) { _kernel = kernel; }
+  Kernel get_kernel() const { return _kernel; }
+
+  // The fastest kernel supported by this CPU
+  static Kernel get_best_kernel();
+  static bool is_kernel_supported(Kernel kernel);
+  static const char* kernel_to_string(Kernel kernel);
+
+  // GF(2^8) primitives, exposed for testing
+  static uint8_t gf_mul(uint8_t a, uint8_t b);
+  static uint8_t gf_inv(uint8_t a);
+
+  // dst ^= coef * src over len bytes
+  static void gf_mul_add_region(Kernel kernel, uint8_t coef, const uint8_t* src, uint8_t* dst, size_t len);
+
+ protected:
+  uint8_t _data_fragments;
+  uint8_t _parity_fragments;
+  Kernel _kernel;
+
+  // (k + m) x k generator matrix, row major. The top k rows are the identity.
+  std::vector<uint8_t> _matrix;
+
+  bool _invert_matrix(std::vector<uint8_t>& matrix, size_t n) const;
+};
+
+}  // namespace Kapua
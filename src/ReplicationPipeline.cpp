@@ -0,0 +1,225 @@
+//
+// Kapua ReplicationPipeline class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "ReplicationPipeline.hpp"
+
+#include <algorithm>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+ReplicationPipeline::ReplicationPipeline(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, size_t workers, size_t dirtyLimit)
+    : _dirty_bytes(0), _batches(0), _batched_blocks(0), _failures(0), _bytes_sent(0), _bytes_skipped(0) {
+  _logger = new ScopedLogger("ReplicationPipeline", logger);
+  _dbs = dbs;
+  _transport = transport;
+  _dirty_limit = dirtyLimit;
+  _running = true;
+
+  for (size_t i = 0; i < std::max((size_t)1, workers); i++) _workers.emplace_back(&ReplicationPipeline::_worker, this);
+}
+
+ReplicationPipeline::~ReplicationPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running = false;
+  }
+  // Workers drain every queue before they exit
+  _work_ready.notify_all();
+  for (auto& worker : _workers) worker.join();
+  delete _logger;
+}
+
+bool ReplicationPipeline::write(uint64_t blockId, const uint8_t* data, size_t len, Consistency consistency, bool checkExisting) {
+  std::shared_ptr<Write> write = _submit(blockId, data, len, consistency, checkExisting, false);
+  if (!write) return false;
+
+  std::unique_lock<std::mutex> lock(write->mutex);
+  write->done.wait(lock, [&] { return write->acks >= write->required || write->failures > write->replicas - write->required; });
+  return write->acks >= write->required;
+}
+
+bool ReplicationPipeline::write_back(uint64_t blockId, const uint8_t* data, size_t len, bool checkExisting) {
+  return _submit(blockId, data, len, Consistency::All, checkExisting, true) != nullptr;
+}
+
+bool ReplicationPipeline::read_buffered(uint64_t blockId, std::vector<uint8_t>* data) {
+  std::shared_ptr<Write> write;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _dirty.find(blockId);
+    if (it == _dirty.end()) return false;
+    write = it->second;
+  }
+  // Write data is never modified once submitted
+  *data = write->data;
+  return true;
+}
+
+void ReplicationPipeline::flush() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _dirty_changed.wait(lock, [this] { return _dirty.empty(); });
+}
+
+size_t ReplicationPipeline::get_required_acks(Consistency consistency, size_t replicas) {
+  switch (consistency) {
+    case Consistency::One:
+      return std::min((size_t)1, replicas);
+    case Consistency::Quorum:
+      return replicas / 2 + 1;
+    case Consistency::All:
+      break;
+  }
+  return replicas;
+}
+
+std::shared_ptr<ReplicationPipeline::Write> ReplicationPipeline::_submit(uint64_t blockId, const uint8_t* data, size_t len, Consistency consistency,
+                                                                         bool checkExisting, bool buffered) {
+  std::vector<uint64_t> nodes = _dbs->get_dbs_nodes_for_block(blockId);
+  if (nodes.empty()) {
+    _logger->error("No nodes available for block " + Util::to_hex64_str(blockId));
+    return nullptr;
+  }
+
+  std::shared_ptr<Write> write = std::make_shared<Write>();
+  write->block_id = blockId;
+  write->data.assign(data, data + len);
+  write->check_existing = checkExisting;
+  write->buffered = buffered;
+  write->replicas = nodes.size();
+  write->required = get_required_acks(consistency, nodes.size());
+  write->acks = 0;
+  write->failures = 0;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (buffered) {
+    // Back pressure: wait for room, though a single block larger than the limit is always let through
+    _dirty_changed.wait(lock, [&] { return _dirty_bytes == 0 || _dirty_bytes + len <= _dirty_limit; });
+    _dirty[blockId] = write;
+    _dirty_bytes += len;
+  }
+
+  for (uint64_t nodeId : nodes) {
+    NodeQueue& queue = _queues[nodeId];
+    queue.writes.push_back(write);
+    if (!queue.active) {
+      queue.active = true;
+      _ready_nodes.push_back(nodeId);
+      _work_ready.notify_one();
+    }
+  }
+  return write;
+}
+
+void ReplicationPipeline::_worker() {
+  std::vector<std::shared_ptr<Write>> batch;
+  std::vector<uint64_t> ids;
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> lens;
+
+  while (true) {
+    uint64_t nodeId;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _work_ready.wait(lock, [this] { return !_ready_nodes.empty() || !_running; });
+      if (_ready_nodes.empty()) return;
+
+      nodeId = _ready_nodes.front();
+      _ready_nodes.pop_front();
+
+      // Take the next write for this node, and coalesce any small writes queued behind a small write
+      NodeQueue& queue = _queues[nodeId];
+      size_t bytes = 0;
+      batch.clear();
+      while (!queue.writes.empty()) {
+        const std::shared_ptr<Write>& next = queue.writes.front();
+        size_t size = next->data.size();
+        if (!batch.empty() && (size > KAPUA_REPLICATION_SMALL_BLOCK || bytes + size > KAPUA_REPLICATION_BATCH_BYTES)) break;
+        batch.push_back(next);
+        queue.writes.pop_front();
+        bytes += size;
+        if (size > KAPUA_REPLICATION_SMALL_BLOCK) break;
+      }
+    }
+
+    // Skip replicas that already hold content addressed blocks
+    ids.clear();
+    data.clear();
+    lens.clear();
+    std::vector<std::shared_ptr<Write>> sending;
+    for (auto& write : batch) {
+      if (write->check_existing && _transport->has_block(nodeId, write->block_id)) {
+        _bytes_skipped += write->data.size();
+        _complete(write, nodeId, true);
+        continue;
+      }
+      sending.push_back(write);
+      ids.push_back(write->block_id);
+      data.push_back(write->data.data());
+      lens.push_back(write->data.size());
+    }
+
+    if (!sending.empty()) {
+      std::unique_ptr<bool[]> stored(new bool[sending.size()]);
+      _transport->put_blocks(nodeId, ids.data(), data.data(), lens.data(), sending.size(), stored.get());
+      if (sending.size() > 1) {
+        _batches++;
+        _batched_blocks += sending.size();
+      }
+      for (size_t i = 0; i < sending.size(); i++) {
+        if (stored[i]) {
+          _bytes_sent += lens[i];
+          // Counted against the node until its next Ping reports what it really holds
+          _dbs->add_dbs_node_usage(nodeId, (int64_t)lens[i]);
+        }
+        _complete(sending[i], nodeId, stored[i]);
+      }
+    }
+
+    // Requeue the node behind the others if it has more work, so one busy node cannot starve the rest
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _queues.find(nodeId);
+    if (it->second.writes.empty()) {
+      _queues.erase(it);
+    } else {
+      _ready_nodes.push_back(nodeId);
+      _work_ready.notify_one();
+    }
+  }
+}
+
+void ReplicationPipeline::_complete(const std::shared_ptr<Write>& write, uint64_t nodeId, bool ok) {
+  bool finished;
+  {
+    std::lock_guard<std::mutex> lock(write->mutex);
+    if (ok) {
+      write->acks++;
+    } else {
+      write->failures++;
+    }
+    finished = write->acks + write->failures == write->replicas;
+  }
+  write->done.notify_all();
+
+  if (!ok) {
+    _failures++;
+    _logger->warn("Failed to store block " + Util::to_hex64_str(write->block_id) + " on node " + Util::to_hex64_str(nodeId));
+  }
+  if (!finished) return;
+
+  if (write->acks == 0) _logger->error("Failed to store block " + Util::to_hex64_str(write->block_id) + " on any node");
+  if (!write->buffered) return;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _dirty.find(write->block_id);
+  // A newer write of the same block may have replaced this one
+  if (it != _dirty.end() && it->second == write) _dirty.erase(it);
+  _dirty_bytes -= write->data.size();
+  _dirty_changed.notify_all();
+}
+
+}  // namespace Kapua
@@ -0,0 +1,112 @@
+//
+// Kapua ReplicationPipeline class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BlockTransport.hpp"
+#include "DistributedBlockStore.hpp"
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_REPLICATION_DEFAULT_WORKERS 8
+#define KAPUA_REPLICATION_DEFAULT_DIRTY_LIMIT (64 * 1024 * 1024)
+#define KAPUA_REPLICATION_BATCH_BYTES (1024 * 1024)
+#define KAPUA_REPLICATION_SMALL_BLOCK (64 * 1024)
+
+// Replicates block writes to every node get_dbs_nodes_for_block chooses, in parallel. Each destination node has its
+// own queue, drained in order by a pool of workers, and consecutive small blocks bound for the same node are coalesced
+// into a single put_blocks call. A write is acknowledged as soon as its consistency level is met, so its latency is
+// that of the fastest replicas rather than the sum of them; the remaining replicas complete in the background.
+//
+// write_back goes further and acknowledges once the block is buffered. Buffered blocks are readable until every
+// replica has answered, and the buffer is bounded: writers wait when it is full.
+class ReplicationPipeline {
+ public:
+  enum class Consistency {
+    One,
+    Quorum,
+    All,
+  };
+
+  ReplicationPipeline(Logger* logger, DistributedBlockStore* dbs, BlockTransport* transport, size_t workers = KAPUA_REPLICATION_DEFAULT_WORKERS,
+                      size_t dirtyLimit = KAPUA_REPLICATION_DEFAULT_DIRTY_LIMIT);
+  ~ReplicationPipeline();
+
+  // Write and wait for the consistency level. With checkExisting, replicas that already hold the block are not sent it.
+  bool write(uint64_t blockId, const uint8_t* data, size_t len, Consistency consistency = Consistency::Quorum, bool checkExisting = false);
+  // Buffer the write and return, replicating in the background
+  bool write_back(uint64_t blockId, const uint8_t* data, size_t len, bool checkExisting = false);
+  // Read a block that is still being replicated
+  bool read_buffered(uint64_t blockId, std::vector<uint8_t>* data);
+  // Wait until every buffered write has been answered by all its replicas
+  void flush();
+
+  size_t get_dirty_bytes() { return _dirty_bytes; }
+  uint64_t get_batches() { return _batches; }
+  uint64_t get_batched_blocks() { return _batched_blocks; }
+  uint64_t get_failures() { return _failures; }
+  uint64_t get_bytes_sent() { return _bytes_sent; }
+  uint64_t get_bytes_skipped() { return _bytes_skipped; }
+
+  static size_t get_required_acks(Consistency consistency, size_t replicas);
+
+ protected:
+  struct Write {
+    uint64_t block_id;
+    std::vector<uint8_t> data;
+    bool check_existing;
+    bool buffered;
+    size_t replicas;
+    size_t required;
+    size_t acks;
+    size_t failures;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+
+  struct NodeQueue {
+    std::deque<std::shared_ptr<Write>> writes;
+    bool active;
+  };
+
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  BlockTransport* _transport;
+
+  std::mutex _mutex;
+  std::condition_variable _work_ready;
+  std::condition_variable _dirty_changed;
+  std::unordered_map<uint64_t, NodeQueue> _queues;
+  std::deque<uint64_t> _ready_nodes;
+  std::unordered_map<uint64_t, std::shared_ptr<Write>> _dirty;
+  size_t _dirty_limit;
+  std::atomic<size_t> _dirty_bytes;
+  bool _running;
+  std::vector<std::thread> _workers;
+
+  std::atomic<uint64_t> _batches;
+  std::atomic<uint64_t> _batched_blocks;
+  std::atomic<uint64_t> _failures;
+  std::atomic<uint64_t> _bytes_sent;
+  std::atomic<uint64_t> _bytes_skipped;
+
+  std::shared_ptr<Write> _submit(uint64_t blockId, const uint8_t* data, size_t len, Consistency consistency, bool checkExisting, bool buffered);
+  void _worker();
+  void _complete(const std::shared_ptr<Write>& write, uint64_t nodeId, bool ok);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,387 @@
+//
+// Kapua Simulator class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "Simulator.hpp"
+
+#include <openssl/evp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "Core.hpp"
+#include "UDPNetwork.hpp"
+
+namespace Kapua {
+
+namespace {
+std::chrono::steady_clock::time_point to_time_point(uint64_t ns) { return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns)); }
+}  // namespace
+
+// Hands a node's datagrams to the simulator, and keeps its virtual time. Datagrams are delivered by the simulator
+// rather than received, as nodes have no thread to receive them on.
+class SimTransport : public Transport {
+ public:
+  SimTransport(Simulator* sim, size_t index) : _sim(sim), _index(index) {}
+
+  bool open(uint16_t) override { return true; }
+  void close() override {}
+  bool wait(uint32_t) override { return false; }
+  size_t receive(Datagram*, size_t) override { return 0; }
+
+  size_t send(const Datagram* datagrams, size_t count) override {
+    for (size_t i = 0; i < count; i++) _sim->send(_index, datagrams[i].data, datagrams[i].size, datagrams[i].addr);
+    return count;
+  }
+
+  std::chrono::steady_clock::time_point now() override { return to_time_point(_sim->get_time_ns()); }
+
+ protected:
+  Simulator* _sim;
+  size_t _index;
+};
+
+// A node in the simulation: a UDPNetwork over a SimTransport, driven by the simulator's clock rather than its own
+// thread.
+class SimNode : public UDPNetwork {
+ public:
+  enum Stage { STAGE_DISCOVERY, STAGE_HANDSHAKE, STAGE_RING, STAGE_DONE };
+
+  SimNode(Simulator* sim, size_t index, Logger* logger, Config* config, Core* core, RSA* rsa)
+      : UDPNetwork(logger, config, core, rsa, new SimTransport(sim, index)) {
+    _port = ntohs(Simulator::get_node_addr(0, 0).sin_port);
+    started = false;
+    start_ns = 0;
+    tx_free_ns = 0;
+    stage = STAGE_DISCOVERY;
+    changed = false;
+  }
+
+  ~SimNode() {
+    if (started) _stop_protocol();
+    // The core and transport were made for this node alone
+    delete _core;
+    delete _transport;
+  }
+
+  void start(const std::vector<TrackerPeer>& seeds) {
+    started = true;
+    _seeds = seeds;
+    _next_seeding_ns = 0;
+    _start_protocol(_transport->now());
+  }
+
+  void deliver(const uint8_t* data, size_t size, const sockaddr_in& from) {
+    // As recvfrom would, a datagram too long for the buffer is cut short
+    size = std::min(size, (size_t)KAPUA_MAX_PACKET_SIZE);
+    std::memcpy(&_buffer, data, size);
+    _handle_datagram({reinterpret_cast<uint8_t*>(&_buffer), size, from});
+    changed = true;
+  }
+
+  void run_timers(uint64_t now) {
+    // Peers in other segments are handed over as a tracker would, again on each refresh, so a greeting sent before the
+    // peer started is tried again. Peers already known are not greeted twice.
+    if (now >= _next_seeding_ns && !_seeds.empty()) {
+      std::lock_guard<std::mutex> lock(_tracker_mutex);
+      _tracker_peers.insert(_tracker_peers.end(), _seeds.begin(), _seeds.end());
+      _next_seeding_ns = now + (uint64_t)_config->local_discovery_interval_ms * 1000000;
+    }
+    _run_timers(_transport->now());
+    _core->get_anti_entropy()->run_repairs();
+  }
+
+  // Whether the node has reached the given stage with every peer
+  bool has_reached(Stage stage) {
+    for (uint64_t id : peers) {
+      Node* node = _core->find_node(id);
+      if (!node) return false;
+      if (stage >= STAGE_HANDSHAKE && node->state != Node::State::Connected) return false;
+      if (stage >= STAGE_RING && !_core->get_block_store()->has_dbs_node(id)) return false;
+    }
+    return true;
+  }
+
+  uint64_t get_id() { return _core->get_my_id(); }
+
+  bool started;
+  uint64_t start_ns;
+  uint64_t tx_free_ns;  // When the node's link is next free to send, if its bandwidth is limited
+  std::vector<uint64_t> peers;
+  Stage stage;
+  bool changed;  // Has received something since its stage was last checked
+
+ protected:
+  std::vector<TrackerPeer> _seeds;
+  uint64_t _next_seeding_ns;
+  Packet _buffer;
+};
+
+Simulator::Simulator(Logger* logger, Config* config, const Options& options) : _random(options.seed) {
+  _logger = new ScopedLogger("Simulator", logger);
+  _config = config;
+  _options = options;
+  _options.segment_size = std::max<size_t>(1, std::min<size_t>(254, options.segment_size));
+  _options.tick_ms = std::max<uint32_t>(1, options.tick_ms);
+  _options.keys = std::max<size_t>(1, options.keys);
+  _rsa = new RSA(_logger, config);
+  _now_ns = 0;
+  _sequence = 0;
+  _started = _discovered = _connected = _placed = 0;
+  _discovered_ms = _connected_ms = _placed_ms = -1;
+  _datagrams_sent = _datagrams_delivered = _datagrams_lost = _datagrams_unreachable = _bytes_sent = 0;
+}
+
+Simulator::~Simulator() {
+  _nodes.clear();
+  for (KeyPair& keys : _keys) {
+    EVP_PKEY_free(keys.publicKey);
+    EVP_PKEY_free(keys.privateKey);
+  }
+  delete _rsa;
+  delete _logger;
+}
+
+bool Simulator::start() {
+  if (!_nodes.empty()) {
+    _logger->warn("start called, but already started");
+    return false;
+  }
+  if (!_make_keys()) return false;
+
+  size_t segments = (_options.nodes + _options.segment_size - 1) / _options.segment_size;
+  if (segments > 0xffff) {
+    _logger->error("Too many segments, at most 65535");
+    return false;
+  }
+
+  std::uniform_int_distribution<uint64_t> ids;
+  std::uniform_int_distribution<uint64_t> starts(0, (uint64_t)_options.start_spread_ms * 1000000);
+  for (size_t i = 0; i < _options.nodes; i++) {
+    Logger* logger = new ScopedLogger("Node " + std::to_string(i), _logger);
+    Core* core = new Core(logger, _config, _rsa, &_metrics);
+    core->_keys = _keys[i % _keys.size()];
+    core->start_simulated(ids(_random));
+    _nodes.emplace_back(new SimNode(this, i, logger, _config, core, _rsa));
+    _nodes.back()->start_ns = starts(_random);
+    _node_loggers.emplace_back(logger);
+  }
+
+  // Every node expects to meet its segment, and its seeds in other segments, who will meet it in turn
+  for (size_t i = 0; i < _options.nodes; i++) {
+    size_t segment = i / _options.segment_size;
+    for (size_t j = segment * _options.segment_size; j < std::min(_options.nodes, (segment + 1) * _options.segment_size); j++) {
+      if (j != i) _nodes[i]->peers.push_back(_nodes[j]->get_id());
+    }
+  }
+  _seeds.resize(_options.nodes);
+  if (segments > 1) {
+    std::uniform_int_distribution<size_t> others(0, _options.nodes - 1);
+    for (size_t i = 0; i < _options.nodes; i++) {
+      for (size_t s = 0; s < _options.seeds; s++) {
+        size_t j = others(_random);
+        if (j / _options.segment_size == i / _options.segment_size) continue;
+        _seeds[i].push_back({_nodes[j]->get_id(), get_node_addr(j / _options.segment_size, j % _options.segment_size), 0});
+        _nodes[i]->peers.push_back(_nodes[j]->get_id());
+        _nodes[j]->peers.push_back(_nodes[i]->get_id());
+      }
+    }
+  }
+  for (std::unique_ptr<SimNode>& node : _nodes) {
+    std::sort(node->peers.begin(), node->peers.end());
+    node->peers.erase(std::unique(node->peers.begin(), node->peers.end()), node->peers.end());
+  }
+
+  _logger->info("Simulating " + std::to_string(_options.nodes) + " nodes in " + std::to_string(segments) + " segments");
+  return true;
+}
+
+void Simulator::run_until(uint64_t timeMs) {
+  while (_now_ns < timeMs * 1000000) _tick();
+}
+
+bool Simulator::run_until_converged(uint64_t timeMs) {
+  while (_placed_ms < 0 && _now_ns < timeMs * 1000000) _tick();
+  return _placed_ms >= 0;
+}
+
+Simulator::Stats Simulator::get_stats() {
+  Stats stats;
+  stats.time_ms = get_time_ms();
+  stats.nodes_started = _started;
+  stats.nodes_discovered = _discovered;
+  stats.nodes_connected = _connected;
+  stats.nodes_placed = _placed;
+  stats.discovered_ms = _discovered_ms;
+  stats.connected_ms = _connected_ms;
+  stats.placed_ms = _placed_ms;
+  stats.datagrams_sent = _datagrams_sent;
+  stats.datagrams_delivered = _datagrams_delivered;
+  stats.datagrams_lost = _datagrams_lost;
+  stats.datagrams_unreachable = _datagrams_unreachable;
+  stats.bytes_sent = _bytes_sent;
+  return stats;
+}
+
+void Simulator::send(size_t from, const uint8_t* buffer, size_t size, const sockaddr_in& addr) {
+  SimNode* node = _nodes[from].get();
+  _datagrams_sent++;
+  _bytes_sent += size;
+
+  // A limited link sends one datagram after another
+  uint64_t departs = _now_ns;
+  if (_options.bandwidth) {
+    departs = std::max(departs, node->tx_free_ns) + size * 1000000000ULL / _options.bandwidth;
+    node->tx_free_ns = departs;
+  }
+
+  size_t segment = from / _options.segment_size;
+  if (addr.sin_addr.s_addr == htonl(INADDR_BROADCAST)) {
+    for (size_t to = segment * _options.segment_size; to < std::min(_options.nodes, (segment + 1) * _options.segment_size); to++) {
+      if (to != from) _queue(from, to, buffer, size, departs);
+    }
+    return;
+  }
+
+  size_t to;
+  if (!_find_node(ntohl(addr.sin_addr.s_addr), &to) || addr.sin_port != get_node_addr(0, 0).sin_port) {
+    _datagrams_unreachable++;
+    return;
+  }
+  _queue(from, to, buffer, size, departs);
+}
+
+sockaddr_in Simulator::get_node_addr(size_t segment, size_t index) {
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(KAPUA_DEFAULT_PORT);
+  // 10.<segment>.<index + 1>
+  addr.sin_addr.s_addr = htonl(0x0a000000 | (uint32_t)(segment << 8) | (uint32_t)(index + 1));
+  return addr;
+}
+
+bool Simulator::_make_keys() {
+  char path[] = "/tmp/kapua_sim_XXXXXX";
+  if (!mkdtemp(path)) {
+    _logger->error("Cannot make a directory for keys");
+    return false;
+  }
+  std::string dir = path;
+
+  bool ok = true;
+  for (size_t i = 0; i < _options.keys && ok; i++) {
+    KeyPair keys;
+    ok = _rsa->generate_rsa_key_pair(dir + "/public.pem", dir + "/private.pem", _options.key_bits) &&
+         _rsa->load_rsa_key_pair(dir + "/public.pem", dir + "/private.pem", keys);
+    if (ok) _keys.push_back(keys);
+  }
+  // The key files are all the directory ever holds
+  for (const char* name : {"/public.pem", "/private.pem"}) {
+    if (unlink((dir + name).c_str()) != 0 && errno != ENOENT) _logger->warn("Cannot remove " + dir + name + ": " + strerror(errno));
+  }
+  if (rmdir(path) != 0) _logger->warn("Cannot remove " + dir + ": " + strerror(errno));
+  if (!ok) _logger->error("Cannot make RSA keys");
+  return ok;
+}
+
+void Simulator::_queue(size_t from, size_t to, const uint8_t* buffer, size_t size, uint64_t departs) {
+  if (_options.loss > 0 && std::uniform_real_distribution<double>(0, 1)(_random) < _options.loss) {
+    _datagrams_lost++;
+    return;
+  }
+
+  bool local = from / _options.segment_size == to / _options.segment_size;
+  uint64_t latency = local ? _options.latency_us : _options.segment_latency_us;
+  if (_options.jitter_us) latency += std::uniform_int_distribution<uint32_t>(0, _options.jitter_us)(_random);
+  uint64_t arrives = departs + latency * 1000;
+  if (!_options.reorder) {
+    // Datagrams between two nodes arrive in the order they were sent
+    uint64_t& last = _last_arrival[(uint64_t)from * _nodes.size() + to];
+    arrives = std::max(arrives, last);
+    last = arrives;
+  }
+
+  Datagram datagram;
+  datagram.time_ns = arrives;
+  datagram.sequence = _sequence++;
+  datagram.to = to;
+  datagram.from = get_node_addr(from / _options.segment_size, from % _options.segment_size);
+  datagram.data.assign(buffer, buffer + size);
+  _in_flight.push(std::move(datagram));
+}
+
+void Simulator::_tick() {
+  uint64_t end = _now_ns + (uint64_t)_options.tick_ms * 1000000;
+
+  while (!_in_flight.empty() && _in_flight.top().time_ns <= end) {
+    Datagram datagram = _in_flight.top();
+    _in_flight.pop();
+    _now_ns = std::max(_now_ns, datagram.time_ns);
+
+    // Nothing is listening on a node that has not started
+    SimNode* node = _nodes[datagram.to].get();
+    if (!node->started) {
+      _datagrams_unreachable++;
+      continue;
+    }
+    _datagrams_delivered++;
+    node->deliver(datagram.data.data(), datagram.data.size(), datagram.from);
+  }
+
+  _now_ns = end;
+  for (size_t i = 0; i < _nodes.size(); i++) {
+    SimNode* node = _nodes[i].get();
+    if (!node->started) {
+      if (node->start_ns > _now_ns) continue;
+      node->start(_seeds[i]);
+      node->changed = true;
+      _started++;
+    }
+    node->run_timers(_now_ns);
+  }
+
+  _check_convergence();
+}
+
+void Simulator::_check_convergence() {
+  for (std::unique_ptr<SimNode>& node : _nodes) {
+    if (!node->changed) continue;
+    node->changed = false;
+    while (node->stage != SimNode::STAGE_DONE && node->has_reached(node->stage)) {
+      switch (node->stage) {
+        case SimNode::STAGE_DISCOVERY:
+          _discovered++;
+          break;
+        case SimNode::STAGE_HANDSHAKE:
+          _connected++;
+          break;
+        default:
+          _placed++;
+      }
+      node->stage = (SimNode::Stage)(node->stage + 1);
+    }
+  }
+
+  int64_t now = get_time_ms();
+  if (_discovered_ms < 0 && _discovered == _nodes.size()) _discovered_ms = now;
+  if (_connected_ms < 0 && _connected == _nodes.size()) _connected_ms = now;
+  if (_placed_ms < 0 && _placed == _nodes.size()) _placed_ms = now;
+}
+
+bool Simulator::_find_node(uint32_t address, size_t* index) {
+  if ((address >> 24) != 0x0a) return false;
+  size_t segment = (address >> 8) & 0xffff;
+  size_t position = (address & 0xff) - 1;
+  if ((address & 0xff) == 0 || position >= _options.segment_size) return false;
+  *index = segment * _options.segment_size + position;
+  return *index < _nodes.size();
+}
+
+}  // namespace Kapua
@@ -0,0 +1,141 @@
+//
+// Kapua Simulator class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "Config.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "RSA.hpp"
+#include "TrackerClient.hpp"
+
+namespace Kapua {
+
+class SimNode;
+
+// Runs a cluster of nodes in one process, each a real Core and UDPNetwork, over a simulated network in virtual time.
+//
+// Nothing waits on a clock: the simulator delivers each datagram at the virtual time it would arrive, and runs every
+// node's timers on each tick, so a run with the same options and seed always plays out the same way, however long it
+// takes. Nodes are split into segments, each its own broadcast domain, and each node is also told about a few nodes in
+// other segments, as a tracker would. Datagrams take a fixed latency plus jitter, longer between segments, can be
+// lost, and queue behind each other when a node's bandwidth is limited.
+//
+// The run is judged by three points of convergence: when every node knows every peer it should (its segment and its
+// seed links), when it has completed the handshake with all of them, and when all of them are on its ring.
+class Simulator {
+ public:
+  struct Options {
+    size_t nodes = 64;
+    size_t segment_size = 16;             // Nodes sharing a broadcast domain, at most 254
+    size_t seeds = 1;                     // Nodes in other segments each node is told about
+    uint32_t latency_us = 200;            // One way, within a segment
+    uint32_t segment_latency_us = 20000;  // One way, between segments
+    uint32_t jitter_us = 100;             // Added to the latency, uniformly from 0
+    bool reorder = false;                 // Let jitter reorder datagrams between two nodes
+    double loss = 0;                      // Fraction of datagrams dropped
+    uint64_t bandwidth = 0;               // Bytes per second each node can send, or 0 for no limit
+    uint32_t start_spread_ms = 1000;      // Nodes start at random over this time
+    uint32_t tick_ms = 10;                // How often node timers run
+    int key_bits = 1024;
+    size_t keys = 16;                     // RSA key pairs, shared out in turn, as making thousands takes minutes
+    uint64_t seed = 1;
+  };
+
+  struct Stats {
+    uint64_t time_ms;
+    size_t nodes_started;
+    size_t nodes_discovered;  // Knows all its peers
+    size_t nodes_connected;   // Has completed the handshake with all its peers
+    size_t nodes_placed;      // Has all its peers on its ring
+    int64_t discovered_ms;    // When every node was discovered, or -1
+    int64_t connected_ms;
+    int64_t placed_ms;
+    uint64_t datagrams_sent;
+    uint64_t datagrams_delivered;
+    uint64_t datagrams_lost;         // Dropped at random
+    uint64_t datagrams_unreachable;  // Sent to a node that had not started, or to no node
+    uint64_t bytes_sent;
+  };
+
+  // Nodes take their settings from config, so its intervals apply to every node
+  Simulator(Logger* logger, Config* config, const Options& options);
+  ~Simulator();
+
+  // Makes the keys and the nodes
+  bool start();
+
+  void run_until(uint64_t timeMs);
+  // Runs until every node has all its peers on its ring, or timeMs. Returns true if they have.
+  bool run_until_converged(uint64_t timeMs);
+
+  uint64_t get_time_ms() { return _now_ns / 1000000; }
+  uint64_t get_time_ns() { return _now_ns; }
+  Stats get_stats();
+  // Counters and histograms from every node, summed, such as kapua_udp_tx_packets_total by packet type
+  MetricsRegistry* get_metrics() { return &_metrics; }
+
+  // For SimNode
+  void send(size_t from, const uint8_t* buffer, size_t size, const sockaddr_in& addr);
+  static sockaddr_in get_node_addr(size_t segment, size_t index);
+
+ protected:
+  struct Datagram {
+    uint64_t time_ns;
+    uint64_t sequence;  // Orders datagrams due at the same time, so runs repeat exactly
+    size_t to;
+    sockaddr_in from;
+    std::vector<uint8_t> data;
+
+    bool operator>(const Datagram& other) const { return time_ns != other.time_ns ? time_ns > other.time_ns : sequence > other.sequence; }
+  };
+
+  Logger* _logger;
+  Config* _config;
+  Options _options;
+  RSA* _rsa;
+  MetricsRegistry _metrics;
+
+  std::mt19937_64 _random;
+  std::vector<KeyPair> _keys;
+  std::vector<std::unique_ptr<Logger>> _node_loggers;
+  std::vector<std::unique_ptr<SimNode>> _nodes;
+  std::vector<std::vector<TrackerPeer>> _seeds;
+  std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>> _in_flight;
+  std::unordered_map<uint64_t, uint64_t> _last_arrival;  // By sender and receiver
+  uint64_t _now_ns;
+  uint64_t _sequence;
+
+  size_t _started;
+  size_t _discovered;
+  size_t _connected;
+  size_t _placed;
+  int64_t _discovered_ms;
+  int64_t _connected_ms;
+  int64_t _placed_ms;
+
+  uint64_t _datagrams_sent;
+  uint64_t _datagrams_delivered;
+  uint64_t _datagrams_lost;
+  uint64_t _datagrams_unreachable;
+  uint64_t _bytes_sent;
+
+  bool _make_keys();
+  void _queue(size_t from, size_t to, const uint8_t* buffer, size_t size, uint64_t departs);
+  void _tick();
+  void _check_convergence();
+  bool _find_node(uint32_t address, size_t* index);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,164 @@
+//
+// Kapua SocketTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "SocketTransport.hpp"
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace Kapua {
+
+SocketTransport::SocketTransport(Logger* logger) : SocketTransport(logger, "SocketTransport") {}
+
+SocketTransport::SocketTransport(Logger* logger, const std::string& name) {
+  _logger = new ScopedLogger(name, logger);
+  _socket_fd = -1;
+  _buffers.resize(KAPUA_RECEIVE_BATCH);
+}
+
+SocketTransport::~SocketTransport() {
+  close();
+  delete _logger;
+}
+
+bool SocketTransport::open(uint16_t port) {
+#ifdef _WIN32
+  // Initialize Windows Socket API (Winsock)
+  if (WSAStartup(MAKEWORD(2, 2), &_wsaData) != 0) {
+    _logger->error("WIN32: Failed to initialize Winsock");
+    return false;
+  }
+#endif
+
+  // Create a server socket
+  _socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (_socket_fd == -1) {
+    _logger->error("Failed creating server socket");
+    return false;
+  }
+
+  // Set up server address
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  // Bind the server socket
+  if (bind(_socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    _logger->error("Failed binding server socket");
+    close();
+    return false;
+  }
+
+  // Set broadcast enabled on sending socket
+  int broadcast_enable = 1;
+  if (setsockopt(_socket_fd, SOL_SOCKET, SO_BROADCAST, (const char*)&broadcast_enable, sizeof(broadcast_enable)) == -1) {
+    _logger->error("Failed setting send socket options (SO_BROADCAST)");
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void SocketTransport::close() {
+  if (_socket_fd == -1) return;
+
+#ifdef _WIN32
+  closesocket(_socket_fd);
+  WSACleanup();
+#else
+  ::close(_socket_fd);
+#endif
+  _socket_fd = -1;
+}
+
+bool SocketTransport::wait(uint32_t timeoutUs) {
+  struct timeval tv;
+  tv.tv_sec = timeoutUs / 1000000;
+  tv.tv_usec = timeoutUs % 1000000;
+  fd_set rfds;
+  FD_ZERO(&rfds);
+  FD_SET(_socket_fd, &rfds);
+  return select(_socket_fd + 1, &rfds, NULL, NULL, &tv) > 0;
+}
+
+size_t SocketTransport::receive(Datagram* datagrams, size_t count) {
+  if (count > _buffers.size()) count = _buffers.size();
+
+#ifdef __linux__
+  mmsghdr msgs[KAPUA_RECEIVE_BATCH];
+  iovec iovs[KAPUA_RECEIVE_BATCH];
+  std::memset(msgs, 0, sizeof(mmsghdr) * count);
+  for (size_t i = 0; i < count; i++) {
+    iovs[i].iov_base = &_buffers[i];
+    iovs[i].iov_len = KAPUA_MAX_PACKET_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &datagrams[i].addr;
+    msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  }
+
+  int received = recvmmsg(_socket_fd, msgs, count, MSG_DONTWAIT, nullptr);
+  if (received <= 0) return 0;
+  for (int i = 0; i < received; i++) {
+    datagrams[i].data = reinterpret_cast<uint8_t*>(&_buffers[i]);
+    datagrams[i].size = msgs[i].msg_len;
+  }
+  return received;
+#else
+  // Without recvmmsg, only read the one datagram that wait saw arrive, so as not to block
+  if (count == 0) return 0;
+  socklen_t addr_len = sizeof(sockaddr_in);
+  int size = recvfrom(_socket_fd, (char*)&_buffers[0], KAPUA_MAX_PACKET_SIZE, 0, (struct sockaddr*)&datagrams[0].addr, &addr_len);
+  if (size <= 0) return 0;
+  datagrams[0].data = reinterpret_cast<uint8_t*>(&_buffers[0]);
+  datagrams[0].size = size;
+  return 1;
+#endif
+}
+
+size_t SocketTransport::send(const Datagram* datagrams, size_t count) {
+#ifdef __linux__
+  size_t sent = 0;
+  while (sent < count) {
+    mmsghdr msgs[KAPUA_RECEIVE_BATCH];
+    iovec iovs[KAPUA_RECEIVE_BATCH];
+    size_t batch = std::min(count - sent, (size_t)KAPUA_RECEIVE_BATCH);
+    std::memset(msgs, 0, sizeof(mmsghdr) * batch);
+    for (size_t i = 0; i < batch; i++) {
+      const Datagram& datagram = datagrams[sent + i];
+      iovs[i].iov_base = datagram.data;
+      iovs[i].iov_len = datagram.size;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&datagram.addr);
+      msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+
+    int done = sendmmsg(_socket_fd, msgs, batch, 0);
+    if (done <= 0) break;
+    // A datagram only counts if all of it went
+    for (int i = 0; i < done; i++) {
+      if (msgs[i].msg_len != datagrams[sent + i].size) return sent + i;
+    }
+    sent += done;
+    if ((size_t)done < batch) break;
+  }
+  return sent;
+#else
+  for (size_t i = 0; i < count; i++) {
+    const Datagram& datagram = datagrams[i];
+    if (sendto(_socket_fd, (const char*)datagram.data, datagram.size, 0, (const struct sockaddr*)&datagram.addr, sizeof(sockaddr_in)) != (int)datagram.size) return i;
+  }
+  return count;
+#endif
+}
+
+}  // namespace Kapua
@@ -0,0 +1,53 @@
+//
+// Kapua SocketTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Logger.hpp"
+#include "Protocol.hpp"
+#include "Transport.hpp"
+
+namespace Kapua {
+
+// A Transport over a plain UDP socket. On Linux a batch is read with one recvmmsg and sent with one sendmmsg, elsewhere
+// with a call per datagram.
+class SocketTransport : public Transport {
+ public:
+  SocketTransport(Logger* logger);
+  ~SocketTransport();
+
+  bool open(uint16_t port) override;
+  void close() override;
+  bool wait(uint32_t timeoutUs) override;
+  size_t receive(Datagram* datagrams, size_t count) override;
+  size_t send(const Datagram* datagrams, size_t count) override;
+
+ protected:
+  // For transports built on this one, to log under their own name
+  SocketTransport(Logger* logger, const std::string& name);
+
+  Logger* _logger;
+  int _socket_fd;
+  std::vector<Packet> _buffers;
+
+#ifdef _WIN32
+  WSADATA _wsaData;
+#endif
+};
+
+}  // namespace Kapua
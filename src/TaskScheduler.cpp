@@ -0,0 +1,214 @@
+//
+// Kapua TaskScheduler class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "TaskScheduler.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "ComputeTransport.hpp"
+#include "Util.hpp"
+
+namespace Kapua {
+
+TaskScheduler::TaskScheduler(Logger* logger, DistributedBlockStore* dbs, ComputeTransport* transport, size_t threads)
+    : _local_running(0), _placed(0), _placed_near_data(0) {
+  _logger = new ScopedLogger("TaskScheduler", logger);
+  _dbs = dbs;
+  _transport = transport;
+  _my_id = dbs->get_dbs_node_id();
+  _pool = new WorkStealingPool(_logger, threads);
+}
+
+TaskScheduler::~TaskScheduler() {
+  std::deque<Pending> pending;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    pending.swap(_pending);
+  }
+  for (Pending& p : pending) p.done(false, nullptr);
+
+  delete _pool;
+  delete _logger;
+}
+
+void TaskScheduler::register_kernel(const std::string& name, ComputeKernel kernel) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _kernels[name] = kernel;
+}
+
+void TaskScheduler::submit(const ComputeTask& task, ComputeCallback done) {
+  uint64_t nodeId = 0;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Tasks already waiting go first
+    if (_pending.empty()) nodeId = _place(task);
+    if (!nodeId) {
+      _pending.push_back({task, done});
+      return;
+    }
+  }
+  _dispatch(nodeId, task, done);
+}
+
+bool TaskScheduler::run_local(const ComputeTask& task, ComputeCallback done) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_kernels.find(task.kernel) == _kernels.end()) return false;
+    _local_running++;
+  }
+  _execute(task, [this, done](bool ok, std::vector<uint8_t>* result) {
+    _release(_my_id);
+    done(ok, result);
+  });
+  return true;
+}
+
+void TaskScheduler::update_node_capacity(uint64_t nodeId, uint32_t slots, uint32_t running) {
+  if (nodeId == _my_id) return;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    ComputeCapacity& capacity = _nodes[nodeId];
+    capacity.slots = slots;
+    capacity.running = running;
+  }
+  _dispatch_pending();
+}
+
+void TaskScheduler::remove_node(uint64_t nodeId) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _nodes.erase(nodeId);
+}
+
+bool TaskScheduler::get_node_capacity(uint64_t nodeId, ComputeCapacity* capacity) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (nodeId == _my_id) {
+    capacity->slots = _pool->get_thread_count();
+    capacity->running = _local_running;
+    capacity->assigned = 0;
+    return true;
+  }
+  auto it = _nodes.find(nodeId);
+  if (it == _nodes.end()) return false;
+  *capacity = it->second;
+  return true;
+}
+
+void TaskScheduler::get_my_capacity(uint32_t* slots, uint32_t* running) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  *slots = _pool->get_thread_count();
+  *running = _local_running;
+}
+
+size_t TaskScheduler::get_pending_count() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _pending.size();
+}
+
+uint64_t TaskScheduler::_place(const ComputeTask& task) {
+  // Where each input's replicas usually are. Bounded load sometimes puts one on a spare instead, which is not counted.
+  std::unordered_map<uint64_t, size_t> held;
+  for (uint64_t blockId : task.inputs) {
+    for (uint64_t nodeId : _dbs->get_dbs_preference_list(blockId, KAPUA_DBS_REPLICAS)) held[nodeId]++;
+  }
+
+  uint64_t best = 0;
+  size_t bestHeld = 0;
+  uint32_t bestFree = 0;
+  auto consider = [&](uint64_t nodeId, uint32_t slots, uint32_t busy) {
+    if (busy >= slots) return;
+    uint32_t free = slots - busy;
+    auto it = held.find(nodeId);
+    size_t h = it == held.end() ? 0 : it->second;
+    if (best && (h < bestHeld || (h == bestHeld && free <= bestFree))) return;
+    best = nodeId;
+    bestHeld = h;
+    bestFree = free;
+  };
+
+  consider(_my_id, _pool->get_thread_count(), _local_running);
+  if (_transport) {
+    for (const auto& pair : _nodes) consider(pair.first, pair.second.slots, std::max(pair.second.running, pair.second.assigned));
+  }
+  if (!best) return 0;
+
+  if (best == _my_id) {
+    _local_running++;
+  } else {
+    _nodes[best].assigned++;
+  }
+  _placed++;
+  if (bestHeld) _placed_near_data++;
+  return best;
+}
+
+void TaskScheduler::_dispatch(uint64_t nodeId, const ComputeTask& task, ComputeCallback done) {
+  ComputeCallback finish = [this, nodeId, done](bool ok, std::vector<uint8_t>* result) {
+    _release(nodeId);
+    done(ok, result);
+  };
+
+  if (nodeId == _my_id) {
+    _execute(task, finish);
+    return;
+  }
+  if (!_transport->compute_run(nodeId, task, finish)) {
+    _logger->warn("Cannot run " + task.kernel + " on node " + Util::to_hex64_str(nodeId));
+    finish(false, nullptr);
+  }
+}
+
+void TaskScheduler::_execute(const ComputeTask& task, ComputeCallback done) {
+  ComputeKernel kernel;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _kernels.find(task.kernel);
+    if (it != _kernels.end()) kernel = it->second;
+  }
+  if (!kernel) {
+    _logger->error("Unknown kernel " + task.kernel);
+    done(false, nullptr);
+    return;
+  }
+
+  _pool->submit([kernel, task, done] {
+    std::vector<uint8_t> result;
+    if (kernel(task, &result)) {
+      done(true, &result);
+    } else {
+      done(false, nullptr);
+    }
+  });
+}
+
+void TaskScheduler::_release(uint64_t nodeId) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (nodeId == _my_id) {
+      if (_local_running) _local_running--;
+    } else {
+      auto it = _nodes.find(nodeId);
+      if (it != _nodes.end() && it->second.assigned) it->second.assigned--;
+    }
+  }
+  _dispatch_pending();
+}
+
+void TaskScheduler::_dispatch_pending() {
+  std::vector<std::pair<uint64_t, Pending>> ready;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (!_pending.empty()) {
+      uint64_t nodeId = _place(_pending.front().task);
+      if (!nodeId) break;
+      ready.emplace_back(nodeId, std::move(_pending.front()));
+      _pending.pop_front();
+    }
+  }
+  for (auto& pair : ready) _dispatch(pair.first, pair.second.task, pair.second.done);
+}
+
+}  // namespace Kapua
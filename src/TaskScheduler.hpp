@@ -0,0 +1,104 @@
+//
+// Kapua TaskScheduler class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DistributedBlockStore.hpp"
+#include "Logger.hpp"
+#include "WorkStealingPool.hpp"
+
+namespace Kapua {
+
+class ComputeTransport;
+
+// A unit of work for the compute pool. Code is not shipped between nodes: the kernel names a function every node has
+// registered, which is given the task and fills in the result.
+struct ComputeTask {
+  std::string kernel;
+  std::vector<uint64_t> inputs;  // Blocks the task reads
+  std::vector<uint8_t> args;
+};
+
+typedef std::function<bool(const ComputeTask& task, std::vector<uint8_t>* result)> ComputeKernel;
+// Called once when a task ends, on whichever thread ran it. result is null if the task failed.
+typedef std::function<void(bool ok, std::vector<uint8_t>* result)> ComputeCallback;
+
+struct ComputeCapacity {
+  uint32_t slots;     // Tasks the node will run at once
+  uint32_t running;   // Tasks the node last reported running
+  uint32_t assigned;  // Tasks this node has sent it that have not ended
+};
+
+// Places compute tasks on nodes and runs the ones placed here on a local work-stealing pool.
+//
+// A task goes to the node holding the most replicas of its input blocks, so it reads them from local disk rather than
+// over the network, among the nodes with a free slot. Ties go to the node with the most free slots. Each node
+// advertises its slots and running tasks in its load reports, and a node counts as busy as the larger of what it last
+// reported and what this node has sent it since, so a stale report never lets it be over-committed. When every node
+// is busy, tasks wait here in order until a slot frees up.
+class TaskScheduler {
+ public:
+  // With no transport, every task runs on this node
+  TaskScheduler(Logger* logger, DistributedBlockStore* dbs, ComputeTransport* transport, size_t threads = 0);
+  ~TaskScheduler();
+
+  void register_kernel(const std::string& name, ComputeKernel kernel);
+
+  void submit(const ComputeTask& task, ComputeCallback done);
+  // Run a task another node placed here. Returns false, without calling done, if the kernel is not registered.
+  bool run_local(const ComputeTask& task, ComputeCallback done);
+
+  void update_node_capacity(uint64_t nodeId, uint32_t slots, uint32_t running);
+  void remove_node(uint64_t nodeId);
+  bool get_node_capacity(uint64_t nodeId, ComputeCapacity* capacity);
+  void get_my_capacity(uint32_t* slots, uint32_t* running);
+
+  size_t get_pending_count();
+  uint64_t get_placed() { return _placed; }
+  // Tasks placed on a node holding at least one of their inputs
+  uint64_t get_placed_near_data() { return _placed_near_data; }
+  WorkStealingPool* get_pool() { return _pool; }
+
+ protected:
+  struct Pending {
+    ComputeTask task;
+    ComputeCallback done;
+  };
+
+  Logger* _logger;
+  DistributedBlockStore* _dbs;
+  ComputeTransport* _transport;
+  WorkStealingPool* _pool;
+  uint64_t _my_id;
+
+  std::mutex _mutex;
+  std::unordered_map<std::string, ComputeKernel> _kernels;
+  std::unordered_map<uint64_t, ComputeCapacity> _nodes;
+  std::deque<Pending> _pending;
+  uint32_t _local_running;
+
+  std::atomic<uint64_t> _placed;
+  std::atomic<uint64_t> _placed_near_data;
+
+  // Pick a node with a free slot and take the slot, or return 0 if there is none. Called with _mutex held.
+  uint64_t _place(const ComputeTask& task);
+  void _dispatch(uint64_t nodeId, const ComputeTask& task, ComputeCallback done);
+  void _execute(const ComputeTask& task, ComputeCallback done);
+  // Give back a task's slot and start whatever pending tasks now fit
+  void _release(uint64_t nodeId);
+  void _dispatch_pending();
+};
+
+}  // namespace Kapua
@@ -0,0 +1,201 @@
+//
+// Kapua ThreadRings class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Kapua {
+
+// One single-producer ring of T per thread, drained in batches by a writer thread. AsyncLogger and EventLog use these.
+//
+// A thread gets its own ring the first time it asks for one, so producers take no lock and share no cache line with
+// each other. The writer wakes every 10ms, or sooner if a ring is half full or a flush is waiting, takes every ring's
+// items, merges them by their time_ns and passes them to the write callback in one go. The callback runs on every
+// pass, even with nothing to write. Rings are shared with their threads, and dropped once their thread has exited and
+// they are empty.
+template <typename T>
+class ThreadRings {
+ public:
+  struct Ring {
+    size_t mask;
+    uint32_t thread;  // Numbered from 1 in the order threads first use the rings
+    std::unique_ptr<T[]> items;
+    std::atomic<uint64_t> head;  // Written by the producing thread
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;  // Written by the writer thread
+
+    Ring(size_t size, uint32_t threadNumber) : mask(size - 1), thread(threadNumber), items(new T[size]), head(0), tail(0) {}
+  };
+
+  typedef std::function<void(std::vector<T>& items)> WriteCallback;
+
+  ThreadRings(size_t ringSize, WriteCallback write) : _next_thread(1), _stopping(false), _flush_requested(0), _flush_done(0) {
+    _id = _next_id++;
+    _write = write;
+    _ring_size = 1;
+    while (_ring_size < ringSize) _ring_size <<= 1;
+  }
+  ~ThreadRings() { stop(); }
+
+  void start() {
+    if (_thread.joinable()) return;
+    _stopping = false;
+    _thread = std::thread(&ThreadRings::_writer_loop, this);
+  }
+
+  // Writes whatever is left in the rings before returning
+  void stop() {
+    if (!_thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+  }
+
+  // Wait until every item published before the call has been written. Only while started.
+  void flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t ticket = ++_flush_requested;
+    _wake.notify_one();
+    _flushed.wait(lock, [this, ticket] { return _flush_done >= ticket; });
+  }
+
+  void wake() { _wake.notify_one(); }
+
+  // The calling thread's ring
+  Ring* get_ring() {
+    for (const ThreadRing& entry : _thread_rings) {
+      if (entry.owner == _id) return entry.ring.get();
+    }
+
+    // Forget rings whose owners have gone
+    _thread_rings.erase(std::remove_if(_thread_rings.begin(), _thread_rings.end(), [](const ThreadRing& entry) { return entry.ring.use_count() == 1; }),
+                        _thread_rings.end());
+
+    std::shared_ptr<Ring> ring;
+    {
+      std::lock_guard<std::mutex> lock(_rings_mutex);
+      ring = std::make_shared<Ring>(_ring_size, _next_thread++);
+      _rings.push_back(ring);
+    }
+    _thread_rings.push_back({_id, ring});
+    return ring.get();
+  }
+
+  // The ring's next free item, or nullptr if the ring is full
+  T* reserve(Ring* ring) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) > ring->mask) return nullptr;
+    return &ring->items[head & ring->mask];
+  }
+
+  // Hand the item from reserve() to the writer
+  void publish(Ring* ring) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+    // Don't wait for the writer's next pass once a ring is half full
+    if (head - ring->tail.load(std::memory_order_relaxed) == ring->mask / 2) _wake.notify_one();
+  }
+
+ protected:
+  // Distinguishes owners in each thread's table of rings, even if one is freed and another takes its address
+  struct ThreadRing {
+    uint64_t owner;
+    std::shared_ptr<Ring> ring;
+  };
+  static std::atomic<uint64_t> _next_id;
+  static thread_local std::vector<ThreadRing> _thread_rings;
+
+  uint64_t _id;
+  size_t _ring_size;
+  WriteCallback _write;
+
+  std::mutex _rings_mutex;
+  std::vector<std::shared_ptr<Ring>> _rings;
+  uint32_t _next_thread;
+
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _flushed;
+  bool _stopping;
+  uint64_t _flush_requested;
+  uint64_t _flush_done;
+
+  void _writer_loop() {
+    while (true) {
+      bool stopping;
+      uint64_t flushTarget;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait_for(lock, std::chrono::milliseconds(10), [this] { return _stopping || _flush_requested != _flush_done; });
+        stopping = _stopping;
+        flushTarget = _flush_requested;
+      }
+
+      _write_pending();
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _flush_done = flushTarget;
+      }
+      _flushed.notify_all();
+      if (stopping) break;
+    }
+  }
+
+  void _write_pending() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+      std::lock_guard<std::mutex> lock(_rings_mutex);
+      rings = _rings;
+    }
+
+    std::vector<T> items;
+    for (const std::shared_ptr<Ring>& ring : rings) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      for (; tail < head; tail++) items.push_back(std::move(ring->items[tail & ring->mask]));
+      ring->tail.store(tail, std::memory_order_release);
+    }
+
+    // Each ring is in order already, so this only interleaves the threads
+    std::stable_sort(items.begin(), items.end(), [](const T& a, const T& b) { return a.time_ns < b.time_ns; });
+    _write(items);
+
+    // A ring held only by _rings and this snapshot belongs to a thread that has exited
+    std::vector<Ring*> finished;
+    for (const std::shared_ptr<Ring>& ring : rings) {
+      if (ring.use_count() == 2 && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed)) finished.push_back(ring.get());
+    }
+    if (finished.empty()) return;
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    _rings.erase(std::remove_if(_rings.begin(), _rings.end(),
+                                [&finished](const std::shared_ptr<Ring>& ring) { return std::find(finished.begin(), finished.end(), ring.get()) != finished.end(); }),
+                 _rings.end());
+  }
+};
+
+template <typename T>
+std::atomic<uint64_t> ThreadRings<T>::_next_id(1);
+
+template <typename T>
+thread_local std::vector<typename ThreadRings<T>::ThreadRing> ThreadRings<T>::_thread_rings;
+
+}  // namespace Kapua
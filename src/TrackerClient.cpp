@@ -0,0 +1,303 @@
+//
+// Kapua TrackerClient class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "TrackerClient.hpp"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include "Util.hpp"
+
+namespace Kapua {
+
+const uint8_t TrackerClient::TYPE_ANNOUNCE = 1;
+const uint8_t TrackerClient::TYPE_PEERS = 2;
+
+namespace {
+const char tracker_magic[4] = {'K', 'T', 'R', 'K'};
+const char cache_magic[4] = {'K', 'T', 'R', 'C'};
+const uint32_t cache_version = 1;
+
+#pragma pack(push, 1)
+struct CacheRecord {
+  TrackerClient::PeerRecord peer;
+  uint64_t last_seen;
+};
+#pragma pack(pop)
+
+uint64_t unix_now() { return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count(); }
+}  // namespace
+
+TrackerClient::TrackerClient(Logger* logger, const std::vector<std::string>& servers, const std::string& cacheFilename, TrackerOptions options)
+    : _random(std::random_device()()), _running(false), _failures(0), _backoff_ms(0) {
+  _logger = new ScopedLogger("TrackerClient", logger);
+  _servers = servers;
+  _cache_filename = cacheFilename;
+  _options = options;
+}
+
+TrackerClient::~TrackerClient() {
+  stop();
+  delete _logger;
+}
+
+bool TrackerClient::start(uint64_t nodeId, uint16_t port, PeersCallback callback) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_running) {
+    _logger->warn("start called, but already running");
+    return false;
+  }
+  _running = true;
+  _thread = std::thread(&TrackerClient::_main_loop, this, nodeId, port, callback);
+  return true;
+}
+
+void TrackerClient::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_running) return;
+    _running = false;
+  }
+  _wake.notify_all();
+  _thread.join();
+}
+
+bool TrackerClient::announce(uint64_t nodeId, uint16_t port, std::vector<TrackerPeer>* peers) {
+  if (_addresses.empty() && !_resolve()) return false;
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    _logger->error("Cannot create socket: " + std::string(strerror(errno)));
+    return false;
+  }
+
+  Request request;
+  write_magic(request.magic);
+  request.type = TYPE_ANNOUNCE;
+  request.reserved = 0;
+  request.wanted = std::min<uint16_t>(_options.wanted, KAPUA_TRACKER_MAX_PEERS);
+  request.transaction = _random();
+  request.node_id = nodeId;
+  request.port = htons(port);
+
+  // Ask every tracker at once, and take the first answer
+  size_t sent = 0;
+  for (const sockaddr_in& addr : _addresses) {
+    if (sendto(fd, &request, sizeof(request), 0, (const sockaddr*)&addr, sizeof(addr)) == sizeof(request)) sent++;
+  }
+
+  uint8_t buffer[sizeof(ReplyHeader) + KAPUA_TRACKER_MAX_PEERS * sizeof(PeerRecord)];
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_options.timeout_ms);
+  bool ok = false;
+  while (sent && !ok) {
+    int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) break;
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, remaining) <= 0) continue;
+
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t len = recvfrom(fd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+    if (len < (ssize_t)sizeof(ReplyHeader)) continue;
+
+    // Anything but a reply to this request from one of our trackers is ignored
+    bool known = false;
+    for (const sockaddr_in& addr : _addresses) known |= addr.sin_addr.s_addr == from.sin_addr.s_addr && addr.sin_port == from.sin_port;
+    ReplyHeader header;
+    std::memcpy(&header, buffer, sizeof(header));
+    if (!known || !check_magic(header.magic) || header.type != TYPE_PEERS || header.transaction != request.transaction) continue;
+    if (header.count > KAPUA_TRACKER_MAX_PEERS || (size_t)len < sizeof(ReplyHeader) + header.count * sizeof(PeerRecord)) {
+      _logger->warn("Truncated reply from tracker " + Util::sockaddr_to_string(from));
+      continue;
+    }
+
+    uint64_t now = unix_now();
+    for (uint16_t i = 0; i < header.count; i++) {
+      PeerRecord record;
+      std::memcpy(&record, buffer + sizeof(ReplyHeader) + i * sizeof(PeerRecord), sizeof(record));
+      if (record.id == nodeId || record.id == 0) continue;
+
+      TrackerPeer peer;
+      peer.id = record.id;
+      std::memset(&peer.addr, 0, sizeof(peer.addr));
+      peer.addr.sin_family = AF_INET;
+      peer.addr.sin_addr.s_addr = record.ip4;
+      peer.addr.sin_port = record.port;
+      peer.last_seen = now;
+      peers->push_back(peer);
+    }
+    ok = true;
+  }
+
+  close(fd);
+  // Names are looked up again next time, in case a tracker has moved
+  if (!ok) _addresses.clear();
+  return ok;
+}
+
+bool TrackerClient::load_cache(std::vector<TrackerPeer>* peers) {
+  std::lock_guard<std::mutex> lock(_cache_mutex);
+
+  FILE* file = fopen(_cache_filename.c_str(), "rb");
+  if (!file) return false;
+
+  char magic[4];
+  uint32_t version, count;
+  if (fread(magic, sizeof(magic), 1, file) != 1 || std::memcmp(magic, cache_magic, sizeof(magic)) != 0 || fread(&version, sizeof(version), 1, file) != 1 ||
+      version != cache_version || fread(&count, sizeof(count), 1, file) != 1) {
+    _logger->warn("Ignoring damaged peer cache " + _cache_filename);
+    fclose(file);
+    return false;
+  }
+
+  uint64_t now = unix_now();
+  size_t start = peers->size();
+  CacheRecord record;
+  for (uint32_t i = 0; i < count && fread(&record, sizeof(record), 1, file) == 1; i++) {
+    if (record.last_seen + _options.cache_max_age_s < now) continue;
+    TrackerPeer peer;
+    peer.id = record.peer.id;
+    std::memset(&peer.addr, 0, sizeof(peer.addr));
+    peer.addr.sin_family = AF_INET;
+    peer.addr.sin_addr.s_addr = record.peer.ip4;
+    peer.addr.sin_port = record.peer.port;
+    peer.last_seen = record.last_seen;
+    peers->push_back(peer);
+  }
+  fclose(file);
+
+  std::sort(peers->begin() + start, peers->end(), [](const TrackerPeer& a, const TrackerPeer& b) { return a.last_seen > b.last_seen; });
+  return true;
+}
+
+bool TrackerClient::update_cache(const std::vector<TrackerPeer>& peers) {
+  std::vector<TrackerPeer> merged;
+  load_cache(&merged);
+
+  std::lock_guard<std::mutex> lock(_cache_mutex);
+
+  // Newer sightings of a peer replace older ones
+  std::unordered_map<uint64_t, size_t> index;
+  for (size_t i = 0; i < merged.size(); i++) index[merged[i].id] = i;
+  for (const TrackerPeer& peer : peers) {
+    auto it = index.find(peer.id);
+    if (it == index.end()) {
+      index[peer.id] = merged.size();
+      merged.push_back(peer);
+    } else if (peer.last_seen >= merged[it->second].last_seen) {
+      merged[it->second] = peer;
+    }
+  }
+  std::sort(merged.begin(), merged.end(), [](const TrackerPeer& a, const TrackerPeer& b) { return a.last_seen > b.last_seen; });
+  if (merged.size() > _options.cache_max_peers) merged.resize(_options.cache_max_peers);
+
+  // Written aside and renamed over, so a crash never leaves a half written cache
+  std::string tempFilename = _cache_filename + ".tmp";
+  FILE* file = fopen(tempFilename.c_str(), "wb");
+  if (!file) {
+    _logger->error("Cannot write peer cache " + tempFilename + ": " + strerror(errno));
+    return false;
+  }
+  uint32_t count = merged.size();
+  bool ok = fwrite(cache_magic, sizeof(cache_magic), 1, file) == 1 && fwrite(&cache_version, sizeof(cache_version), 1, file) == 1 &&
+            fwrite(&count, sizeof(count), 1, file) == 1;
+  for (const TrackerPeer& peer : merged) {
+    CacheRecord record;
+    record.peer.id = peer.id;
+    record.peer.ip4 = peer.addr.sin_addr.s_addr;
+    record.peer.port = peer.addr.sin_port;
+    record.last_seen = peer.last_seen;
+    ok &= fwrite(&record, sizeof(record), 1, file) == 1;
+  }
+  ok &= fclose(file) == 0;
+  if (!ok || rename(tempFilename.c_str(), _cache_filename.c_str()) != 0) {
+    _logger->error("Cannot write peer cache " + _cache_filename);
+    unlink(tempFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+void TrackerClient::write_magic(uint8_t* magic) { std::memcpy(magic, tracker_magic, sizeof(tracker_magic)); }
+
+bool TrackerClient::check_magic(const uint8_t* magic) { return std::memcmp(magic, tracker_magic, sizeof(tracker_magic)) == 0; }
+
+void TrackerClient::_main_loop(uint64_t nodeId, uint16_t port, PeersCallback callback) {
+  std::vector<TrackerPeer> peers;
+  if (load_cache(&peers) && !peers.empty()) {
+    _logger->debug("Starting with " + std::to_string(peers.size()) + " cached peers");
+    callback(peers);
+  }
+
+  while (true) {
+    int32_t wait;
+    peers.clear();
+    if (announce(nodeId, port, &peers)) {
+      _logger->debug("Trackers returned " + std::to_string(peers.size()) + " peers");
+      _failures = 0;
+      _backoff_ms = 0;
+      if (!peers.empty()) {
+        callback(peers);
+        update_cache(peers);
+      }
+      wait = _options.refresh_interval_ms;
+    } else {
+      _failures++;
+      wait = _next_backoff();
+      _backoff_ms = wait;
+      _logger->warn("No reply from trackers, retrying in " + std::to_string(wait) + "ms");
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_wake.wait_for(lock, std::chrono::milliseconds(wait), [this] { return !_running; })) break;
+  }
+}
+
+bool TrackerClient::_resolve() {
+  for (const std::string& server : _servers) {
+    std::string host = server;
+    uint16_t port = KAPUA_TRACKER_DEFAULT_PORT;
+    size_t colon = server.rfind(':');
+    if (colon != std::string::npos) {
+      host = server.substr(0, colon);
+      port = std::atoi(server.substr(colon + 1).c_str());
+    }
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result) {
+      _logger->warn("Cannot resolve tracker " + server);
+      continue;
+    }
+    sockaddr_in addr = *(sockaddr_in*)result->ai_addr;
+    addr.sin_port = htons(port);
+    _addresses.push_back(addr);
+    freeaddrinfo(result);
+  }
+  return !_addresses.empty();
+}
+
+int32_t TrackerClient::_next_backoff() {
+  // Doubles with each failure up to the limit, then a random point in its upper half
+  uint64_t backoff = _options.min_backoff_ms;
+  for (uint32_t i = 1; i < _failures && backoff < (uint64_t)_options.max_backoff_ms; i++) backoff *= 2;
+  backoff = std::min(backoff, (uint64_t)_options.max_backoff_ms);
+  return backoff / 2 + std::uniform_int_distribution<uint64_t>(0, backoff - backoff / 2)(_random);
+}
+
+}  // namespace Kapua
@@ -0,0 +1,130 @@
+//
+// Kapua TrackerClient class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+
+namespace Kapua {
+
+#define KAPUA_TRACKER_DEFAULT_PORT 11841
+// Peers in one reply, which keeps a reply inside a single 1500 byte frame
+#define KAPUA_TRACKER_MAX_PEERS 96
+
+struct TrackerPeer {
+  uint64_t id;
+  sockaddr_in addr;
+  uint64_t last_seen;  // Unix time, in seconds
+};
+
+struct TrackerOptions {
+  int32_t timeout_ms = 1000;                   // Wait for a reply to an announce
+  int32_t min_backoff_ms = 1000;               // After the first failed announce
+  int32_t max_backoff_ms = 5 * 60 * 1000;      // However many announces fail
+  int32_t refresh_interval_ms = 30 * 60 * 1000;  // Between successful announces
+  uint16_t wanted = KAPUA_TRACKER_MAX_PEERS;
+  size_t cache_max_peers = 1024;
+  uint64_t cache_max_age_s = 7 * 24 * 60 * 60;
+};
+
+// Finds peers through trackers, for nodes that cannot find each other by local discovery.
+//
+// One announce is a single UDP datagram to every tracker at once, carrying this node's ID and port, and the first
+// tracker to answer returns up to KAPUA_TRACKER_MAX_PEERS peers in a single datagram, so a new node learns a whole
+// node table in one round trip. Every peer learned is kept in a cache file, which is handed out before any tracker is
+// asked, so a restarting node can rejoin without waiting on the network at all. Failed announces are retried with
+// exponential backoff, with jitter so that nodes do not retry in step.
+class TrackerClient {
+ public:
+  typedef std::function<void(const std::vector<TrackerPeer>& peers)> PeersCallback;
+
+#pragma pack(push, 1)
+  struct Request {
+    uint8_t magic[4];
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t wanted;
+    uint32_t transaction;
+    uint64_t node_id;
+    uint16_t port;  // Network order. Trackers take the address from the datagram, as seen past any NAT.
+  };
+
+  struct ReplyHeader {
+    uint8_t magic[4];
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t count;
+    uint32_t transaction;
+  };
+
+  struct PeerRecord {
+    uint64_t id;
+    uint32_t ip4;   // Network order
+    uint16_t port;  // Network order
+  };
+#pragma pack(pop)
+
+  static const uint8_t TYPE_ANNOUNCE;
+  static const uint8_t TYPE_PEERS;
+
+  // Servers are "host" or "host:port"
+  TrackerClient(Logger* logger, const std::vector<std::string>& servers, const std::string& cacheFilename, TrackerOptions options = TrackerOptions());
+  ~TrackerClient();
+
+  // Hand the cached peers to callback at once, then announce in the background, handing on the peers from each reply
+  bool start(uint64_t nodeId, uint16_t port, PeersCallback callback);
+  void stop();
+
+  // A single announce to every tracker, giving the peers from the first to answer
+  bool announce(uint64_t nodeId, uint16_t port, std::vector<TrackerPeer>* peers);
+
+  // Peers in the cache file that are not too old, most recently seen first
+  bool load_cache(std::vector<TrackerPeer>* peers);
+  // Merge peers into the cache file
+  bool update_cache(const std::vector<TrackerPeer>& peers);
+
+  uint32_t get_failures() { return _failures; }
+  int32_t get_backoff_ms() { return _backoff_ms; }
+
+  static void write_magic(uint8_t* magic);
+  static bool check_magic(const uint8_t* magic);
+
+ protected:
+  Logger* _logger;
+  std::vector<std::string> _servers;
+  std::string _cache_filename;
+  TrackerOptions _options;
+
+  std::vector<sockaddr_in> _addresses;
+  std::mutex _cache_mutex;
+  std::mt19937 _random;
+
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _running;
+
+  std::atomic<uint32_t> _failures;
+  std::atomic<int32_t> _backoff_ms;
+
+  void _main_loop(uint64_t nodeId, uint16_t port, PeersCallback callback);
+  bool _resolve();
+  int32_t _next_backoff();
+};
+
+}  // namespace Kapua
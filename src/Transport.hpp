@@ -0,0 +1,62 @@
+//
+// Kapua Transport interface
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+namespace Kapua {
+
+// Most datagrams read by one receive call, and so handled between timer runs
+#define KAPUA_RECEIVE_BATCH 32
+// How long the network loop waits for a datagram before running its timers
+#define KAPUA_RECEIVE_WAIT_US 100
+
+// Moves datagrams between UDPNetwork and the network, and keeps its time. UDPNetwork decides what a datagram means,
+// implementations of this interface decide how it gets there: a UDP socket, io_uring, or memory in the same process.
+//
+// All calls are made from the thread that drives the network.
+class Transport {
+ public:
+  struct Datagram {
+    uint8_t* data;
+    size_t size;
+    sockaddr_in addr;  // Where it is going to, or came from
+  };
+
+  virtual ~Transport() {}
+
+  // Starts listening on the given port, on every address, with broadcast enabled
+  virtual bool open(uint16_t port) = 0;
+  virtual void close() = 0;
+
+  // Waits up to timeoutUs for a datagram to arrive. Returns true if one has.
+  virtual bool wait(uint32_t timeoutUs) = 0;
+
+  // Reads up to count datagrams without waiting, and returns how many it read. The data of each is left in a buffer of
+  // the transport's, at least sizeof(Packet) long, which the caller may change, such as to decrypt in place, and which
+  // stays valid until the next call to receive.
+  virtual size_t receive(Datagram* datagrams, size_t count) = 0;
+
+  // Sends the given datagrams, and returns how many were taken. Their data is copied before this returns, but they may
+  // not go out until flush is called.
+  virtual size_t send(const Datagram* datagrams, size_t count) = 0;
+  virtual void flush() {}
+
+  // The time that protocol timers run by
+  virtual std::chrono::steady_clock::time_point now() { return std::chrono::steady_clock::now(); }
+};
+
+}  // namespace Kapua
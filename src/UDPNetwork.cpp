@@ -6,21 +6,46 @@
 //
 #include "UDPNetwork.hpp"
 
+#include "IOUringTransport.hpp"
 #include "Protocol.hpp"
+#include "SocketTransport.hpp"
 #include "Util.hpp"
+#include "XDPTransport.hpp"
 
 namespace Kapua {
 
-UDPNetwork::UDPNetwork(Logger* logger, Config* config, Core* core, RSA* rsa) {
+UDPNetwork::UDPNetwork(Logger* logger, Config* config, Core* core, RSA* rsa, Transport* transport) {
   _logger = new ScopedLogger("UDPNetwork", logger);
   _core = core;
   _config = config;
   _rsa = rsa;
   _running = false;
+  _anti_entropy_peer = 0;
+  _tracker = nullptr;
+  _transport = transport;
+  _own_transport = false;
+
+  MetricsRegistry* metrics = core->get_metrics();
+  for (size_t slot = 0; slot < PACKET_TYPE_SLOTS; slot++) {
+    std::string type = slot == PACKET_TYPE_SLOTS - 1 ? "Unknown" : slot == PACKET_TYPE_SLOTS - 2 ? "Discovery" : Packet::packet_type_to_string((Packet::PacketType)slot);
+    _rx_packets[slot] = metrics->counter("kapua_udp_rx_packets_total", "Packets received and accepted, by type", "type=\"" + type + "\"");
+    _tx_packets[slot] = metrics->counter("kapua_udp_tx_packets_total", "Packets sent, by type", "type=\"" + type + "\"");
+  }
+  _rx_bytes = metrics->counter("kapua_udp_rx_bytes_total", "Bytes received, including rejected packets");
+  _tx_bytes = metrics->counter("kapua_udp_tx_bytes_total", "Bytes sent");
+  _rejected_short = metrics->counter("kapua_udp_rejected_packets_total", "Packets received and dropped, by reason", "reason=\"short\"");
+  _rejected_version = metrics->counter("kapua_udp_rejected_packets_total", "Packets received and dropped, by reason", "reason=\"version\"");
+  _rejected_magic = metrics->counter("kapua_udp_rejected_packets_total", "Packets received and dropped, by reason", "reason=\"magic\"");
+  _decrypt_errors = metrics->counter("kapua_udp_crypto_errors_total", "AES failures", "op=\"decrypt\"");
+  _encrypt_errors = metrics->counter("kapua_udp_crypto_errors_total", "AES failures", "op=\"encrypt\"");
+  _process_ns = metrics->histogram("kapua_udp_process_ns", "Time to handle an accepted packet, in nanoseconds");
+  _tracer = nullptr;
 }
 
 UDPNetwork::~UDPNetwork() {
   if (_running) stop();
+  delete _tracer;
+  if (_own_transport) delete _transport;
   delete _logger;
 }
 
@@ -32,6 +57,20 @@ bool UDPNetwork::start(int port) {
   }
 
   _port = port;
+  // Made here rather than in the constructor, as the configuration is loaded in between
+  delete _tracer;
+  _tracer = new PacketTracer(_logger, _core->get_metrics(), _config->tracing_sample_every);
+  if (!_transport || _own_transport) {
+    delete _transport;
+    if (_config->server_transport == "io_uring") {
+      _transport = new IOUringTransport(_logger);
+    } else if (_config->server_transport == "xdp") {
+      _transport = new XDPTransport(_logger, _config->server_xdp_interface);
+    } else {
+      _transport = new SocketTransport(_logger);
+    }
+    _own_transport = true;
+  }
   _main_thread = new std::thread(&UDPNetwork::_main_loop, this);
   return true;
 }
@@ -51,108 +90,155 @@ bool UDPNetwork::stop() {
   return true;
 }
 
-bool UDPNetwork::_listen(int port) {
-#ifdef _WIN32
-  // Initialize Windows Socket API (Winsock)
-  if (WSAStartup(MAKEWORD(2, 2), &_wsaData) != 0) {
-    _logger->error("WIN32: Failed to initialize Winsock");
-    _shutdown();
-    return false;
-  }
-#endif
-
-  // Create a server socket
-  _server_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-  if (_server_socket_fd == -1) {
-    _logger->error("Failed creating server socket");
-    return false;
-  }
-
-  // Set up server address
-  _server_addr.sin_family = AF_INET;
-  _server_addr.sin_port = htons(port);
-  _server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-  // Bind the server socket
-  if (bind(_server_socket_fd, (struct sockaddr*)&_server_addr, sizeof(_server_addr)) == -1) {
-    _logger->error("Failed binding server socket");
-    _shutdown();
-    return false;
-  }
-
-  // Set broadcast enabled on sending socket
-  int broadcast_enable = 1;
-  if (setsockopt(_server_socket_fd, SOL_SOCKET, SO_BROADCAST, &broadcast_enable, sizeof(broadcast_enable)) == -1) {
-    _logger->error("Failed setting send socket options (SO_BROADCAST)");
-    _shutdown();
-    return false;
-  }
-
-  return true;
-}
-
 void UDPNetwork::_main_loop() {
-  sockaddr_in from_addr;
-  Node* node;
-
-  // Standby Buffer
-  std::shared_ptr<Packet> pkt = nullptr;
+  Transport::Datagram datagrams[KAPUA_RECEIVE_BATCH];
 
   // Set up listening on the server port
-  if (!_listen(_port)) {
+  if (!_transport->open(_port)) {
     _logger->error("Listen failed");
-    _shutdown();
     return;
   }
 
+  _start_protocol(_transport->now());
+
   // Set state _running true
   _running = true;
   _logger->debug("Started");
 
-  // Set this in the past so we immediately do a broadcast
-  auto last_broadcast_time = std::chrono::steady_clock::now() - std::chrono::hours(24);
+  // Peers found through trackers are greeted from this thread
+  if (!_config->tracing_capture_file.empty()) _tracer->start_capture(_config->tracing_capture_file, _config->tracing_capture_duration_ms);
 
-  while (_running) {
-    // If there's no standby buffer, allocate one
-    if (!pkt) pkt = std::make_shared<Packet>();
+  if (_config->trackers_enable && !_config->trackers_servers.empty()) {
+    _tracker = new TrackerClient(_logger, _config->trackers_servers, _config->trackers_cache_file);
+    _tracker->start(_core->get_my_id(), _port, [this](const std::vector<TrackerPeer>& peers) {
+      std::lock_guard<std::mutex> lock(_tracker_mutex);
+      _tracker_peers.insert(_tracker_peers.end(), peers.begin(), peers.end());
+    });
+  }
 
-    // Receive if any
-    if (_receive(&node, pkt, from_addr)) {
-      _process_packet(node, pkt);
+  while (_running) {
+    // Receive a batch if there is one. The first packet of a batch is traced from the read, the rest from when their
+    // turn comes.
+    if (_transport->wait(KAPUA_RECEIVE_WAIT_US)) {
+      _tracer->begin();
+      size_t count;
+      {
+        PacketTracer::Span span(_tracer, PacketTracer::STAGE_RECEIVE);
+        count = _transport->receive(datagrams, KAPUA_RECEIVE_BATCH);
+      }
+      if (count == 0) _tracer->end(false, 0);
+      for (size_t i = 0; i < count; i++) {
+        if (i > 0) _tracer->begin();
+        _handle_datagram(datagrams[i]);
+      }
     }
 
-    // Get timing
-    auto now = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_broadcast_time);
+    _run_timers(_transport->now());
 
-    if (_config->local_discovery_enable && duration.count() >= _config->local_discovery_interval_ms) {
-      // Do the discovery broadcast
-      _broadcast();
+    // Replies and timer sends go out together
+    _transport->flush();
 
-      // Reset the last_broadcast_time variable
-      last_broadcast_time = now;
-    }
+    _tracer->check_capture();
+  }
+
+  _stop_protocol();
+
+  if (_tracker) {
+    _tracker->stop();
+    delete _tracker;
+    _tracker = nullptr;
   }
 
   _logger->debug("Stopping...");
-  _shutdown();
+  _transport->flush();
+  _transport->close();
 
   _logger->debug("Stopped");
-}  // namespace Kapua
+}
+
+void UDPNetwork::_start_protocol(std::chrono::steady_clock::time_point now) {
+  // Anti-entropy messages go out over this network, from the thread that drives it
+  _core->get_anti_entropy()->set_sender(
+      [this](uint64_t nodeId, const uint8_t* data, size_t len) { return _send_anti_entropy(nodeId, data, len); });
+
+  // Set this in the past so we immediately do a broadcast
+  _last_broadcast_time = now - std::chrono::hours(24);
+  _last_ping_time = now;
+  _last_anti_entropy_time = now;
+}
+
+void UDPNetwork::_stop_protocol() { _core->get_anti_entropy()->set_sender(nullptr); }
+
+void UDPNetwork::_run_timers(std::chrono::steady_clock::time_point now) {
+  if (_config->local_discovery_enable && std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_broadcast_time).count() >= _config->local_discovery_interval_ms) {
+    // Do the discovery broadcast
+    _broadcast();
+
+    _last_broadcast_time = now;
+  }
+
+  _greet_tracker_peers();
+
+  if (std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_ping_time).count() >= _config->server_ping_interval_ms) {
+    // Ping connected nodes with our current load, and drop those that have gone quiet
+    _ping();
+    _expire_nodes(now);
+
+    _last_ping_time = now;
+  }
+
+  if (std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_anti_entropy_time).count() >= _config->storage_anti_entropy_interval_ms) {
+    // Compare one shared arc with the next connected node
+    _anti_entropy_round();
+
+    _last_anti_entropy_time = now;
+  }
+}
 
-void UDPNetwork::_process_packet(Node* node, std::shared_ptr<Packet> pkt) {
+bool UDPNetwork::_handle_datagram(const Transport::Datagram& datagram) {
+  Packet* pkt = reinterpret_cast<Packet*>(datagram.data);
+  Node* node;
+  size_t payload_size;
+
+  bool accepted = _accept(&node, pkt, datagram.size, datagram.addr, &payload_size);
+  if (accepted) {
+    auto started = std::chrono::steady_clock::now();
+    {
+      PacketTracer::Span span(_tracer, PacketTracer::STAGE_PROCESS);
+      _process_packet(node, pkt, payload_size);
+    }
+    _process_ns->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+  }
+  // A simulated node has no tracer
+  if (_tracer) _tracer->end(accepted, pkt->type);
+  return accepted;
+}
+
+void UDPNetwork::_process_packet(Node* node, Packet* pkt, size_t payload_size) {
   uint8_t buffer[KAPUA_MAX_DATA_SIZE];
   size_t len;
   std::shared_ptr<Packet> reply;
 
-  if (node) node->update_last_contact();
+  if (node) node->update_last_contact(_transport->now());
 
-  _logger->debug("Packet From " + Util::to_hex64_str(pkt->from_id) + ", " + std::to_string(pkt->length) + " bytes (" +
-                 Packet::packet_type_to_string(pkt->type) + ")");
+  _rx_packets[_get_packet_type_slot(pkt->type)]->add();
+  EventLog* events = _core->get_event_log();
+  if (events) events->record(EVENT_PACKET_RECEIVED, pkt->from_id, pkt->length, pkt->type);
+  if (_logger->is_enabled(LOG_LEVEL_DEBUG)) {
+    _logger->debug("Packet From " + Util::to_hex64_str(pkt->from_id) + ", " + std::to_string(pkt->length) + " bytes (" +
+                   Packet::packet_type_to_string(pkt->type) + ")");
+  }
 
   switch (pkt->type) {
-    case Packet::Ping:
+    case Packet::Ping: {
+      // Only connected nodes take part in the block store
+      if (!node || node->state != Node::State::Connected) break;
+
+      NodeLoadReport report;
+      if (pkt->read_load_report(&report, payload_size)) _core->update_node_load(node->id, report);
+
       break;
+    }
 
     case Packet::PublicKeyRequest:
       // The node must be known to us
@@ -189,7 +275,10 @@ void UDPNetwork::_process_packet(Node* node, std::shared_ptr<Packet> pkt) {
       }
 
       // Read and set the public key for this node
-      pkt->read_public_key(&node->keys);
+      if (!pkt->read_public_key(&node->keys, payload_size)) {
+        _logger->warn("PublicKeyReply with an invalid key");
+        break;
+      }
 
       // Generate and set a random AESKey (session key) and encrypt it using the node public key, then send it to the node.
       reply = std::make_shared<Packet>(Packet::EncryptionContext, _core->get_my_id(), node->id);
@@ -222,7 +311,7 @@ void UDPNetwork::_process_packet(Node* node, std::shared_ptr<Packet> pkt) {
       }
 
       // Decrypt the AESKey sent to us using the node's public key, set it as the node session key.
-      if (!_rsa->decrypt_aes_context(&(node->aes_context_rx), _core->get_my_public_key()->privateKey, (uint8_t*)&(pkt->data), pkt->length, &len)) {
+      if (!_rsa->decrypt_aes_context(&(node->aes_context_rx), _core->get_my_public_key()->privateKey, (uint8_t*)&(pkt->data), payload_size, &len)) {
         _logger->warn("Decrypting AESKey failed");
         break;
       }
@@ -256,10 +345,19 @@ void UDPNetwork::_process_packet(Node* node, std::shared_ptr<Packet> pkt) {
       // Node state is now Connected
       node->state = Node::State::Connected;
 
+      if (events) events->record(EVENT_HANDSHAKE_COMPLETE, node->id);
       _logger->debug("Node "+Util::to_hex64_str(node->id)+" Completed AES Handshake");
 
       break;
 
+    case Packet::AntiEntropy:
+      // Only connected nodes take part in the block store
+      if (!node || node->state != Node::State::Connected) break;
+
+      _core->get_anti_entropy()->handle_message(node->id, pkt->data, payload_size);
+
+      break;
+
     case Packet::Discovery:
       // _logger->debug("Discovery from " + Util::to_hex64_str(pkt->from_id));
       break;
@@ -287,44 +385,94 @@ void UDPNetwork::_broadcast() {
   }
 }
 
-bool UDPNetwork::_receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in& client_addr) {
-  uint8_t crypt_buffer[KAPUA_MAX_PACKET_SIZE];
-  uint8_t* buffer = reinterpret_cast<uint8_t*>(pkt.get());
+void UDPNetwork::_greet_tracker_peers() {
+  std::vector<TrackerPeer> peers;
+  {
+    std::lock_guard<std::mutex> lock(_tracker_mutex);
+    peers.swap(_tracker_peers);
+  }
 
-  // Do a select to see if there is a packet waiting
-  struct timeval tv;
-  tv.tv_sec = 0;
-  tv.tv_usec = 100;
-  fd_set rfds;
-  FD_ZERO(&rfds);
-  FD_SET(_server_socket_fd, &rfds);
-  int recVal = select(_server_socket_fd + 1, &rfds, NULL, NULL, &tv);
-
-  // If there is, get the packet and return
-  if (recVal <= 0) {
-    return false;
+  // A discovery packet sent straight to the peer starts the handshake, as a local discovery broadcast does
+  for (const TrackerPeer& peer : peers) {
+    if (peer.id == _core->get_my_id() || _core->find_node(peer.id) || _core->find_node(peer.addr)) continue;
+    std::shared_ptr<Packet> pkt = std::make_shared<Packet>(Packet::Discovery, _core->get_my_id(), peer.id);
+    if (!_send(nullptr, pkt, peer.addr)) {
+      _logger->warn("Error sending Discovery to " + Util::to_hex64_str(peer.id) + " (" + Util::sockaddr_to_string(peer.addr) + ")");
+    }
   }
+}
 
-  // Get a packet, reaad directly into packet buffer
-  socklen_t client_len = sizeof(client_addr);
-  uint16_t size = recvfrom(_server_socket_fd, buffer, KAPUA_MAX_PACKET_SIZE, 0, (struct sockaddr*)&client_addr, &client_len);
+void UDPNetwork::_ping() {
+  NodeLoadReport report;
+  _core->get_my_load(&report);
 
-  // _logger->debug("> Packet From " + Util::sockaddr_to_string(client_addr) + " "+std::to_string(size)+" bytes");
+  for (Node* node : _core->get_connected_nodes()) {
+    std::shared_ptr<Packet> pkt = std::make_shared<Packet>(Packet::Ping, _core->get_my_id(), node->id);
+    pkt->write_load_report(&report);
 
-  // Is there a packet?
-  if (size <= 0) {
-    return false;
+    if (!_send(node, pkt, node->addr)) {
+      _logger->warn("Error sending Ping to " + Util::to_hex64_str(node->id));
+    }
   }
+}
+
+void UDPNetwork::_expire_nodes(std::chrono::steady_clock::time_point now) {
+  EventLog* events = _core->get_event_log();
+  auto timeout = std::chrono::milliseconds(_config->server_node_timeout_ms);
+
+  // Only connected nodes are pinged, so only their silence means they have gone. A handshake can wait longer than this
+  // behind a slow link.
+  for (Node* node : _core->get_connected_nodes()) {
+    if (now - node->last_contact_time < timeout) continue;
+    uint64_t id = node->id;
+    _logger->info("Node " + Util::to_hex64_str(id) + " expired");
+    if (events) events->record(EVENT_NODE_EXPIRED, id);
+    _core->remove_node(id);
+  }
+}
+
+void UDPNetwork::_anti_entropy_round() {
+  std::vector<Node*> nodes = _core->get_connected_nodes();
+  if (nodes.empty()) return;
+
+  // Try each node in turn until one shares an arc with us
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Node* node = nodes[_anti_entropy_peer++ % nodes.size()];
+    if (_core->get_anti_entropy()->start_round(node->id)) return;
+  }
+}
+
+bool UDPNetwork::_send_anti_entropy(uint64_t nodeId, const uint8_t* data, size_t len) {
+  Node* node = _core->find_node(nodeId);
+  if (!node || node->state != Node::State::Connected || len > KAPUA_MAX_DATA_SIZE) return false;
+
+  std::shared_ptr<Packet> pkt = std::make_shared<Packet>(Packet::AntiEntropy, _core->get_my_id(), node->id);
+  std::memcpy(pkt->data, data, len);
+  pkt->length = len;
+  return _send(node, pkt, node->addr);
+}
+
+bool UDPNetwork::_accept(Node** node, Packet* pkt, size_t size, const sockaddr_in& client_addr, size_t* payload_size) {
+  uint8_t crypt_buffer[KAPUA_MAX_PACKET_SIZE];
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(pkt);
+  EventLog* events = _core->get_event_log();
+
+  _rx_bytes->add(size);
   // _logger->debug("Parsing Packet (" + std::to_string(size) + " bytes)");
 
   // Is the packet large enough?
   if (size < KAPUA_HEADER_SIZE) {
     _logger->debug("Non-Kapua packet received (too short)");
+    _rejected_short->add();
+    if (events) events->record(EVENT_PACKET_REJECTED, client_addr.sin_addr.s_addr, client_addr.sin_port, size);
     return false;
   }
 
   // Packet may be from a known node.
-  *node = _core->find_node(client_addr);
+  {
+    PacketTracer::Span span(_tracer, PacketTracer::STAGE_LOOKUP);
+    *node = _core->find_node(client_addr);
+  }
 
   // Valid magic Number?
   if (pkt->check_magic_valid()) {
@@ -338,18 +486,28 @@ bool UDPNetwork::_receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in&
       // Check for connected/context
       // _logger->warn("Decrypting packet");
       size_t plaintext_len;
+      bool decrypted;
+      {
+        PacketTracer::Span span(_tracer, PacketTracer::STAGE_DECRYPT);
+        decrypted = _aes_decrypt((*node)->aes_context_rx, buffer, size, crypt_buffer, &plaintext_len);
+      }
 
-      if (!_aes_decrypt((*node)->aes_context_rx, buffer, size, crypt_buffer, &plaintext_len)) {
+      if (!decrypted) {
         _logger->error("Error while decrypting packet: "+get_aes_error_string());
+        _decrypt_errors->add();
+        if (events) events->record(EVENT_PACKET_REJECTED, client_addr.sin_addr.s_addr, client_addr.sin_port, size);
         return false;
       }
 
       // Update packet with unencrypted plaintext
       memcpy(buffer, crypt_buffer, plaintext_len);
+      size = plaintext_len;
 
       // Check now valid
       if (!pkt->check_magic_valid()) {
         _logger->debug("Error: Decrypted packet has bad magic number");
+        _rejected_magic->add();
+        if (events) events->record(EVENT_PACKET_REJECTED, client_addr.sin_addr.s_addr, client_addr.sin_port, size);
         // TODO: Handle node state.
         // node->state = Node::State::Desynchronisied;
         return false;
@@ -362,8 +520,20 @@ bool UDPNetwork::_receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in&
     // TODO: Setting for strict version checking
     // Version
     _logger->debug("Packet received with incompatible version (" + pkt->get_version_string() + ")");
+    _rejected_version->add();
+    if (events) events->record(EVENT_PACKET_REJECTED, client_addr.sin_addr.s_addr, client_addr.sin_port, size);
+    return false;
+  }
+
+  // Does the length fit in what was received? A length that claims more is from a bad sender. Anything received
+  // past the length is not payload.
+  if (size < KAPUA_HEADER_SIZE || pkt->length > size - KAPUA_HEADER_SIZE) {
+    _logger->debug("Packet received shorter than its length (" + std::to_string(size) + " bytes, length " + std::to_string(pkt->length) + ")");
+    _rejected_short->add();
+    if (events) events->record(EVENT_PACKET_REJECTED, client_addr.sin_addr.s_addr, client_addr.sin_port, size);
     return false;
   }
+  *payload_size = pkt->length;
 
   // Check from us
   if (pkt->from_id == _core->get_my_id()) {
@@ -372,12 +542,14 @@ bool UDPNetwork::_receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in&
     return false;
   }
 
-  std::string client_addr_str = Util::sockaddr_to_string(client_addr);
-
   // Is this a new node?
   if (!*node) {
+    std::string client_addr_str = Util::sockaddr_to_string(client_addr);
+
     // Add the node
     *node = _core->add_node(pkt->from_id, client_addr);
+    (*node)->update_last_contact(_transport->now());
+    if (events) events->record(EVENT_NODE_ADDED, pkt->from_id, client_addr.sin_addr.s_addr, client_addr.sin_port);
     _logger->info("New node detected, ID: " + Util::to_hex64_str(pkt->from_id) + " (" + client_addr_str + ")");
 
     std::shared_ptr<Packet> rpk_pkt = std::make_shared<Packet>(Packet::PublicKeyRequest, _core->get_my_id(), pkt->from_id);
@@ -392,6 +564,7 @@ bool UDPNetwork::_receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in&
 }
 
 bool UDPNetwork::_send(Node* node, std::shared_ptr<Packet> pkt, const sockaddr_in& addr) {
+  PacketTracer::Span span(_tracer, PacketTracer::STAGE_SEND);
   uint8_t crypt_buffer[KAPUA_MAX_PACKET_SIZE];
   uint8_t* buffer = reinterpret_cast<uint8_t*>(pkt.get());
   size_t size = KAPUA_HEADER_SIZE + pkt->length;
@@ -399,33 +572,27 @@ bool UDPNetwork::_send(Node* node, std::shared_ptr<Packet> pkt, const sockaddr_i
     // _logger->debug("Encrypting packet");
     if (!_aes_encrypt(node->aes_context_tx, buffer, KAPUA_HEADER_SIZE + pkt->length, crypt_buffer, &size)) {
       _logger->error("Error while encrypting packet: "+get_aes_error_string());
+      _encrypt_errors->add();
       return false;
     }
     buffer = crypt_buffer;
   }
 
   // _logger->debug("> Packet To " + Util::sockaddr_to_string(addr) + " "+std::to_string(size)+" bytes");
+  EventLog* events = _core->get_event_log();
+  if (events) events->record(EVENT_PACKET_SENT, pkt->to_id, pkt->length, pkt->type);
 
-  return sendto(_server_socket_fd, buffer, size, 0, (const struct sockaddr*)&addr, sizeof(addr)) == KAPUA_HEADER_SIZE + pkt->length;
+  Transport::Datagram datagram = {buffer, size, addr};
+  if (_transport->send(&datagram, 1) != 1) return false;
+  _tx_packets[_get_packet_type_slot(pkt->type)]->add();
+  _tx_bytes->add(size);
+  return true;
 }
 
-bool UDPNetwork::_shutdown() {
-  // Close the server socket
-  if (_server_socket_fd != -1) {
-#ifdef _WIN32
-    closesocket(_server_socket_fd);
-#else
-    close(_server_socket_fd);
-#endif
-    _server_socket_fd = -1;
-  }
-
-#ifdef _WIN32
-  // Cleanup if Windows
-  WSACleanup();
-#endif
-
-  return true;
+size_t UDPNetwork::_get_packet_type_slot(Packet::PacketType type) {
+  if (type <= Packet::AntiEntropy) return type;
+  if (type == Packet::Discovery) return PACKET_TYPE_SLOTS - 2;
+  return PACKET_TYPE_SLOTS - 1;
 }
 
 // AES encryption and decryption functions
@@ -12,6 +12,7 @@
 #include <sys/time.h>
 
 #include <atomic>
+#include <chrono>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
@@ -20,6 +21,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -34,25 +36,45 @@
 #include "Core.hpp"
 #include "Kapua.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "PacketTracer.hpp"
 #include "Protocol.hpp"
 #include "RSA.hpp"
+#include "TrackerClient.hpp"
+#include "Transport.hpp"
 
 namespace Kapua {
+
 class UDPNetwork {
  public:
-  UDPNetwork(Logger* logger, Config* config, Core* core, RSA* rsa);
-  ~UDPNetwork();
+  // Datagrams go by the given transport if there is one, such as a MemoryTransport in tests, or else the one set by
+  // server.transport
+  UDPNetwork(Logger* logger, Config* config, Core* core, RSA* rsa, Transport* transport = nullptr);
+  virtual ~UDPNetwork();
 
   bool start(int port);
   bool stop();
 
  protected:
-  bool _listen(int port);
   void _main_loop();
   void _broadcast();
+  void _ping();
+  void _expire_nodes(std::chrono::steady_clock::time_point now);
+  void _greet_tracker_peers();
+  void _anti_entropy_round();
+  bool _send_anti_entropy(uint64_t nodeId, const uint8_t* data, size_t len);
   bool _send(Node* node, std::shared_ptr<Packet> pkt, const sockaddr_in& addr);
-  bool _receive(Node** node, std::shared_ptr<Packet> pkt, sockaddr_in& client_addr);
-  bool _shutdown();
+  // Checks and handles a datagram as the transport received it, whichever transport that is. Returns true if it was
+  // accepted. Ends the trace the caller began.
+  bool _handle_datagram(const Transport::Datagram& datagram);
+  // Checks a datagram read into pkt, decrypting it in place if it is from a connected node. Returns true if it should
+  // be processed, with payload_size set to the bytes received after the header.
+  bool _accept(Node** node, Packet* pkt, size_t size, const sockaddr_in& client_addr, size_t* payload_size);
+
+  // The protocol is driven by whoever calls these, the main loop or a simulator, with the time as they see it
+  void _start_protocol(std::chrono::steady_clock::time_point now);
+  void _run_timers(std::chrono::steady_clock::time_point now);
+  void _stop_protocol();
 
   bool _aes_encrypt(AESKey& context, const uint8_t* plaintext, size_t plaintext_len, uint8_t* ciphertext, size_t *ciphertext_len);
   bool _aes_decrypt(AESKey& context, const uint8_t* ciphertext, size_t ciphertext_len, uint8_t* plaintext, size_t *plaintext_len);
@@ -62,25 +84,48 @@ class UDPNetwork {
     RAND_bytes(ptr, 32);
   }
 
-  void _process_packet(Node* node, std::shared_ptr<Packet> packet);
+  // Handles an accepted packet. Payloads are read only as far as payload_size, what was received, never as far as the
+  // length in the header says.
+  void _process_packet(Node* node, Packet* pkt, size_t payload_size);
 
   Core* _core;
   Config* _config;
   RSA* _rsa;
 
   uint16_t _port;
+  size_t _anti_entropy_peer;
 
-  int _server_socket_fd;
-  sockaddr_in _server_addr;
+  Transport* _transport;
+  bool _own_transport;
 
   Logger* _logger;
 
   std::thread* _main_thread;
 
+  TrackerClient* _tracker;
+  std::mutex _tracker_mutex;
+  std::vector<TrackerPeer> _tracker_peers;
+
   std::atomic_bool _running;
 
-#ifdef _WIN32
-  WSADATA _wsaData;
-#endif
+  std::chrono::steady_clock::time_point _last_broadcast_time;
+  std::chrono::steady_clock::time_point _last_ping_time;
+  std::chrono::steady_clock::time_point _last_anti_entropy_time;
+
+  // Packet types are counted by slot: each known type, then Discovery, then anything else
+  static const size_t PACKET_TYPE_SLOTS = Packet::AntiEntropy + 3;
+  MetricCounter* _rx_packets[PACKET_TYPE_SLOTS];
+  MetricCounter* _tx_packets[PACKET_TYPE_SLOTS];
+  MetricCounter* _rx_bytes;
+  MetricCounter* _tx_bytes;
+  MetricCounter* _rejected_short;
+  MetricCounter* _rejected_version;
+  MetricCounter* _rejected_magic;
+  MetricCounter* _decrypt_errors;
+  MetricCounter* _encrypt_errors;
+  MetricHistogram* _process_ns;
+  PacketTracer* _tracer;
+
+  static size_t _get_packet_type_slot(Packet::PacketType type);
 };
 }  // namespace Kapua
@@ -4,6 +4,20 @@
 // Author: Tom Cully <mail@tomcully.com>
 // Copyright (c) Tom Cully 2023
 //
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#endif
+
 namespace Kapua {
 
 namespace Util {
@@ -25,6 +39,24 @@ static std::string to_hex(const uint8_t *buffer, size_t len) {
   return oss.str();
 }
 
+// CRC-32C (Castagnoli), for checksumming records on disk
+static uint32_t crc32c(const uint8_t *buffer, size_t len, uint32_t crc = 0) {
+  static const struct Table {
+    uint32_t entries[256];
+    Table() {
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        entries[i] = c;
+      }
+    }
+  } table;
+
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) crc = table.entries[(crc ^ buffer[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
 }  // namespace Util
 
 }  // namespace Kapua
\ No newline at end of file
@@ -0,0 +1,245 @@
+//
+// Kapua Wire classes
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Kapua {
+
+// The longest a 64 bit varint can be
+#define KAPUA_WIRE_MAX_VARINT 10
+
+// Packet payloads are written and read through these, so that every node reads the bytes the same way.
+//
+// * Fixed width integers are little endian, whatever the host, which is also how payloads that were copied straight
+//   from structs look on the hosts nodes run on.
+// * Varints are LEB128: seven bits to a byte, lowest first, with the top bit set on every byte but the last. Counts,
+//   lengths and extension types are varints.
+// * ID arrays are a varint count, then each ID as a fixed width 64 bit integer.
+// * Extensions are a varint type, a varint length, then that many bytes. They go at the end of a payload, after its
+//   fixed fields, and a reader skips any it doesn't know, so a payload can grow without breaking older nodes.
+//
+// Neither throws nor allocates. Each carries on after a write that doesn't fit or a read past the end, with that and
+// everything after it failing: a writer writes nothing more, and a reader returns zeroes and empty views. So a run of
+// calls needs one check of ok() at the end, not one each.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline uint16_t wire_le16(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t wire_le32(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t wire_le64(uint64_t v) { return __builtin_bswap64(v); }
+#else
+inline uint16_t wire_le16(uint16_t v) { return v; }
+inline uint32_t wire_le32(uint32_t v) { return v; }
+inline uint64_t wire_le64(uint64_t v) { return v; }
+#endif
+
+// A view of an ID array where it lies in a payload
+class WireIds {
+ public:
+  WireIds() : _data(nullptr), _count(0) {}
+  WireIds(const uint8_t* data, size_t count) : _data(data), _count(count) {}
+
+  size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+
+  uint64_t operator[](size_t index) const {
+    uint64_t id;
+    std::memcpy(&id, _data + index * sizeof(uint64_t), sizeof(uint64_t));
+    return wire_le64(id);
+  }
+
+ protected:
+  const uint8_t* _data;
+  size_t _count;
+};
+
+class WireWriter {
+ public:
+  WireWriter(uint8_t* buffer, size_t capacity) : _buffer(buffer), _capacity(capacity), _size(0), _ok(true) {}
+
+  void put_u8(uint8_t value) { _put(&value, sizeof(value)); }
+
+  void put_u16(uint16_t value) {
+    value = wire_le16(value);
+    _put(&value, sizeof(value));
+  }
+
+  void put_u32(uint32_t value) {
+    value = wire_le32(value);
+    _put(&value, sizeof(value));
+  }
+
+  void put_u64(uint64_t value) {
+    value = wire_le64(value);
+    _put(&value, sizeof(value));
+  }
+
+  void put_varint(uint64_t value) {
+    uint8_t encoded[KAPUA_WIRE_MAX_VARINT];
+    size_t size = 0;
+    for (; value >= 0x80; value >>= 7) encoded[size++] = (uint8_t)value | 0x80;
+    encoded[size++] = (uint8_t)value;
+    _put(encoded, size);
+  }
+
+  void put_bytes(const void* data, size_t size) { _put(data, size); }
+
+  void put_ids(const uint64_t* ids, size_t count) {
+    put_varint(count);
+    uint8_t* out = reserve(count * sizeof(uint64_t));
+    if (!out) return;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t id = wire_le64(ids[i]);
+      std::memcpy(out + i * sizeof(uint64_t), &id, sizeof(uint64_t));
+    }
+  }
+
+  void put_extension(uint64_t type, const void* value, size_t size) {
+    put_varint(type);
+    put_varint(size);
+    _put(value, size);
+  }
+
+  // Makes room for size bytes and returns where they go, for a value that is written in place, or nullptr if they
+  // don't fit
+  uint8_t* reserve(size_t size) {
+    if (!_ok || size > _capacity - _size) {
+      _fail();
+      return nullptr;
+    }
+    uint8_t* out = _buffer + _size;
+    _size += size;
+    return out;
+  }
+
+  bool ok() const { return _ok; }
+  // What has been written, up to the first write that didn't fit, which may have written part of an ID array or
+  // extension
+  size_t size() const { return _size; }
+
+ protected:
+  uint8_t* _buffer;
+  size_t _capacity;
+  size_t _size;
+  bool _ok;
+
+  void _put(const void* data, size_t size) {
+    uint8_t* out = reserve(size);
+    if (out) std::memcpy(out, data, size);
+  }
+
+  void _fail() {
+    _ok = false;
+    _capacity = _size;
+  }
+};
+
+class WireReader {
+ public:
+  WireReader() : _data(nullptr), _size(0), _pos(0), _ok(true) {}
+  WireReader(const uint8_t* data, size_t size) : _data(data), _size(size), _pos(0), _ok(true) {}
+
+  uint8_t get_u8() {
+    uint8_t value = 0;
+    _get(&value, sizeof(value));
+    return value;
+  }
+
+  uint16_t get_u16() {
+    uint16_t value = 0;
+    _get(&value, sizeof(value));
+    return wire_le16(value);
+  }
+
+  uint32_t get_u32() {
+    uint32_t value = 0;
+    _get(&value, sizeof(value));
+    return wire_le32(value);
+  }
+
+  uint64_t get_u64() {
+    uint64_t value = 0;
+    _get(&value, sizeof(value));
+    return wire_le64(value);
+  }
+
+  // Fails on a varint that runs off the end, or is longer than 64 bits can need
+  uint64_t get_varint() {
+    uint64_t value = 0;
+    size_t limit = std::min<size_t>(_size - _pos, KAPUA_WIRE_MAX_VARINT);
+    for (size_t i = 0; i < limit; i++) {
+      uint8_t byte = _data[_pos + i];
+      value |= (uint64_t)(byte & 0x7f) << (7 * i);
+      if (!(byte & 0x80)) {
+        // The tenth byte only has room for the top bit
+        if (i == KAPUA_WIRE_MAX_VARINT - 1 && byte > 1) break;
+        _pos += i + 1;
+        return value;
+      }
+    }
+    _fail();
+    return 0;
+  }
+
+  // The next size bytes where they lie, or nullptr if there aren't that many
+  const uint8_t* get_bytes(size_t size) {
+    if (!_ok || size > _size - _pos) {
+      _fail();
+      return nullptr;
+    }
+    const uint8_t* bytes = _data + _pos;
+    _pos += size;
+    return bytes;
+  }
+
+  WireIds get_ids() {
+    uint64_t count = get_varint();
+    if (count > (_size - _pos) / sizeof(uint64_t)) {
+      _fail();
+      return WireIds();
+    }
+    return WireIds(get_bytes(count * sizeof(uint64_t)), count);
+  }
+
+  // Reads the next extension, and returns false once there are none left, or if it is cut short, which also fails the
+  // reader
+  bool get_extension(uint64_t* type, WireReader* value) {
+    if (!_ok || _pos == _size) return false;
+    *type = get_varint();
+    uint64_t size = get_varint();
+    if (!_ok || size > _size - _pos) {
+      _fail();
+      return false;
+    }
+    *value = WireReader(get_bytes(size), size);
+    return true;
+  }
+
+  bool ok() const { return _ok; }
+  size_t remaining() const { return _size - _pos; }
+
+ protected:
+  const uint8_t* _data;
+  size_t _size;
+  size_t _pos;
+  bool _ok;
+
+  void _get(void* out, size_t size) {
+    const uint8_t* bytes = get_bytes(size);
+    if (bytes) std::memcpy(out, bytes, size);
+  }
+
+  void _fail() {
+    _ok = false;
+    _pos = _size;
+  }
+};
+
+}  // namespace Kapua
@@ -0,0 +1,114 @@
+//
+// Kapua WorkStealingDeque class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Kapua {
+
+// A Chase-Lev work-stealing deque, with the memory orderings from Lê et al., "Correct and Efficient Work-Stealing for
+// Weak Memory Models" (PPoPP 2013). The owning thread pushes and pops at the bottom without locks or, unless the
+// deque is down to its last item, atomic read-modify-writes. Any other thread may steal from the top.
+//
+// T must be trivially copyable, and is usually a pointer. The ring grows as needed, and outgrown rings are kept until
+// the deque is destroyed, since a thief may still be reading one.
+template <typename T>
+class WorkStealingDeque {
+ public:
+  WorkStealingDeque(size_t capacity = 256) : _top(0), _bottom(0) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    _rings.emplace_back(new Ring(size));
+    _ring.store(_rings.back().get(), std::memory_order_relaxed);
+  }
+
+  // Owner only
+  void push(T item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    Ring* ring = _ring.load(std::memory_order_relaxed);
+    if (b - t > (int64_t)ring->mask) ring = _grow(ring, t, b);
+    ring->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only. Takes the most recently pushed item.
+  bool pop(T* item) {
+    int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    Ring* ring = _ring.load(std::memory_order_relaxed);
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *item = ring->get(b);
+    if (t == b) {
+      // The last item, which a thief may be taking too
+      bool won = _top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // Any thread. Takes the least recently pushed item, and fails if the deque is empty or another thread took it first.
+  bool steal(T* item) {
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+    if (t >= b) return false;
+
+    Ring* ring = _ring.load(std::memory_order_acquire);
+    T candidate = ring->get(t);
+    if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return false;
+    *item = candidate;
+    return true;
+  }
+
+  // Approximate when other threads are pushing or stealing
+  size_t size() const {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+ protected:
+  struct Ring {
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> items;
+
+    Ring(size_t size) : mask(size - 1), items(new std::atomic<T>[size]) {}
+    T get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+    void put(int64_t i, T item) { items[i & mask].store(item, std::memory_order_relaxed); }
+  };
+
+  // Kept on separate cache lines, as thieves write the top and the owner the bottom
+  std::atomic<int64_t> _top;
+  char _padding[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> _bottom;
+  std::atomic<Ring*> _ring;
+  std::vector<std::unique_ptr<Ring>> _rings;  // Owner only
+
+  Ring* _grow(Ring* ring, int64_t t, int64_t b) {
+    Ring* bigger = new Ring((ring->mask + 1) * 2);
+    for (int64_t i = t; i < b; i++) bigger->put(i, ring->get(i));
+    _rings.emplace_back(bigger);
+    _ring.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+};
+
+}  // namespace Kapua
@@ -0,0 +1,128 @@
+//
+// Kapua WorkStealingPool class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "WorkStealingPool.hpp"
+
+namespace Kapua {
+
+namespace {
+// The pool and worker the current thread belongs to, if any
+thread_local WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(Logger* logger, size_t threads) : _queued(0), _sleeping(0), _stopping(false), _outstanding(0), _executed(0), _steals(0) {
+  _logger = new ScopedLogger("WorkStealingPool", logger);
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  for (size_t i = 0; i < threads; i++) _workers.emplace_back(new Worker());
+  for (size_t i = 0; i < threads; i++) _workers[i]->thread = std::thread(&WorkStealingPool::_worker_loop, this, i);
+  _logger->debug("Started " + std::to_string(threads) + " workers");
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (std::unique_ptr<Worker>& worker : _workers) worker->thread.join();
+  delete _logger;
+}
+
+void WorkStealingPool::submit(Task task) {
+  Task* item = new Task(std::move(task));
+  _outstanding++;
+  _queued++;
+
+  if (current_pool == this) {
+    _workers[current_worker]->deque.push(item);
+  } else {
+    std::lock_guard<std::mutex> lock(_injected_mutex);
+    _injected.push_back(item);
+  }
+
+  if (_sleeping > 0) {
+    // Taking the lock orders this wakeup after a sleeper's last check
+    { std::lock_guard<std::mutex> lock(_sleep_mutex); }
+    _wake.notify_one();
+  }
+}
+
+void WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(_idle_mutex);
+  _idle.wait(lock, [this] { return _outstanding == 0; });
+}
+
+void WorkStealingPool::_worker_loop(size_t index) {
+  current_pool = this;
+  current_worker = index;
+  // xorshift, to pick victims without sharing a generator
+  uint64_t seed = 0x9e3779b97f4a7c15ULL * (index + 1);
+
+  while (true) {
+    Task* task = _find_task(index, &seed);
+    if (!task) {
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      _sleeping++;
+      _wake.wait(lock, [this] { return _queued > 0 || _stopping; });
+      _sleeping--;
+      if (_stopping && _queued == 0) break;
+      continue;
+    }
+
+    (*task)();
+    delete task;
+    _executed++;
+    if (--_outstanding == 0) {
+      std::lock_guard<std::mutex> lock(_idle_mutex);
+      _idle.notify_all();
+    }
+  }
+
+  current_pool = nullptr;
+}
+
+WorkStealingPool::Task* WorkStealingPool::_find_task(size_t index, uint64_t* seed) {
+  Task* task = nullptr;
+
+  if (_workers[index]->deque.pop(&task)) {
+    _queued--;
+    return task;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_injected_mutex);
+    if (!_injected.empty()) {
+      task = _injected.front();
+      _injected.pop_front();
+      _queued--;
+      return task;
+    }
+  }
+
+  // Try every other worker once, starting from a random one. A steal that loses a race moves on, since something
+  // else is making progress.
+  size_t count = _workers.size();
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  size_t start = *seed % count;
+  for (size_t i = 0; i < count; i++) {
+    size_t victim = (start + i) % count;
+    if (victim == index) continue;
+    if (_workers[victim]->deque.steal(&task)) {
+      _queued--;
+      _steals++;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace Kapua
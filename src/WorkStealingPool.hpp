@@ -0,0 +1,78 @@
+//
+// Kapua WorkStealingPool class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Logger.hpp"
+#include "WorkStealingDeque.hpp"
+
+namespace Kapua {
+
+// A fixed pool of worker threads, each with its own work-stealing deque. Tasks submitted by a worker go on its own
+// deque and are run newest first, which keeps a task's children on the core whose cache holds their data. Tasks
+// submitted from outside the pool go on a shared queue. A worker with nothing to do takes from the shared queue, then
+// steals the oldest task from another worker, and only sleeps when there is no work anywhere.
+class WorkStealingPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // With no thread count, one thread per core
+  WorkStealingPool(Logger* logger, size_t threads = 0);
+  // Runs every task already submitted, then stops the workers
+  ~WorkStealingPool();
+
+  void submit(Task task);
+  // Wait until every submitted task has run, including any they submit. Must not be called from a task.
+  void wait();
+
+  size_t get_thread_count() const { return _workers.size(); }
+  // Tasks submitted but not yet finished
+  size_t get_outstanding() { return _outstanding; }
+  uint64_t get_executed() { return _executed; }
+  uint64_t get_steals() { return _steals; }
+
+ protected:
+  struct Worker {
+    WorkStealingDeque<Task*> deque;
+    std::thread thread;
+  };
+
+  Logger* _logger;
+  std::vector<std::unique_ptr<Worker>> _workers;
+
+  std::mutex _injected_mutex;
+  std::deque<Task*> _injected;
+
+  // Sleeping workers. A submitter bumps _queued then checks _sleeping, a worker bumps _sleeping then checks _queued,
+  // so one of them always sees the other and no wakeup is lost.
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+  std::atomic<size_t> _queued;
+  std::atomic<size_t> _sleeping;
+  bool _stopping;
+
+  std::mutex _idle_mutex;
+  std::condition_variable _idle;
+  std::atomic<size_t> _outstanding;
+
+  std::atomic<uint64_t> _executed;
+  std::atomic<uint64_t> _steals;
+
+  void _worker_loop(size_t index);
+  Task* _find_task(size_t index, uint64_t* seed);
+};
+
+}  // namespace Kapua
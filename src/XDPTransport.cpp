@@ -0,0 +1,457 @@
+//
+// Kapua XDPTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#include "XDPTransport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+// Everything used here is in the headers from Linux 5.10
+#if defined(XDP_USE_NEED_WAKEUP) && defined(BPF_F_SLEEPABLE) && defined(__NR_bpf)
+#define KAPUA_XDP
+#endif
+#endif
+#endif
+
+namespace Kapua {
+
+#ifdef KAPUA_XDP
+
+namespace {
+
+// An Ethernet header, then an IPv4 header without options, then a UDP header
+const size_t ETH_HEADER_SIZE = 14;
+const size_t MIN_IP_HEADER_SIZE = 20;
+const size_t UDP_HEADER_SIZE = 8;
+const size_t STEERED_HEADERS_SIZE = ETH_HEADER_SIZE + MIN_IP_HEADER_SIZE + UDP_HEADER_SIZE;
+
+// A frame's data can start after the headroom the kernel keeps in native mode, and an IPv4 header can be up to 60 bytes
+static_assert(KAPUA_XDP_FRAME_SIZE - XDP_PACKET_HEADROOM - ETH_HEADER_SIZE - 60 - UDP_HEADER_SIZE >= sizeof(Packet),
+              "a received payload must have room for a Packet after it");
+
+// Offsets the program reads at, from the start of the Ethernet header
+const int16_t ETH_TYPE_OFFSET = 12;
+const int16_t IP_VERSION_OFFSET = ETH_HEADER_SIZE;
+const int16_t IP_FRAGMENT_OFFSET = ETH_HEADER_SIZE + 6;
+const int16_t IP_PROTOCOL_OFFSET = ETH_HEADER_SIZE + 9;
+const int16_t UDP_DEST_PORT_OFFSET = ETH_HEADER_SIZE + MIN_IP_HEADER_SIZE + 2;
+
+const uint32_t COMPLETION_RING_SIZE = 64;  // Nothing is sent, but the kernel wants one
+
+long bpf(int cmd, bpf_attr* attr) { return syscall(__NR_bpf, cmd, attr, sizeof(bpf_attr)); }
+
+bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+  bpf_insn result;
+  std::memset(&result, 0, sizeof(result));
+  result.code = code;
+  result.dst_reg = dst;
+  result.src_reg = src;
+  result.off = off;
+  result.imm = imm;
+  return result;
+}
+
+uint32_t load_acquire(uint32_t* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+void store_release(uint32_t* p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+}  // namespace
+
+#endif
+
+XDPTransport::XDPTransport(Logger* logger, const std::string& interface) : SocketTransport(logger, "XDPTransport") {
+  _interface = interface;
+  _map_fd = _prog_fd = _link_fd = -1;
+  _socket_readable = false;
+  _busy_waits = 0;
+}
+
+XDPTransport::~XDPTransport() { close(); }
+
+bool XDPTransport::open(uint16_t port) {
+  if (!SocketTransport::open(port)) return false;
+  if (!_setup_xdp(port)) _logger->warn("AF_XDP unavailable, using the socket alone");
+  return true;
+}
+
+void XDPTransport::close() {
+  _teardown_xdp();
+  SocketTransport::close();
+}
+
+#ifdef KAPUA_XDP
+
+bool XDPTransport::_setup_xdp(uint16_t port) {
+  if (_interface.empty()) {
+    _logger->warn("server.xdp_interface is not set");
+    return false;
+  }
+  int ifindex = if_nametoindex(_interface.c_str());
+  if (ifindex == 0) {
+    _logger->warn("No interface " + _interface);
+    return false;
+  }
+
+  // A socket for each receive queue. Interfaces that can't say how many they have get one.
+  uint32_t queues = 1;
+  ethtool_channels channels;
+  std::memset(&channels, 0, sizeof(channels));
+  channels.cmd = ETHTOOL_GCHANNELS;
+  ifreq request;
+  std::memset(&request, 0, sizeof(request));
+  std::strncpy(request.ifr_name, _interface.c_str(), IFNAMSIZ - 1);
+  request.ifr_data = reinterpret_cast<char*>(&channels);
+  if (ioctl(_socket_fd, SIOCETHTOOL, &request) == 0) queues = std::max(queues, std::max(channels.rx_count, channels.combined_count));
+  queues = std::min<uint32_t>(queues, KAPUA_XDP_MAX_QUEUES);
+
+  bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = queues;
+  std::strncpy(attr.map_name, "kapua_xsks", BPF_OBJ_NAME_LEN - 1);
+  _map_fd = bpf(BPF_MAP_CREATE, &attr);
+  if (_map_fd < 0) {
+    _logger->warn(std::string("Creating the socket map failed: ") + strerror(errno));
+    _teardown_xdp();
+    return false;
+  }
+  if (!_load_program(port)) {
+    _teardown_xdp();
+    return false;
+  }
+
+  for (uint32_t index = 0; index < queues; index++) {
+    Queue queue;
+    if (!_open_queue(ifindex, index, &queue)) {
+      _teardown_xdp();
+      return false;
+    }
+    _queues.push_back(queue);
+
+    std::memset(&attr, 0, sizeof(attr));
+    attr.map_fd = _map_fd;
+    attr.key = (uint64_t)(uintptr_t)&index;
+    attr.value = (uint64_t)(uintptr_t)&queue.fd;
+    attr.flags = BPF_ANY;
+    if (bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+      _logger->warn(std::string("Adding a socket to the map failed: ") + strerror(errno));
+      _teardown_xdp();
+      return false;
+    }
+  }
+
+  // Attached last, so nothing is steered before there is somewhere for it to go. Native mode if the driver has it,
+  // otherwise the generic mode every interface has.
+  const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+  for (uint32_t mode : modes) {
+    std::memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = _prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = mode;
+    _link_fd = bpf(BPF_LINK_CREATE, &attr);
+    if (_link_fd >= 0) break;
+  }
+  if (_link_fd < 0) {
+    _logger->warn(std::string("Attaching the XDP program failed: ") + strerror(errno));
+    _teardown_xdp();
+    return false;
+  }
+
+  _logger->debug("Using AF_XDP on " + _interface + ", " + std::to_string(queues) + " queue(s)");
+  return true;
+}
+
+bool XDPTransport::_load_program(uint16_t port) {
+  // Values are compared as loaded from the frame, so in network order
+  const int32_t ethTypeIp = htons(ETH_P_IP);
+  const int32_t fragmentMask = htons(0x3fff);  // More fragments, and the fragment offset
+  const int32_t destPort = htons(port);
+  const int32_t ipv4NoOptions = 0x45;
+
+  std::vector<bpf_insn> program;
+  std::vector<size_t> toPass;  // Jumps to the end, filled in once it is known
+  auto passUnless = [&](uint8_t op, uint8_t reg, int32_t value) {
+    toPass.push_back(program.size());
+    program.push_back(insn(BPF_JMP | op | BPF_K, reg, 0, 0, value));
+  };
+
+  // r6 = ctx, r2 = data, r3 = data_end
+  program.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+  program.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(xdp_md, data), 0));
+  program.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(xdp_md, data_end), 0));
+  // Long enough to hold the headers
+  program.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+  program.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, STEERED_HEADERS_SIZE));
+  toPass.push_back(program.size());
+  program.push_back(insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+  // IPv4, without options, not a fragment, UDP, to the port
+  program.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, ETH_TYPE_OFFSET, 0));
+  passUnless(BPF_JNE, BPF_REG_5, ethTypeIp);
+  program.push_back(insn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, IP_VERSION_OFFSET, 0));
+  passUnless(BPF_JNE, BPF_REG_5, ipv4NoOptions);
+  program.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, IP_FRAGMENT_OFFSET, 0));
+  program.push_back(insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, fragmentMask));
+  passUnless(BPF_JNE, BPF_REG_5, 0);
+  program.push_back(insn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, IP_PROTOCOL_OFFSET, 0));
+  passUnless(BPF_JNE, BPF_REG_5, IPPROTO_UDP);
+  program.push_back(insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, UDP_DEST_PORT_OFFSET, 0));
+  passUnless(BPF_JNE, BPF_REG_5, destPort);
+  // return bpf_redirect_map(&map, ctx->rx_queue_index, XDP_PASS), which passes it on if the queue has no socket
+  program.push_back(insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(xdp_md, rx_queue_index), 0));
+  program.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, _map_fd));
+  program.push_back(insn(0, 0, 0, 0, 0));
+  program.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+  program.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+  program.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  // Anything else goes on to the kernel
+  size_t pass = program.size();
+  program.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+  program.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  for (size_t jump : toPass) program[jump].off = pass - jump - 1;
+
+  bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t)(uintptr_t)program.data();
+  attr.insn_cnt = program.size();
+  attr.license = (uint64_t)(uintptr_t) "MIT";
+  std::strncpy(attr.prog_name, "kapua_steer", BPF_OBJ_NAME_LEN - 1);
+  _prog_fd = bpf(BPF_PROG_LOAD, &attr);
+  if (_prog_fd < 0) {
+    _logger->warn(std::string("Loading the XDP program failed: ") + strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool XDPTransport::_open_queue(int ifindex, uint32_t index, Queue* queue) {
+  std::memset(queue, 0, sizeof(Queue));
+  queue->fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (queue->fd < 0) {
+    _logger->warn(std::string("Creating an AF_XDP socket failed: ") + strerror(errno));
+    return false;
+  }
+
+  size_t umemSize = (size_t)KAPUA_XDP_FRAMES * KAPUA_XDP_FRAME_SIZE;
+  void* umem = mmap(nullptr, umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (umem == MAP_FAILED) {
+    _logger->warn(std::string("AF_XDP frame allocation failed: ") + strerror(errno));
+    _close_queue(queue);
+    return false;
+  }
+  queue->umem = static_cast<uint8_t*>(umem);
+
+  xdp_umem_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.addr = (uint64_t)(uintptr_t)umem;
+  reg.len = umemSize;
+  reg.chunk_size = KAPUA_XDP_FRAME_SIZE;
+  int frames = KAPUA_XDP_FRAMES;
+  int completions = COMPLETION_RING_SIZE;
+  if (setsockopt(queue->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+      setsockopt(queue->fd, SOL_XDP, XDP_UMEM_FILL_RING, &frames, sizeof(frames)) < 0 ||
+      setsockopt(queue->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completions, sizeof(completions)) < 0 ||
+      setsockopt(queue->fd, SOL_XDP, XDP_RX_RING, &frames, sizeof(frames)) < 0) {
+    _logger->warn(std::string("AF_XDP socket setup failed: ") + strerror(errno));
+    _close_queue(queue);
+    return false;
+  }
+
+  xdp_mmap_offsets offsets;
+  socklen_t offsetsSize = sizeof(offsets);
+  if (getsockopt(queue->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsSize) < 0) {
+    _logger->warn(std::string("AF_XDP socket setup failed: ") + strerror(errno));
+    _close_queue(queue);
+    return false;
+  }
+  queue->rx_map_size = offsets.rx.desc + KAPUA_XDP_FRAMES * sizeof(xdp_desc);
+  queue->rx_map = mmap(nullptr, queue->rx_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, queue->fd, XDP_PGOFF_RX_RING);
+  if (queue->rx_map == MAP_FAILED) queue->rx_map = nullptr;
+  queue->fill_map_size = offsets.fr.desc + KAPUA_XDP_FRAMES * sizeof(uint64_t);
+  queue->fill_map = mmap(nullptr, queue->fill_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, queue->fd, XDP_UMEM_PGOFF_FILL_RING);
+  if (queue->fill_map == MAP_FAILED) queue->fill_map = nullptr;
+  if (!queue->rx_map || !queue->fill_map) {
+    _logger->warn(std::string("AF_XDP ring mapping failed: ") + strerror(errno));
+    _close_queue(queue);
+    return false;
+  }
+  uint8_t* rx = static_cast<uint8_t*>(queue->rx_map);
+  uint8_t* fill = static_cast<uint8_t*>(queue->fill_map);
+  queue->rx_producer = reinterpret_cast<uint32_t*>(rx + offsets.rx.producer);
+  queue->rx_consumer = reinterpret_cast<uint32_t*>(rx + offsets.rx.consumer);
+  queue->rx_descs = rx + offsets.rx.desc;
+  queue->fill_producer = reinterpret_cast<uint32_t*>(fill + offsets.fr.producer);
+  queue->fill_flags = reinterpret_cast<uint32_t*>(fill + offsets.fr.flags);
+  queue->fill_addrs = reinterpret_cast<uint64_t*>(fill + offsets.fr.desc);
+
+  // Every frame starts out with the kernel
+  for (uint32_t frame = 0; frame < KAPUA_XDP_FRAMES; frame++) _fill(queue, (uint64_t)frame * KAPUA_XDP_FRAME_SIZE);
+
+  // Zero copy where the driver can DMA into the frames, copied in otherwise
+  sockaddr_xdp addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = index;
+  addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+  if (bind(queue->fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if (bind(queue->fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      _logger->warn("Binding an AF_XDP socket to " + _interface + " queue " + std::to_string(index) + " failed: " + strerror(errno));
+      _close_queue(queue);
+      return false;
+    }
+  }
+  return true;
+}
+
+void XDPTransport::_close_queue(Queue* queue) {
+  if (queue->fd >= 0) ::close(queue->fd);
+  if (queue->rx_map) munmap(queue->rx_map, queue->rx_map_size);
+  if (queue->fill_map) munmap(queue->fill_map, queue->fill_map_size);
+  if (queue->umem) munmap(queue->umem, (size_t)KAPUA_XDP_FRAMES * KAPUA_XDP_FRAME_SIZE);
+  std::memset(queue, 0, sizeof(Queue));
+  queue->fd = -1;
+}
+
+void XDPTransport::_teardown_xdp() {
+  // Detaching the program first, so nothing more is steered to the sockets
+  if (_link_fd >= 0) ::close(_link_fd);
+  for (Queue& queue : _queues) _close_queue(&queue);
+  if (_prog_fd >= 0) ::close(_prog_fd);
+  if (_map_fd >= 0) ::close(_map_fd);
+  _link_fd = _prog_fd = _map_fd = -1;
+  _queues.clear();
+  _handed_out.clear();
+}
+
+bool XDPTransport::wait(uint32_t timeoutUs) {
+  if (_queues.empty()) return SocketTransport::wait(timeoutUs);
+
+  // Datagrams already in a ring needn't wait, but keep looking at the socket now and then, so what comes that way isn't
+  // held up for as long as the rings stay busy
+  bool waiting = _socket_readable;
+  for (size_t i = 0; i < _queues.size() && !waiting; i++) waiting = load_acquire(_queues[i].rx_producer) != *_queues[i].rx_consumer;
+  if (waiting) {
+    if (++_busy_waits < KAPUA_XDP_SOCKET_EVERY) return true;
+    timeoutUs = 0;
+  }
+  _busy_waits = 0;
+
+  // Polling an AF_XDP socket also wakes the driver, if it is waiting for frames to be filled
+  pollfd fds[KAPUA_XDP_MAX_QUEUES + 1];
+  for (size_t i = 0; i < _queues.size(); i++) fds[i] = {_queues[i].fd, POLLIN, 0};
+  fds[_queues.size()] = {_socket_fd, POLLIN, 0};
+  timespec ts;
+  ts.tv_sec = timeoutUs / 1000000;
+  ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+  int ready = ppoll(fds, _queues.size() + 1, &ts, nullptr);
+  if (ready <= 0) return waiting;
+  if (fds[_queues.size()].revents & POLLIN) _socket_readable = true;
+  return true;
+}
+
+size_t XDPTransport::receive(Datagram* datagrams, size_t count) {
+  if (_queues.empty()) return SocketTransport::receive(datagrams, count);
+
+  // The caller is done with the last batch
+  for (const std::pair<size_t, uint64_t>& frame : _handed_out) _fill(&_queues[frame.first], frame.second);
+  _handed_out.clear();
+
+  size_t received = 0;
+  for (size_t q = 0; q < _queues.size() && received < count; q++) {
+    Queue& queue = _queues[q];
+    if (*queue.fill_flags & XDP_RING_NEED_WAKEUP) recvfrom(queue.fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+
+    uint32_t consumer = *queue.rx_consumer;
+    uint32_t producer = load_acquire(queue.rx_producer);
+    for (; consumer != producer && received < count; consumer++) {
+      const xdp_desc& desc = static_cast<xdp_desc*>(queue.rx_descs)[consumer & (KAPUA_XDP_FRAMES - 1)];
+      uint64_t frame = desc.addr & ~(uint64_t)(KAPUA_XDP_FRAME_SIZE - 1);
+      uint8_t* eth = queue.umem + desc.addr;
+
+      // The program only steers IPv4 UDP without options, but the lengths inside are the sender's to get wrong
+      uint8_t* ip = eth + ETH_HEADER_SIZE;
+      size_t ipHeaderSize = (ip[0] & 0x0f) * 4;
+      uint8_t* udp = ip + ipHeaderSize;
+      uint16_t udpLength;
+      if (desc.len < ETH_HEADER_SIZE + ipHeaderSize + UDP_HEADER_SIZE || ipHeaderSize < MIN_IP_HEADER_SIZE) {
+        _fill(&queue, frame);
+        continue;
+      }
+      std::memcpy(&udpLength, udp + 4, sizeof(udpLength));
+      udpLength = ntohs(udpLength);
+      size_t available = desc.len - (ETH_HEADER_SIZE + ipHeaderSize + UDP_HEADER_SIZE);
+      if (udpLength < UDP_HEADER_SIZE || (size_t)(udpLength - UDP_HEADER_SIZE) > available) {
+        _fill(&queue, frame);
+        continue;
+      }
+
+      Datagram& datagram = datagrams[received++];
+      std::memset(&datagram.addr, 0, sizeof(sockaddr_in));
+      datagram.addr.sin_family = AF_INET;
+      std::memcpy(&datagram.addr.sin_addr.s_addr, ip + 12, sizeof(uint32_t));
+      std::memcpy(&datagram.addr.sin_port, udp, sizeof(uint16_t));
+      datagram.data = udp + UDP_HEADER_SIZE;
+      // As recvfrom would, a datagram too long for a Packet is cut short
+      datagram.size = std::min<size_t>(udpLength - UDP_HEADER_SIZE, KAPUA_MAX_PACKET_SIZE);
+      _handed_out.push_back(std::make_pair(q, frame));
+    }
+    store_release(queue.rx_consumer, consumer);
+  }
+
+  // Then whatever the program passed on, or came in on another interface
+  if (_socket_readable && received < count) {
+    size_t fromSocket = SocketTransport::receive(datagrams + received, count - received);
+    if (fromSocket < count - received) _socket_readable = false;
+    received += fromSocket;
+  }
+  return received;
+}
+
+void XDPTransport::_fill(Queue* queue, uint64_t frame) {
+  uint32_t producer = *queue->fill_producer;
+  queue->fill_addrs[producer & (KAPUA_XDP_FRAMES - 1)] = frame;
+  store_release(queue->fill_producer, producer + 1);
+}
+
+#else
+
+bool XDPTransport::_setup_xdp(uint16_t port) {
+  _logger->warn("Built without AF_XDP");
+  return false;
+}
+
+void XDPTransport::_teardown_xdp() {}
+bool XDPTransport::wait(uint32_t timeoutUs) { return SocketTransport::wait(timeoutUs); }
+size_t XDPTransport::receive(Datagram* datagrams, size_t count) { return SocketTransport::receive(datagrams, count); }
+bool XDPTransport::_load_program(uint16_t port) { return false; }
+bool XDPTransport::_open_queue(int ifindex, uint32_t index, Queue* queue) { return false; }
+void XDPTransport::_close_queue(Queue* queue) {}
+void XDPTransport::_fill(Queue* queue, uint64_t frame) {}
+
+#endif
+
+}  // namespace Kapua
@@ -0,0 +1,92 @@
+//
+// Kapua XDPTransport class
+//
+// Author: Tom Cully <mail@tomcully.com>
+// Copyright (c) Tom Cully 2023
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SocketTransport.hpp"
+
+namespace Kapua {
+
+// Frames in each receive queue's memory, a power of two
+#define KAPUA_XDP_FRAMES 2048
+// Each frame holds one received Ethernet frame, a power of two from 2048 to the page size
+#define KAPUA_XDP_FRAME_SIZE 2048
+// Receive queues bound on one interface. Datagrams arriving on any others go through the socket.
+#define KAPUA_XDP_MAX_QUEUES 64
+// Batches taken from the receive rings while they are busy between looks at the socket
+#define KAPUA_XDP_SOCKET_EVERY 64
+
+// A Transport that takes datagrams for its port straight off a network interface with AF_XDP, for nodes where the
+// kernel's UDP stack costs more than the protocol does.
+//
+// A small XDP program is attached to the interface. It hands IPv4 UDP datagrams for the port, unfragmented and without
+// IP options, to an AF_XDP socket on the queue they arrived on, and passes everything else on to the kernel. Each
+// queue's socket has its own memory that the frames land in, laid out so that a datagram's payload can be handled
+// there as a Packet, and a frame goes back to the kernel at the next receive.
+//
+// Only receiving bypasses the kernel. The UDP socket stays open, so the port is held, datagrams the program passed on
+// are still received, and sends go out through it, with the kernel's routing and neighbour tables.
+//
+// The program is built and loaded with raw system calls, so there is nothing extra to link. It needs Linux 5.9 and
+// root, or CAP_NET_ADMIN and CAP_BPF. Where it can't be set up, including when another XDP program is already on the
+// interface, open logs why and the transport carries on as a plain SocketTransport.
+class XDPTransport : public SocketTransport {
+ public:
+  XDPTransport(Logger* logger, const std::string& interface);
+  ~XDPTransport();
+
+  bool open(uint16_t port) override;
+  void close() override;
+  bool wait(uint32_t timeoutUs) override;
+  size_t receive(Datagram* datagrams, size_t count) override;
+
+  // Whether datagrams are being taken from the interface, rather than all coming through the socket
+  bool is_using_xdp() { return !_queues.empty(); }
+
+ protected:
+  // An AF_XDP socket on one of the interface's receive queues, and the memory its frames land in. The rings are as
+  // mapped from the kernel, kept untyped here so this header builds without its headers.
+  struct Queue {
+    int fd;
+    uint8_t* umem;
+    void* rx_map;
+    size_t rx_map_size;
+    uint32_t* rx_producer;
+    uint32_t* rx_consumer;
+    void* rx_descs;
+    void* fill_map;
+    size_t fill_map_size;
+    uint32_t* fill_producer;
+    uint32_t* fill_flags;
+    uint64_t* fill_addrs;
+  };
+
+  std::string _interface;
+  int _map_fd;
+  int _prog_fd;
+  int _link_fd;
+  std::vector<Queue> _queues;
+  std::vector<std::pair<size_t, uint64_t>> _handed_out;  // Queue and frame of each datagram the last receive gave out
+  bool _socket_readable;
+  uint32_t _busy_waits;  // Waits since the socket was last looked at
+
+  // Attaches the program and opens a socket on each receive queue. Returns false, having undone what it did, if it
+  // can't.
+  virtual bool _setup_xdp(uint16_t port);
+  void _teardown_xdp();
+  bool _load_program(uint16_t port);
+  bool _open_queue(int ifindex, uint32_t index, Queue* queue);
+  void _close_queue(Queue* queue);
+  // Gives a frame back to the kernel to receive into
+  void _fill(Queue* queue, uint64_t frame);
+};
+
+}  // namespace Kapua
@@ -0,0 +1,248 @@
+#include "AntiEntropy.hpp"
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <map>
+#include <tuple>
+
+#include "MemoryBlockTransport.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class AntiEntropyTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  MemoryBlockTransport transport;
+  DistributedBlockStore dbs1{1, DistributedBlockStore::get_dbs_virtual_ids(1, 4), 1ULL << 30};
+  DistributedBlockStore dbs2{2, DistributedBlockStore::get_dbs_virtual_ids(2, 4), 1ULL << 30};
+  std::vector<uint64_t> blockIds = DistributedBlockStore::get_dbs_virtual_ids(12345, 200);
+
+  std::map<uint64_t, AntiEntropy*> nodes;
+  std::deque<std::tuple<uint64_t, uint64_t, std::vector<uint8_t>>> messages;
+
+  void SetUp() override {
+    dbs1.add_dbs_node(2, DistributedBlockStore::get_dbs_virtual_ids(2, 4), 1ULL << 30);
+    dbs2.add_dbs_node(1, DistributedBlockStore::get_dbs_virtual_ids(1, 4), 1ULL << 30);
+  }
+
+  void connect(uint64_t id, AntiEntropy* node) {
+    nodes[id] = node;
+    node->set_sender([this, id](uint64_t to, const uint8_t* data, size_t len) {
+      messages.emplace_back(id, to, std::vector<uint8_t>(data, data + len));
+      return true;
+    });
+  }
+
+  // Deliver messages until the exchange goes quiet
+  void pump() {
+    while (!messages.empty()) {
+      auto message = messages.front();
+      messages.pop_front();
+      nodes[std::get<1>(message)]->handle_message(std::get<0>(message), std::get<2>(message).data(), std::get<2>(message).size());
+    }
+  }
+
+  void store(uint64_t nodeId, AntiEntropy* node, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+      std::vector<uint8_t> data(100, (uint8_t)i);
+      transport.put_block(nodeId, blockIds[i], data.data(), data.size());
+      node->add_block(blockIds[i], i);
+    }
+  }
+};
+
+TEST_F(AntiEntropyTest, MerkleTreeIsOrderIndependent) {
+  MerkleTree a(4), b(4);
+  a.toggle(3, MerkleTree::get_item_hash(1, 10));
+  a.toggle(9, MerkleTree::get_item_hash(2, 20));
+  b.toggle(9, MerkleTree::get_item_hash(2, 20));
+  b.toggle(3, MerkleTree::get_item_hash(1, 10));
+  EXPECT_EQ(a.get_root(), b.get_root());
+  EXPECT_NE(a.get_root(), 0);
+
+  // Removing both items empties the tree
+  a.toggle(3, MerkleTree::get_item_hash(1, 10));
+  a.toggle(9, MerkleTree::get_item_hash(2, 20));
+  EXPECT_EQ(a.get_root(), 0);
+
+  // The same item in another leaf is a different tree
+  MerkleTree c(4);
+  c.toggle(4, MerkleTree::get_item_hash(1, 10));
+  c.toggle(9, MerkleTree::get_item_hash(2, 20));
+  EXPECT_NE(b.get_root(), c.get_root());
+}
+
+TEST_F(AntiEntropyTest, LeavesSplitArcsEvenly) {
+  EXPECT_EQ(AntiEntropy::get_leaf(100, 164, 101, 6), 0);
+  EXPECT_EQ(AntiEntropy::get_leaf(100, 164, 164, 6), 63);
+  EXPECT_TRUE(AntiEntropy::check_in_range(100, 164, 164));
+  EXPECT_FALSE(AntiEntropy::check_in_range(100, 164, 100));
+  EXPECT_FALSE(AntiEntropy::check_in_range(100, 164, 165));
+
+  // An arc that wraps past zero
+  EXPECT_TRUE(AntiEntropy::check_in_range(UINT64_MAX - 10, 10, 5));
+  EXPECT_FALSE(AntiEntropy::check_in_range(UINT64_MAX - 10, 10, 11));
+  EXPECT_LT(AntiEntropy::get_leaf(UINT64_MAX - 10, 10, 0, 6), AntiEntropy::get_leaf(UINT64_MAX - 10, 10, 10, 6));
+
+  // A single token's arc is the whole ring
+  EXPECT_TRUE(AntiEntropy::check_in_range(7, 7, 12345));
+  EXPECT_EQ(AntiEntropy::get_leaf(7, 7, 8, 6), 0);
+  EXPECT_EQ(AntiEntropy::get_leaf(7, 7, 7, 6), 63);
+}
+
+TEST_F(AntiEntropyTest, MatchingReplicasCompareOneHash) {
+  AntiEntropy node1(&logger, &dbs1, &transport, 2), node2(&logger, &dbs2, &transport, 2);
+  connect(1, &node1);
+  connect(2, &node2);
+  store(1, &node1, 0, 100);
+  store(2, &node2, 0, 100);
+
+  EXPECT_EQ(node2.get_range_count(), 8);
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  EXPECT_EQ(node2.get_rounds(), 8);
+  EXPECT_EQ(node2.get_hashes_compared(), 8);
+  EXPECT_EQ(node2.get_leaves_compared(), 0);
+}
+
+TEST_F(AntiEntropyTest, RepairsMissingBlocks) {
+  AntiEntropyLimits limits;
+  limits.max_leaves = 64;
+  AntiEntropy node1(&logger, &dbs1, &transport, 2), node2(&logger, &dbs2, &transport, 2, limits);
+  connect(1, &node1);
+  connect(2, &node2);
+  store(1, &node1, 0, 200);
+  store(2, &node2, 0, 150);
+
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  node2.wait_repairs();
+
+  EXPECT_EQ(node2.get_blocks_repaired(), 50);
+  EXPECT_EQ(node2.get_bytes_repaired(), 5000);
+  EXPECT_EQ(node2.get_conflicts(), 0);
+  for (size_t i = 150; i < 200; i++) EXPECT_TRUE(transport.has_block(2, blockIds[i]));
+
+  // Only the differing parts of the trees were walked
+  EXPECT_LT(node2.get_hashes_compared(), 8 * 127);
+
+  // Once repaired the replicas match
+  uint64_t hashes = node2.get_hashes_compared();
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  EXPECT_EQ(node2.get_hashes_compared(), hashes + 8);
+}
+
+TEST_F(AntiEntropyTest, RepairsWithoutAThread) {
+  AntiEntropyLimits limits;
+  limits.max_leaves = 64;
+  AntiEntropy node1(&logger, &dbs1, &transport, 2), node2(&logger, &dbs2, &transport, 2, limits, false);
+  connect(1, &node1);
+  connect(2, &node2);
+  store(1, &node1, 0, 200);
+  store(2, &node2, 0, 150);
+
+  // Nothing is pulled until the owner runs the repairs
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  EXPECT_EQ(node2.get_blocks_repaired(), 0);
+  EXPECT_EQ(node2.run_repairs(), 50);
+  EXPECT_EQ(node2.run_repairs(), 0);
+  EXPECT_EQ(node2.get_blocks_repaired(), 50);
+  for (size_t i = 150; i < 200; i++) EXPECT_TRUE(transport.has_block(2, blockIds[i]));
+}
+
+TEST_F(AntiEntropyTest, RepairsOnlyWhereWritesPlace) {
+  AntiEntropyLimits limits;
+  limits.max_leaves = 64;
+  AntiEntropy node1(&logger, &dbs1, &transport, 1), node2(&logger, &dbs2, &transport, 1, limits);
+  connect(1, &node1);
+  connect(2, &node2);
+  store(1, &node1, 0, 200);
+
+  // Node 2 is over its bound, so writes put every block on node 1 and it has nothing to pull
+  dbs2.update_dbs_node_load(2, 1 << 20, 0, 0);
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  node2.wait_repairs();
+  EXPECT_GT(node2.get_leaves_compared(), 0);
+  EXPECT_EQ(node2.get_blocks_repaired(), 0);
+
+  // Once node 1 is the loaded one, writes go to node 2 and it pulls everything
+  dbs2.update_dbs_node_load(2, 0, 0, 0);
+  dbs2.update_dbs_node_load(1, 1 << 20, 0, 0);
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  node2.wait_repairs();
+  EXPECT_EQ(node2.get_blocks_repaired(), 200);
+}
+
+TEST_F(AntiEntropyTest, CountsConflicts) {
+  AntiEntropy node1(&logger, &dbs1, &transport, 2), node2(&logger, &dbs2, &transport, 2);
+  connect(1, &node1);
+  connect(2, &node2);
+  node1.add_block(blockIds[0], 1);
+  node2.add_block(blockIds[0], 2);
+
+  for (size_t i = 0; i < node2.get_range_count(); i++) {
+    ASSERT_TRUE(node2.start_round(1));
+    pump();
+  }
+  node2.wait_repairs();
+  EXPECT_EQ(node2.get_conflicts(), 1);
+  EXPECT_EQ(node2.get_blocks_repaired(), 0);
+}
+
+TEST_F(AntiEntropyTest, RoundsAreBounded) {
+  AntiEntropyLimits limits;
+  limits.max_hashes = 9;
+  limits.max_repair_bytes = 1;
+  AntiEntropy node1(&logger, &dbs1, &transport, 2), node2(&logger, &dbs2, &transport, 2, limits);
+  connect(1, &node1);
+  connect(2, &node2);
+  store(1, &node1, 0, 200);
+
+  ASSERT_TRUE(node2.start_round(1));
+  pump();
+  node2.wait_repairs();
+
+  // The root and four levels of two children fit in 9 hashes, which is not deep enough to reach the leaves
+  EXPECT_LE(node2.get_hashes_compared(), 9);
+  EXPECT_EQ(node2.get_leaves_compared(), 0);
+
+  // With room to reach the leaves, the byte budget stops each round's repair after its first block
+  limits.max_hashes = 4096;
+  AntiEntropy node3(&logger, &dbs2, &transport, 2, limits);
+  connect(2, &node3);
+  for (size_t i = 0; i < node3.get_range_count(); i++) {
+    ASSERT_TRUE(node3.start_round(1));
+    pump();
+  }
+  node3.wait_repairs();
+  EXPECT_GT(node3.get_leaves_compared(), 0);
+  EXPECT_GT(node3.get_blocks_repaired(), 0);
+  EXPECT_LE(node3.get_blocks_repaired(), node3.get_rounds());
+}
+
+TEST_F(AntiEntropyTest, NoSharedRanges) {
+  AntiEntropy node1(&logger, &dbs1, &transport, 2);
+  EXPECT_FALSE(node1.start_round(99));
+}
+
+}  // namespace KapuaTest
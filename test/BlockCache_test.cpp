@@ -0,0 +1,148 @@
+#include "BlockCache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class BlockCacheTest : public ::testing::Test {
+ protected:
+  MockLogger logger;
+
+  std::vector<uint8_t> block(uint64_t id, size_t len = 4096) { return std::vector<uint8_t>(len, (uint8_t)id); }
+};
+
+TEST_F(BlockCacheTest, ReadThrough) {
+  BlockCache cache(&logger, 1 << 20, 1);
+  int loads = 0;
+  auto loader = [&](uint64_t id, std::vector<uint8_t>* data) {
+    loads++;
+    *data = block(id, 1000);
+    return true;
+  };
+
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(cache.get(5, &data, loader));
+  ASSERT_TRUE(cache.get(5, &data, loader));
+  EXPECT_EQ(data, block(5, 1000));
+  EXPECT_EQ(loads, 1);
+  EXPECT_EQ(cache.get_hits(), 1);
+  EXPECT_EQ(cache.get_misses(), 1);
+
+  // Failed loads are not cached
+  EXPECT_FALSE(cache.get(6, &data, [](uint64_t, std::vector<uint8_t>*) { return false; }));
+  EXPECT_FALSE(cache.get(6, &data));
+}
+
+TEST_F(BlockCacheTest, SizeClasses) {
+  EXPECT_EQ(BlockCache::get_size_class(1), 4096);
+  EXPECT_EQ(BlockCache::get_size_class(4096), 4096);
+  EXPECT_EQ(BlockCache::get_size_class(4097), 8192);
+  EXPECT_EQ(BlockCache::get_size_class(3 << 20), 4 << 20);
+}
+
+TEST_F(BlockCacheTest, BoundedAndScanResistant) {
+  // 64 blocks of 4K
+  BlockCache cache(&logger, 64 * 4096, 1);
+  std::vector<uint8_t> data;
+
+  // A working set read twice is promoted to main
+  for (uint64_t id = 0; id < 16; id++) cache.put(id, block(id).data(), 4096);
+  for (uint64_t id = 0; id < 16; id++) ASSERT_TRUE(cache.get(id, &data));
+
+  // A long scan of blocks read once only churns the small queue
+  for (uint64_t id = 1000; id < 2000; id++) cache.put(id, block(id).data(), 4096);
+  EXPECT_LE(cache.get_memory(), cache.get_capacity());
+  EXPECT_GT(cache.get_evictions(), 0);
+
+  for (uint64_t id = 0; id < 16; id++) {
+    ASSERT_TRUE(cache.get(id, &data)) << id;
+    EXPECT_EQ(data, block(id));
+  }
+
+  cache.invalidate(3);
+  EXPECT_FALSE(cache.get(3, &data));
+}
+
+TEST_F(BlockCacheTest, CoalescesConcurrentMisses) {
+  BlockCache cache(&logger, 1 << 20);
+  std::atomic<int> loads(0);
+  auto loader = [&](uint64_t id, std::vector<uint8_t>* data) {
+    loads++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    *data = block(id);
+    return true;
+  };
+
+  std::vector<std::thread> readers;
+  std::atomic<int> ok(0);
+  for (int i = 0; i < 8; i++) {
+    readers.emplace_back([&] {
+      std::vector<uint8_t> data;
+      if (cache.get(77, &data, loader) && data == block(77)) ok++;
+    });
+  }
+  for (auto& reader : readers) reader.join();
+
+  EXPECT_EQ(ok, 8);
+  EXPECT_EQ(loads, 1);
+  EXPECT_EQ(cache.get_misses() + cache.get_coalesced() + cache.get_hits(), 8);
+}
+
+TEST_F(BlockCacheTest, MemoryBoundedAcrossSizeClasses) {
+  BlockCache cache(&logger, 1 << 20, 1);
+  std::vector<uint8_t> data;
+
+  // Interleave blocks of every class up to 64K, so slabs of each class end up partly used
+  for (uint64_t id = 0; id < 2000; id++) {
+    size_t len = (size_t)4096 << (id * 7 % 5);
+    cache.put(id, block(id, len).data(), len);
+    ASSERT_LE(cache.get_memory(), cache.get_capacity()) << id;
+    ASSERT_LE(cache.get_size(), cache.get_memory()) << id;
+  }
+  EXPECT_GT(cache.get_count(), 0);
+
+  ASSERT_TRUE(cache.get(1999, &data));
+  EXPECT_EQ(data, block(1999, (size_t)4096 << (1999 * 7 % 5)));
+}
+
+TEST_F(BlockCacheTest, LoaderThatThrowsEndsTheFlight) {
+  BlockCache cache(&logger, 1 << 20);
+  std::atomic<bool> loading(false);
+  auto thrower = [&](uint64_t, std::vector<uint8_t>*) -> bool {
+    loading = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    throw std::runtime_error("store failed");
+  };
+
+  std::thread leader([&] {
+    std::vector<uint8_t> data;
+    EXPECT_THROW(cache.get(42, &data, thrower), std::runtime_error);
+  });
+  while (!loading) std::this_thread::yield();
+
+  auto loader = [&](uint64_t id, std::vector<uint8_t>* data) {
+    *data = block(id);
+    return true;
+  };
+
+  // A reader coalesced onto the failed flight is woken with a miss
+  std::vector<uint8_t> data;
+  EXPECT_FALSE(cache.get(42, &data, loader));
+  EXPECT_EQ(cache.get_coalesced(), 1);
+  leader.join();
+
+  // And the next reader loads the block afresh
+  EXPECT_TRUE(cache.get(42, &data, loader));
+  EXPECT_EQ(data, block(42));
+}
+
+}  // namespace KapuaTest
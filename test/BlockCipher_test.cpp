@@ -0,0 +1,129 @@
+#include "BlockCipher.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class BlockCipherTest : public ::testing::Test {
+ protected:
+  MockLogger logger;
+  BlockKey key;
+
+  void SetUp() override {
+    for (size_t i = 0; i < sizeof(key.key); i++) key.key[i] = (uint8_t)i;
+  }
+
+  std::vector<uint8_t> random_bytes(size_t len) {
+    std::vector<uint8_t> bytes(len);
+    std::mt19937 rng(len);
+    for (auto& b : bytes) b = (uint8_t)rng();
+    return bytes;
+  }
+};
+
+TEST_F(BlockCipherTest, RoundTrip) {
+  BlockCipher cipher(&logger, 4, 1024);
+  for (size_t len : {0, 1, 1023, 1024, 1025, 10000}) {
+    std::vector<uint8_t> plaintext = random_bytes(len), ciphertext, decrypted;
+    ASSERT_TRUE(cipher.encrypt(key, 42, plaintext.data(), len, &ciphertext));
+    EXPECT_EQ(ciphertext.size(), cipher.get_encrypted_size(len));
+    ASSERT_TRUE(cipher.decrypt(key, 42, ciphertext.data(), ciphertext.size(), &decrypted)) << len;
+    EXPECT_EQ(decrypted, plaintext);
+  }
+}
+
+TEST_F(BlockCipherTest, StreamingMatchesOneShot) {
+  BlockCipher cipher(&logger, 4, 1024);
+  std::vector<uint8_t> plaintext = random_bytes(5000), streamed;
+
+  BlockCipher::Encryptor encryptor(key, 7, plaintext.size(), 1024);
+  for (size_t offset = 0; offset < plaintext.size(); offset += 300) {
+    ASSERT_TRUE(encryptor.update(plaintext.data() + offset, std::min((size_t)300, plaintext.size() - offset), &streamed));
+  }
+  ASSERT_TRUE(encryptor.finish(&streamed));
+
+  // A streamed block decrypts in one shot, and a one shot block decrypts streamed
+  std::vector<uint8_t> decrypted;
+  ASSERT_TRUE(cipher.decrypt(key, 7, streamed.data(), streamed.size(), &decrypted));
+  EXPECT_EQ(decrypted, plaintext);
+
+  std::vector<uint8_t> oneShot;
+  ASSERT_TRUE(cipher.encrypt(key, 7, plaintext.data(), plaintext.size(), &oneShot));
+  decrypted.clear();
+  BlockCipher::Decryptor decryptor(key, 7);
+  for (size_t offset = 0; offset < oneShot.size(); offset += 777) {
+    ASSERT_TRUE(decryptor.update(oneShot.data() + offset, std::min((size_t)777, oneShot.size() - offset), &decrypted));
+  }
+  ASSERT_TRUE(decryptor.finish());
+  EXPECT_EQ(decrypted, plaintext);
+}
+
+TEST_F(BlockCipherTest, DetectsTampering) {
+  BlockCipher cipher(&logger, 2, 1024);
+  std::vector<uint8_t> plaintext = random_bytes(3000), ciphertext, decrypted;
+  ASSERT_TRUE(cipher.encrypt(key, 9, plaintext.data(), plaintext.size(), &ciphertext));
+
+  std::vector<uint8_t> flipped = ciphertext;
+  flipped[flipped.size() / 2] ^= 1;
+  EXPECT_FALSE(cipher.decrypt(key, 9, flipped.data(), flipped.size(), &decrypted));
+  EXPECT_TRUE(decrypted.empty());
+
+  // Wrong block ID, truncation and a different key all fail
+  EXPECT_FALSE(cipher.decrypt(key, 10, ciphertext.data(), ciphertext.size(), &decrypted));
+  EXPECT_FALSE(cipher.decrypt(key, 9, ciphertext.data(), ciphertext.size() - 1040, &decrypted));
+  BlockKey other = key;
+  other.key[0] ^= 1;
+  EXPECT_FALSE(cipher.decrypt(other, 9, ciphertext.data(), ciphertext.size(), &decrypted));
+
+  // A streamed read stopping at a chunk boundary is not complete
+  decrypted.clear();
+  BlockCipher::Decryptor decryptor(key, 9);
+  ASSERT_TRUE(decryptor.update(ciphertext.data(), sizeof(BlockCipherHeader) + 1024 + KAPUA_BLOCK_CIPHER_TAG_SIZE, &decrypted));
+  EXPECT_EQ(decrypted.size(), 1024);
+  EXPECT_FALSE(decryptor.finish());
+}
+
+TEST_F(BlockCipherTest, RejectsLengthsThatWrap) {
+  BlockCipher cipher(&logger, 2, 1024);
+  BlockCipherHeader header = {};
+  header.version = KAPUA_BLOCK_CIPHER_VERSION;
+  header.chunk_size = 1024;
+  std::vector<uint8_t> forged(100), decrypted;
+
+  // Find a plaintext length close to 2^64 for which header, plaintext and tags add up, wrapping, to the real size
+  uint64_t target = forged.size() - sizeof(header);
+  uint64_t estimate = ((1ULL << 58) - target) / 65 * 64;
+  for (uint64_t x = estimate - 2000; x < estimate + 2000 && header.plaintext_length == 0; x++) {
+    uint64_t length = 0 - x;
+    if (length + BlockCipher::get_chunk_count(length, 1024) * KAPUA_BLOCK_CIPHER_TAG_SIZE == target) header.plaintext_length = length;
+  }
+  ASSERT_NE(header.plaintext_length, 0);
+  std::memcpy(forged.data(), &header, sizeof(header));
+
+  EXPECT_FALSE(cipher.decrypt(key, 9, forged.data(), forged.size(), &decrypted));
+  EXPECT_TRUE(decrypted.empty());
+}
+
+TEST_F(BlockCipherTest, KeysPerOriginator) {
+  KeyPair keys = {nullptr, EVP_PKEY_Q_keygen(nullptr, nullptr, "EC", "P-256")};
+  ASSERT_NE(keys.privateKey, nullptr);
+
+  BlockCipher cipher(&logger);
+  BlockKey a1, a2, b;
+  ASSERT_TRUE(cipher.derive_key(&keys, 1, &a1));
+  ASSERT_TRUE(cipher.derive_key(&keys, 1, &a2));
+  ASSERT_TRUE(cipher.derive_key(&keys, 2, &b));
+  EXPECT_EQ(memcmp(a1.key, a2.key, sizeof(a1.key)), 0);
+  EXPECT_NE(memcmp(a1.key, b.key, sizeof(a1.key)), 0);
+
+  EVP_PKEY_free(keys.privateKey);
+}
+
+}  // namespace KapuaTest
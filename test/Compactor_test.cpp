@@ -0,0 +1,151 @@
+#include "Compactor.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "Config.hpp"
+#include "Core.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class CompactorTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_compactor_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  std::vector<uint8_t> block(uint64_t id, size_t len) { return std::vector<uint8_t>(len, (uint8_t)id); }
+
+  // 64 blocks of 4000 bytes over 64KiB segments, then remove all but every fourth
+  void fill(LocalBlockStore* store) {
+    for (uint64_t id = 0; id < 64; id++) ASSERT_TRUE(store->put(id, block(id, 4000).data(), 4000));
+    for (uint64_t id = 0; id < 64; id++) {
+      if (id % 4) {
+        ASSERT_TRUE(store->remove(id));
+      }
+    }
+  }
+};
+
+TEST_F(CompactorTest, ScoresFavourDeadAndColdSegments) {
+  EXPECT_GT(Compactor::get_score(10, 100, 60), Compactor::get_score(50, 100, 60));
+  EXPECT_GT(Compactor::get_score(50, 100, 600), Compactor::get_score(50, 100, 60));
+  EXPECT_EQ(Compactor::get_score(100, 100, 60), 0);
+}
+
+TEST_F(CompactorTest, ReclaimsDeadSpace) {
+  LocalBlockStore store(&logger, 64 * 1024);
+  ASSERT_TRUE(store.open(dir));
+  fill(&store);
+  size_t segments = store.get_segment_count();
+  ASSERT_GE(segments, 4);
+
+  CompactorOptions options;
+  options.max_bytes_per_second = 0;
+  Compactor compactor(&logger, &store, options);
+  while (compactor.compact_once()) {
+  }
+
+  EXPECT_GE(compactor.get_segments_compacted(), segments - 1);
+  EXPECT_LT(store.get_segment_count(), segments);
+  EXPECT_GT(compactor.get_bytes_reclaimed(), 0);
+  EXPECT_GT(compactor.get_write_amplification(), 1.0);
+  EXPECT_EQ(store.get_compaction_written_bytes(), compactor.get_bytes_copied());
+
+  // Every live block is intact and every removed one stays removed, including after a restart
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<uint8_t> data;
+    for (uint64_t id = 0; id < 64; id++) {
+      if (id % 4) {
+        EXPECT_FALSE(store.has(id));
+      } else {
+        ASSERT_TRUE(store.get(id, &data));
+        EXPECT_EQ(data, block(id, 4000));
+      }
+    }
+    store.close();
+    ASSERT_TRUE(store.open(dir));
+  }
+}
+
+TEST_F(CompactorTest, ViewsSurviveCompaction) {
+  LocalBlockStore store(&logger, 64 * 1024);
+  ASSERT_TRUE(store.open(dir));
+  fill(&store);
+
+  BlockView view;
+  ASSERT_TRUE(store.get_view(0, &view));
+
+  Compactor compactor(&logger, &store);
+  ASSERT_TRUE(compactor.compact_once());
+  EXPECT_EQ(std::vector<uint8_t>(view.data(), view.data() + view.size()), block(0, 4000));
+}
+
+TEST_F(CompactorTest, LeavesFullSegments) {
+  LocalBlockStore store(&logger, 64 * 1024);
+  ASSERT_TRUE(store.open(dir));
+  for (uint64_t id = 0; id < 64; id++) ASSERT_TRUE(store.put(id, block(id, 4000).data(), 4000));
+
+  Compactor compactor(&logger, &store);
+  EXPECT_FALSE(compactor.compact_once());
+  EXPECT_EQ(compactor.get_write_amplification(), 1.0);
+}
+
+TEST_F(CompactorTest, ThrottlesToRate) {
+  LocalBlockStore store(&logger, 64 * 1024);
+  ASSERT_TRUE(store.open(dir));
+  fill(&store);
+
+  CompactorOptions options;
+  options.batch_bytes = 4096;
+  options.max_bytes_per_second = 1024 * 1024;
+  Compactor compactor(&logger, &store, options);
+  ASSERT_TRUE(compactor.compact_once());
+
+  // Each copied byte costs about a microsecond at 1MB/s, less rounding per batch
+  EXPECT_GT(compactor.get_bytes_copied(), 0);
+  EXPECT_GE(compactor.get_throttled_us(), compactor.get_bytes_copied() * 990000 / (1024 * 1024));
+}
+
+TEST_F(CompactorTest, BackgroundThread) {
+  LocalBlockStore store(&logger, 64 * 1024);
+  ASSERT_TRUE(store.open(dir));
+  fill(&store);
+
+  CompactorOptions options;
+  options.interval_ms = 10;
+  Compactor compactor(&logger, &store, options);
+  ASSERT_TRUE(compactor.start());
+  for (int i = 0; i < 200 && compactor.get_segments_compacted() == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_TRUE(compactor.stop());
+  EXPECT_GT(compactor.get_segments_compacted(), 0);
+}
+
+TEST_F(CompactorTest, RunsWithTheNodesStore) {
+  Config config(&logger);
+  config.storage_directory = dir;
+  Kapua::RSA rsa(&logger, &config);
+  MetricsRegistry metrics;
+  Core core(&logger, &config, &rsa, &metrics);
+  ASSERT_TRUE(core.start());
+
+  ASSERT_NE(core.get_compactor(), nullptr);
+  fill(core.get_local_store());
+  std::string text = metrics.to_prometheus();
+  EXPECT_NE(text.find("kapua_compaction_reclaimed_bytes 0"), std::string::npos);
+  EXPECT_NE(text.find("kapua_compaction_write_amplification_permille 1000"), std::string::npos);
+  core.stop();
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,221 @@
+#include "ContentStore.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#include "Blake3.hpp"
+#include "MemoryBlockTransport.hpp"
+#include "MockLogger.hpp"
+#include "Util.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class ContentStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dbs = std::make_unique<DistributedBlockStore>(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+    for (uint64_t id = 2; id <= 6; id++) dbs->add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1 << 30);
+  }
+
+  // The input pattern used by the official BLAKE3 test vectors
+  std::vector<uint8_t> test_input(size_t len) {
+    std::vector<uint8_t> input(len);
+    for (size_t i = 0; i < len; i++) input[i] = (uint8_t)(i % 251);
+    return input;
+  }
+
+  std::string hex(const Blake3Hash& hash) { return Util::to_hex(hash.bytes, sizeof(hash.bytes)); }
+
+  MockLogger logger;
+  MemoryBlockTransport transport;
+  std::unique_ptr<DistributedBlockStore> dbs;
+};
+
+TEST_F(ContentStoreTest, Blake3Vectors) {
+  const std::vector<std::pair<size_t, std::string>> vectors = {
+      {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+      {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+      {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+      {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+      {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+      {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+      {3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+      {8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+      {31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+      {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+  };
+
+  for (const auto& vector : vectors) {
+    std::vector<uint8_t> input = test_input(vector.first);
+
+    // Whole buffer, on one thread and on several
+    Blake3Hash hash;
+    Blake3::hash(input.data(), input.size(), &hash, 1);
+    EXPECT_EQ(hex(hash), vector.second) << vector.first << " bytes";
+
+    Blake3::hash(input.data(), input.size(), &hash, 4);
+    EXPECT_EQ(hex(hash), vector.second) << vector.first << " bytes, threaded";
+
+    // Streaming, in awkward pieces
+    Blake3 hasher;
+    for (size_t offset = 0; offset < input.size(); offset += 77) hasher.update(input.data() + offset, std::min((size_t)77, input.size() - offset));
+    hasher.finalize(&hash);
+    EXPECT_EQ(hex(hash), vector.second) << vector.first << " bytes, streamed";
+  }
+}
+
+TEST_F(ContentStoreTest, ParallelMatchesSequential) {
+  std::vector<uint8_t> input = test_input(Blake3::PARALLEL_THRESHOLD * 3 + 517);
+  Blake3Hash sequential, parallel;
+  Blake3::hash(input.data(), input.size(), &sequential, 1);
+  Blake3::hash(input.data(), input.size(), &parallel, 8);
+  EXPECT_EQ(hex(sequential), hex(parallel));
+}
+
+TEST_F(ContentStoreTest, DuplicateWritesShortCircuit) {
+  DedupIndex index(&logger);
+  ContentStore store(&logger, dbs.get(), &transport, &index);
+
+  std::vector<uint8_t> block = test_input(10000);
+  uint64_t first, second;
+  ASSERT_TRUE(store.put(block.data(), block.size(), &first));
+  size_t puts = transport.puts;
+  EXPECT_EQ(puts, KAPUA_DBS_REPLICAS);
+
+  ASSERT_TRUE(store.put(block.data(), block.size(), &second));
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(transport.puts, puts);
+  EXPECT_EQ(index.get_duplicate_count(), 1);
+
+  std::vector<uint8_t> read;
+  ASSERT_TRUE(store.get(first, &read));
+  EXPECT_EQ(read, block);
+
+  // Both references have to go before the block is unreferenced
+  EXPECT_FALSE(store.release(first));
+  EXPECT_TRUE(store.release(first));
+}
+
+TEST_F(ContentStoreTest, OtherOriginatorSkipsTransfer) {
+  DedupIndex indexA(&logger), indexB(&logger);
+  ContentStore storeA(&logger, dbs.get(), &transport, &indexA);
+  ContentStore storeB(&logger, dbs.get(), &transport, &indexB);
+
+  std::vector<uint8_t> block = test_input(4096);
+  uint64_t idA, idB;
+  ASSERT_TRUE(storeA.put(block.data(), block.size(), &idA));
+  ASSERT_TRUE(storeB.put(block.data(), block.size(), &idB));
+  EXPECT_EQ(idA, idB);
+  EXPECT_EQ(storeB.get_bytes_sent(), 0);
+}
+
+TEST_F(ContentStoreTest, FailedStoreIsForgotten) {
+  DedupIndex index(&logger);
+  ContentStore store(&logger, dbs.get(), &transport, &index);
+
+  std::vector<uint8_t> block = test_input(3000);
+  uint64_t id;
+  for (uint64_t node = 1; node <= 6; node++) transport.down[node] = true;
+  EXPECT_FALSE(store.put(block.data(), block.size(), &id));
+  EXPECT_FALSE(index.contains(id));
+
+  // The next put of the same content stores it, rather than being handed the ID of a block that never existed
+  for (uint64_t node = 1; node <= 6; node++) transport.down[node] = false;
+  ASSERT_TRUE(store.put(block.data(), block.size(), &id));
+  EXPECT_EQ(transport.puts, KAPUA_DBS_REPLICAS);
+  EXPECT_EQ(index.get_duplicate_count(), 0);
+  std::vector<uint8_t> read;
+  ASSERT_TRUE(store.get(id, &read));
+  EXPECT_EQ(read, block);
+}
+
+// Holds every put until released, then fails the given number of them
+class GatedBlockTransport : public MemoryBlockTransport {
+ public:
+  bool put_block(uint64_t nodeId, uint64_t blockId, const uint8_t* data, size_t len) override {
+    {
+      std::unique_lock<std::mutex> lock(gate_mutex);
+      waiting++;
+      gate.wait(lock, [this] { return open; });
+      if (failures > 0) {
+        failures--;
+        return false;
+      }
+    }
+    return MemoryBlockTransport::put_block(nodeId, blockId, data, len);
+  }
+
+  void release(size_t failing) {
+    std::lock_guard<std::mutex> lock(gate_mutex);
+    open = true;
+    failures = failing;
+    gate.notify_all();
+  }
+
+  std::mutex gate_mutex;
+  std::condition_variable gate;
+  std::atomic<int> waiting{0};
+  bool open = false;
+  size_t failures = 0;
+};
+
+TEST_F(ContentStoreTest, DuplicatesWaitForTheFirstStore) {
+  for (bool failing : {false, true}) {
+    GatedBlockTransport gated;
+    DedupIndex index(&logger);
+    ContentStore store(&logger, dbs.get(), &gated, &index);
+    std::vector<uint8_t> block = test_input(5000);
+
+    std::atomic<int> done(0);
+    bool firstOk = false, secondOk = false;
+    uint64_t firstId, secondId;
+    std::thread first([&] {
+      firstOk = store.put(block.data(), block.size(), &firstId);
+      done++;
+    });
+    while (gated.waiting == 0) std::this_thread::yield();
+    std::thread second([&] {
+      secondOk = store.put(block.data(), block.size(), &secondId);
+      done++;
+    });
+
+    // The duplicate is not acknowledged while the first copy is still being stored
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(done, 0);
+
+    // If every replica of the first store fails, the duplicate stores the block itself
+    gated.release(failing ? KAPUA_DBS_REPLICAS : 0);
+    first.join();
+    second.join();
+
+    EXPECT_EQ(firstOk, !failing);
+    EXPECT_TRUE(secondOk);
+    std::vector<uint8_t> read;
+    ASSERT_TRUE(store.get(secondId, &read));
+    EXPECT_EQ(read, block);
+  }
+}
+
+TEST_F(ContentStoreTest, CorruptReplicaIsSkipped) {
+  DedupIndex index(&logger);
+  ContentStore store(&logger, dbs.get(), &transport, &index);
+
+  std::vector<uint8_t> block = test_input(2048);
+  uint64_t id;
+  ASSERT_TRUE(store.put(block.data(), block.size(), &id));
+
+  std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(id);
+  transport.blocks[std::make_pair(nodes[0], id)][0] ^= 0xff;
+
+  std::vector<uint8_t> read;
+  ASSERT_TRUE(store.get(id, &read));
+  EXPECT_EQ(read, block);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,211 @@
+#include "DNSServer.hpp"
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+// Reaches into the cache, to put a store read on either side of a change
+class CacheDNSServer : public DNSServer {
+ public:
+  using DNSServer::DNSServer;
+
+  uint64_t get_cache_generation() { return _cache_generation; }
+
+  // Cache response as a lookup that read the store at generation would
+  void cache(const std::vector<uint8_t>& query, const std::vector<uint8_t>& response, uint64_t generation) {
+    Question question;
+    ASSERT_TRUE(_parse_question(query.data(), query.size(), &question));
+    _cache_put(question, response.data(), response.size(), 60, {{(uint16_t)(12 + question.length + 6), 60}}, generation);
+  }
+};
+
+class DNSServerTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+  DistributedBlockStore dbs{1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30};
+  LoopbackKVTransport transport;
+  std::unique_ptr<KVLog> log;
+  std::unique_ptr<KVStore> kv;
+  std::unique_ptr<Config> config;
+  std::unique_ptr<CacheDNSServer> server;
+  int fd = -1;
+  sockaddr_in addr;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_dns_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+    log.reset(new KVLog(&logger));
+    ASSERT_TRUE(log->open(dir + "/kv.log"));
+    transport.add_node(1, log.get());
+    kv.reset(new KVStore(&logger, &dbs, &transport, 1, 1, 1));
+
+    config.reset(new Config(&logger));
+    inet_pton(AF_INET, "127.0.0.1", &config->dns_ip4_sockaddr.sin_addr);
+    config->dns_ip4_sockaddr.sin_port = 0;
+    server.reset(new CacheDNSServer(&logger, config.get(), kv.get()));
+    ASSERT_TRUE(server->start());
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    addr = config->dns_ip4_sockaddr;
+    addr.sin_port = htons(server->get_port());
+  }
+
+  void TearDown() override {
+    close(fd);
+    server.reset();
+    kv.reset();
+    log.reset();
+    system(("rm -rf " + dir).c_str());
+  }
+
+  std::vector<uint8_t> make_query(uint16_t id, const std::string& name, uint16_t type, uint16_t klass = 1) {
+    std::vector<uint8_t> query = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+    // Labels keep the case they were given
+    size_t start = 0;
+    while (start < name.size()) {
+      size_t end = std::min(name.find('.', start), name.size());
+      query.push_back(end - start);
+      query.insert(query.end(), name.begin() + start, name.begin() + end);
+      start = end + 1;
+    }
+    query.push_back(0);
+    query.insert(query.end(), {(uint8_t)(type >> 8), (uint8_t)type, (uint8_t)(klass >> 8), (uint8_t)klass});
+    return query;
+  }
+
+  std::vector<uint8_t> exchange(const std::vector<uint8_t>& query) {
+    sendto(fd, query.data(), query.size(), 0, (sockaddr*)&addr, sizeof(addr));
+    std::vector<uint8_t> response(512);
+    ssize_t n = recv(fd, response.data(), response.size(), 0);
+    response.resize(n > 0 ? n : 0);
+    return response;
+  }
+
+  static uint8_t rcode(const std::vector<uint8_t>& response) { return response[3] & 0xf; }
+  static uint16_t ancount(const std::vector<uint8_t>& response) { return response[6] << 8 | response[7]; }
+  static uint32_t first_ttl(const std::vector<uint8_t>& response, size_t questionLength) {
+    const uint8_t* ttl = &response[12 + questionLength + 6];
+    return (uint32_t)ttl[0] << 24 | ttl[1] << 16 | ttl[2] << 8 | ttl[3];
+  }
+  static std::vector<uint8_t> first_rdata(const std::vector<uint8_t>& response, size_t questionLength) {
+    size_t offset = 12 + questionLength + 10;
+    size_t length = response[offset] << 8 | response[offset + 1];
+    return std::vector<uint8_t>(response.begin() + offset + 2, response.begin() + offset + 2 + length);
+  }
+};
+
+TEST_F(DNSServerTest, EncodeName) {
+  std::vector<uint8_t> wire;
+  ASSERT_TRUE(DNSServer::encode_name("WWW.Example.com.", &wire));
+  EXPECT_EQ(wire, std::vector<uint8_t>({3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0}));
+  ASSERT_TRUE(DNSServer::encode_name("", &wire));
+  EXPECT_EQ(wire, std::vector<uint8_t>({0}));
+  EXPECT_FALSE(DNSServer::encode_name("a..b", &wire));
+  EXPECT_FALSE(DNSServer::encode_name(std::string(64, 'a') + ".com", &wire));
+}
+
+TEST_F(DNSServerTest, AnswersFromStore) {
+  ASSERT_TRUE(server->set_records("host.kapua", {{DNSServer::TYPE_A, 300, {10, 0, 0, 1}}, {DNSServer::TYPE_A, 300, {10, 0, 0, 2}},
+                                                 {DNSServer::TYPE_TXT, 60, {5, 'h', 'e', 'l', 'l', 'o'}}}));
+
+  std::vector<uint8_t> query = make_query(0x1234, "Host.KAPUA", DNSServer::TYPE_A);
+  std::vector<uint8_t> response = exchange(query);
+  ASSERT_GT(response.size(), query.size());
+  EXPECT_EQ(response[0], 0x12);
+  EXPECT_EQ(response[1], 0x34);
+  EXPECT_EQ(response[2] & 0x84, 0x84);  // QR and AA
+  EXPECT_EQ(rcode(response), DNSServer::RCODE_NOERROR);
+  EXPECT_EQ(ancount(response), 2);
+  // The question is echoed as asked
+  EXPECT_TRUE(std::equal(query.begin() + 12, query.end(), response.begin() + 12));
+  EXPECT_EQ(first_rdata(response, query.size() - 12), std::vector<uint8_t>({10, 0, 0, 1}));
+
+  // Types the name has no records of
+  response = exchange(make_query(1, "host.kapua", DNSServer::TYPE_AAAA));
+  EXPECT_EQ(rcode(response), DNSServer::RCODE_NOERROR);
+  EXPECT_EQ(ancount(response), 0);
+
+  response = exchange(make_query(2, "missing.kapua", DNSServer::TYPE_A));
+  EXPECT_EQ(rcode(response), DNSServer::RCODE_NXDOMAIN);
+}
+
+TEST_F(DNSServerTest, CachedAnswers) {
+  ASSERT_TRUE(server->set_records("host.kapua", {{DNSServer::TYPE_A, 2, {10, 0, 0, 1}}}));
+
+  std::vector<uint8_t> query = make_query(7, "host.kapua", DNSServer::TYPE_A);
+  ASSERT_EQ(ancount(exchange(query)), 1);
+  EXPECT_EQ(server->get_cache_hits(), 0);
+
+  // A cached answer carries the new ID and case
+  std::vector<uint8_t> mixed = make_query(8, "hOsT.kApUa", DNSServer::TYPE_A);
+  std::vector<uint8_t> response = exchange(mixed);
+  EXPECT_EQ(server->get_cache_hits(), 1);
+  EXPECT_EQ(response[1], 8);
+  EXPECT_TRUE(std::equal(mixed.begin() + 12, mixed.end(), response.begin() + 12));
+
+  // Changes written behind the server's back are seen once the answer expires, with the TTL counting down meanwhile
+  std::vector<uint8_t> value = {DNSServer::TYPE_A, 0, 60, 0, 0, 0, 4, 0, 10, 0, 0, 9};
+  ASSERT_TRUE(kv->set("dns:host.kapua", value.data(), value.size()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  response = exchange(query);
+  EXPECT_EQ(first_rdata(response, query.size() - 12), std::vector<uint8_t>({10, 0, 0, 1}));
+  EXPECT_EQ(first_ttl(response, query.size() - 12), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  EXPECT_EQ(first_rdata(exchange(query), query.size() - 12), std::vector<uint8_t>({10, 0, 0, 9}));
+
+  // Changes made through the server are seen at once
+  ASSERT_TRUE(server->set_records("host.kapua", {{DNSServer::TYPE_A, 60, {10, 0, 0, 3}}}));
+  EXPECT_EQ(first_rdata(exchange(query), query.size() - 12), std::vector<uint8_t>({10, 0, 0, 3}));
+  ASSERT_TRUE(server->remove_records("host.kapua"));
+  EXPECT_EQ(rcode(exchange(query)), DNSServer::RCODE_NXDOMAIN);
+}
+
+TEST_F(DNSServerTest, ChangesDuringALookupAreNotCached) {
+  ASSERT_TRUE(server->set_records("host.kapua", {{DNSServer::TYPE_A, 60, {10, 0, 0, 1}}}));
+  std::vector<uint8_t> query = make_query(7, "host.kapua", DNSServer::TYPE_A);
+
+  // A lookup reads the old records, then they are changed before it gets to cache them
+  uint64_t generation = server->get_cache_generation();
+  std::vector<uint8_t> stale = exchange(query);
+  ASSERT_TRUE(server->set_records("host.kapua", {{DNSServer::TYPE_A, 60, {10, 0, 0, 3}}}));
+  server->cache(query, stale, generation);
+
+  EXPECT_EQ(first_rdata(exchange(query), query.size() - 12), std::vector<uint8_t>({10, 0, 0, 3}));
+  EXPECT_EQ(server->get_cache_hits(), 0);
+}
+
+TEST_F(DNSServerTest, Errors) {
+  std::vector<uint8_t> query = make_query(1, "host.kapua", DNSServer::TYPE_A);
+
+  // A truncated question
+  std::vector<uint8_t> response = exchange(std::vector<uint8_t>(query.begin(), query.end() - 3));
+  EXPECT_EQ(rcode(response), DNSServer::RCODE_FORMERR);
+
+  // Compression pointers in the question
+  std::vector<uint8_t> pointer = {0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0xc0, 12, 0, 1, 0, 1};
+  EXPECT_EQ(rcode(exchange(pointer)), DNSServer::RCODE_FORMERR);
+
+  // Inverse queries
+  query[2] |= 0x08;
+  EXPECT_EQ(rcode(exchange(query)), DNSServer::RCODE_NOTIMP);
+
+  // Chaosnet
+  EXPECT_EQ(rcode(exchange(make_query(1, "host.kapua", DNSServer::TYPE_A, 3))), DNSServer::RCODE_REFUSED);
+}
+
+}  // namespace KapuaTest
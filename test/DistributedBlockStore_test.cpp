@@ -0,0 +1,108 @@
+#include "DistributedBlockStore.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class DistributedBlockStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dbs = std::make_unique<DistributedBlockStore>(1, DistributedBlockStore::get_dbs_virtual_ids(1, 64), 1000000);
+    for (uint64_t id = 2; id <= 8; id++) {
+      dbs->add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 64), 1000000);
+    }
+  }
+
+  std::unique_ptr<DistributedBlockStore> dbs;
+};
+
+TEST_F(DistributedBlockStoreTest, VirtualIdsAreDeterministic) {
+  EXPECT_EQ(DistributedBlockStore::get_dbs_virtual_ids(42, 16), DistributedBlockStore::get_dbs_virtual_ids(42, 16));
+  EXPECT_NE(DistributedBlockStore::get_dbs_virtual_ids(42, 16), DistributedBlockStore::get_dbs_virtual_ids(43, 16));
+}
+
+TEST_F(DistributedBlockStoreTest, PlacesOnDistinctRealNodes) {
+  for (uint64_t block = 0; block < 1000; block++) {
+    std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(block * 0x9e3779b97f4a7c15ULL);
+    ASSERT_EQ(nodes.size(), KAPUA_DBS_REPLICAS);
+    for (uint64_t node : nodes) {
+      EXPECT_GE(node, 1);
+      EXPECT_LE(node, 8);
+      EXPECT_EQ(std::count(nodes.begin(), nodes.end(), node), 1);
+    }
+  }
+}
+
+TEST_F(DistributedBlockStoreTest, SkipsFullNodes) {
+  dbs->update_dbs_node_load(3, 1000000, 0, 0);
+  for (uint64_t block = 0; block < 1000; block++) {
+    std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(block * 0x9e3779b97f4a7c15ULL);
+    EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 3), 0);
+  }
+}
+
+TEST_F(DistributedBlockStoreTest, UpdatesLoad) {
+  dbs->update_dbs_node_load(2, 500, 10, 3);
+  dbs->add_dbs_node_usage(2, 100);
+
+  NodeLoad load;
+  ASSERT_TRUE(dbs->get_dbs_node_load(2, &load));
+  EXPECT_EQ(load.capacity, 1000000);
+  EXPECT_EQ(load.usage, 600);
+  EXPECT_EQ(load.iops, 10);
+  EXPECT_EQ(load.queue_depth, 3);
+
+  EXPECT_FALSE(dbs->get_dbs_node_load(99, &load));
+}
+
+TEST_F(DistributedBlockStoreTest, BoundedLoadKeepsNodesNearAverage) {
+  const uint64_t blockSize = 1000;
+  std::map<uint64_t, uint64_t> usage;
+
+  // Single replica placement so every block lands on exactly one node
+  for (uint64_t block = 0; block < 800; block++) {
+    std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(block * 0x9e3779b97f4a7c15ULL, 1);
+    ASSERT_EQ(nodes.size(), 1);
+    dbs->add_dbs_node_usage(nodes[0], blockSize);
+    usage[nodes[0]] += blockSize;
+  }
+
+  uint64_t average = (800 * blockSize) / 8;
+  for (const auto& pair : usage) {
+    EXPECT_LE(pair.second, (uint64_t)((1.0 + dbs->get_dbs_load_epsilon()) * average) + blockSize);
+  }
+}
+
+TEST_F(DistributedBlockStoreTest, WritesStayWithinCandidates) {
+  std::map<uint64_t, std::vector<uint64_t>> candidates;
+  for (uint64_t block = 0; block < 200; block++) candidates[block] = dbs->get_dbs_candidates_for_block(block * 0x9e3779b97f4a7c15ULL);
+
+  // Skew the load so that writes pass over some nodes
+  dbs->update_dbs_node_load(2, 600000, 0, 0);
+  dbs->update_dbs_node_load(5, 500000, 0, 0);
+  for (uint64_t block = 0; block < 200; block++) {
+    uint64_t id = block * 0x9e3779b97f4a7c15ULL;
+    std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(id);
+    ASSERT_EQ(nodes.size(), KAPUA_DBS_REPLICAS);
+    EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 2), 0);
+    // A reader finds every copy among the candidates, which the load didn't move
+    EXPECT_EQ(dbs->get_dbs_candidates_for_block(id), candidates[block]);
+    for (uint64_t node : nodes) EXPECT_EQ(std::count(candidates[block].begin(), candidates[block].end(), node), 1);
+  }
+}
+
+TEST_F(DistributedBlockStoreTest, RemoveNode) {
+  dbs->remove_dbs_node(4);
+  EXPECT_FALSE(dbs->has_dbs_node(4));
+  for (uint64_t block = 0; block < 100; block++) {
+    std::vector<uint64_t> nodes = dbs->get_dbs_nodes_for_block(block * 0x9e3779b97f4a7c15ULL);
+    EXPECT_EQ(std::count(nodes.begin(), nodes.end(), 4), 0);
+  }
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,134 @@
+#include "EventLog.hpp"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "MockLogger.hpp"
+#include "Protocol.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class EventLogTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_events_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  std::vector<EventLog::Record> read_all(const std::string& filename) {
+    std::vector<EventLog::Record> records;
+    EXPECT_TRUE(EventLog::read_file(&logger, filename, [&records](const EventLog::Record& record) { records.push_back(record); }));
+    return records;
+  }
+};
+
+TEST_F(EventLogTest, RecordsAndReadsBack) {
+  EventLog events(&logger, dir + "/events");
+
+  // Nothing is recorded until started
+  events.record(EVENT_HANDSHAKE_COMPLETE, 1);
+  ASSERT_TRUE(events.start());
+  events.record(EVENT_PACKET_RECEIVED, 0x1234, 120, Packet::Ping);
+  events.record(EVENT_NODE_ADDED, 0x5678, htonl(0x0a000001), htons(11840));
+  events.record(EVENT_HANDSHAKE_COMPLETE, 0x5678);
+  events.stop();
+  EXPECT_EQ(events.get_recorded(), 3);
+
+  std::vector<EventLog::Record> records = read_all(dir + "/events");
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_EQ(records[0].id, EVENT_PACKET_RECEIVED);
+  EXPECT_EQ(records[0].arg_count, 3);
+  EXPECT_EQ(records[0].args[1], 120);
+  EXPECT_EQ(records[2].arg_count, 1);
+  EXPECT_LE(records[0].time_ns, records[1].time_ns);
+
+  // Only the arguments an event has take up space in the file
+  FILE* file = fopen((dir + "/events").c_str(), "rb");
+  fseek(file, 0, SEEK_END);
+  EXPECT_EQ(ftell(file), 8 + 3 * 16 + (3 + 3 + 1) * 8);
+  fclose(file);
+}
+
+TEST_F(EventLogTest, Formats) {
+  EventLog::Record record;
+  record.time_ns = 1318057629123456789ULL;
+  record.id = EVENT_PACKET_RECEIVED;
+  record.arg_count = 3;
+  record.thread = 2;
+  record.args[0] = 0x1234;
+  record.args[1] = 120;
+  record.args[2] = Packet::Ping;
+  EXPECT_EQ(EventLog::format(record), "2011-10-08T07:07:09.123456789Z [2] PacketReceived: Packet From 0x0000000000001234, 120 bytes (Ping)");
+
+  record.id = EVENT_NODE_ADDED;
+  record.args[1] = htonl(0x0a000001);
+  record.args[2] = htons(11840);
+  EXPECT_EQ(EventLog::format(record), "2011-10-08T07:07:09.123456789Z [2] NodeAdded: New node 0x0000000000001234 at 10.0.0.1:11840");
+
+  // Events from a newer build still show their arguments
+  record.id = 999;
+  record.arg_count = 1;
+  EXPECT_EQ(EventLog::format(record), "2011-10-08T07:07:09.123456789Z [2] Unknown event 999 4660");
+}
+
+TEST_F(EventLogTest, ManyThreads) {
+  EventLog events(&logger, dir + "/events", 64);
+  ASSERT_TRUE(events.start());
+
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < 4; t++) {
+    threads.emplace_back([&events, t] {
+      for (uint64_t i = 0; i < 500; i++) {
+        events.record(EVENT_PACKET_SENT, t, i, Packet::Ping);
+        if (i % 32 == 31) events.flush();
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  events.stop();
+  EXPECT_EQ(events.get_dropped(), 0);
+
+  // Each thread's events stay in order, under their own thread number
+  std::map<uint64_t, uint64_t> next;
+  std::map<uint64_t, uint32_t> numbers;
+  std::vector<EventLog::Record> records = read_all(dir + "/events");
+  ASSERT_EQ(records.size(), 2000);
+  for (const EventLog::Record& record : records) {
+    EXPECT_EQ(record.args[1], next[record.args[0]]++);
+    if (!numbers.count(record.args[0])) numbers[record.args[0]] = record.thread;
+    EXPECT_EQ(record.thread, numbers[record.args[0]]);
+  }
+  EXPECT_EQ(numbers.size(), 4);
+}
+
+TEST_F(EventLogTest, DamagedFile) {
+  EventLog events(&logger, dir + "/events");
+  ASSERT_TRUE(events.start());
+  events.record(EVENT_HANDSHAKE_COMPLETE, 1);
+  events.record(EVENT_HANDSHAKE_COMPLETE, 2);
+  events.stop();
+  truncate((dir + "/events").c_str(), 8 + 24 + 20);
+
+  // Records up to the damage are still read
+  std::vector<EventLog::Record> records;
+  EXPECT_FALSE(EventLog::read_file(&logger, dir + "/events", [&records](const EventLog::Record& record) { records.push_back(record); }));
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].args[0], 1);
+
+  EXPECT_FALSE(EventLog::read_file(&logger, dir + "/missing", [](const EventLog::Record&) {}));
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,254 @@
+#include "FileSystem.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "MemoryBlockTransport.hpp"
+#include "MockLogger.hpp"
+#include "Util.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class FileSystemTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+  DistributedBlockStore dbs{1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1ULL << 30};
+  LoopbackKVTransport kvTransport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  MemoryBlockTransport transport;
+  std::unique_ptr<KVStore> kv;
+  std::unique_ptr<ReplicationPipeline> pipeline;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_fs_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+
+    for (uint64_t id = 1; id <= 5; id++) {
+      if (id > 1) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1ULL << 30);
+      logs.emplace_back(new KVLog(&logger));
+      ASSERT_TRUE(logs.back()->open(dir + "/" + std::to_string(id) + ".log"));
+      kvTransport.add_node(id, logs.back().get());
+    }
+    kv.reset(new KVStore(&logger, &dbs, &kvTransport));
+    pipeline.reset(new ReplicationPipeline(&logger, &dbs, &transport));
+  }
+
+  void TearDown() override {
+    pipeline.reset();
+    kv.reset();
+    logs.clear();
+    system(("rm -rf " + dir).c_str());
+  }
+
+  FileSystemOptions options() {
+    FileSystemOptions options;
+    options.chunk_size = 1000;
+    options.readahead = 4;
+    options.write_behind = 4;
+    return options;
+  }
+
+  std::vector<uint8_t> pattern(size_t len, uint8_t seed) {
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(i * 7 + seed);
+    return data;
+  }
+
+  bool write_file(FileSystem* fs, const std::string& path, const std::vector<uint8_t>& data, size_t step) {
+    std::unique_ptr<FileWriter> writer = fs->create(path);
+    if (!writer) return false;
+    for (size_t offset = 0; offset < data.size(); offset += step) {
+      if (!writer->write(data.data() + offset, std::min(step, data.size() - offset))) return false;
+    }
+    return writer->close();
+  }
+
+  std::vector<uint8_t> read_all(FileReader* reader, size_t step) {
+    std::vector<uint8_t> data, buffer(step);
+    ssize_t count;
+    while ((count = reader->read(buffer.data(), buffer.size())) > 0) data.insert(data.end(), buffer.begin(), buffer.begin() + count);
+    EXPECT_EQ(count, 0);
+    return data;
+  }
+};
+
+TEST_F(FileSystemTest, SplitPath) {
+  std::vector<std::string> components;
+  ASSERT_TRUE(FileSystem::split_path("/", &components));
+  EXPECT_TRUE(components.empty());
+  ASSERT_TRUE(FileSystem::split_path("/a//b/", &components));
+  EXPECT_EQ(components, std::vector<std::string>({"a", "b"}));
+  EXPECT_FALSE(FileSystem::split_path("a/b", &components));
+  EXPECT_FALSE(FileSystem::split_path("/a/../b", &components));
+  EXPECT_FALSE(FileSystem::split_path("/" + std::string(256, 'x'), &components));
+}
+
+TEST_F(FileSystemTest, Directories) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+
+  ASSERT_TRUE(fs.mkdir("/a"));
+  ASSERT_TRUE(fs.mkdir("/a/b"));
+  EXPECT_FALSE(fs.mkdir("/a"));
+  EXPECT_FALSE(fs.mkdir("/missing/b"));
+
+  std::vector<DirEntry> entries;
+  ASSERT_TRUE(fs.list("/", &entries));
+  ASSERT_EQ(entries.size(), 1);
+  EXPECT_EQ(entries[0].name, "a");
+  EXPECT_TRUE(entries[0].directory);
+
+  FileStat stat;
+  ASSERT_TRUE(fs.stat("/a/b", &stat));
+  EXPECT_TRUE(stat.directory);
+  EXPECT_FALSE(fs.stat("/a/c", &stat));
+
+  // Only empty directories can be removed
+  EXPECT_FALSE(fs.remove("/a"));
+  ASSERT_TRUE(fs.remove("/a/b"));
+  ASSERT_TRUE(fs.remove("/a"));
+  ASSERT_TRUE(fs.list("/", &entries));
+  EXPECT_TRUE(entries.empty());
+}
+
+TEST_F(FileSystemTest, WriteAndRead) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  ASSERT_TRUE(fs.mkdir("/data"));
+
+  // Writes that straddle chunk boundaries, and a partial last chunk
+  std::vector<uint8_t> data = pattern(10500, 1);
+  ASSERT_TRUE(write_file(&fs, "/data/file", data, 333));
+  EXPECT_EQ(fs.get_chunks_written(), 11);
+
+  FileStat stat;
+  ASSERT_TRUE(fs.stat("/data/file", &stat));
+  EXPECT_FALSE(stat.directory);
+  EXPECT_EQ(stat.size, 10500);
+  EXPECT_EQ(stat.chunk_size, 1000);
+
+  std::unique_ptr<FileReader> reader = fs.open("/data/file");
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(read_all(reader.get(), 4096), data);
+  EXPECT_EQ(fs.get_chunks_read(), 11);
+
+  // Seek back into the middle of a chunk
+  ASSERT_TRUE(reader->seek(2500));
+  std::vector<uint8_t> buffer(100);
+  ASSERT_EQ(reader->read(buffer.data(), buffer.size()), 100);
+  EXPECT_EQ(buffer, std::vector<uint8_t>(data.begin() + 2500, data.begin() + 2600));
+  EXPECT_EQ(reader->tell(), 2600);
+  EXPECT_FALSE(reader->seek(20000));
+
+  EXPECT_EQ(fs.open("/data"), nullptr);
+  EXPECT_EQ(fs.open("/data/missing"), nullptr);
+}
+
+TEST_F(FileSystemTest, EmptyFile) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  ASSERT_TRUE(write_file(&fs, "/empty", std::vector<uint8_t>(), 1));
+
+  std::unique_ptr<FileReader> reader = fs.open("/empty");
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(reader->get_size(), 0);
+  EXPECT_TRUE(read_all(reader.get(), 100).empty());
+}
+
+TEST_F(FileSystemTest, ReadersKeepTheirVersion) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  std::vector<uint8_t> first = pattern(5000, 1), second = pattern(3000, 2);
+  ASSERT_TRUE(write_file(&fs, "/file", first, 5000));
+
+  std::unique_ptr<FileReader> reader = fs.open("/file");
+  ASSERT_NE(reader, nullptr);
+  ASSERT_TRUE(write_file(&fs, "/file", second, 5000));
+
+  EXPECT_EQ(read_all(reader.get(), 700), first);
+  std::unique_ptr<FileReader> newReader = fs.open("/file");
+  EXPECT_EQ(read_all(newReader.get(), 700), second);
+
+  // The old version's five chunks go with its last reader
+  EXPECT_EQ(fs.get_chunks_removed(), 0);
+  reader.reset();
+  EXPECT_EQ(fs.get_chunks_removed(), 5 * KAPUA_DBS_REPLICAS);
+
+  // The directory still holds one entry
+  std::vector<DirEntry> entries;
+  ASSERT_TRUE(fs.list("/", &entries));
+  EXPECT_EQ(entries.size(), 1);
+}
+
+TEST_F(FileSystemTest, DeletesReplacedAndRemovedChunks) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  ASSERT_TRUE(write_file(&fs, "/file", pattern(5000, 1), 5000));
+  EXPECT_EQ(transport.blocks.size(), 5 * KAPUA_DBS_REPLICAS);
+  uint64_t usage = dbs.get_dbs_total_usage();
+
+  // Only the new version's chunks are left, and the old ones no longer count against their nodes
+  ASSERT_TRUE(write_file(&fs, "/file", pattern(3000, 2), 5000));
+  EXPECT_EQ(transport.blocks.size(), 3 * KAPUA_DBS_REPLICAS);
+  EXPECT_EQ(dbs.get_dbs_total_usage(), usage - 2000 * KAPUA_DBS_REPLICAS);
+
+  ASSERT_TRUE(fs.remove("/file"));
+  EXPECT_TRUE(transport.blocks.empty());
+  EXPECT_EQ(dbs.get_dbs_total_usage(), 0);
+  EXPECT_EQ(fs.get_chunks_removed(), 8 * KAPUA_DBS_REPLICAS);
+}
+
+TEST_F(FileSystemTest, RejectsInodesWithoutChunkSize) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  ASSERT_TRUE(write_file(&fs, "/file", pattern(2000, 1), 2000));
+  FileStat stat;
+  ASSERT_TRUE(fs.stat("/file", &stat));
+
+  // A damaged record would otherwise have reads divide by zero
+  std::vector<uint8_t> record;
+  ASSERT_EQ(kv->get("fs:inode:" + Util::to_hex64_str(stat.inode), &record), KVStore::Result::Found);
+  std::fill(record.begin() + 9, record.begin() + 13, 0);
+  ASSERT_TRUE(kv->set("fs:inode:" + Util::to_hex64_str(stat.inode), record.data(), record.size()));
+  EXPECT_EQ(fs.open("/file"), nullptr);
+  EXPECT_FALSE(fs.stat("/file", &stat));
+}
+
+TEST_F(FileSystemTest, UnclosedWriterChangesNothing) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  {
+    std::unique_ptr<FileWriter> writer = fs.create("/file");
+    ASSERT_TRUE(writer->write(pattern(2500, 1).data(), 2500));
+  }
+  FileStat stat;
+  EXPECT_FALSE(fs.stat("/file", &stat));
+}
+
+TEST_F(FileSystemTest, ReadsFallBackToOtherReplicas) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  std::vector<uint8_t> data = pattern(8000, 3);
+  ASSERT_TRUE(write_file(&fs, "/file", data, 8000));
+
+  // With a node down, chunks that would have started there are read from the next replica
+  FileStat stat;
+  ASSERT_TRUE(fs.stat("/file", &stat));
+  transport.down[dbs.get_dbs_nodes_for_block(FileSystem::get_chunk_id(stat.inode, stat.generation, 0))[0]] = true;
+  std::unique_ptr<FileReader> reader = fs.open("/file");
+  ASSERT_NE(reader, nullptr);
+  EXPECT_EQ(read_all(reader.get(), 1000), data);
+  EXPECT_GT(fs.get_read_retries(), 0);
+}
+
+TEST_F(FileSystemTest, WriteFailsWithoutQuorum) {
+  FileSystem fs(&logger, kv.get(), &dbs, &transport, pipeline.get(), options());
+  for (uint64_t id = 1; id <= 3; id++) transport.down[id] = true;
+
+  std::unique_ptr<FileWriter> writer = fs.create("/file");
+  ASSERT_NE(writer, nullptr);
+  writer->write(pattern(3000, 1).data(), 3000);
+  EXPECT_FALSE(writer->close());
+
+  FileStat stat;
+  EXPECT_FALSE(fs.stat("/file", &stat));
+}
+
+}  // namespace KapuaTest
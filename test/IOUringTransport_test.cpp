@@ -0,0 +1,120 @@
+#include "IOUringTransport.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+#define TEST_PORT 47890
+
+// Falls back as it would on a kernel without io_uring
+class IOUringTransportNoRing : public IOUringTransport {
+ public:
+  IOUringTransportNoRing(Logger* logger) : IOUringTransport(logger) {}
+
+ protected:
+  bool _setup_ring() override { return false; }
+};
+
+class IOUringTransportTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    peer = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(peer, -1);
+    std::memset(&peer_addr, 0, sizeof(peer_addr));
+    peer_addr.sin_family = AF_INET;
+    peer_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(peer, (sockaddr*)&peer_addr, sizeof(peer_addr)), 0);
+    // Room for every reply sent in a burst
+    int size = 1 << 20;
+    setsockopt(peer, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    socklen_t len = sizeof(peer_addr);
+    getsockname(peer, (sockaddr*)&peer_addr, &len);
+
+    std::memset(&transport_addr, 0, sizeof(transport_addr));
+    transport_addr.sin_family = AF_INET;
+    transport_addr.sin_port = htons(TEST_PORT);
+    transport_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+
+  void TearDown() override { close(peer); }
+
+  // Sends count numbered datagrams from the peer, and checks the transport receives all of them in order
+  void expect_received(Transport* transport, int count) {
+    for (int i = 0; i < count; i++) {
+      std::string text = "datagram " + std::to_string(i);
+      ASSERT_EQ(sendto(peer, text.data(), text.size(), 0, (sockaddr*)&transport_addr, sizeof(transport_addr)), (ssize_t)text.size());
+    }
+
+    int received = 0;
+    for (int tries = 0; received < count && tries < 1000; tries++) {
+      if (!transport->wait(10000)) continue;
+      Transport::Datagram datagrams[KAPUA_RECEIVE_BATCH];
+      size_t got = transport->receive(datagrams, KAPUA_RECEIVE_BATCH);
+      for (size_t i = 0; i < got; i++, received++) {
+        EXPECT_EQ(std::string((char*)datagrams[i].data, datagrams[i].size), "datagram " + std::to_string(received));
+        EXPECT_EQ(datagrams[i].addr.sin_port, peer_addr.sin_port);
+        EXPECT_EQ(datagrams[i].addr.sin_addr.s_addr, peer_addr.sin_addr.s_addr);
+      }
+    }
+    EXPECT_EQ(received, count);
+  }
+
+  // Sends count datagrams from the transport, and checks the peer gets them all
+  void expect_sent(Transport* transport, int count) {
+    for (int i = 0; i < count; i++) {
+      std::string text = "reply " + std::to_string(i);
+      Transport::Datagram datagram = {(uint8_t*)text.data(), text.size(), peer_addr};
+      ASSERT_EQ(transport->send(&datagram, 1), 1);
+    }
+    transport->flush();
+
+    timeval tv = {1, 0};
+    setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    for (int i = 0; i < count; i++) {
+      char buffer[64];
+      ssize_t size = recv(peer, buffer, sizeof(buffer), 0);
+      ASSERT_GT(size, 0);
+      EXPECT_EQ(std::string(buffer, size), "reply " + std::to_string(i));
+    }
+  }
+
+  ::testing::NiceMock<MockLogger> mockLogger;
+  int peer;
+  sockaddr_in peer_addr;
+  sockaddr_in transport_addr;
+};
+
+TEST_F(IOUringTransportTest, ReceivesAndSends) {
+  IOUringTransport transport(&mockLogger);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+
+  expect_received(&transport, 10);
+  expect_sent(&transport, 10);
+}
+
+TEST_F(IOUringTransportTest, ReusesBuffers) {
+  IOUringTransport transport(&mockLogger);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+
+  // More than there are buffers in the ring, so the receive runs out and is armed again, with the rest left in the socket
+  for (int i = 0; i < 3; i++) expect_received(&transport, KAPUA_IO_URING_BUFFERS + 100);
+  expect_sent(&transport, KAPUA_IO_URING_SEND_SLOTS + 10);
+}
+
+TEST_F(IOUringTransportTest, FallsBackToSocket) {
+  IOUringTransportNoRing transport(&mockLogger);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+  EXPECT_FALSE(transport.is_using_ring());
+
+  expect_received(&transport, 10);
+  expect_sent(&transport, 10);
+}
+
+}  // namespace KapuaTest
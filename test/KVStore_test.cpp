@@ -0,0 +1,184 @@
+#include "KVStore.hpp"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+#include "MemcachedServer.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class KVStoreTest : public ::testing::Test {
+ protected:
+  MockLogger logger;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_kv_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  std::vector<uint8_t> bytes(const std::string& str) { return std::vector<uint8_t>(str.begin(), str.end()); }
+};
+
+TEST_F(KVStoreTest, LogRecoversIndex) {
+  std::string filename = dir + "/kv.log";
+  {
+    KVLog log(&logger);
+    ASSERT_TRUE(log.open(filename));
+    ASSERT_TRUE(log.apply("a", 1, false, (const uint8_t*)"one", 3));
+    ASSERT_TRUE(log.apply("b", 1, false, (const uint8_t*)"two", 3));
+    ASSERT_TRUE(log.apply("a", 2, false, (const uint8_t*)"three", 5));
+    // Older versions are ignored
+    ASSERT_TRUE(log.apply("a", 1, false, (const uint8_t*)"stale", 5));
+    ASSERT_TRUE(log.apply("b", 2, true, nullptr, 0));
+  }
+
+  // A torn write at the end of the log
+  FILE* file = fopen(filename.c_str(), "ab");
+  fwrite("garbage", 1, 7, file);
+  fclose(file);
+
+  EXPECT_CALL(logger, warn(::testing::_)).Times(1);
+  KVLog log(&logger);
+  ASSERT_TRUE(log.open(filename));
+  KVRecord record;
+  ASSERT_TRUE(log.get("a", &record));
+  EXPECT_EQ(record.version, 2);
+  EXPECT_EQ(record.value, bytes("three"));
+  ASSERT_TRUE(log.get("b", &record));
+  EXPECT_TRUE(record.deleted);
+  EXPECT_GT(log.get_dead_bytes(), 0);
+
+  ASSERT_TRUE(log.compact());
+  EXPECT_EQ(log.get_dead_bytes(), 0);
+  EXPECT_FALSE(log.get("b", &record));
+  ASSERT_TRUE(log.get("a", &record));
+  EXPECT_EQ(record.value, bytes("three"));
+}
+
+TEST_F(KVStoreTest, CompactionKeepsRecentTombstones) {
+  KVLog log(&logger);
+  ASSERT_TRUE(log.open(dir + "/kv.log"));
+  uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t written = now << 12, deleted = (now + 1) << 12;
+  ASSERT_TRUE(log.apply("key", written, false, (const uint8_t*)"value", 5));
+  ASSERT_TRUE(log.apply("key", deleted, true, nullptr, 0));
+  // Deleted long ago, past the grace period
+  ASSERT_TRUE(log.apply("old", 1 << 12, true, nullptr, 0));
+  ASSERT_TRUE(log.compact());
+
+  // A replica that missed the delete repairs this one with the old value, which loses to the tombstone
+  ASSERT_TRUE(log.apply("key", written, false, (const uint8_t*)"value", 5));
+  KVRecord record;
+  ASSERT_TRUE(log.get("key", &record));
+  EXPECT_TRUE(record.deleted);
+  EXPECT_EQ(record.version, deleted);
+  EXPECT_FALSE(log.get("old", &record));
+}
+
+TEST_F(KVStoreTest, QuorumAndReadRepair) {
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+  LoopbackKVTransport transport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  for (uint64_t id = 1; id <= 3; id++) {
+    if (id > 1) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1 << 30);
+    logs.emplace_back(new KVLog(&logger));
+    ASSERT_TRUE(logs.back()->open(dir + "/" + std::to_string(id) + ".log"));
+    transport.add_node(id, logs.back().get());
+  }
+
+  KVStore kv(&logger, &dbs, &transport);
+  std::vector<uint8_t> value;
+  ASSERT_TRUE(kv.set("key", (const uint8_t*)"v1", 2));
+  ASSERT_EQ(kv.get("key", &value), KVStore::Result::Found);
+  EXPECT_EQ(value, bytes("v1"));
+
+  // With one replica down a write still reaches quorum, and the replica is repaired by a later read
+  std::vector<uint64_t> replicas = dbs.get_dbs_preference_list(KVStore::get_key_id("key"), 3);
+  transport.set_node_down(replicas[0], true);
+  ASSERT_TRUE(kv.set("key", (const uint8_t*)"v2", 2));
+  transport.set_node_down(replicas[0], false);
+
+  ASSERT_EQ(kv.get("key", &value), KVStore::Result::Found);
+  EXPECT_EQ(value, bytes("v2"));
+  EXPECT_EQ(kv.get_read_repairs(), 1);
+
+  ASSERT_TRUE(kv.remove("key"));
+  EXPECT_EQ(kv.get("key", &value), KVStore::Result::NotFound);
+
+  // Two down is below quorum either way
+  EXPECT_CALL(logger, warn(::testing::_)).Times(2);
+  transport.set_node_down(replicas[1], true);
+  transport.set_node_down(replicas[2], true);
+  EXPECT_FALSE(kv.set("key", (const uint8_t*)"v3", 2));
+  EXPECT_EQ(kv.get("key", &value), KVStore::Result::Unavailable);
+}
+
+TEST_F(KVStoreTest, MemcachedProtocol) {
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+  LoopbackKVTransport transport;
+  KVLog log(&logger);
+  ASSERT_TRUE(log.open(dir + "/kv.log"));
+  transport.add_node(1, &log);
+  KVStore kv(&logger, &dbs, &transport, 1, 1, 1);
+
+  Config config(&logger);
+  inet_pton(AF_INET, "127.0.0.1", &config.memcached_ip4_sockaddr.sin_addr);
+  config.memcached_ip4_sockaddr.sin_port = 0;
+  MemcachedServer server(&logger, &config, &kv);
+  ASSERT_TRUE(server.start());
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = config.memcached_ip4_sockaddr;
+  addr.sin_port = htons(server.get_port());
+  ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+
+  auto request = [&](const std::string& command, const std::string& terminator) {
+    send(fd, command.data(), command.size(), 0);
+    std::string response;
+    char buffer[4096];
+    while (response.size() < terminator.size() || response.compare(response.size() - terminator.size(), terminator.size(), terminator) != 0) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) break;
+      response.append(buffer, n);
+    }
+    return response;
+  };
+
+  EXPECT_EQ(request("set greeting 42 0 5\r\nhello\r\n", "\r\n"), "STORED\r\n");
+  EXPECT_EQ(request("get greeting missing\r\n", "END\r\n"), "VALUE greeting 42 5\r\nhello\r\nEND\r\n");
+  // Pipelined, with a noreply set
+  EXPECT_EQ(request("set a 0 0 1 noreply\r\nx\r\ndelete greeting\r\nget greeting a\r\n", "END\r\n"), "DELETED\r\nVALUE a 0 1\r\nx\r\nEND\r\n");
+  EXPECT_EQ(request("bogus\r\n", "\r\n"), "ERROR\r\n");
+  EXPECT_EQ(request("get\r\n", "\r\n"), "ERROR\r\n");
+  // 2^64 + 5 bytes must not be read as 5
+  EXPECT_EQ(request("set k 0 0 18446744073709551621\r\n", "\r\n"), "CLIENT_ERROR bad command line format\r\n");
+  EXPECT_EQ(request("set k 0 4294967296 5\r\nhello\r\n", "\r\n"), "CLIENT_ERROR bad command line format\r\n");
+  // The largest value fits the store with its flags, one byte more is refused up front
+  std::string largest = "set big 0 0 " + std::to_string(KAPUA_MEMCACHED_MAX_DATA_LENGTH) + "\r\n" + std::string(KAPUA_MEMCACHED_MAX_DATA_LENGTH, 'v') + "\r\n";
+  EXPECT_EQ(request(largest, "\r\n"), "STORED\r\n");
+  EXPECT_EQ(request("set k 0 0 3\r\ntoolong\r\n", "\r\n"), "CLIENT_ERROR bad data chunk\r\n");
+
+  // Both errors close the connection, so this one needs another
+  close(fd);
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+  EXPECT_EQ(request("set big 0 0 " + std::to_string(KAPUA_MEMCACHED_MAX_DATA_LENGTH + 1) + "\r\n", "\r\n"), "SERVER_ERROR object too large for cache\r\n");
+
+  close(fd);
+  server.stop();
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,186 @@
+#include "LocalBlockStore.hpp"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <map>
+#include <thread>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class LocalBlockStoreTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_lbs_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  std::vector<uint8_t> block(uint64_t id, size_t len) {
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(id * 31 + i);
+    return data;
+  }
+};
+
+TEST_F(LocalBlockStoreTest, PutGetRemove) {
+  LocalBlockStore store(&logger, 1 << 20);
+  ASSERT_TRUE(store.open(dir));
+
+  for (uint64_t id = 1; id <= 100; id++) ASSERT_TRUE(store.put(id, block(id, 20000 + id).data(), 20000 + id));
+  EXPECT_EQ(store.get_block_count(), 100);
+
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(store.get(42, &data));
+  EXPECT_EQ(data, block(42, 20042));
+
+  EXPECT_TRUE(store.remove(42));
+  EXPECT_FALSE(store.remove(42));
+  EXPECT_FALSE(store.has(42));
+  EXPECT_FALSE(store.get(42, &data));
+  EXPECT_EQ(store.get_block_count(), 99);
+
+  // Records that do not fit start a new segment
+  EXPECT_GT(store.get_segment_count(), 1);
+  EXPECT_FALSE(store.put(1000, block(1000, 1 << 20).data(), 1 << 20));
+}
+
+TEST_F(LocalBlockStoreTest, ReportsChanges) {
+  std::map<uint64_t, uint64_t> reported;
+  {
+    LocalBlockStore store(&logger, 1 << 20);
+    ASSERT_TRUE(store.open(dir));
+    store.set_change_callback([&reported](uint64_t blockId, uint64_t digest, bool removed) {
+      if (removed) {
+        reported.erase(blockId);
+      } else {
+        reported[blockId] = digest;
+      }
+    });
+
+    for (uint64_t id = 1; id <= 10; id++) ASSERT_TRUE(store.put(id, block(id, 1000).data(), 1000));
+    ASSERT_TRUE(store.put(5, block(50, 1000).data(), 1000));
+    ASSERT_TRUE(store.remove(7));
+    EXPECT_FALSE(store.remove(7));
+    EXPECT_EQ(reported.size(), 9);
+    EXPECT_EQ(reported.count(7), 0);
+  }
+
+  // Digests depend only on the records, so they survive a reopen and differ when the contents do
+  LocalBlockStore store(&logger, 1 << 20);
+  ASSERT_TRUE(store.open(dir));
+  std::map<uint64_t, uint64_t> held;
+  store.for_each_block([&held](uint64_t blockId, uint64_t digest) { held[blockId] = digest; });
+  EXPECT_EQ(held, reported);
+  EXPECT_NE(held[5], held[6]);
+}
+
+TEST_F(LocalBlockStoreTest, RecoversIndex) {
+  {
+    LocalBlockStore store(&logger, 1 << 20);
+    ASSERT_TRUE(store.open(dir));
+    for (uint64_t id = 1; id <= 300; id++) ASSERT_TRUE(store.put(id, block(id, 10000).data(), 10000));
+    ASSERT_TRUE(store.put(7, block(8, 500).data(), 500));
+    ASSERT_TRUE(store.remove(9));
+  }
+
+  LocalBlockStore store(&logger, 1 << 20);
+  ASSERT_TRUE(store.open(dir));
+  EXPECT_EQ(store.get_block_count(), 299);
+  EXPECT_EQ(store.get_live_bytes(), 298 * 10000 + 500);
+
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(store.get(7, &data));
+  EXPECT_EQ(data, block(8, 500));
+  EXPECT_FALSE(store.has(9));
+  ASSERT_TRUE(store.get(300, &data));
+  EXPECT_EQ(data, block(300, 10000));
+}
+
+TEST_F(LocalBlockStoreTest, TruncatesTornWrite) {
+  {
+    LocalBlockStore store(&logger, 1 << 20);
+    ASSERT_TRUE(store.open(dir));
+    ASSERT_TRUE(store.put(1, block(1, 100).data(), 100));
+    ASSERT_TRUE(store.put(2, block(2, 100).data(), 100));
+  }
+
+  // Cut the last record short
+  std::string filename = dir + "/00000001.seg";
+  FILE* file = fopen(filename.c_str(), "r+");
+  ASSERT_NE(file, nullptr);
+  fseek(file, 0, SEEK_END);
+  ASSERT_EQ(ftruncate(fileno(file), ftell(file) - 10), 0);
+  fclose(file);
+
+  EXPECT_CALL(logger, warn(::testing::_)).Times(1);
+  LocalBlockStore store(&logger, 1 << 20);
+  ASSERT_TRUE(store.open(dir));
+  EXPECT_TRUE(store.has(1));
+  EXPECT_FALSE(store.has(2));
+
+  // The log carries on from the last good record
+  ASSERT_TRUE(store.put(3, block(3, 100).data(), 100));
+  std::vector<uint8_t> data;
+  ASSERT_TRUE(store.get(3, &data));
+  EXPECT_EQ(data, block(3, 100));
+}
+
+TEST_F(LocalBlockStoreTest, ViewsArePinned) {
+  BlockView view;
+  {
+    LocalBlockStore store(&logger, 1 << 20);
+    ASSERT_TRUE(store.open(dir));
+    ASSERT_TRUE(store.put(5, block(5, 4096).data(), 4096));
+    ASSERT_TRUE(store.get_view(5, &view));
+    EXPECT_EQ(std::vector<uint8_t>(view.data(), view.data() + view.size()), block(5, 4096));
+
+    // Removing the block does not invalidate the view
+    ASSERT_TRUE(store.remove(5));
+    EXPECT_FALSE(store.get_view(5, &view));
+  }
+
+  // Nor does closing the store
+  EXPECT_EQ(std::vector<uint8_t>(view.data(), view.data() + view.size()), block(5, 4096));
+  view.reset();
+  EXPECT_TRUE(view.empty());
+}
+
+TEST_F(LocalBlockStoreTest, SendsWithoutCopy) {
+  LocalBlockStore store(&logger, 1 << 20);
+  ASSERT_TRUE(store.open(dir));
+  std::vector<uint8_t> data = block(11, 200000);
+  ASSERT_TRUE(store.put(11, data.data(), data.size()));
+
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  std::vector<uint8_t> received;
+  std::thread reader([&] {
+    uint8_t buffer[65536];
+    ssize_t n;
+    while ((n = read(fds[1], buffer, sizeof(buffer))) > 0) received.insert(received.end(), buffer, buffer + n);
+  });
+
+  EXPECT_TRUE(store.send_block(11, fds[0]));
+  EXPECT_FALSE(store.send_block(12, fds[0]));
+  close(fds[0]);
+  reader.join();
+  close(fds[1]);
+
+  EXPECT_EQ(received, data);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,146 @@
+#include "Logger.hpp"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+// A stream buffer that holds up the first write until it is released, so a test can keep the writer thread busy
+class HeldStreamBuf : public std::stringbuf {
+ public:
+  HeldStreamBuf() : _held(true), _entered(false) {}
+
+  void wait_entered() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _entered; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _held = false;
+    _changed.notify_all();
+  }
+
+ protected:
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  bool _held;
+  bool _entered;
+
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _entered = true;
+      _changed.notify_all();
+      _changed.wait(lock, [this] { return !_held; });
+    }
+    return std::stringbuf::xsputn(s, n);
+  }
+};
+
+std::vector<std::string> lines_of(const std::string& text) {
+  std::vector<std::string> lines;
+  std::istringstream in(text);
+  std::string line;
+  while (std::getline(in, line)) lines.push_back(line);
+  return lines;
+}
+
+TEST(LoggerTest, IOStreamLoggerLevels) {
+  std::ostringstream out;
+  IOStreamLogger logger(&out, LOG_LEVEL_INFO);
+
+  EXPECT_TRUE(logger.is_enabled(LOG_LEVEL_INFO));
+  EXPECT_FALSE(logger.is_enabled(LOG_LEVEL_DEBUG));
+  logger.debug("hidden");
+  logger.info("shown");
+  logger.error("failed");
+
+  std::vector<std::string> lines = lines_of(out.str());
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_NE(lines[0].find("Z [INFO ] shown"), std::string::npos);
+  EXPECT_NE(lines[1].find("Z [ERROR] failed"), std::string::npos);
+}
+
+TEST(LoggerTest, ScopedLoggerChecksLevelFirst) {
+  std::ostringstream out;
+  IOStreamLogger logger(&out, LOG_LEVEL_INFO);
+  ScopedLogger scoped("Scope", &logger);
+  ScopedLogger quieter("Quiet", &logger, LOG_LEVEL_WARN);
+
+  // Both the scope's own level and the wrapped logger's are honoured
+  EXPECT_FALSE(scoped.is_enabled(LOG_LEVEL_DEBUG));
+  EXPECT_TRUE(scoped.is_enabled(LOG_LEVEL_INFO));
+  EXPECT_FALSE(quieter.is_enabled(LOG_LEVEL_INFO));
+  scoped.debug("hidden");
+  scoped.info("shown");
+  quieter.info("hidden");
+  quieter.warn("warned");
+
+  std::vector<std::string> lines = lines_of(out.str());
+  ASSERT_EQ(lines.size(), 2);
+  EXPECT_NE(lines[0].find("[INFO ] (Scope) shown"), std::string::npos);
+  EXPECT_NE(lines[1].find("[WARN ] (Quiet) warned"), std::string::npos);
+}
+
+TEST(LoggerTest, AsyncLoggerWritesEveryThread) {
+  std::ostringstream out;
+  AsyncLogger logger(&out, LOG_LEVEL_INFO, 64);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&logger, t] {
+      for (int i = 0; i < 50; i++) {
+        logger.info(std::to_string(t) + " " + std::to_string(i));
+        // Let the writer keep up with the small rings
+        if (i % 16 == 15) logger.flush();
+      }
+      logger.debug("hidden");
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  logger.flush();
+  EXPECT_EQ(logger.get_dropped(), 0);
+
+  // Every line is written, and each thread's lines stay in order
+  std::map<int, int> next;
+  std::vector<std::string> lines = lines_of(out.str());
+  ASSERT_EQ(lines.size(), 200);
+  for (const std::string& line : lines) {
+    size_t at = line.find("[INFO ] ");
+    ASSERT_NE(at, std::string::npos);
+    std::istringstream fields(line.substr(at + 8));
+    int t, i;
+    fields >> t >> i;
+    EXPECT_EQ(i, next[t]++);
+  }
+}
+
+TEST(LoggerTest, AsyncLoggerDropsWhenFull) {
+  HeldStreamBuf buf;
+  std::ostream out(&buf);
+  AsyncLogger logger(&out, LOG_LEVEL_INFO, 4);
+
+  // The writer is stuck writing the first line, so only a ring's worth of the rest fits
+  logger.info("first");
+  buf.wait_entered();
+  for (int i = 0; i < 100; i++) logger.info("line " + std::to_string(i));
+  EXPECT_EQ(logger.get_dropped(), 96);
+
+  buf.release();
+  logger.flush();
+  std::vector<std::string> lines = lines_of(buf.str());
+  ASSERT_EQ(lines.size(), 6);
+  EXPECT_NE(lines[4].find("line 3"), std::string::npos);
+  EXPECT_NE(lines[5].find("96 lines dropped"), std::string::npos);
+}
+
+}  // namespace KapuaTest
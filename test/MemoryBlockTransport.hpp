@@ -0,0 +1,47 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "BlockTransport.hpp"
+
+namespace KapuaTest {
+
+// In-memory BlockTransport where nodes can be marked as down
+class MemoryBlockTransport : public Kapua::BlockTransport {
+ public:
+  bool put_block(uint64_t nodeId, uint64_t blockId, const uint8_t* data, size_t len) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (down[nodeId]) return false;
+    puts++;
+    blocks[std::make_pair(nodeId, blockId)].assign(data, data + len);
+    return true;
+  }
+
+  bool get_block(uint64_t nodeId, uint64_t blockId, std::vector<uint8_t>* data) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (down[nodeId]) return false;
+    auto it = blocks.find(std::make_pair(nodeId, blockId));
+    if (it == blocks.end()) return false;
+    *data = it->second;
+    return true;
+  }
+
+  bool remove_block(uint64_t nodeId, uint64_t blockId) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !down[nodeId] && blocks.erase(std::make_pair(nodeId, blockId)) > 0;
+  }
+
+  bool has_block(uint64_t nodeId, uint64_t blockId) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !down[nodeId] && blocks.find(std::make_pair(nodeId, blockId)) != blocks.end();
+  }
+
+  std::mutex mutex;
+  std::map<std::pair<uint64_t, uint64_t>, std::vector<uint8_t>> blocks;
+  std::map<uint64_t, bool> down;
+  size_t puts = 0;
+};
+
+}  // namespace KapuaTest
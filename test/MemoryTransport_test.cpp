@@ -0,0 +1,75 @@
+#include "MemoryTransport.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class MemoryTransportTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    a.reset(new MemoryTransport(&network, 0x0a000001));
+    b.reset(new MemoryTransport(&network, 0x0a000002));
+    c.reset(new MemoryTransport(&network, 0x0a000003));
+  }
+
+  Transport::Datagram to(MemoryTransport* transport, const char* text) {
+    Transport::Datagram datagram = {(uint8_t*)text, std::strlen(text), transport->get_addr()};
+    return datagram;
+  }
+
+  MemoryNetwork network;
+  std::unique_ptr<MemoryTransport> a, b, c;
+};
+
+TEST_F(MemoryTransportTest, SendsToAddress) {
+  ASSERT_TRUE(a->open(9999));
+  ASSERT_TRUE(b->open(9999));
+  ASSERT_TRUE(c->open(9999));
+
+  Transport::Datagram datagrams[2] = {to(b.get(), "one"), to(b.get(), "two")};
+  EXPECT_EQ(a->send(datagrams, 2), 2);
+  EXPECT_FALSE(c->wait(0));
+  ASSERT_TRUE(b->wait(1000));
+
+  Transport::Datagram received[KAPUA_RECEIVE_BATCH];
+  ASSERT_EQ(b->receive(received, KAPUA_RECEIVE_BATCH), 2);
+  EXPECT_EQ(std::string((char*)received[0].data, received[0].size), "one");
+  EXPECT_EQ(std::string((char*)received[1].data, received[1].size), "two");
+  EXPECT_EQ(received[0].addr.sin_addr.s_addr, a->get_addr().sin_addr.s_addr);
+  EXPECT_EQ(received[0].addr.sin_port, htons(9999));
+  EXPECT_EQ(b->receive(received, KAPUA_RECEIVE_BATCH), 0);
+  EXPECT_EQ(network.get_delivered(), 2);
+}
+
+TEST_F(MemoryTransportTest, BroadcastsToOthersOnPort) {
+  ASSERT_TRUE(a->open(9999));
+  ASSERT_TRUE(b->open(9999));
+  ASSERT_TRUE(c->open(9998));
+
+  Transport::Datagram datagram = to(b.get(), "hello");
+  datagram.addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+  EXPECT_EQ(a->send(&datagram, 1), 1);
+
+  Transport::Datagram received;
+  EXPECT_EQ(a->receive(&received, 1), 0);
+  EXPECT_EQ(b->receive(&received, 1), 1);
+  EXPECT_EQ(c->receive(&received, 1), 0);
+}
+
+TEST_F(MemoryTransportTest, DropsWhenNothingListens) {
+  ASSERT_TRUE(a->open(9999));
+  ASSERT_TRUE(b->open(9999));
+  b->close();
+  EXPECT_FALSE(MemoryTransport(&network, 0x0a000001).open(9999));
+
+  Transport::Datagram datagram = to(b.get(), "lost");
+  EXPECT_EQ(a->send(&datagram, 1), 1);
+  EXPECT_EQ(network.get_delivered(), 0);
+  EXPECT_EQ(network.get_dropped(), 1);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,129 @@
+#include "Metrics.hpp"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "MetricsServer.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+TEST(MetricsTest, CountsAcrossThreads) {
+  MetricCounter counter;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&counter] {
+      for (int i = 0; i < 10000; i++) counter.add();
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  counter.add(5);
+  EXPECT_EQ(counter.get(), 80005);
+}
+
+TEST(MetricsTest, HistogramBuckets) {
+  // Small values are exact, and every bucket above them is an eighth of its power of two
+  for (uint64_t value = 0; value < 8; value++) EXPECT_EQ(MetricHistogram::get_bucket(value), value);
+  EXPECT_EQ(MetricHistogram::get_bucket(8), 8);
+  EXPECT_EQ(MetricHistogram::get_bucket(16), 16);
+  EXPECT_EQ(MetricHistogram::get_bucket(17), 16);
+  EXPECT_EQ(MetricHistogram::get_bucket_upper(16), 17);
+  for (uint64_t value : {9ULL, 100ULL, 1000ULL, 123456789ULL, ~0ULL}) {
+    size_t bucket = MetricHistogram::get_bucket(value);
+    ASSERT_LT(bucket, KAPUA_HISTOGRAM_BUCKETS);
+    EXPECT_GE(MetricHistogram::get_bucket_upper(bucket), value);
+    EXPECT_LT(MetricHistogram::get_bucket_upper(bucket - 1), value);
+    EXPECT_LE(MetricHistogram::get_bucket_upper(bucket) - value, value / 8);
+  }
+
+  MetricHistogram histogram;
+  EXPECT_EQ(histogram.get_percentile(0.5), 0);
+  for (uint64_t value = 1; value <= 1000; value++) histogram.record(value * 1000);
+  EXPECT_EQ(histogram.get_count(), 1000);
+  EXPECT_EQ(histogram.get_sum(), 500500000);
+  EXPECT_NEAR(histogram.get_percentile(0.5), 500000, 500000 / 8);
+  EXPECT_NEAR(histogram.get_percentile(0.99), 990000, 990000 / 8);
+  EXPECT_GE(histogram.get_percentile(1.0), 1000000);
+}
+
+TEST(MetricsTest, PrometheusText) {
+  MetricsRegistry metrics;
+  metrics.counter("kapua_test_packets_total", "Packets", "type=\"Ping\"")->add(3);
+  metrics.counter("kapua_test_packets_total", "Packets", "type=\"Ready\"")->add();
+  // The same name and labels are the same counter
+  metrics.counter("kapua_test_packets_total", "Packets", "type=\"Ping\"")->add();
+  metrics.gauge("kapua_test_depth", "Depth")->set(-2);
+  metrics.gauge_callback("kapua_test_nodes", "Nodes", [] { return 7; });
+  MetricHistogram* histogram = metrics.histogram("kapua_test_ns", "Latency");
+  histogram->record(1);
+  histogram->record(5);
+  histogram->record(100);
+
+  EXPECT_EQ(metrics.to_prometheus(),
+            "# HELP kapua_test_depth Depth\n"
+            "# TYPE kapua_test_depth gauge\n"
+            "kapua_test_depth -2\n"
+            "# HELP kapua_test_nodes Nodes\n"
+            "# TYPE kapua_test_nodes gauge\n"
+            "kapua_test_nodes 7\n"
+            "# HELP kapua_test_ns Latency\n"
+            "# TYPE kapua_test_ns histogram\n"
+            "kapua_test_ns_bucket{le=\"1\"} 1\n"
+            "kapua_test_ns_bucket{le=\"3\"} 1\n"
+            "kapua_test_ns_bucket{le=\"7\"} 2\n"
+            "kapua_test_ns_bucket{le=\"15\"} 2\n"
+            "kapua_test_ns_bucket{le=\"31\"} 2\n"
+            "kapua_test_ns_bucket{le=\"63\"} 2\n"
+            "kapua_test_ns_bucket{le=\"+Inf\"} 3\n"
+            "kapua_test_ns_sum 106\n"
+            "kapua_test_ns_count 3\n"
+            "# HELP kapua_test_packets_total Packets\n"
+            "# TYPE kapua_test_packets_total counter\n"
+            "kapua_test_packets_total{type=\"Ping\"} 4\n"
+            "kapua_test_packets_total{type=\"Ready\"} 1\n");
+}
+
+TEST(MetricsTest, ServesOverHTTP) {
+  ::testing::NiceMock<MockLogger> logger;
+  Config config(&logger);
+  inet_pton(AF_INET, "127.0.0.1", &config.metrics_ip4_sockaddr.sin_addr);
+  config.metrics_ip4_sockaddr.sin_port = 0;
+  MetricsRegistry metrics;
+  metrics.counter("kapua_test_total", "Test")->add(42);
+  MetricsServer server(&logger, &config, &metrics);
+  ASSERT_TRUE(server.start());
+
+  auto get = [&server](const std::string& request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.get_port());
+    EXPECT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    send(fd, request.data(), request.size(), 0);
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, n);
+    close(fd);
+    return response;
+  };
+
+  std::string response = get("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_EQ(response.compare(0, 15, "HTTP/1.1 200 OK"), 0);
+  EXPECT_NE(response.find("\r\n\r\n# HELP kapua_test_total Test\n# TYPE kapua_test_total counter\nkapua_test_total 42\n"), std::string::npos);
+
+  EXPECT_EQ(get("GET / HTTP/1.1\r\n\r\n").compare(0, 22, "HTTP/1.1 404 Not Found"), 0);
+  EXPECT_TRUE(server.stop());
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,113 @@
+#include "PacketTracer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "MockLogger.hpp"
+#include "Protocol.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class PacketTracerTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  MetricsRegistry metrics;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_trace_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  // A packet as UDPNetwork handles one, with a send nested in processing
+  void handle_packet(PacketTracer* tracer) {
+    tracer->begin();
+    { PacketTracer::Span span(tracer, PacketTracer::STAGE_RECEIVE); }
+    { PacketTracer::Span span(tracer, PacketTracer::STAGE_DECRYPT); }
+    {
+      PacketTracer::Span span(tracer, PacketTracer::STAGE_PROCESS);
+      PacketTracer::Span send(tracer, PacketTracer::STAGE_SEND);
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    tracer->end(true, Packet::Ping);
+  }
+
+  uint64_t stage_count(PacketTracer::Stage stage) {
+    return metrics.histogram("kapua_trace_stage_ns", "", std::string("stage=\"") + PacketTracer::get_stage_name(stage) + "\"")->get_count();
+  }
+};
+
+TEST_F(PacketTracerTest, Samples) {
+  PacketTracer tracer(&logger, &metrics, 4);
+  for (int i = 0; i < 100; i++) handle_packet(&tracer);
+
+  // One packet in four is traced, and only the stages it went through
+  EXPECT_EQ(metrics.counter("kapua_trace_packets_total", "")->get(), 25);
+  EXPECT_EQ(stage_count(PacketTracer::STAGE_RECEIVE), 25);
+  EXPECT_EQ(stage_count(PacketTracer::STAGE_SEND), 25);
+  EXPECT_EQ(stage_count(PacketTracer::STAGE_LOOKUP), 0);
+
+  // The process stage includes the send within it
+  MetricHistogram* process = metrics.histogram("kapua_trace_stage_ns", "", "stage=\"process\"");
+  EXPECT_GE(process->get_percentile(0.0), 50000);
+}
+
+TEST_F(PacketTracerTest, Off) {
+  PacketTracer tracer(&logger, &metrics, 0);
+  for (int i = 0; i < 10; i++) handle_packet(&tracer);
+  EXPECT_EQ(metrics.counter("kapua_trace_packets_total", "")->get(), 0);
+
+  // Spans outside a traced packet, such as sends from other threads, are ignored
+  PacketTracer sampled(&logger, &metrics, 1);
+  { PacketTracer::Span span(&sampled, PacketTracer::STAGE_SEND); }
+  PacketTracer::Span none(nullptr, PacketTracer::STAGE_SEND);
+  EXPECT_EQ(stage_count(PacketTracer::STAGE_SEND), 0);
+}
+
+TEST_F(PacketTracerTest, ChromeTrace) {
+  PacketTracer tracer(&logger, &metrics, 1);
+  // A packet already being handled when the capture starts
+  tracer.begin();
+  ASSERT_TRUE(tracer.start_capture(dir + "/trace.json", 100));
+  tracer.end(true, Packet::Ping);
+  EXPECT_FALSE(tracer.start_capture(dir + "/other.json", 100));
+  for (int i = 0; i < 3; i++) handle_packet(&tracer);
+  tracer.begin();
+  tracer.end(false, 0);
+
+  // Nothing is written until the capture's time is up
+  EXPECT_FALSE(tracer.check_capture());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  handle_packet(&tracer);
+  EXPECT_TRUE(tracer.check_capture());
+  EXPECT_FALSE(tracer.is_capturing());
+
+  std::ifstream file(dir + "/trace.json");
+  std::stringstream json;
+  json << file.rdbuf();
+  std::string text = json.str();
+  EXPECT_EQ(text.compare(0, 46, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name"), 0);
+  EXPECT_EQ(text.substr(text.size() - 4), "\n]}\n");
+
+  // Four packets, three with four stages each, and the early and late packets left out
+  auto count = [&text](const std::string& what) {
+    size_t n = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) n++;
+    return n;
+  };
+  EXPECT_EQ(count("\"name\":\"packet\""), 4);
+  EXPECT_EQ(count("\"name\":\"send\""), 3);
+  EXPECT_EQ(count("\"ph\":\"X\""), 16);
+  EXPECT_EQ(count("\"type\":\"Ping\""), 3);
+  EXPECT_EQ(count("\"type\":\"rejected\""), 1);
+}
+
+}  // namespace KapuaTest
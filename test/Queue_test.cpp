@@ -0,0 +1,331 @@
+#include "Queue.hpp"
+
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class QueueTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_queue_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  std::string message(uint64_t i) { return "message " + std::to_string(i) + std::string(i % 50, 'x'); }
+
+  bool append(QueueLog* log, uint64_t i, uint64_t* offset) { return log->append((const uint8_t*)message(i).data(), message(i).size(), offset); }
+
+  // Read every message from offset to the end, in slices of at most maxBytes
+  std::vector<std::string> read_all(QueueLog* log, uint64_t offset, size_t maxBytes) {
+    std::vector<std::string> messages;
+    uint64_t start = offset;
+    QueueSlice slice;
+    while (log->fetch(offset, maxBytes, &slice) && !slice.empty()) {
+      QueueMessage msg;
+      while (slice.next(&msg)) {
+        EXPECT_EQ(msg.offset, start + messages.size());
+        messages.push_back(std::string((const char*)msg.data, msg.length));
+      }
+      offset = slice.get_next_offset();
+    }
+    return messages;
+  }
+};
+
+TEST_F(QueueTest, AppendAndFetch) {
+  QueueLog log(&logger, 64 * 1024);
+  ASSERT_TRUE(log.open(dir, false));
+
+  uint64_t offset;
+  for (uint64_t i = 0; i < 3000; i++) {
+    ASSERT_TRUE(append(&log, i, &offset));
+    ASSERT_EQ(offset, i);
+  }
+  EXPECT_EQ(log.get_end_offset(), 3000);
+  EXPECT_GT(log.get_segment_count(), 1);
+
+  // Slices never span segments, but reading on crosses them
+  std::vector<std::string> messages = read_all(&log, 0, 4096);
+  ASSERT_EQ(messages.size(), 3000);
+  for (uint64_t i = 0; i < 3000; i++) ASSERT_EQ(messages[i], message(i));
+
+  // From the middle, one message at a time
+  QueueSlice slice;
+  ASSERT_TRUE(log.fetch(1234, 1, &slice));
+  EXPECT_EQ(slice.get_first_offset(), 1234);
+  EXPECT_EQ(slice.get_next_offset(), 1235);
+
+  // At the end there is nothing yet, and past it is an error
+  ASSERT_TRUE(log.fetch(3000, 4096, &slice));
+  EXPECT_TRUE(slice.empty());
+  EXPECT_FALSE(log.fetch(3001, 4096, &slice));
+}
+
+TEST_F(QueueTest, Batches) {
+  QueueLog log(&logger, 64 * 1024);
+  ASSERT_TRUE(log.open(dir));
+
+  std::vector<std::string> batch;
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> lens;
+  for (uint64_t i = 0; i < 1000; i++) batch.push_back(message(i));
+  for (const std::string& msg : batch) {
+    data.push_back((const uint8_t*)msg.data());
+    lens.push_back(msg.size());
+  }
+
+  // A batch spanning several segments is still one append
+  uint64_t first;
+  ASSERT_TRUE(log.append(data.data(), lens.data(), data.size(), &first));
+  ASSERT_TRUE(log.append(data.data(), lens.data(), data.size(), &first));
+  EXPECT_EQ(first, 1000);
+  EXPECT_EQ(log.get_commits(), 2);
+  EXPECT_GT(log.get_segment_count(), 1);
+
+  std::vector<std::string> messages = read_all(&log, 1000, 1 << 20);
+  EXPECT_EQ(messages, batch);
+}
+
+TEST_F(QueueTest, GroupCommit) {
+  QueueLog log(&logger, 1 << 20);
+  ASSERT_TRUE(log.open(dir));
+
+  std::vector<std::thread> producers;
+  std::atomic<int> failures(0);
+  for (int t = 0; t < 8; t++) {
+    producers.emplace_back([&, t] {
+      uint64_t offset;
+      for (uint64_t i = 0; i < 100; i++) {
+        if (!append(&log, t * 1000 + i, &offset)) failures++;
+      }
+    });
+  }
+  for (std::thread& producer : producers) producer.join();
+
+  EXPECT_EQ(failures, 0);
+  EXPECT_EQ(log.get_appends(), 800);
+  EXPECT_EQ(log.get_end_offset(), 800);
+  // Producers waiting on a sync have their appends committed together
+  EXPECT_LT(log.get_commits(), 800);
+  EXPECT_EQ(read_all(&log, 0, 1 << 20).size(), 800);
+}
+
+TEST_F(QueueTest, RecoversAndTrims) {
+  {
+    QueueLog log(&logger, 16 * 1024);
+    ASSERT_TRUE(log.open(dir));
+    uint64_t offset;
+    for (uint64_t i = 0; i < 1000; i++) ASSERT_TRUE(append(&log, i, &offset));
+  }
+
+  // Cut the last record short
+  std::vector<std::string> files;
+  FILE* ls = popen(("ls " + dir).c_str(), "r");
+  char name[256];
+  while (fscanf(ls, "%255s", name) == 1) files.push_back(name);
+  pclose(ls);
+  ASSERT_GT(files.size(), 2);
+  std::string last = dir + "/" + files.back();
+  FILE* file = fopen(last.c_str(), "r+");
+  fseek(file, 0, SEEK_END);
+  ASSERT_EQ(ftruncate(fileno(file), ftell(file) - 5), 0);
+  fclose(file);
+
+  EXPECT_CALL(logger, warn(::testing::_)).Times(1);
+  QueueLog log(&logger, 16 * 1024);
+  ASSERT_TRUE(log.open(dir));
+  EXPECT_EQ(log.get_end_offset(), 999);
+
+  // The log carries on from the last good record
+  uint64_t offset;
+  ASSERT_TRUE(append(&log, 999, &offset));
+  EXPECT_EQ(offset, 999);
+  std::vector<std::string> messages = read_all(&log, 0, 4096);
+  ASSERT_EQ(messages.size(), 1000);
+  EXPECT_EQ(messages[999], message(999));
+
+  // Trimming drops whole segments only
+  size_t segments = log.get_segment_count();
+  log.trim(500);
+  EXPECT_LT(log.get_segment_count(), segments);
+  EXPECT_GT(log.get_start_offset(), 0);
+  EXPECT_LE(log.get_start_offset(), 500);
+  QueueSlice slice;
+  EXPECT_FALSE(log.fetch(0, 4096, &slice));
+  EXPECT_EQ(read_all(&log, 500, 4096).size(), 500);
+}
+
+TEST_F(QueueTest, FailedRolloverPublishesNothing) {
+  QueueLog log(&logger, 64 * 1024);
+  ASSERT_TRUE(log.open(dir, false));
+  uint64_t offset;
+  for (uint64_t i = 0; i < 10; i++) ASSERT_TRUE(append(&log, i, &offset));
+
+  // A small message that fits the first segment, then one too big for what is left of it. Files may not grow past
+  // 16KiB, so the second write, into a new segment, fails.
+  std::string small = message(10), big(log.get_max_message_size(), 'b');
+  const uint8_t* data[] = {(const uint8_t*)small.data(), (const uint8_t*)big.data()};
+  size_t lens[] = {small.size(), big.size()};
+  struct rlimit limit, saved;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+  limit = saved;
+  limit.rlim_cur = 16 * 1024;
+  sighandler_t handler = signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  bool appended = log.append(data, lens, 2, &offset);
+  setrlimit(RLIMIT_FSIZE, &saved);
+  signal(SIGXFSZ, handler);
+  EXPECT_FALSE(appended);
+
+  EXPECT_EQ(log.get_end_offset(), 10);
+  EXPECT_EQ(log.get_segment_count(), 1);
+
+  // The log carries on as if the batch had never been tried, and reopens the same
+  ASSERT_TRUE(log.append(data, lens, 2, &offset));
+  EXPECT_EQ(offset, 10);
+  EXPECT_EQ(log.get_segment_count(), 2);
+  log.close();
+  QueueLog reopened(&logger, 64 * 1024);
+  ASSERT_TRUE(reopened.open(dir, false));
+  std::vector<std::string> messages = read_all(&reopened, 0, 1 << 20);
+  ASSERT_EQ(messages.size(), 12);
+  EXPECT_EQ(messages[10], small);
+  EXPECT_EQ(messages[11], big);
+}
+
+TEST_F(QueueTest, FailedWriteLeavesNothingBehind) {
+  QueueLog log(&logger, 64 * 1024);
+  ASSERT_TRUE(log.open(dir, false));
+  uint64_t offset;
+  for (uint64_t i = 0; i < 10; i++) ASSERT_TRUE(append(&log, i, &offset));
+
+  // Files may only grow 2KiB, so a batch of 6KiB is partly written, whole records included, and then fails
+  struct stat st;
+  ASSERT_EQ(stat((dir + "/00000000000000000000.qlog").c_str(), &st), 0);
+  std::vector<std::string> batch;
+  for (uint64_t i = 0; i < 50; i++) batch.push_back(message(i) + std::string(100, 'y'));
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> lens;
+  for (const std::string& m : batch) {
+    data.push_back((const uint8_t*)m.data());
+    lens.push_back(m.size());
+  }
+  struct rlimit limit, saved;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+  limit = saved;
+  limit.rlim_cur = st.st_size + 2048;
+  sighandler_t handler = signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  bool appended = log.append(data.data(), lens.data(), data.size(), &offset);
+  setrlimit(RLIMIT_FSIZE, &saved);
+  signal(SIGXFSZ, handler);
+  EXPECT_FALSE(appended);
+
+  // The records that made it to disk before the failure do not come back on reopening
+  log.close();
+  QueueLog reopened(&logger, 64 * 1024);
+  ASSERT_TRUE(reopened.open(dir, false));
+  EXPECT_EQ(reopened.get_end_offset(), 10);
+  ASSERT_TRUE(append(&reopened, 10, &offset));
+  EXPECT_EQ(offset, 10);
+  EXPECT_EQ(read_all(&reopened, 0, 1 << 20).size(), 11);
+}
+
+TEST_F(QueueTest, SendsWithoutCopy) {
+  QueueLog log(&logger, 1 << 20);
+  ASSERT_TRUE(log.open(dir, false));
+  uint64_t offset;
+  for (uint64_t i = 0; i < 100; i++) ASSERT_TRUE(append(&log, i, &offset));
+
+  QueueSlice slice;
+  ASSERT_TRUE(log.fetch(10, 1 << 20, &slice));
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::vector<uint8_t> received;
+  std::thread reader([&] {
+    uint8_t buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[1], buffer, sizeof(buffer))) > 0) received.insert(received.end(), buffer, buffer + n);
+  });
+  ASSERT_TRUE(QueueLog::send_slice(slice, fds[0]));
+  close(fds[0]);
+  reader.join();
+  close(fds[1]);
+
+  EXPECT_EQ(received, std::vector<uint8_t>(slice.data(), slice.data() + slice.size()));
+}
+
+TEST_F(QueueTest, PartitionsAndConsumerGroups) {
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+  for (uint64_t id = 2; id <= 3; id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1 << 30);
+  LoopbackKVTransport transport;
+  std::vector<std::unique_ptr<KVLog>> logs;
+  for (uint64_t id = 1; id <= 3; id++) {
+    logs.emplace_back(new KVLog(&logger));
+    ASSERT_TRUE(logs.back()->open(dir + "/" + std::to_string(id) + ".log"));
+    transport.add_node(id, logs.back().get());
+  }
+  KVStore kv(&logger, &dbs, &transport);
+  Queue queue(&logger, &dbs, &kv, dir + "/queue");
+
+  EXPECT_FALSE(Queue::valid_name("bad/topic"));
+  EXPECT_FALSE(Queue::valid_name(".."));
+  EXPECT_TRUE(Queue::valid_name("orders.v1"));
+
+  // Partitions are spread over the nodes, and only this node's take appends here
+  uint32_t local = UINT32_MAX, remote = UINT32_MAX;
+  for (uint32_t partition = 0; partition < 64; partition++) {
+    if (queue.is_local("orders", partition)) {
+      if (local == UINT32_MAX) local = partition;
+    } else if (remote == UINT32_MAX) {
+      remote = partition;
+    }
+  }
+  ASSERT_NE(local, UINT32_MAX);
+  ASSERT_NE(remote, UINT32_MAX);
+  uint64_t offset;
+  EXPECT_FALSE(queue.produce("orders", remote, (const uint8_t*)"x", 1, &offset));
+
+  for (uint64_t i = 0; i < 10; i++) ASSERT_TRUE(queue.produce("orders", local, (const uint8_t*)message(i).data(), message(i).size(), &offset));
+
+  // A group without a committed offset starts at the beginning, then carries on from what it commits
+  QueueSlice slice;
+  QueueMessage msg;
+  ASSERT_TRUE(queue.poll("billing", "orders", local, 1, &slice));
+  ASSERT_TRUE(slice.next(&msg));
+  EXPECT_EQ(msg.offset, 0);
+  ASSERT_TRUE(queue.commit("billing", "orders", local, slice.get_next_offset()));
+
+  ASSERT_TRUE(queue.poll("billing", "orders", local, 1 << 20, &slice));
+  EXPECT_EQ(slice.get_first_offset(), 1);
+  EXPECT_EQ(slice.get_next_offset(), 10);
+  ASSERT_TRUE(queue.commit("billing", "orders", local, slice.get_next_offset()));
+  ASSERT_EQ(queue.get_committed("billing", "orders", local, &offset), KVStore::Result::Found);
+  EXPECT_EQ(offset, 10);
+
+  // Other groups have their own offsets
+  ASSERT_TRUE(queue.poll("audit", "orders", local, 1, &slice));
+  EXPECT_EQ(slice.get_first_offset(), 0);
+}
+
+}  // namespace KapuaTest
@@ -122,4 +122,26 @@ TEST_F(RSATest, EncryptAndDecryptAESContext) {
   EVP_PKEY_free(keyPair.privateKey);
 }
 
+TEST_F(RSATest, DecryptAESContextIgnoresOutSize) {
+  KeyPair keyPair;
+  ASSERT_TRUE(rsa->load_rsa_key_pair("fixtures/public.pem", "fixtures/private.pem", keyPair));
+
+  AESKey originalContext = generate_random_aes_context();
+  uint8_t buffer[2048 / 8];
+  size_t encryptedSize;
+  ASSERT_TRUE(rsa->encrypt_aes_context(&originalContext, keyPair.publicKey, buffer, sizeof(buffer), &encryptedSize));
+
+  // out_size is only an output, so whatever it held before must not matter
+  for (size_t before : {(size_t)0, sizeof(AESKey), (size_t)1 << 20}) {
+    AESKey decryptedContext;
+    size_t decryptedSize = before;
+    ASSERT_TRUE(rsa->decrypt_aes_context(&decryptedContext, keyPair.privateKey, buffer, encryptedSize, &decryptedSize));
+    EXPECT_EQ(decryptedSize, sizeof(AESKey));
+    EXPECT_EQ(memcmp(&originalContext, &decryptedContext, sizeof(AESKey)), 0);
+  }
+
+  EVP_PKEY_free(keyPair.publicKey);
+  EVP_PKEY_free(keyPair.privateKey);
+}
+
 }  // namespace KapuaTest
@@ -0,0 +1,139 @@
+#include "ReedSolomon.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+#include "ErasureCodedStore.hpp"
+#include "MemoryBlockTransport.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class ReedSolomonTest : public ::testing::Test {
+ protected:
+  std::vector<uint8_t> random_bytes(size_t len) {
+    std::vector<uint8_t> bytes(len);
+    std::mt19937 rng(len);
+    for (auto& b : bytes) b = (uint8_t)rng();
+    return bytes;
+  }
+};
+
+TEST_F(ReedSolomonTest, FieldInverse) {
+  for (int a = 1; a < 256; a++) {
+    EXPECT_EQ(ReedSolomon::gf_mul((uint8_t)a, ReedSolomon::gf_inv((uint8_t)a)), 1);
+  }
+}
+
+TEST_F(ReedSolomonTest, KernelsAgree) {
+  std::vector<uint8_t> src = random_bytes(1000);
+  for (int coef : {2, 7, 0x53, 0xff}) {
+    std::vector<uint8_t> expected(src.size(), 0);
+    ReedSolomon::gf_mul_add_region(ReedSolomon::Kernel::Scalar, (uint8_t)coef, src.data(), expected.data(), src.size());
+
+    for (ReedSolomon::Kernel kernel : {ReedSolomon::Kernel::SSSE3, ReedSolomon::Kernel::AVX2}) {
+      if (!ReedSolomon::is_kernel_supported(kernel)) continue;
+      std::vector<uint8_t> actual(src.size(), 0);
+      ReedSolomon::gf_mul_add_region(kernel, (uint8_t)coef, src.data(), actual.data(), src.size());
+      EXPECT_EQ(expected, actual) << ReedSolomon::kernel_to_string(kernel);
+    }
+  }
+}
+
+TEST_F(ReedSolomonTest, ReconstructFromAnyK) {
+  const size_t k = 4, m = 2, len = 333;
+  ReedSolomon rs(k, m);
+
+  std::vector<std::vector<uint8_t>> original(k + m);
+  std::vector<uint8_t*> ptrs(k + m);
+  for (size_t i = 0; i < k + m; i++) {
+    original[i] = i < k ? random_bytes(len + i) : std::vector<uint8_t>(len);
+    original[i].resize(len);
+    ptrs[i] = original[i].data();
+  }
+  rs.encode(ptrs.data(), ptrs.data() + k, len);
+
+  // Lose every pair of fragments in turn
+  for (size_t a = 0; a < k + m; a++) {
+    for (size_t b = a + 1; b < k + m; b++) {
+      std::vector<std::vector<uint8_t>> damaged = original;
+      bool present[k + m];
+      for (size_t i = 0; i < k + m; i++) {
+        present[i] = i != a && i != b;
+        if (!present[i]) std::fill(damaged[i].begin(), damaged[i].end(), 0);
+        ptrs[i] = damaged[i].data();
+      }
+      ASSERT_TRUE(rs.reconstruct(ptrs.data(), present, len));
+      EXPECT_EQ(damaged, original) << "lost " << a << " and " << b;
+    }
+  }
+}
+
+TEST_F(ReedSolomonTest, TooFewFragments) {
+  const size_t k = 3, m = 1, len = 64;
+  ReedSolomon rs(k, m);
+  std::vector<std::vector<uint8_t>> fragments(k + m, std::vector<uint8_t>(len));
+  std::vector<uint8_t*> ptrs(k + m);
+  for (size_t i = 0; i < k + m; i++) ptrs[i] = fragments[i].data();
+
+  bool present[k + m] = {true, false, false, true};
+  EXPECT_FALSE(rs.reconstruct(ptrs.data(), present, len));
+}
+
+TEST_F(ReedSolomonTest, InvalidParameters) {
+  EXPECT_TRUE(ReedSolomon::is_valid(1, 0));
+  EXPECT_TRUE(ReedSolomon::is_valid(200, 55));
+  EXPECT_FALSE(ReedSolomon::is_valid(0, 2));
+  EXPECT_FALSE(ReedSolomon::is_valid(200, 56));
+
+  // No data fragments, and too many fragments for distinct Cauchy points
+  ReedSolomon none(0, 2), wide(200, 100);
+  EXPECT_FALSE(none.is_valid());
+  EXPECT_FALSE(wide.is_valid());
+  std::vector<uint8_t> fragment(64);
+  std::vector<uint8_t*> ptrs(300, fragment.data());
+  bool present[300] = {};
+  EXPECT_FALSE(wide.reconstruct(ptrs.data(), present, fragment.size()));
+
+  ::testing::NiceMock<MockLogger> logger;
+  MemoryBlockTransport transport;
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+  EXPECT_CALL(logger, error(::testing::_)).Times(1);
+  ErasureCodedStore store(&logger, &dbs, &transport, 0, 2);
+  std::vector<uint8_t> block = random_bytes(1000);
+  EXPECT_FALSE(store.write_block(1, block.data(), block.size()));
+  EXPECT_EQ(transport.puts, 0);
+}
+
+TEST_F(ReedSolomonTest, ErasureCodedStoreDegradedRead) {
+  MockLogger logger;
+  MemoryBlockTransport transport;
+  DistributedBlockStore dbs(1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1 << 30);
+  for (uint64_t id = 2; id <= 6; id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1 << 30);
+
+  ErasureCodedStore store(&logger, &dbs, &transport, 4, 2);
+  std::vector<uint8_t> block = random_bytes(100000);
+  ASSERT_TRUE(store.write_block(0x1234, block.data(), block.size()));
+
+  std::vector<uint8_t> read;
+  ASSERT_TRUE(store.read_block(0x1234, &read));
+  EXPECT_EQ(read, block);
+
+  // Two of the six fragment holders go away
+  std::vector<uint64_t> nodes = dbs.get_dbs_preference_list(0x1234, 6);
+  transport.down[nodes[0]] = true;
+  transport.down[nodes[3]] = true;
+  read.clear();
+  ASSERT_TRUE(store.read_block(0x1234, &read));
+  EXPECT_EQ(read, block);
+
+  // A third is one too many
+  transport.down[nodes[5]] = true;
+  EXPECT_FALSE(store.read_block(0x1234, &read));
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,135 @@
+#include "ReplicationPipeline.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "MemoryBlockTransport.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+// Memory transport with a per-node delay, counting batched puts
+class SlowBlockTransport : public MemoryBlockTransport {
+ public:
+  bool put_block(uint64_t nodeId, uint64_t blockId, const uint8_t* data, size_t len) override {
+    auto it = delay_ms.find(nodeId);
+    if (it != delay_ms.end()) std::this_thread::sleep_for(std::chrono::milliseconds(it->second));
+    return MemoryBlockTransport::put_block(nodeId, blockId, data, len);
+  }
+
+  void put_blocks(uint64_t nodeId, const uint64_t* blockIds, const uint8_t* const* data, const size_t* lens, size_t count, bool* stored) override {
+    calls++;
+    MemoryBlockTransport::put_blocks(nodeId, blockIds, data, lens, count, stored);
+  }
+
+  std::map<uint64_t, int> delay_ms;
+  std::atomic<int> calls{0};
+};
+
+class ReplicationPipelineTest : public ::testing::Test {
+ protected:
+  MockLogger logger;
+  SlowBlockTransport transport;
+  DistributedBlockStore dbs{1, DistributedBlockStore::get_dbs_virtual_ids(1, 16), 1ULL << 30};
+
+  void SetUp() override {
+    for (uint64_t id = 2; id <= 5; id++) dbs.add_dbs_node(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1ULL << 30);
+  }
+};
+
+TEST_F(ReplicationPipelineTest, RequiredAcks) {
+  EXPECT_EQ(ReplicationPipeline::get_required_acks(ReplicationPipeline::Consistency::One, 5), 1);
+  EXPECT_EQ(ReplicationPipeline::get_required_acks(ReplicationPipeline::Consistency::Quorum, 5), 3);
+  EXPECT_EQ(ReplicationPipeline::get_required_acks(ReplicationPipeline::Consistency::Quorum, 2), 2);
+  EXPECT_EQ(ReplicationPipeline::get_required_acks(ReplicationPipeline::Consistency::All, 5), 5);
+}
+
+TEST_F(ReplicationPipelineTest, CountsUsageOfStoredCopies) {
+  std::vector<uint8_t> block(1000, 0x42);
+  ReplicationPipeline pipeline(&logger, &dbs, &transport);
+  ASSERT_TRUE(pipeline.write(7, block.data(), block.size(), ReplicationPipeline::Consistency::All));
+
+  // Every node holding a copy is charged for it, so placement sees the write before the next Ping
+  NodeLoad load;
+  for (uint64_t nodeId : dbs.get_dbs_nodes_for_block(7)) {
+    ASSERT_TRUE(dbs.get_dbs_node_load(nodeId, &load));
+    EXPECT_EQ(load.usage, 1000);
+  }
+  EXPECT_EQ(dbs.get_dbs_total_usage(), 5000);
+}
+
+TEST_F(ReplicationPipelineTest, QuorumDoesNotWaitForSlowReplicas) {
+  std::vector<uint8_t> block(1000, 0x42);
+  std::vector<uint64_t> nodes = dbs.get_dbs_nodes_for_block(7);
+  transport.delay_ms[nodes[3]] = 300;
+  transport.delay_ms[nodes[4]] = 300;
+
+  ReplicationPipeline pipeline(&logger, &dbs, &transport);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(pipeline.write(7, block.data(), block.size(), ReplicationPipeline::Consistency::Quorum));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+
+  // All waits for everyone
+  start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(pipeline.write(7, block.data(), block.size(), ReplicationPipeline::Consistency::All));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+}
+
+TEST_F(ReplicationPipelineTest, QuorumFailure) {
+  std::vector<uint8_t> block(100, 1);
+  std::vector<uint64_t> nodes = dbs.get_dbs_nodes_for_block(9);
+  for (size_t i = 0; i < 3; i++) transport.down[nodes[i]] = true;
+
+  // Each write fails on the same three replicas
+  EXPECT_CALL(logger, warn(::testing::_)).Times(6);
+  ReplicationPipeline pipeline(&logger, &dbs, &transport);
+  EXPECT_FALSE(pipeline.write(9, block.data(), block.size(), ReplicationPipeline::Consistency::Quorum));
+  EXPECT_TRUE(pipeline.write(9, block.data(), block.size(), ReplicationPipeline::Consistency::One));
+}
+
+TEST_F(ReplicationPipelineTest, WriteBackCoalescesSmallWrites) {
+  // One worker, and a slow first write so the rest queue up behind it
+  ReplicationPipeline pipeline(&logger, &dbs, &transport, 1, 1 << 20);
+  for (uint64_t id = 1; id <= 5; id++) transport.delay_ms[id] = 20;
+
+  std::vector<uint8_t> block(512, 0x11), read;
+  for (uint64_t blockId = 100; blockId < 200; blockId++) ASSERT_TRUE(pipeline.write_back(blockId, block.data(), block.size()));
+  EXPECT_TRUE(pipeline.read_buffered(150, &read) || transport.has_block(dbs.get_dbs_nodes_for_block(150)[0], 150));
+
+  pipeline.flush();
+  EXPECT_EQ(pipeline.get_dirty_bytes(), 0);
+  EXPECT_FALSE(pipeline.read_buffered(150, &read));
+  EXPECT_EQ(transport.puts, 500);
+  EXPECT_LT(transport.calls, 500);
+  EXPECT_GT(pipeline.get_batches(), 0);
+}
+
+TEST_F(ReplicationPipelineTest, DirtyBufferIsBounded) {
+  ReplicationPipeline pipeline(&logger, &dbs, &transport, 2, 64 * 1024);
+  for (uint64_t id = 1; id <= 5; id++) transport.delay_ms[id] = 5;
+
+  std::atomic<size_t> peak(0);
+  std::atomic<bool> writing(true);
+  std::thread monitor([&] {
+    while (writing) {
+      peak = std::max(peak.load(), pipeline.get_dirty_bytes());
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+
+  std::vector<uint8_t> block(16 * 1024, 0x22);
+  for (uint64_t blockId = 0; blockId < 40; blockId++) ASSERT_TRUE(pipeline.write_back(blockId, block.data(), block.size()));
+  pipeline.flush();
+  writing = false;
+  monitor.join();
+
+  EXPECT_LE(peak, 64 * 1024);
+  EXPECT_EQ(transport.puts, 200);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,88 @@
+#include "Simulator.hpp"
+
+#include <gtest/gtest.h>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class SimulatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    config.reset(new Config(&mockLogger));
+    config->local_discovery_enable = true;
+    config->local_discovery_interval_ms = 1000;
+    config->server_ping_interval_ms = 1000;
+    config->storage_anti_entropy_interval_ms = 1000 * 1000;
+
+    options.nodes = 12;
+    options.segment_size = 4;
+    options.seeds = 1;
+    options.keys = 2;
+  }
+
+  ::testing::NiceMock<MockLogger> mockLogger;
+  std::unique_ptr<Config> config;
+  Simulator::Options options;
+};
+
+TEST_F(SimulatorTest, ClusterConverges) {
+  Simulator sim(&mockLogger, config.get(), options);
+  ASSERT_TRUE(sim.start());
+  ASSERT_TRUE(sim.run_until_converged(60 * 1000));
+
+  Simulator::Stats stats = sim.get_stats();
+  EXPECT_EQ(stats.nodes_started, 12);
+  EXPECT_EQ(stats.nodes_placed, 12);
+  EXPECT_GE(stats.discovered_ms, 0);
+  EXPECT_LE(stats.discovered_ms, stats.connected_ms);
+  EXPECT_LE(stats.connected_ms, stats.placed_ms);
+  EXPECT_EQ(stats.datagrams_lost, 0);
+  EXPECT_GT(sim.get_metrics()->counter("kapua_udp_rx_packets_total", "", "type=\"Ready\"")->get(), 0);
+}
+
+TEST_F(SimulatorTest, RunsRepeatExactly) {
+  options.jitter_us = 5000;
+  Simulator first(&mockLogger, config.get(), options);
+  Simulator second(&mockLogger, config.get(), options);
+  ASSERT_TRUE(first.start());
+  ASSERT_TRUE(second.start());
+  first.run_until(20 * 1000);
+  second.run_until(20 * 1000);
+
+  Simulator::Stats a = first.get_stats(), b = second.get_stats();
+  EXPECT_EQ(a.connected_ms, b.connected_ms);
+  EXPECT_EQ(a.placed_ms, b.placed_ms);
+  EXPECT_EQ(a.datagrams_sent, b.datagrams_sent);
+  EXPECT_EQ(a.bytes_sent, b.bytes_sent);
+}
+
+TEST_F(SimulatorTest, LosesDatagrams) {
+  options.loss = 0.5;
+  Simulator sim(&mockLogger, config.get(), options);
+  ASSERT_TRUE(sim.start());
+  sim.run_until(10 * 1000);
+
+  Simulator::Stats stats = sim.get_stats();
+  EXPECT_EQ(stats.time_ms, 10 * 1000);
+  EXPECT_GT(stats.datagrams_lost, (stats.datagrams_lost + stats.datagrams_delivered) / 4);
+  EXPECT_LT(stats.datagrams_lost, (stats.datagrams_lost + stats.datagrams_delivered) * 3 / 4);
+}
+
+TEST_F(SimulatorTest, LimitsBandwidth) {
+  Simulator fast(&mockLogger, config.get(), options);
+  ASSERT_TRUE(fast.start());
+  ASSERT_TRUE(fast.run_until_converged(60 * 1000));
+
+  // A public key takes most of a second at this rate
+  options.bandwidth = 200;
+  Simulator slow(&mockLogger, config.get(), options);
+  ASSERT_TRUE(slow.start());
+  ASSERT_TRUE(slow.run_until_converged(120 * 1000));
+
+  EXPECT_GT(slow.get_stats().connected_ms, fast.get_stats().connected_ms + 1000);
+}
+
+}  // namespace KapuaTest
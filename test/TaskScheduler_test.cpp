@@ -0,0 +1,206 @@
+#include "TaskScheduler.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "ComputeTransport.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class TaskSchedulerTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+
+  std::vector<std::unique_ptr<DistributedBlockStore>> stores;
+  std::vector<std::unique_ptr<TaskScheduler>> schedulers;
+  LoopbackComputeTransport transport;
+
+  // Tasks waiting on the gate
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool open = true;
+  int running = 0;
+  int most_running = 0;
+
+  // Every node is on every other node's ring and knows every other node's capacity. Each node's "where" kernel
+  // answers with its node ID.
+  void start_cluster(uint64_t nodes, size_t threads) {
+    for (uint64_t id = 1; id <= nodes; id++) {
+      stores.emplace_back(new DistributedBlockStore(id, DistributedBlockStore::get_dbs_virtual_ids(id, 16), 1 << 30));
+      for (uint64_t other = 1; other <= nodes; other++) {
+        if (other != id) stores.back()->add_dbs_node(other, DistributedBlockStore::get_dbs_virtual_ids(other, 16), 1 << 30);
+      }
+      schedulers.emplace_back(new TaskScheduler(&logger, stores.back().get(), nodes > 1 ? &transport : nullptr, threads));
+      transport.add_node(id, schedulers.back().get());
+
+      schedulers.back()->register_kernel("where", [id, this](const ComputeTask&, std::vector<uint8_t>* result) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          running++;
+          most_running = std::max(most_running, running);
+          changed.notify_all();
+          changed.wait(lock, [this] { return open; });
+          running--;
+        }
+        result->resize(sizeof(id));
+        std::memcpy(result->data(), &id, sizeof(id));
+        return true;
+      });
+    }
+    for (uint64_t id = 1; id <= nodes; id++) {
+      for (uint64_t other = 1; other <= nodes; other++) schedulers[id - 1]->update_node_capacity(other, threads, 0);
+    }
+  }
+
+  void set_gate(bool isOpen) {
+    std::lock_guard<std::mutex> lock(mutex);
+    open = isOpen;
+    changed.notify_all();
+  }
+
+  void wait_running(int count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return running == count; });
+  }
+
+  // Submit a task and wait for the node it ran on, or 0 if it failed
+  uint64_t run(TaskScheduler* scheduler, const ComputeTask& task) {
+    std::mutex m;
+    std::condition_variable cv;
+    bool done = false;
+    uint64_t node = 0;
+    scheduler->submit(task, [&](bool ok, std::vector<uint8_t>* result) {
+      std::lock_guard<std::mutex> lock(m);
+      if (ok) std::memcpy(&node, result->data(), sizeof(node));
+      done = true;
+      cv.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] { return done; });
+    return node;
+  }
+};
+
+TEST_F(TaskSchedulerTest, PlacesNearData) {
+  start_cluster(8, 2);
+  TaskScheduler* scheduler = schedulers[0].get();
+
+  for (uint64_t i = 0; i < 50; i++) {
+    ComputeTask task;
+    task.kernel = "where";
+    for (uint64_t j = 0; j < 3; j++) task.inputs.push_back((i * 3 + j) * 0x9e3779b97f4a7c15ULL);
+
+    // Each node's share of the task's inputs
+    std::map<uint64_t, int> held;
+    int most = 0;
+    for (uint64_t block : task.inputs) {
+      for (uint64_t node : stores[0]->get_dbs_preference_list(block, KAPUA_DBS_REPLICAS)) most = std::max(most, ++held[node]);
+    }
+
+    uint64_t node = run(scheduler, task);
+    ASSERT_NE(node, 0);
+    EXPECT_EQ(held[node], most) << "task " << i << " ran on " << node;
+  }
+  EXPECT_EQ(scheduler->get_placed(), 50);
+  EXPECT_EQ(scheduler->get_placed_near_data(), 50);
+}
+
+TEST_F(TaskSchedulerTest, NeverOverCommits) {
+  start_cluster(1, 2);
+  TaskScheduler* scheduler = schedulers[0].get();
+
+  set_gate(false);
+  std::atomic<int> finished(0);
+  ComputeTask task;
+  task.kernel = "where";
+  for (int i = 0; i < 6; i++) scheduler->submit(task, [&](bool ok, std::vector<uint8_t>*) { finished += ok; });
+
+  // Two run, the rest wait their turn
+  wait_running(2);
+  EXPECT_EQ(scheduler->get_pending_count(), 4);
+  uint32_t slots, busy;
+  scheduler->get_my_capacity(&slots, &busy);
+  EXPECT_EQ(slots, 2);
+  EXPECT_EQ(busy, 2);
+
+  set_gate(true);
+  scheduler->get_pool()->wait();
+  EXPECT_EQ(finished, 6);
+  EXPECT_EQ(most_running, 2);
+  EXPECT_EQ(scheduler->get_pending_count(), 0);
+  scheduler->get_my_capacity(&slots, &busy);
+  EXPECT_EQ(busy, 0);
+}
+
+TEST_F(TaskSchedulerTest, RespectsRemoteLoad) {
+  start_cluster(2, 1);
+  TaskScheduler* scheduler = schedulers[0].get();
+
+  // Node 2 says it is full, so everything runs here, one at a time
+  scheduler->update_node_capacity(2, 1, 1);
+  ComputeTask task;
+  task.kernel = "where";
+  for (int i = 0; i < 5; i++) EXPECT_EQ(run(scheduler, task), 1);
+
+  // With this node busy and node 2 free again, work goes there
+  set_gate(false);
+  scheduler->submit(task, [](bool, std::vector<uint8_t>*) {});
+  scheduler->update_node_capacity(2, 1, 0);
+  std::atomic<uint64_t> node(0);
+  scheduler->submit(task, [&](bool ok, std::vector<uint8_t>* result) {
+    if (ok) node = *(uint64_t*)result->data();
+  });
+
+  // And nothing more can start anywhere until those end
+  ComputeCapacity capacity;
+  ASSERT_TRUE(scheduler->get_node_capacity(2, &capacity));
+  EXPECT_EQ(capacity.assigned, 1);
+  scheduler->submit(task, [](bool, std::vector<uint8_t>*) {});
+  EXPECT_EQ(scheduler->get_pending_count(), 1);
+
+  set_gate(true);
+  while (scheduler->get_pending_count() || scheduler->get_pool()->get_outstanding() || schedulers[1]->get_pool()->get_outstanding()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  schedulers[1]->get_pool()->wait();
+  EXPECT_EQ(node, 2);
+}
+
+TEST_F(TaskSchedulerTest, Failures) {
+  start_cluster(2, 1);
+  TaskScheduler* scheduler = schedulers[0].get();
+
+  // Unknown kernels fail
+  ComputeTask task;
+  task.kernel = "missing";
+  EXPECT_CALL(logger, error(::testing::_)).Times(1);
+  EXPECT_EQ(run(scheduler, task), 0);
+  EXPECT_FALSE(schedulers[1]->run_local(task, [](bool, std::vector<uint8_t>*) {}));
+
+  // As do tasks sent to a node that cannot be reached. With this node busy, the next task goes to node 2.
+  task.kernel = "where";
+  set_gate(false);
+  scheduler->submit(task, [](bool, std::vector<uint8_t>*) {});
+  transport.set_node_down(2, true);
+  EXPECT_CALL(logger, warn(::testing::_)).Times(1);
+  EXPECT_EQ(run(scheduler, task), 0);
+
+  ComputeCapacity capacity;
+  ASSERT_TRUE(scheduler->get_node_capacity(2, &capacity));
+  EXPECT_EQ(capacity.assigned, 0);
+  set_gate(true);
+  scheduler->get_pool()->wait();
+}
+
+}  // namespace KapuaTest
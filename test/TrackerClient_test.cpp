@@ -0,0 +1,216 @@
+#include "TrackerClient.hpp"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "MockLogger.hpp"
+#include "Util.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+// A tracker on loopback that answers every announce with the same peers, unless it is told to stay quiet
+class StandInTracker {
+ public:
+  std::vector<TrackerClient::PeerRecord> peers;
+  std::atomic<bool> quiet;
+  std::atomic<int> requests;
+  TrackerClient::Request last_request;
+
+  StandInTracker() : quiet(false), requests(0), _running(true) {
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(_fd, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(_fd, (sockaddr*)&addr, &len);
+    _port = ntohs(addr.sin_port);
+    _thread = std::thread(&StandInTracker::_loop, this);
+  }
+
+  ~StandInTracker() {
+    _running = false;
+    _thread.join();
+    close(_fd);
+  }
+
+  std::string address() { return "127.0.0.1:" + std::to_string(_port); }
+
+ protected:
+  int _fd;
+  uint16_t _port;
+  std::atomic<bool> _running;
+  std::thread _thread;
+
+  void _loop() {
+    while (_running) {
+      pollfd pfd = {_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 10) <= 0) continue;
+
+      TrackerClient::Request request;
+      sockaddr_in from;
+      socklen_t fromLen = sizeof(from);
+      if (recvfrom(_fd, &request, sizeof(request), 0, (sockaddr*)&from, &fromLen) != sizeof(request)) continue;
+      if (!TrackerClient::check_magic(request.magic) || request.type != TrackerClient::TYPE_ANNOUNCE) continue;
+      last_request = request;
+      requests++;
+      if (quiet) continue;
+
+      std::vector<uint8_t> reply(sizeof(TrackerClient::ReplyHeader));
+      TrackerClient::ReplyHeader header;
+      TrackerClient::write_magic(header.magic);
+      header.type = TrackerClient::TYPE_PEERS;
+      header.reserved = 0;
+      header.count = std::min<size_t>(peers.size(), request.wanted);
+      header.transaction = request.transaction;
+      std::memcpy(reply.data(), &header, sizeof(header));
+      reply.insert(reply.end(), (uint8_t*)peers.data(), (uint8_t*)(peers.data() + header.count));
+      sendto(_fd, reply.data(), reply.size(), 0, (sockaddr*)&from, fromLen);
+    }
+  }
+};
+
+class TrackerClientTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+  std::string dir;
+  TrackerOptions options;
+
+  void SetUp() override {
+    char path[] = "/tmp/kapua_tracker_XXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+    dir = path;
+    options.timeout_ms = 50;
+    options.min_backoff_ms = 10;
+    options.max_backoff_ms = 40;
+  }
+
+  void TearDown() override { system(("rm -rf " + dir).c_str()); }
+
+  void add_peers(StandInTracker* tracker, uint64_t count) {
+    for (uint64_t id = 1; id <= count; id++) tracker->peers.push_back({id, htonl(0x0a000000 + id), htons(11840)});
+  }
+};
+
+TEST_F(TrackerClientTest, OneRoundTrip) {
+  StandInTracker tracker;
+  add_peers(&tracker, 200);
+  TrackerClient client(&logger, {tracker.address()}, dir + "/peers", options);
+
+  std::vector<TrackerPeer> peers;
+  ASSERT_TRUE(client.announce(0x1234, 11840, &peers));
+
+  // A single request fills the node table
+  EXPECT_EQ(tracker.requests, 1);
+  EXPECT_EQ(tracker.last_request.node_id, 0x1234);
+  EXPECT_EQ(ntohs(tracker.last_request.port), 11840);
+  ASSERT_EQ(peers.size(), KAPUA_TRACKER_MAX_PEERS);
+  EXPECT_EQ(peers[0].id, 1);
+  EXPECT_EQ(Util::sockaddr_to_string(peers[0].addr), "10.0.0.1:11840");
+}
+
+TEST_F(TrackerClientTest, FirstTrackerToAnswer) {
+  StandInTracker quiet, tracker;
+  quiet.quiet = true;
+  add_peers(&tracker, 5);
+  TrackerClient client(&logger, {"tracker.invalid", quiet.address(), tracker.address()}, dir + "/peers", options);
+
+  // Unresolvable and silent trackers don't hold up the answer
+  std::vector<TrackerPeer> peers;
+  ASSERT_TRUE(client.announce(0x1234, 11840, &peers));
+  EXPECT_EQ(peers.size(), 5);
+  EXPECT_EQ(quiet.requests, 1);
+}
+
+TEST_F(TrackerClientTest, WarmStartFromCache) {
+  StandInTracker tracker;
+  add_peers(&tracker, 20);
+
+  std::mutex mutex;
+  std::vector<TrackerPeer> received;
+  auto collect = [&](const std::vector<TrackerPeer>& peers) {
+    std::lock_guard<std::mutex> lock(mutex);
+    received.insert(received.end(), peers.begin(), peers.end());
+  };
+  auto count = [&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    return received.size();
+  };
+
+  {
+    TrackerClient client(&logger, {tracker.address()}, dir + "/peers", options);
+    ASSERT_TRUE(client.start(0x1234, 11840, collect));
+    while (count() < 20) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // With the tracker gone, a restarted node still has its peers straight away
+  tracker.quiet = true;
+  received.clear();
+  TrackerClient client(&logger, {tracker.address()}, dir + "/peers", options);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(client.start(0x1234, 11840, collect));
+  while (count() < 20) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(options.timeout_ms));
+  EXPECT_EQ(received[0].addr.sin_addr.s_addr, htonl(0x0a000001));
+}
+
+TEST_F(TrackerClientTest, BacksOff) {
+  StandInTracker tracker;
+  tracker.quiet = true;
+  add_peers(&tracker, 3);
+
+  std::atomic<int> calls(0);
+  TrackerClient client(&logger, {tracker.address()}, dir + "/peers", options);
+  ASSERT_TRUE(client.start(0x1234, 11840, [&](const std::vector<TrackerPeer>&) { calls++; }));
+
+  // Retries slow down, up to the limit
+  while (client.get_failures() < 5) {
+    EXPECT_LE(client.get_backoff_ms(), options.max_backoff_ms);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_GE(client.get_backoff_ms(), options.max_backoff_ms / 2);
+  EXPECT_EQ(calls, 0);
+
+  // And the tracker is picked up again once it answers
+  tracker.quiet = false;
+  while (calls == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_EQ(client.get_failures(), 0);
+  EXPECT_EQ(client.get_backoff_ms(), 0);
+}
+
+TEST_F(TrackerClientTest, CacheMerges) {
+  options.cache_max_peers = 3;
+  TrackerClient client(&logger, {}, dir + "/peers", options);
+
+  std::vector<TrackerPeer> peers;
+  EXPECT_FALSE(client.load_cache(&peers));
+
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  ASSERT_TRUE(client.update_cache({{1, addr, now - 30}, {2, addr, now - 20}, {3, addr, now - 10}}));
+  // A newer sighting replaces an older one, the oldest peer is dropped, and stale peers are never loaded
+  addr.sin_port = htons(1);
+  ASSERT_TRUE(client.update_cache({{1, addr, now}, {4, addr, now - 5}, {5, addr, now - options.cache_max_age_s - 1}}));
+
+  ASSERT_TRUE(client.load_cache(&peers));
+  ASSERT_EQ(peers.size(), 3);
+  EXPECT_EQ(peers[0].id, 1);
+  EXPECT_EQ(peers[0].addr.sin_port, htons(1));
+  EXPECT_EQ(peers[1].id, 4);
+  EXPECT_EQ(peers[2].id, 3);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,155 @@
+#include "UDPNetwork.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "MemoryTransport.hpp"
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class UDPNetworkTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    config.reset(new Config(&mockLogger));
+    config->local_discovery_enable = true;
+    config->local_discovery_interval_ms = 50;
+    config->server_ping_interval_ms = 50;
+    config->server_node_timeout_ms = 500;
+
+    ASSERT_TRUE(Kapua::RSA(&mockLogger, config.get()).load_rsa_key_pair("fixtures/public.pem", "fixtures/private.pem", keys));
+    for (int i = 0; i < 2; i++) {
+      rsa[i].reset(new Kapua::RSA(&mockLogger, config.get()));
+      core[i].reset(new Core(&mockLogger, config.get(), rsa[i].get()));
+      core[i]->_keys = keys;
+      core[i]->start_simulated(i + 1);
+      transport[i].reset(new MemoryTransport(&memory, 0x0a000001 + i));
+      network[i].reset(new UDPNetwork(&mockLogger, config.get(), core[i].get(), rsa[i].get(), transport[i].get()));
+    }
+  }
+
+  void TearDown() override {
+    for (int i = 0; i < 2; i++) {
+      network[i].reset();
+      core[i].reset();
+    }
+    EVP_PKEY_free(keys.publicKey);
+    EVP_PKEY_free(keys.privateKey);
+  }
+
+  // Waits for the given core to have placed the other node on its ring
+  bool wait_placed(int i, int timeoutMs) {
+    for (int waited = 0; waited < timeoutMs; waited += 10) {
+      if (core[i]->get_block_store()->has_dbs_node(2 - i)) return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+
+  ::testing::NiceMock<MockLogger> mockLogger;
+  std::unique_ptr<Config> config;
+  KeyPair keys;
+  MemoryNetwork memory;
+  std::unique_ptr<Kapua::RSA> rsa[2];
+  std::unique_ptr<Core> core[2];
+  std::unique_ptr<MemoryTransport> transport[2];
+  std::unique_ptr<UDPNetwork> network[2];
+};
+
+TEST_F(UDPNetworkTest, NodesConnectOverTransport) {
+  ASSERT_TRUE(network[0]->start(9999));
+  ASSERT_TRUE(network[1]->start(9999));
+
+  // A node is placed on the ring by its first ping, which only goes to connected nodes
+  EXPECT_TRUE(wait_placed(0, 5000));
+  EXPECT_TRUE(wait_placed(1, 5000));
+  ASSERT_NE(core[0]->find_node(2), nullptr);
+  EXPECT_EQ(core[0]->find_node(2)->state, Node::State::Connected);
+  EXPECT_EQ(core[0]->find_node(2)->addr.sin_addr.s_addr, transport[1]->get_addr().sin_addr.s_addr);
+
+  EXPECT_TRUE(network[0]->stop());
+  EXPECT_TRUE(network[1]->stop());
+  EXPECT_EQ(memory.get_dropped(), 0);
+}
+
+TEST_F(UDPNetworkTest, QuietNodesExpire) {
+  ASSERT_TRUE(network[0]->start(9999));
+  ASSERT_TRUE(network[1]->start(9999));
+  ASSERT_TRUE(wait_placed(0, 5000));
+
+  // Once node 2 stops, node 1 forgets it and takes it off the ring when it times out
+  EXPECT_TRUE(network[1]->stop());
+  for (int waited = 0; waited < 5000 && core[0]->get_block_store()->has_dbs_node(2); waited += 10) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(core[0]->get_block_store()->has_dbs_node(2));
+  EXPECT_EQ(core[0]->find_node(2), nullptr);
+
+  EXPECT_TRUE(network[0]->stop());
+}
+
+TEST_F(UDPNetworkTest, DropsPacketsShorterThanTheirLength) {
+  MetricCounter* rejected = core[0]->get_metrics()->counter("kapua_udp_rejected_packets_total", "Packets received and dropped, by reason", "reason=\"short\"");
+  ASSERT_TRUE(network[0]->start(9999));
+  MemoryTransport peer(&memory, 0x0a000003);
+  ASSERT_TRUE(peer.open(9999));
+  // The node is listening once its discovery broadcasts arrive
+  ASSERT_TRUE(peer.wait(5000000));
+
+  // A header that claims a payload it doesn't carry
+  Packet pkt(Packet::Ping, 3, 1);
+  pkt.length = KAPUA_MAX_DATA_SIZE;
+  Transport::Datagram datagram = {(uint8_t*)&pkt, KAPUA_HEADER_SIZE + 16, transport[0]->get_addr()};
+  ASSERT_EQ(peer.send(&datagram, 1), 1);
+  for (int waited = 0; waited < 5000 && rejected->get() == 0; waited += 10) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(rejected->get(), 1);
+  EXPECT_EQ(core[0]->find_node(3), nullptr);
+
+  // The same packet with a length that fits is taken, and its sender added
+  pkt.length = 16;
+  ASSERT_EQ(peer.send(&datagram, 1), 1);
+  for (int waited = 0; waited < 5000 && !core[0]->find_node(3); waited += 10) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_NE(core[0]->find_node(3), nullptr);
+  EXPECT_EQ(rejected->get(), 1);
+
+  EXPECT_TRUE(network[0]->stop());
+}
+
+TEST_F(UDPNetworkTest, IgnoresBytesPastTheLength) {
+  MetricCounter* pings = core[0]->get_metrics()->counter("kapua_udp_rx_packets_total", "Packets received and accepted, by type", "type=\"Ping\"");
+  ASSERT_TRUE(network[0]->start(9999));
+  MemoryTransport peer(&memory, 0x0a000003);
+  ASSERT_TRUE(peer.open(9999));
+  ASSERT_TRUE(peer.wait(5000000));
+  Node* node = core[0]->add_node(3, peer.get_addr());
+  node->update_last_contact(transport[0]->now());
+  node->state = Node::State::Connected;
+  DistributedBlockStore* dbs = core[0]->get_block_store();
+  uint64_t ownCapacity = dbs->get_dbs_total_capacity();
+
+  // A ping with a load report places its sender
+  Packet pkt(Packet::Ping, 3, 1);
+  NodeLoadReport report;
+  report.capacity = 1 << 20;
+  ASSERT_TRUE(pkt.write_load_report(&report));
+  size_t size = KAPUA_HEADER_SIZE + pkt.length;
+  Transport::Datagram datagram = {(uint8_t*)&pkt, size, transport[0]->get_addr()};
+  ASSERT_EQ(peer.send(&datagram, 1), 1);
+
+  // The same ping with a length that leaves the report out is an empty ping, whatever else arrived with it
+  report.capacity = 1 << 30;
+  ASSERT_TRUE(pkt.write_load_report(&report));
+  pkt.length = 0;
+  ASSERT_EQ(peer.send(&datagram, 1), 1);
+  // And a third, which is counted only once the second has been handled
+  ASSERT_EQ(peer.send(&datagram, 1), 1);
+
+  for (int waited = 0; waited < 5000 && pings->get() < 3; waited += 10) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(pings->get(), 3);
+  EXPECT_EQ(dbs->get_dbs_total_capacity(), ownCapacity + (1 << 20));
+
+  EXPECT_TRUE(network[0]->stop());
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,343 @@
+#include "Wire.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Config.hpp"
+#include "MockLogger.hpp"
+#include "Protocol.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+static std::vector<uint8_t> varint(uint64_t value) {
+  uint8_t buffer[KAPUA_WIRE_MAX_VARINT];
+  WireWriter writer(buffer, sizeof(buffer));
+  writer.put_varint(value);
+  return std::vector<uint8_t>(buffer, buffer + writer.size());
+}
+
+TEST(WireTest, WritesLittleEndian) {
+  uint8_t buffer[15];
+  WireWriter writer(buffer, sizeof(buffer));
+  writer.put_u8(0x01);
+  writer.put_u16(0x0302);
+  writer.put_u32(0x07060504);
+  writer.put_u64(0x0f0e0d0c0b0a0908);
+  ASSERT_TRUE(writer.ok());
+  ASSERT_EQ(writer.size(), 15);
+  for (int i = 0; i < 15; i++) EXPECT_EQ(buffer[i], i + 1);
+
+  WireReader reader(buffer, sizeof(buffer));
+  EXPECT_EQ(reader.get_u8(), 0x01);
+  EXPECT_EQ(reader.get_u16(), 0x0302);
+  EXPECT_EQ(reader.get_u32(), 0x07060504);
+  EXPECT_EQ(reader.get_u64(), 0x0f0e0d0c0b0a0908);
+  EXPECT_TRUE(reader.ok());
+  EXPECT_EQ(reader.remaining(), 0);
+}
+
+TEST(WireTest, EncodesVarints) {
+  EXPECT_EQ(varint(0), std::vector<uint8_t>({0x00}));
+  EXPECT_EQ(varint(127), std::vector<uint8_t>({0x7f}));
+  EXPECT_EQ(varint(128), std::vector<uint8_t>({0x80, 0x01}));
+  EXPECT_EQ(varint(300), std::vector<uint8_t>({0xac, 0x02}));
+  EXPECT_EQ(varint(UINT64_MAX), std::vector<uint8_t>({0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01}));
+
+  for (int bit = 0; bit < 64; bit++) {
+    for (uint64_t value : {(1ULL << bit) - 1, 1ULL << bit, (1ULL << bit) + 1}) {
+      std::vector<uint8_t> encoded = varint(value);
+      WireReader reader(encoded.data(), encoded.size());
+      EXPECT_EQ(reader.get_varint(), value);
+      EXPECT_TRUE(reader.ok());
+      EXPECT_EQ(reader.remaining(), 0);
+    }
+  }
+}
+
+TEST(WireTest, RejectsBadVarints) {
+  // Cut short
+  uint8_t truncated[] = {0x80, 0x80};
+  WireReader reader(truncated, sizeof(truncated));
+  EXPECT_EQ(reader.get_varint(), 0);
+  EXPECT_FALSE(reader.ok());
+
+  // More than 64 bits
+  uint8_t tooBig[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02};
+  reader = WireReader(tooBig, sizeof(tooBig));
+  EXPECT_EQ(reader.get_varint(), 0);
+  EXPECT_FALSE(reader.ok());
+
+  // More than ten bytes
+  uint8_t tooLong[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00};
+  reader = WireReader(tooLong, sizeof(tooLong));
+  EXPECT_EQ(reader.get_varint(), 0);
+  EXPECT_FALSE(reader.ok());
+}
+
+TEST(WireTest, StopsAtTheEnd) {
+  uint8_t buffer[10];
+  WireWriter writer(buffer, sizeof(buffer));
+  writer.put_u64(1);
+  writer.put_u32(2);
+  writer.put_u8(3);
+  EXPECT_FALSE(writer.ok());
+  EXPECT_EQ(writer.size(), 8);
+  EXPECT_EQ(writer.reserve(1), nullptr);
+
+  WireReader reader(buffer, 8);
+  EXPECT_EQ(reader.get_u32(), 1);
+  EXPECT_EQ(reader.get_u64(), 0);
+  EXPECT_FALSE(reader.ok());
+  // Everything after fails too, even what would have fitted
+  EXPECT_EQ(reader.get_u8(), 0);
+  EXPECT_EQ(reader.get_bytes(0), nullptr);
+  EXPECT_EQ(reader.remaining(), 0);
+}
+
+TEST(WireTest, ViewsIdArrays) {
+  uint64_t ids[] = {1, KAPUA_ID_BROADCAST, 0x0123456789abcdef};
+  uint8_t buffer[64];
+  WireWriter writer(buffer, sizeof(buffer));
+  writer.put_ids(ids, 3);
+  writer.put_u8(0xaa);
+  ASSERT_TRUE(writer.ok());
+  EXPECT_EQ(writer.size(), 1 + 3 * 8 + 1);
+
+  WireReader reader(buffer, writer.size());
+  WireIds view = reader.get_ids();
+  ASSERT_EQ(view.size(), 3);
+  for (size_t i = 0; i < 3; i++) EXPECT_EQ(view[i], ids[i]);
+  EXPECT_EQ(reader.get_u8(), 0xaa);
+  EXPECT_TRUE(reader.ok());
+
+  // A count larger than what follows
+  buffer[0] = 4;
+  reader = WireReader(buffer, writer.size());
+  EXPECT_TRUE(reader.get_ids().empty());
+  EXPECT_FALSE(reader.ok());
+}
+
+TEST(WireTest, SkipsUnknownExtensions) {
+  uint8_t buffer[64];
+  WireWriter writer(buffer, sizeof(buffer));
+  writer.put_u32(7);
+  writer.put_extension(1, "one", 3);
+  writer.put_extension(1000, "unknown", 7);
+  writer.put_extension(2, "", 0);
+  ASSERT_TRUE(writer.ok());
+
+  WireReader reader(buffer, writer.size());
+  EXPECT_EQ(reader.get_u32(), 7);
+  std::vector<uint64_t> types;
+  uint64_t type;
+  WireReader value;
+  while (reader.get_extension(&type, &value)) {
+    types.push_back(type);
+    if (type == 1) {
+      EXPECT_EQ(std::string((const char*)value.get_bytes(3), 3), "one");
+    }
+  }
+  EXPECT_TRUE(reader.ok());
+  EXPECT_EQ(types, std::vector<uint64_t>({1, 1000, 2}));
+
+  // One whose length runs past the end
+  reader = WireReader(buffer, writer.size() - 10);
+  reader.get_u32();
+  EXPECT_TRUE(reader.get_extension(&type, &value));
+  EXPECT_FALSE(reader.get_extension(&type, &value));
+  EXPECT_FALSE(reader.ok());
+}
+
+// Random bytes read as random fields must never be read past, whatever they say
+TEST(WireTest, FuzzReadsStayInBounds) {
+  std::mt19937 rng(1);
+  for (int round = 0; round < 20000; round++) {
+    // Exactly sized, so a read past the end would be past the allocation
+    size_t size = rng() % 65;
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+    for (size_t i = 0; i < size; i++) buffer[i] = rng() % 4 ? rng() : (rng() % 2 ? 0x80 : 0xff);
+    const uint8_t* end = buffer.get() + size;
+
+    WireReader reader(buffer.get(), size);
+    while (reader.ok() && reader.remaining()) {
+      size_t before = reader.remaining();
+      switch (rng() % 6) {
+        case 0:
+          reader.get_u16();
+          break;
+        case 1:
+          reader.get_u64();
+          break;
+        case 2:
+          reader.get_varint();
+          break;
+        case 3: {
+          WireIds ids = reader.get_ids();
+          uint64_t sum = 0;
+          for (size_t i = 0; i < ids.size(); i++) sum += ids[i];
+          EXPECT_LE(ids.size() * sizeof(uint64_t), before);
+          break;
+        }
+        case 4: {
+          size_t want = rng() % 16;
+          const uint8_t* bytes = reader.get_bytes(want);
+          if (bytes) {
+            EXPECT_LE(bytes + want, end);
+          }
+          break;
+        }
+        case 5: {
+          uint64_t type;
+          WireReader value;
+          if (reader.get_extension(&type, &value)) {
+            size_t size = value.remaining();
+            const uint8_t* bytes = value.get_bytes(size);
+            if (bytes) {
+              EXPECT_LE(bytes + size, end);
+            }
+          }
+          break;
+        }
+      }
+      ASSERT_LE(reader.remaining(), before);
+    }
+  }
+}
+
+// Random fields written then read back must come back the same, and writing must stop cleanly when full
+TEST(WireTest, FuzzRoundTrips) {
+  std::mt19937_64 rng(2);
+  for (int round = 0; round < 5000; round++) {
+    uint8_t buffer[256];
+    WireWriter writer(buffer, rng() % sizeof(buffer));
+    std::vector<std::pair<int, uint64_t>> written;
+    uint64_t ids[8];
+    size_t fitted = 0;
+    while (writer.ok()) {
+      int kind = rng() % 5;
+      // Mostly small values, as counts and lengths are
+      uint64_t value = rng() >> (rng() % 64);
+      switch (kind) {
+        case 0:
+          writer.put_u8(value);
+          break;
+        case 1:
+          writer.put_u32(value);
+          break;
+        case 2:
+          writer.put_u64(value);
+          break;
+        case 3:
+          writer.put_varint(value);
+          break;
+        case 4:
+          value %= 8;
+          for (uint64_t i = 0; i < value; i++) ids[i] = value * 100 + i;
+          writer.put_ids(ids, value);
+          break;
+      }
+      if (writer.ok()) {
+        written.push_back(std::make_pair(kind, value));
+        fitted = writer.size();
+      }
+    }
+
+    // The last write failed, perhaps partway, so what fitted before it reads back
+    EXPECT_GE(writer.size(), fitted);
+    WireReader reader(buffer, fitted);
+    for (auto& field : written) {
+      switch (field.first) {
+        case 0:
+          EXPECT_EQ(reader.get_u8(), (uint8_t)field.second);
+          break;
+        case 1:
+          EXPECT_EQ(reader.get_u32(), (uint32_t)field.second);
+          break;
+        case 2:
+          EXPECT_EQ(reader.get_u64(), field.second);
+          break;
+        case 3:
+          EXPECT_EQ(reader.get_varint(), field.second);
+          break;
+        case 4: {
+          WireIds view = reader.get_ids();
+          ASSERT_EQ(view.size(), field.second);
+          for (size_t i = 0; i < view.size(); i++) EXPECT_EQ(view[i], field.second * 100 + i);
+          break;
+        }
+      }
+    }
+    EXPECT_TRUE(reader.ok());
+    EXPECT_EQ(reader.remaining(), 0);
+  }
+}
+
+TEST(WireTest, PacketPayloadIsBounded) {
+  Packet pkt(Packet::Ping, 1);
+  WireWriter writer = pkt.get_payload_writer();
+  EXPECT_NE(writer.reserve(KAPUA_MAX_DATA_SIZE), nullptr);
+  writer.put_u8(0);
+  EXPECT_FALSE(pkt.set_payload(writer));
+
+  // Read as far as was received, whatever the header claims, and never past the end of the packet
+  pkt.length = 0xffff;
+  EXPECT_EQ(pkt.get_payload_reader(16).remaining(), 16);
+  EXPECT_EQ(pkt.get_payload_reader(0xffff).remaining(), KAPUA_MAX_DATA_SIZE);
+}
+
+TEST(WireTest, PacketLoadReportReadsOlderNodes) {
+  NodeLoadReport report = {1ULL << 40, 1ULL << 30, 1000, 8, 4, 1};
+  Packet pkt(Packet::Ping, 1);
+  ASSERT_TRUE(pkt.write_load_report(&report));
+  ASSERT_EQ(pkt.length, sizeof(NodeLoadReport));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // The same bytes as when the struct was copied in whole
+  EXPECT_EQ(std::memcmp(pkt.data, &report, sizeof(report)), 0);
+#endif
+
+  // Before the compute fields
+  NodeLoadReport received;
+  ASSERT_TRUE(pkt.read_load_report(&received, offsetof(NodeLoadReport, compute_slots)));
+  EXPECT_EQ(received.capacity, report.capacity);
+  EXPECT_EQ(received.queue_depth, report.queue_depth);
+  EXPECT_EQ(received.compute_slots, 0);
+
+  // Before the report
+  EXPECT_FALSE(pkt.read_load_report(&received, 0));
+
+  // A header that claims the whole report over a datagram that was cut short
+  EXPECT_FALSE(pkt.read_load_report(&received, 8));
+}
+
+TEST(WireTest, PacketPublicKeyRoundTrips) {
+  ::testing::NiceMock<MockLogger> mockLogger;
+  Config config(&mockLogger);
+  KeyPair keys;
+  ASSERT_TRUE(Kapua::RSA(&mockLogger, &config).load_rsa_key_pair("fixtures/public.pem", "fixtures/private.pem", keys));
+
+  Packet pkt(Packet::PublicKeyReply, 1);
+  ASSERT_TRUE(pkt.write_public_key(&keys));
+  KeyPair received;
+  ASSERT_TRUE(pkt.read_public_key(&received, pkt.length));
+  Packet again(Packet::PublicKeyReply, 1);
+  ASSERT_TRUE(again.write_public_key(&received));
+  ASSERT_EQ(again.length, pkt.length);
+  EXPECT_EQ(std::memcmp(again.data, pkt.data, pkt.length), 0);
+  EVP_PKEY_free(received.publicKey);
+
+  // Cut short, or not there at all, without throwing
+  EXPECT_FALSE(pkt.read_public_key(&received, pkt.length / 2));
+  KeyPair none;
+  none.publicKey = nullptr;
+  EXPECT_FALSE(pkt.write_public_key(&none));
+
+  EVP_PKEY_free(keys.publicKey);
+  EVP_PKEY_free(keys.privateKey);
+}
+
+}  // namespace KapuaTest
@@ -0,0 +1,114 @@
+#include "WorkStealingPool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+class WorkStealingPoolTest : public ::testing::Test {
+ protected:
+  ::testing::NiceMock<MockLogger> logger;
+};
+
+TEST_F(WorkStealingPoolTest, DequeOrder) {
+  WorkStealingDeque<uintptr_t> deque(4);
+  uintptr_t item;
+  EXPECT_FALSE(deque.pop(&item));
+  EXPECT_FALSE(deque.steal(&item));
+
+  // Grows past its initial capacity, the owner takes newest first and thieves oldest first
+  for (uintptr_t i = 1; i <= 100; i++) deque.push(i);
+  EXPECT_EQ(deque.size(), 100);
+  ASSERT_TRUE(deque.pop(&item));
+  EXPECT_EQ(item, 100);
+  ASSERT_TRUE(deque.steal(&item));
+  EXPECT_EQ(item, 1);
+  EXPECT_EQ(deque.size(), 98);
+}
+
+TEST_F(WorkStealingPoolTest, DequeRaces) {
+  // Every item is taken exactly once, by the owner or one of the thieves
+  const uintptr_t count = 200000;
+  WorkStealingDeque<uintptr_t> deque(16);
+  std::vector<std::atomic<int>> taken(count + 1);
+  for (std::atomic<int>& t : taken) t = 0;
+  std::atomic<bool> done(false);
+
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < 3; i++) {
+    thieves.emplace_back([&] {
+      uintptr_t item;
+      while (!done || !deque.empty()) {
+        if (deque.steal(&item)) taken[item]++;
+      }
+    });
+  }
+
+  uintptr_t item;
+  for (uintptr_t i = 1; i <= count; i++) {
+    deque.push(i);
+    if (i % 3 == 0 && deque.pop(&item)) taken[item]++;
+  }
+  while (deque.pop(&item)) taken[item]++;
+  done = true;
+  for (std::thread& thief : thieves) thief.join();
+
+  for (uintptr_t i = 1; i <= count; i++) ASSERT_EQ(taken[i], 1) << "item " << i;
+}
+
+TEST_F(WorkStealingPoolTest, RunsEverything) {
+  WorkStealingPool pool(&logger, 4);
+  EXPECT_EQ(pool.get_thread_count(), 4);
+
+  std::atomic<int> ran(0);
+  for (int i = 0; i < 1000; i++) pool.submit([&] { ran++; });
+  pool.wait();
+  EXPECT_EQ(ran, 1000);
+  EXPECT_EQ(pool.get_outstanding(), 0);
+  EXPECT_EQ(pool.get_executed(), 1000);
+}
+
+// Each task splits in two until it is small, so the tasks start on one worker and the rest must steal them
+std::atomic<uint64_t> leaves;
+void split(WorkStealingPool* pool, int depth) {
+  if (depth == 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    leaves++;
+    return;
+  }
+  pool->submit([pool, depth] { split(pool, depth - 1); });
+  pool->submit([pool, depth] { split(pool, depth - 1); });
+}
+
+TEST_F(WorkStealingPoolTest, StealsNestedTasks) {
+  WorkStealingPool pool(&logger, 4);
+  leaves = 0;
+  pool.submit([&pool] { split(&pool, 10); });
+  pool.wait();
+
+  EXPECT_EQ(leaves, 1 << 10);
+  EXPECT_GT(pool.get_steals(), 0);
+}
+
+TEST_F(WorkStealingPoolTest, FinishesOnDestruction) {
+  std::atomic<int> ran(0);
+  {
+    WorkStealingPool pool(&logger, 2);
+    for (int i = 0; i < 100; i++) {
+      pool.submit([&] {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ran++;
+      });
+    }
+  }
+  EXPECT_EQ(ran, 100);
+}
+
+}  // namespace KapuaTest
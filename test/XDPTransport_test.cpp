@@ -0,0 +1,158 @@
+#include "XDPTransport.hpp"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sched.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "MockLogger.hpp"
+
+using namespace Kapua;
+
+namespace KapuaTest {
+
+#define TEST_PORT 47892
+#define TEST_NETNS "kapua-xdp-test"
+#define TEST_INTERFACE "kxdp0"
+#define TEST_LOCAL_IP "10.213.0.1"
+#define TEST_PEER_IP "10.213.0.2"
+
+class XDPTransportTest : public ::testing::Test {
+ protected:
+  sockaddr_in make_addr(const char* ip, uint16_t port) {
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return addr;
+  }
+
+  // Sends count numbered datagrams from the sender, and checks the transport receives all of them in order
+  void expect_received(Transport* transport, int count, int sender, const sockaddr_in& from, const sockaddr_in& to) {
+    for (int i = 0; i < count; i++) {
+      std::string text = "datagram " + std::to_string(i);
+      ASSERT_EQ(sendto(sender, text.data(), text.size(), 0, (sockaddr*)&to, sizeof(to)), (ssize_t)text.size());
+    }
+
+    int received = 0;
+    for (int tries = 0; received < count && tries < 1000; tries++) {
+      if (!transport->wait(10000)) continue;
+      Transport::Datagram datagrams[KAPUA_RECEIVE_BATCH];
+      size_t got = transport->receive(datagrams, KAPUA_RECEIVE_BATCH);
+      for (size_t i = 0; i < got; i++, received++) {
+        EXPECT_EQ(std::string((char*)datagrams[i].data, datagrams[i].size), "datagram " + std::to_string(received));
+        EXPECT_EQ(datagrams[i].addr.sin_port, from.sin_port);
+        EXPECT_EQ(datagrams[i].addr.sin_addr.s_addr, from.sin_addr.s_addr);
+      }
+    }
+    EXPECT_EQ(received, count);
+  }
+
+  ::testing::NiceMock<MockLogger> mockLogger;
+};
+
+// The transport on one end of a veth pair, and a peer on the other end in its own network namespace, so datagrams
+// arrive on the interface as they would from another host. Needs root, and is skipped without it.
+class XDPTransportVethTest : public XDPTransportTest {
+ protected:
+  void SetUp() override {
+    peer = -1;
+    if (geteuid() != 0) GTEST_SKIP() << "needs root to set up a network namespace";
+    TearDownNetwork();
+    std::string commands = "ip netns add " TEST_NETNS " && ip link add " TEST_INTERFACE " type veth peer name kxdp1 netns " TEST_NETNS
+                           " && ip addr add " TEST_LOCAL_IP "/24 dev " TEST_INTERFACE " && ip link set " TEST_INTERFACE " up"
+                           " && ip -n " TEST_NETNS " addr add " TEST_PEER_IP "/24 dev kxdp1 && ip -n " TEST_NETNS " link set kxdp1 up";
+    if (system((commands + " 2>/dev/null").c_str()) != 0) GTEST_SKIP() << "can't make a veth pair in a network namespace";
+
+    // A socket belongs to the namespace it is made in, so make the peer's on a thread that has moved into it
+    std::thread([this]() {
+      int ns = open("/var/run/netns/" TEST_NETNS, O_RDONLY);
+      if (ns < 0 || setns(ns, CLONE_NEWNET) != 0) return;
+      peer = socket(AF_INET, SOCK_DGRAM, 0);
+      ::close(ns);
+    }).join();
+    ASSERT_NE(peer, -1);
+    peer_addr = make_addr(TEST_PEER_IP, 0);
+    ASSERT_EQ(bind(peer, (sockaddr*)&peer_addr, sizeof(peer_addr)), 0);
+    socklen_t len = sizeof(peer_addr);
+    getsockname(peer, (sockaddr*)&peer_addr, &len);
+    int size = 1 << 20;
+    setsockopt(peer, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+
+  void TearDown() override {
+    if (peer != -1) ::close(peer);
+    TearDownNetwork();
+  }
+
+  void TearDownNetwork() { system("ip netns del " TEST_NETNS " 2>/dev/null; ip link del " TEST_INTERFACE " 2>/dev/null"); }
+
+  int peer;
+  sockaddr_in peer_addr;
+};
+
+TEST_F(XDPTransportVethTest, ReceivesFromInterface) {
+  XDPTransport transport(&mockLogger, TEST_INTERFACE);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+  ASSERT_TRUE(transport.is_using_xdp());
+
+  expect_received(&transport, 10, peer, peer_addr, make_addr(TEST_LOCAL_IP, TEST_PORT));
+
+  // Replies go out through the socket
+  Transport::Datagram datagram = {(uint8_t*)"reply", 5, peer_addr};
+  ASSERT_EQ(transport.send(&datagram, 1), 1);
+  transport.flush();
+  timeval tv = {1, 0};
+  setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  char buffer[64];
+  ssize_t size = recv(peer, buffer, sizeof(buffer), 0);
+  ASSERT_EQ(size, 5);
+  EXPECT_EQ(std::string(buffer, size), "reply");
+}
+
+TEST_F(XDPTransportVethTest, ReusesFrames) {
+  XDPTransport transport(&mockLogger, TEST_INTERFACE);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+  ASSERT_TRUE(transport.is_using_xdp());
+
+  // More than there are frames, so they must go back to the kernel to be received into again
+  for (int i = 0; i < 3; i++) expect_received(&transport, KAPUA_XDP_FRAMES / 2 + 100, peer, peer_addr, make_addr(TEST_LOCAL_IP, TEST_PORT));
+}
+
+TEST_F(XDPTransportVethTest, LeavesOtherTrafficToKernel) {
+  XDPTransport transport(&mockLogger, TEST_INTERFACE);
+  ASSERT_TRUE(transport.open(TEST_PORT));
+  ASSERT_TRUE(transport.is_using_xdp());
+
+  int other = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in otherAddr = make_addr(TEST_LOCAL_IP, TEST_PORT + 1);
+  ASSERT_EQ(bind(other, (sockaddr*)&otherAddr, sizeof(otherAddr)), 0);
+  ASSERT_EQ(sendto(peer, "other", 5, 0, (sockaddr*)&otherAddr, sizeof(otherAddr)), 5);
+
+  timeval tv = {1, 0};
+  setsockopt(other, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  char buffer[64];
+  EXPECT_EQ(recv(other, buffer, sizeof(buffer), 0), 5);
+  ::close(other);
+  EXPECT_FALSE(transport.wait(10000));
+}
+
+TEST_F(XDPTransportTest, FallsBackToSocket) {
+  XDPTransport transport(&mockLogger, "kapua-none");
+  ASSERT_TRUE(transport.open(TEST_PORT));
+  EXPECT_FALSE(transport.is_using_xdp());
+
+  int local = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in localAddr = make_addr("127.0.0.1", 0);
+  bind(local, (sockaddr*)&localAddr, sizeof(localAddr));
+  socklen_t len = sizeof(localAddr);
+  getsockname(local, (sockaddr*)&localAddr, &len);
+  expect_received(&transport, 10, local, localAddr, make_addr("127.0.0.1", TEST_PORT));
+  ::close(local);
+}
+
+}  // namespace KapuaTest